@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2022-2024 Jason Woodward <woodwardj at jaos dot org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "memory.h"
+#include "vm.h"
+#include "vmopcodes.h"
+
+#define CACHE_MAGIC "TOTC"
+#define CACHE_FORMAT 1 // bump whenever the layout written below changes
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+#if defined(__x86_64__)
+#define CACHE_ARCH "x86_64"
+#elif defined(__i386__)
+#define CACHE_ARCH "i386"
+#elif defined(__aarch64__)
+#define CACHE_ARCH "aarch64"
+#elif defined(__arm__)
+#define CACHE_ARCH "arm"
+#elif defined(__riscv)
+#define CACHE_ARCH "riscv"
+#elif defined(__powerpc64__)
+#define CACHE_ARCH "ppc64"
+#else
+#define CACHE_ARCH "unknown"
+#endif
+
+typedef enum {
+    CACHE_NIL,
+    CACHE_FALSE,
+    CACHE_TRUE,
+    CACHE_NUMBER,
+    CACHE_STRING,
+    CACHE_FUNCTION,
+    CACHE_LIST,
+    CACHE_MAP,
+} cache_tag_t;
+
+typedef struct {
+    char magic[4];
+    uint32_t format;
+    uint64_t build; // the tater version and instruction set that wrote it
+    uint64_t flags; // vm flags that change the emitted code
+    uint64_t source_hash;
+    uint64_t source_length;
+    uint64_t body_hash;
+    uint64_t body_length;
+} cache_header_t;
+
+typedef struct {
+    uint8_t *bytes;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} cache_writer_t;
+
+typedef struct {
+    const uint8_t *bytes;
+    size_t count;
+    size_t offset;
+} cache_reader_t;
+
+static uint64_t fnv_hash(const void *data, const size_t length, uint64_t hash)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t build_hash(void)
+{
+    // raw numbers, line tables and lengths are written in host layout
+    const uint32_t byte_order = 0x01020304;
+    const uint8_t sizes[] = {sizeof(void*), sizeof(value_t), sizeof(double), sizeof(line_info_t)};
+    uint64_t hash = fnv_hash(VERSION, strlen(VERSION), FNV_OFFSET);
+    hash = fnv_hash(CACHE_ARCH, strlen(CACHE_ARCH), hash);
+    hash = fnv_hash(&byte_order, sizeof byte_order, hash);
+    hash = fnv_hash(sizes, sizeof sizes, hash);
+    for (int op = 0; op < INVALID_OPCODE; op++)
+        hash = fnv_hash(op_code_name[op], strlen(op_code_name[op]), hash);
+    return hash;
+}
+
+static void cache_header_t_init(cache_header_t *header, const char *source)
+{
+    memset(header, 0, sizeof *header);
+    memcpy(header->magic, CACHE_MAGIC, sizeof header->magic);
+    header->format = CACHE_FORMAT;
+    header->build = build_hash();
+    header->flags = vm.flags & VM_FLAG_NO_OPTIMIZE;
+    header->source_length = strlen(source);
+    header->source_hash = fnv_hash(source, header->source_length, FNV_OFFSET);
+}
+
+static void write_bytes(cache_writer_t *writer, const void *data, const size_t length)
+{
+    if (writer->failed)
+        return;
+    if (writer->count + length > writer->capacity) {
+        size_t capacity = writer->capacity < 256 ? 256 : writer->capacity;
+        while (capacity < writer->count + length)
+            capacity *= 2;
+        uint8_t *bytes = realloc(writer->bytes, capacity);
+        if (bytes == NULL) {
+            writer->failed = true;
+            return;
+        }
+        writer->bytes = bytes;
+        writer->capacity = capacity;
+    }
+    memcpy(writer->bytes + writer->count, data, length);
+    writer->count += length;
+}
+
+static void write_u8(cache_writer_t *writer, const uint8_t value)
+{
+    write_bytes(writer, &value, sizeof value);
+}
+
+static void write_u32(cache_writer_t *writer, const uint32_t value)
+{
+    write_bytes(writer, &value, sizeof value);
+}
+
+static void write_string(cache_writer_t *writer, const obj_string_t *string)
+{
+    write_u8(writer, CACHE_STRING);
+    write_u32(writer, (uint32_t)string->length);
+    write_bytes(writer, string->chars, string->length);
+}
+
+static void write_function(cache_writer_t *writer, const obj_function_t *function);
+
+static void write_value(cache_writer_t *writer, const value_t value)
+{
+    if (IS_NIL(value)) {
+        write_u8(writer, CACHE_NIL);
+    } else if (IS_BOOL(value)) {
+        write_u8(writer, AS_BOOL(value) ? CACHE_TRUE : CACHE_FALSE);
+    } else if (IS_NUMBER(value)) {
+        const double number = AS_NUMBER(value);
+        write_u8(writer, CACHE_NUMBER);
+        write_bytes(writer, &number, sizeof number);
+    } else if (IS_STRING(value)) {
+        write_string(writer, AS_STRING(value));
+    } else if (IS_FUNCTION(value)) {
+        write_function(writer, AS_FUNCTION(value));
+    } else if (IS_LIST(value)) {
+        const value_list_t *elements = &AS_LIST(value)->elements;
+        write_u8(writer, CACHE_LIST);
+        write_u32(writer, (uint32_t)elements->count);
+        for (int i = 0; i < elements->count; i++)
+            write_value(writer, elements->values[i]);
+    } else if (IS_MAP(value)) {
+        const obj_map_t *map = AS_MAP(value);
+        write_u8(writer, CACHE_MAP);
+        write_u32(writer, (uint32_t)obj_map_t_count(map));
+        int cursor = 0;
+        value_t key, entry;
+        while (obj_map_t_next(map, &cursor, &key, &entry)) {
+            write_value(writer, key);
+            write_value(writer, entry);
+        }
+    } else {
+        writer->failed = true; // nothing the compiler emits today
+    }
+}
+
+static void write_function(cache_writer_t *writer, const obj_function_t *function)
+{
+    if (function->lazy_source != NULL) {
+        writer->failed = true; // an uncompiled body has no bytecode to keep
+        return;
+    }
+    const chunk_t *chunk = &function->chunk;
+    write_u8(writer, CACHE_FUNCTION);
+    write_u32(writer, (uint32_t)function->arity);
+    write_u32(writer, (uint32_t)function->upvalue_count);
+    write_u32(writer, (uint32_t)function->slot_count);
+    if (function->name == NULL)
+        write_u8(writer, CACHE_NIL);
+    else
+        write_string(writer, function->name);
+    write_u32(writer, (uint32_t)chunk->count);
+    write_bytes(writer, chunk->code, chunk->count);
+    write_u32(writer, (uint32_t)chunk->line_count);
+    write_bytes(writer, chunk->lines, sizeof *chunk->lines * chunk->line_count);
+    write_u32(writer, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++)
+        write_value(writer, chunk->constants.values[i]);
+}
+
+bool cache_write(const char *path, const char *source_path, const obj_function_t *function, const char *source)
+{
+    // a cache the reader would not trust is not worth writing
+    struct stat source_st;
+    if (stat(source_path, &source_st) != 0 || source_st.st_uid != geteuid())
+        return false;
+
+    cache_writer_t writer = {NULL, 0, 0, false};
+    write_function(&writer, function);
+    if (writer.failed) {
+        free(writer.bytes);
+        return false;
+    }
+
+    cache_header_t header;
+    cache_header_t_init(&header, source);
+    header.body_length = writer.count;
+    header.body_hash = fnv_hash(writer.bytes, writer.count, FNV_OFFSET);
+
+    // written to a fresh file beside it and renamed over, so a concurrent run never maps a partial file and nothing
+    // already sitting at a guessable name is followed or reused
+    char temp_path[PATH_MAX];
+    if (snprintf(temp_path, sizeof temp_path, "%s.XXXXXX", path) >= (int)sizeof temp_path) {
+        free(writer.bytes);
+        return false;
+    }
+    const int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        free(writer.bytes);
+        return false;
+    }
+    // readable by whoever can read the source, writable by its owner only
+    FILE *f = fchmod(fd, source_st.st_mode & (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == 0 ? fdopen(fd, "wb") : NULL;
+    if (f == NULL) {
+        close(fd);
+        unlink(temp_path);
+        free(writer.bytes);
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof header, 1, f) == 1 && fwrite(writer.bytes, 1, writer.count, f) == writer.count;
+    ok = fclose(f) == 0 && ok;
+    free(writer.bytes);
+    if (!ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+static bool read_bytes(cache_reader_t *reader, void *data, const size_t length)
+{
+    if (length > reader->count - reader->offset)
+        return false;
+    memcpy(data, reader->bytes + reader->offset, length);
+    reader->offset += length;
+    return true;
+}
+
+static bool read_u8(cache_reader_t *reader, uint8_t *value)
+{
+    return read_bytes(reader, value, sizeof *value);
+}
+
+static bool read_u32(cache_reader_t *reader, uint32_t *value)
+{
+    return read_bytes(reader, value, sizeof *value) && *value <= INT32_MAX;
+}
+
+static bool read_value(cache_reader_t *reader, value_t *value);
+
+static bool read_string(cache_reader_t *reader, value_t *value)
+{
+    uint32_t length;
+    if (!read_u32(reader, &length) || length > reader->count - reader->offset)
+        return false;
+    *value = OBJ_VAL(obj_string_t_copy_from((const char *)reader->bytes + reader->offset, (int)length, true));
+    reader->offset += length;
+    return true;
+}
+
+// everything allocated here stays on the vm stack until it is reachable from the function being read
+static bool read_function(cache_reader_t *reader, value_t *value)
+{
+    obj_function_t *function = obj_function_t_allocate();
+    vm_push(OBJ_VAL(function));
+    chunk_t *chunk = &function->chunk;
+
+    uint32_t arity, upvalue_count, slot_count, code_count, line_count, constant_count;
+    uint8_t tag;
+    if (!read_u32(reader, &arity) || !read_u32(reader, &upvalue_count) || !read_u32(reader, &slot_count))
+        return false;
+    function->arity = (int)arity;
+    function->upvalue_count = (int)upvalue_count;
+    function->slot_count = (int)slot_count;
+
+    if (!read_u8(reader, &tag))
+        return false;
+    if (tag == CACHE_STRING) {
+        value_t name;
+        if (!read_string(reader, &name))
+            return false;
+        function->name = AS_STRING(name);
+    } else if (tag != CACHE_NIL) {
+        return false;
+    }
+
+    if (!read_u32(reader, &code_count) || code_count > reader->count - reader->offset)
+        return false;
+    if (code_count > 0) {
+        chunk->code = GROW_ARRAY(uint8_t, NULL, 0, code_count);
+        chunk->capacity = (int)code_count;
+        read_bytes(reader, chunk->code, code_count);
+        chunk->count = (int)code_count;
+    }
+
+    if (!read_u32(reader, &line_count) || line_count > (reader->count - reader->offset) / sizeof(line_info_t))
+        return false;
+    if (line_count > 0) {
+        chunk->lines = GROW_ARRAY(line_info_t, NULL, 0, line_count);
+        chunk->line_capacity = (int)line_count;
+        read_bytes(reader, chunk->lines, sizeof(line_info_t) * line_count);
+        chunk->line_count = (int)line_count;
+    }
+
+    if (!read_u32(reader, &constant_count))
+        return false;
+    for (uint32_t i = 0; i < constant_count; i++) {
+        value_t constant;
+        if (!read_value(reader, &constant))
+            return false;
+        chunk_t_add_constant(chunk, constant);
+    }
+
+    *value = vm_pop();
+    return true;
+}
+
+static bool read_value(cache_reader_t *reader, value_t *value)
+{
+    uint8_t tag;
+    if (!read_u8(reader, &tag))
+        return false;
+    switch (tag) {
+        case CACHE_NIL: *value = NIL_VAL; return true;
+        case CACHE_FALSE: *value = FALSE_VAL; return true;
+        case CACHE_TRUE: *value = TRUE_VAL; return true;
+        case CACHE_NUMBER: {
+            double number;
+            if (!read_bytes(reader, &number, sizeof number))
+                return false;
+            *value = NUMBER_VAL(number);
+            return true;
+        }
+        case CACHE_STRING: return read_string(reader, value);
+        case CACHE_FUNCTION: return read_function(reader, value);
+        case CACHE_LIST: {
+            uint32_t count;
+            if (!read_u32(reader, &count))
+                return false;
+            obj_list_t *list = obj_list_t_allocate();
+            vm_push(OBJ_VAL(list));
+            for (uint32_t i = 0; i < count; i++) {
+                value_t element;
+                if (!read_value(reader, &element))
+                    return false;
+                vm_push(element);
+                value_list_t_add(&list->elements, element);
+                vm_pop();
+            }
+            *value = vm_pop();
+            return true;
+        }
+        case CACHE_MAP: {
+            uint32_t count;
+            if (!read_u32(reader, &count))
+                return false;
+            obj_map_t *map = obj_map_t_allocate();
+            vm_push(OBJ_VAL(map));
+            for (uint32_t i = 0; i < count; i++) {
+                value_t key, entry;
+                if (!read_value(reader, &key))
+                    return false;
+                vm_push(key);
+                if (!read_value(reader, &entry))
+                    return false;
+                vm_push(entry);
+                obj_map_t_set(map, key, entry);
+                vm_pop();
+                vm_pop();
+            }
+            *value = vm_pop();
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+obj_function_t *cache_read(const char *path, const char *source_path, const char *source)
+{
+    struct stat source_st;
+    if (stat(source_path, &source_st) != 0)
+        return NULL;
+    const int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1)
+        return NULL;
+    // bytecode is run as is, so only a cache from the source's owner that nobody else could have changed is used
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != source_st.st_uid || (st.st_mode & (S_IWGRP | S_IWOTH))
+        || (size_t)st.st_size < sizeof(cache_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    const size_t size = (size_t)st.st_size;
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return NULL;
+
+    // anything stale or damaged is a miss, the caller compiles the source and writes a fresh cache
+    cache_header_t expected, header;
+    cache_header_t_init(&expected, source);
+    memcpy(&header, mapped, sizeof header);
+    const uint8_t *body = (const uint8_t *)mapped + sizeof header;
+    obj_function_t *function = NULL;
+    if (memcmp(header.magic, expected.magic, sizeof header.magic) == 0 && header.format == expected.format
+        && header.build == expected.build && header.flags == expected.flags
+        && header.source_hash == expected.source_hash && header.source_length == expected.source_length
+        && header.body_length == size - sizeof header && header.body_hash == fnv_hash(body, header.body_length, FNV_OFFSET)) {
+        cache_reader_t reader = {body, header.body_length, 0};
+        value_t *stack_top = vm.stack_top;
+        uint8_t tag;
+        value_t value;
+        if (read_u8(&reader, &tag) && tag == CACHE_FUNCTION && read_function(&reader, &value) && reader.offset == reader.count)
+            function = AS_FUNCTION(value);
+        vm.stack_top = stack_top;
+    }
+    munmap(mapped, size);
+    return function;
+}
+
+#undef CACHE_MAGIC
+#undef CACHE_FORMAT
+#undef FNV_OFFSET
+#undef FNV_PRIME
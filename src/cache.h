@@ -0,0 +1,29 @@
+#ifndef tater_cache_h
+#define tater_cache_h
+/*
+ * Copyright (C) 2022-2024 Jason Woodward <woodwardj at jaos dot org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "common.h"
+#include "type.h"
+
+// compiled scripts saved beside their source and loaded back instead of compiling it again, only trusted when owned
+// by the owner of source_path and not writable by anyone else
+obj_function_t *cache_read(const char *path, const char *source_path, const char *source);
+bool cache_write(const char *path, const char *source_path, const obj_function_t *function, const char *source);
+
+#endif
@@ -17,6 +17,7 @@
  */
 
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,6 +27,7 @@
 #include "compiler.h"
 #include "debug.h"
 #include "memory.h"
+#include "number.h"
 #include "type.h"
 #include "scanner.h"
 #include "vmopcodes.h"
@@ -69,7 +71,7 @@ typedef struct {
 } local_t;
 
 typedef struct {
-    uint8_t index;
+    int index;
     bool is_local;
 } upvalue_t;
 
@@ -80,15 +82,34 @@ typedef enum {
     TYPE_SCRIPT,
 } function_type_t;
 
+#define MAX_OPERAND_PUSHES 16
+
+// a forward jump not patched yet, island is the wide jump it hops through once it is too far away
+typedef struct {
+    int operand;
+    int island;
+} pending_jump_t;
+
 typedef struct compiler {
-    local_t locals[UINT8_COUNT];
-    upvalue_t upvalues[UINT8_COUNT];
+    local_t *locals;
+    int local_capacity;
+    upvalue_t *upvalues;
+    int upvalue_capacity;
+    pending_jump_t *pending_jumps;
+    int pending_jump_count;
+    int pending_jump_capacity;
     table_t string_constants;
     struct compiler *enclosing;
     obj_function_t *function;
     function_type_t type;
     int local_count;
     int scope_depth;
+    int operand_pushes[MAX_OPERAND_PUSHES]; // offsets of recent constant and local pushes, for folding and fusing
+    int operand_push_count;
+    int jump_target; // the most recent forward jump destination, folding never crosses it
+    int operators[2]; // offsets of the last two operators that were emitted rather than folded
+    int last_call; // offset of the most recent call or invoke, a return right after it is a tail call
+    int last_store; // offset of the most recent single byte local store, a pop right after it folds into it
 } compiler_t;
 
 typedef struct type_compiler {
@@ -101,9 +122,20 @@ static compiler_t *current = NULL;
 static type_compiler_t *current_type = NULL;
 static int compiler_count = 0;
 static bool compiler_debug = false;
+static bool compiler_optimize = true;
+int inner_most_loop_start = -1;
+int inner_most_loop_end = -1;
+int inner_most_loop_scope_depth = 0;
+
+// with VM_FLAG_LAZY_COMPILE top level bodies are kept as slices of a copy of the source until their first call
+static const char *source_start = NULL;
+static obj_string_t *lazy_source = NULL;
 
 #define MAX_COMPILERS 1024
 #define MAX_PARAMETERS 255
+#define MAX_LOCALS (UINT16_MAX + 1)
+#define MAX_WIDE_OPERAND 0xffffff
+#define JUMP_ISLAND_DISTANCE (UINT16_MAX / 2)
 
 static chunk_t *current_chunk(void)
 {
@@ -181,24 +213,59 @@ static void emit_bytes(const uint8_t byte1, const uint8_t byte2)
     emit_byte(byte2);
 }
 
-static void emit_loop(const int loop_start)
+// wide operands are three bytes, low byte first
+static void emit_wide_operand(const int operand)
 {
-    emit_byte(OP_LOOP);
+    emit_byte(operand & 0xff);
+    emit_byte((operand >> 8) & 0xff);
+    emit_byte((operand >> 16) & 0xff);
+}
 
-    const int offset = current_chunk()->count - loop_start + 2;
-    if (offset > UINT16_MAX)
-        error(gettext("Loop body too large."));
+// an instruction whose first operand is a constant, local or upvalue index, prefixed with OP_WIDE past a byte
+static void emit_indexed(const uint8_t op, const int index)
+{
+    if (index <= UINT8_MAX) {
+        emit_bytes(op, (uint8_t)index);
+        return;
+    }
+    emit_bytes(OP_WIDE, op);
+    emit_wide_operand(index);
+}
 
+static void emit_loop(const int loop_start)
+{
+    int offset = current_chunk()->count - loop_start + 3;
+    if (offset > UINT16_MAX) {
+        offset += 2;
+        if (offset > MAX_WIDE_OPERAND)
+            error(gettext("Loop body too large."));
+        emit_bytes(OP_WIDE, OP_LOOP);
+        emit_wide_operand(offset);
+        return;
+    }
+    emit_byte(OP_LOOP);
     emit_byte((offset >> 8) & 0xff);
     emit_byte(offset & 0xff);
 }
 
-static int emit_jump(const uint8_t instruction)
+static int emit_jump_operand(void)
 {
-    emit_byte(instruction);
     emit_byte(0xff);
     emit_byte(0xff);
-    return current_chunk()->count - 2;
+    const int operand = current_chunk()->count - 2;
+    if (current->pending_jump_count == current->pending_jump_capacity) {
+        const int old_capacity = current->pending_jump_capacity;
+        current->pending_jump_capacity = GROW_CAPACITY(old_capacity);
+        current->pending_jumps = GROW_ARRAY(pending_jump_t, current->pending_jumps, old_capacity, current->pending_jump_capacity);
+    }
+    current->pending_jumps[current->pending_jump_count++] = (pending_jump_t){operand, -1};
+    return operand;
+}
+
+static int emit_jump(const uint8_t instruction)
+{
+    emit_byte(instruction);
+    return emit_jump_operand();
 }
 
 static void emit_return(void)
@@ -211,29 +278,461 @@ static void emit_return(void)
     emit_byte(OP_RETURN);
 }
 
-static uint8_t make_constant(const value_t value)
+static int make_constant(const value_t value)
 {
     const int constant = chunk_t_add_constant(current_chunk(), value);
-    if (constant > UINT8_MAX) {
-        error(gettext("Too many constants in one chunk.")); // See OP_CONSTANT_LONG to fix
+    if (constant > MAX_WIDE_OPERAND) {
+        error(gettext("Too many constants in one chunk."));
         return 0;
     }
-    return (uint8_t)constant;
+    return constant;
+}
+
+static void emit_load_constant(const int constant)
+{
+    if (constant <= UINT8_MAX) {
+        emit_bytes(OP_CONSTANT, (uint8_t)constant);
+        return;
+    }
+    emit_byte(OP_CONSTANT_LONG);
+    emit_wide_operand(constant);
+}
+
+static void note_operand_push(const int offset)
+{
+    if (current->operand_push_count == MAX_OPERAND_PUSHES) {
+        memmove(current->operand_pushes, current->operand_pushes + 1, sizeof(int) * (MAX_OPERAND_PUSHES - 1));
+        current->operand_push_count--;
+    }
+    current->operand_pushes[current->operand_push_count++] = offset;
 }
 
 static void emit_constant(const value_t value)
 {
-    emit_bytes(OP_CONSTANT, make_constant(value));
+    const int offset = current_chunk()->count;
+    emit_load_constant(make_constant(value));
+    note_operand_push(offset);
 }
 
-static void patch_jump(const int offset)
+static void emit_value(const value_t value)
+{
+    if (IS_NIL(value) || IS_BOOL(value)) {
+        note_operand_push(current_chunk()->count);
+        emit_byte(IS_NIL(value) ? OP_NIL : AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emit_constant(value);
+    }
+}
+
+static int wide_operand_at(const chunk_t *chunk, const int offset)
+{
+    return chunk->code[offset] | (chunk->code[offset + 1] << 8) | (chunk->code[offset + 2] << 16);
+}
+
+static bool constant_at(const int offset, value_t *value, int *end)
+{
+    const chunk_t *chunk = current_chunk();
+    if (offset < 0 || offset >= chunk->count)
+        return false;
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT: *value = chunk->constants.values[chunk->code[offset + 1]]; *end = offset + 2; return true;
+        case OP_CONSTANT_LONG: *value = chunk->constants.values[wide_operand_at(chunk, offset + 1)]; *end = offset + 4; return true;
+        case OP_NIL: *value = NIL_VAL; *end = offset + 1; return true;
+        case OP_TRUE: *value = TRUE_VAL; *end = offset + 1; return true;
+        case OP_FALSE: *value = FALSE_VAL; *end = offset + 1; return true;
+        default: return false;
+    }
+}
+
+// numbers are never shared between constant slots, so a folded operand at the end of the pool can go
+static void release_constant(const int offset)
+{
+    chunk_t *chunk = current_chunk();
+    int index;
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT: index = chunk->code[offset + 1]; break;
+        case OP_CONSTANT_LONG: index = wide_operand_at(chunk, offset + 1); break;
+        default: return;
+    }
+    if (index == chunk->constants.count - 1 && IS_NUMBER(chunk->constants.values[index]))
+        chunk->constants.count--;
+}
+
+static bool fits_integer(const double value)
+{
+    return fabs(value) < 9007199254740992.0;
+}
+
+static bool fold_unary_value(const uint8_t op, const value_t a, value_t *result)
+{
+    switch (op) {
+        case OP_NOT:
+            if (IS_OBJ(a) && !IS_STRING(a))
+                return false;
+            *result = BOOL_VAL(IS_NIL(a) || (IS_BOOL(a) && !AS_BOOL(a)) || (IS_NUMBER(a) && AS_NUMBER(a) == 0));
+            return true;
+        case OP_NEGATE:
+            if (!IS_NUMBER(a))
+                return false;
+            *result = NUMBER_VAL(-AS_NUMBER(a));
+            return true;
+        case OP_BITWISE_NOT:
+            if (!IS_NUMBER(a) || !fits_integer(AS_NUMBER(a)))
+                return false;
+            *result = NUMBER_VAL((double)(~(long long)AS_NUMBER(a)));
+            return true;
+        default:
+            return false;
+    }
+}
+
+// only folds what the vm would compute without raising an error, anything else is left for runtime
+static bool fold_binary_value(const uint8_t op, const value_t a, const value_t b, value_t *result)
+{
+    if (op == OP_EQUAL) {
+        if ((IS_OBJ(a) && !IS_STRING(a)) || (IS_OBJ(b) && !IS_STRING(b)))
+            return false;
+        *result = BOOL_VAL(value_t_equal(a, b));
+        return true;
+    }
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))
+        return false;
+    const double x = AS_NUMBER(a);
+    const double y = AS_NUMBER(b);
+    switch (op) {
+        case OP_ADD: *result = NUMBER_VAL(x + y); return true;
+        case OP_SUBTRACT: *result = NUMBER_VAL(x - y); return true;
+        case OP_MULTIPLY: *result = NUMBER_VAL(x * y); return true;
+        case OP_DIVIDE: if (y == 0) return false; *result = NUMBER_VAL(x / y); return true;
+        case OP_MOD: if (y == 0) return false; *result = NUMBER_VAL(fmod(x, y)); return true;
+        case OP_GREATER: *result = BOOL_VAL(x > y); return true;
+        case OP_LESS: *result = BOOL_VAL(x < y); return true;
+        default: break;
+    }
+    if (!fits_integer(x) || !fits_integer(y))
+        return false;
+    switch (op) {
+        case OP_BITWISE_AND: *result = NUMBER_VAL((double)((long long)x & (long long)y)); return true;
+        case OP_BITWISE_OR: *result = NUMBER_VAL((double)((long long)x | (long long)y)); return true;
+        case OP_BITWISE_XOR: *result = NUMBER_VAL((double)((long long)x ^ (long long)y)); return true;
+        default: return false;
+    }
+}
+
+// drop the code emitted from start onwards, it can never run
+static void discard_code(const int start, const int loop_end)
+{
+    chunk_t_truncate(current_chunk(), start);
+    if (inner_most_loop_end >= start)
+        inner_most_loop_end = loop_end;
+    if (current->jump_target > start)
+        current->jump_target = start;
+    while (current->operand_push_count > 0 && current->operand_pushes[current->operand_push_count - 1] >= start)
+        current->operand_push_count--;
+    for (int i = 0; i < 2; i++) {
+        if (current->operators[i] >= start)
+            current->operators[i] = -1;
+    }
+    if (current->last_call >= start)
+        current->last_call = -1;
+    if (current->last_store >= start)
+        current->last_store = -1;
+    int kept = 0;
+    for (int i = 0; i < current->pending_jump_count; i++) {
+        pending_jump_t jump = current->pending_jumps[i];
+        if (jump.operand >= start)
+            continue;
+        if (jump.island >= start)
+            jump.island = -1;
+        current->pending_jumps[kept++] = jump;
+    }
+    current->pending_jump_count = kept;
+}
+
+// replace the trailing operand pushes starting at start with the folded result
+static void replace_with_constant(const int start, const value_t result)
+{
+    discard_code(start, inner_most_loop_end);
+    emit_value(result);
+}
+
+static bool fold(const uint8_t op)
+{
+    const int count = current->operand_push_count;
+    if (count == 0)
+        return false;
+
+    value_t a, b, result;
+    int a_end, b_end;
+    const int b_start = current->operand_pushes[count - 1];
+    if (!constant_at(b_start, &b, &b_end) || b_end != current_chunk()->count)
+        return false;
+
+    if (op == OP_NOT || op == OP_NEGATE || op == OP_BITWISE_NOT) {
+        if (current->jump_target > b_start || !fold_unary_value(op, b, &result))
+            return false;
+        release_constant(b_start);
+        replace_with_constant(b_start, result);
+        return true;
+    }
+
+    if (count < 2)
+        return false;
+    const int a_start = current->operand_pushes[count - 2];
+    if (!constant_at(a_start, &a, &a_end) || a_end != b_start || current->jump_target > a_start)
+        return false;
+    if (!fold_binary_value(op, a, b, &result))
+        return false;
+    release_constant(b_start);
+    release_constant(a_start);
+    replace_with_constant(a_start, result);
+    return true;
+}
+
+// the truthiness of a condition that folded down to a trailing constant, -1 when only known at runtime
+static int constant_condition(void)
+{
+    value_t value, result;
+    int end;
+    const int count = current->operand_push_count;
+    if (!compiler_optimize || count == 0)
+        return -1;
+    const int start = current->operand_pushes[count - 1];
+    if (!constant_at(start, &value, &end) || end != current_chunk()->count || current->jump_target > start)
+        return -1;
+    if (!fold_unary_value(OP_NOT, value, &result))
+        return -1;
+    return AS_BOOL(result) ? 0 : 1;
+}
+
+// only valid right after constant_condition said the value is known
+static void drop_condition(void)
+{
+    const int start = current->operand_pushes[current->operand_push_count - 1];
+    release_constant(start);
+    discard_code(start, inner_most_loop_end);
+}
+
+// two locals pushed back to back are read by a single instruction
+static void fuse_local_pair(void)
+{
+    chunk_t *chunk = current_chunk();
+    const int count = current->operand_push_count;
+    if (count < 2)
+        return;
+    const int a = current->operand_pushes[count - 2];
+    const int b = current->operand_pushes[count - 1];
+    if (a < 0 || b != a + 2 || chunk->count != b + 2 || current->jump_target > a
+        || chunk->code[a] != OP_GET_LOCAL || chunk->code[b] != OP_GET_LOCAL)
+        return;
+    const uint8_t slot = chunk->code[b + 1];
+    discard_code(b, inner_most_loop_end);
+    current->operand_push_count--;
+    chunk->code[a] = OP_GET_LOCALS;
+    emit_byte(slot);
+}
+
+// operators go through here so constant operands are folded at compile time
+static void emit_operator(const uint8_t op)
+{
+    if (compiler_optimize && fold(op))
+        return;
+    // comparisons keep their local operands apart, they may still become a fused jump
+    if (compiler_optimize && op != OP_LESS && op != OP_GREATER && op != OP_EQUAL)
+        fuse_local_pair();
+    current->operators[0] = current->operators[1];
+    current->operators[1] = current_chunk()->count;
+    emit_byte(op);
+}
+
+// a trailing comparison becomes the fused jump standing in for it and a JUMP_IF_FALSE_POP
+static uint8_t fused_compare(const int offset, const bool negated)
+{
+    if (offset < 0 || current->jump_target > offset)
+        return OP_JUMP_IF_FALSE_POP;
+    switch (current_chunk()->code[offset]) {
+        case OP_LESS: return negated ? OP_JUMP_IF_LESS : OP_JUMP_IF_NOT_LESS;
+        case OP_GREATER: return negated ? OP_JUMP_IF_GREATER : OP_JUMP_IF_NOT_GREATER;
+        case OP_EQUAL: return negated ? OP_JUMP_IF_EQUAL : OP_JUMP_IF_NOT_EQUAL;
+        default: return OP_JUMP_IF_FALSE_POP;
+    }
+}
+
+// jump over the following code when the condition just compiled is false, the condition is consumed
+static int emit_condition_jump(void)
+{
+    if (!compiler_optimize)
+        return emit_jump(OP_JUMP_IF_FALSE_POP);
+
+    chunk_t *chunk = current_chunk();
+    int compare = -1;
+    uint8_t op = OP_JUMP_IF_FALSE_POP;
+    if (current->operators[1] == chunk->count - 1) {
+        if (chunk->code[chunk->count - 1] == OP_NOT && current->operators[0] == chunk->count - 2) {
+            compare = chunk->count - 2;
+            op = fused_compare(compare, true);
+        } else {
+            compare = chunk->count - 1;
+            op = fused_compare(compare, false);
+        }
+    }
+    if (op == OP_JUMP_IF_FALSE_POP)
+        return emit_jump(op);
+
+    discard_code(compare, inner_most_loop_end);
+    current->operators[0] = current->operators[1] = -1;
+
+    // operands that are a local and a constant or two locals are read in place
+    const int count = current->operand_push_count;
+    if (count >= 2) {
+        const int a = current->operand_pushes[count - 2];
+        const int b = current->operand_pushes[count - 1];
+        if (a >= 0 && b == a + 2 && compare == b + 2 && current->jump_target <= a
+            && chunk->code[a] == OP_GET_LOCAL && (chunk->code[b] == OP_GET_LOCAL || chunk->code[b] == OP_CONSTANT)) {
+            const uint8_t slot = chunk->code[a + 1];
+            const uint8_t operand = chunk->code[b + 1];
+            const uint8_t form = chunk->code[b] == OP_CONSTANT ? OP_JUMP_IF_LOCAL_CONST : OP_JUMP_IF_LOCAL_LOCAL;
+            discard_code(a, inner_most_loop_end);
+            emit_bytes(form, slot);
+            emit_bytes(operand, op);
+            return emit_jump_operand();
+        }
+    }
+    return emit_jump(op);
+}
+
+static void write_jump(const int operand, const int target)
 {
-    const int jump = current_chunk()->count - offset - 2;
+    const int jump = target - operand - 2;
     if (jump > UINT16_MAX) {
         error(gettext("Too much code to jump over."));
     }
-    current_chunk()->code[offset] = (jump >> 8) & 0xff;
-    current_chunk()->code[offset + 1] = jump & 0xff;
+    current_chunk()->code[operand] = (jump >> 8) & 0xff;
+    current_chunk()->code[operand + 1] = jump & 0xff;
+}
+
+// point the jump operand at target, through its island if it has one
+static void patch_jump_to(const int offset, const int target)
+{
+    for (int i = current->pending_jump_count - 1; i >= 0; i--) {
+        const pending_jump_t jump = current->pending_jumps[i];
+        if (jump.operand != offset)
+            continue;
+        current->pending_jumps[i] = current->pending_jumps[--current->pending_jump_count];
+        if (jump.island != -1) {
+            const int distance = target - jump.island - 3;
+            uint8_t *code = current_chunk()->code + jump.island;
+            code[0] = distance & 0xff;
+            code[1] = (distance >> 8) & 0xff;
+            code[2] = (distance >> 16) & 0xff;
+            return;
+        }
+        break;
+    }
+    write_jump(offset, target);
+}
+
+static void patch_jump(const int offset)
+{
+    patch_jump_to(offset, current_chunk()->count);
+    current->jump_target = current_chunk()->count;
+}
+
+// forward jumps reach 64KiB, the ones still open far behind hop through wide jumps emitted here instead
+static void emit_jump_islands(void)
+{
+    const int far = current_chunk()->count - JUMP_ISLAND_DISTANCE;
+    bool needed = false;
+    for (int i = 0; i < current->pending_jump_count && !needed; i++)
+        needed = current->pending_jumps[i].island == -1 && current->pending_jumps[i].operand < far;
+    if (!needed)
+        return;
+
+    const int skip = emit_jump(OP_JUMP);
+    for (int i = 0; i < current->pending_jump_count; i++) {
+        pending_jump_t *jump = &current->pending_jumps[i];
+        if (jump->island != -1 || jump->operand >= far)
+            continue;
+        write_jump(jump->operand, current_chunk()->count);
+        emit_bytes(OP_WIDE, OP_JUMP);
+        jump->island = current_chunk()->count;
+        emit_wide_operand(MAX_WIDE_OPERAND);
+    }
+    patch_jump(skip);
+}
+
+static bool is_jump(const uint8_t op)
+{
+    switch (op) {
+        case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_LOOP: case OP_JUMP_IF_FALSE_POP:
+        case OP_JUMP_IF_FALSE_OR_POP: case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_NOT_LESS: case OP_JUMP_IF_NOT_GREATER: case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_LESS: case OP_JUMP_IF_GREATER: case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_LOCAL_CONST: case OP_JUMP_IF_LOCAL_LOCAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// every jump keeps its distance in the last two bytes of the instruction
+static int jump_destination(const chunk_t *chunk, const int offset)
+{
+    const int end = offset + chunk_t_instruction_length(chunk, offset);
+    const int distance = (chunk->code[end - 2] << 8) | chunk->code[end - 1];
+    return chunk->code[offset] == OP_LOOP ? end - distance : end + distance;
+}
+
+// retarget jumps that land on unconditional jumps at the final destination
+static void thread_jumps(chunk_t *chunk)
+{
+    for (int offset = 0; offset < chunk->count; offset += chunk_t_instruction_length(chunk, offset)) {
+        const uint8_t op = chunk->code[offset];
+        if (!is_jump(op))
+            continue;
+
+        int destination = jump_destination(chunk, offset);
+        for (int hops = 0; hops < 8 && destination >= 0 && destination < chunk->count; hops++) {
+            const uint8_t next = chunk->code[destination];
+            if ((next != OP_JUMP && next != OP_LOOP) || destination == offset)
+                break;
+            destination = jump_destination(chunk, destination);
+        }
+        if (destination < 0 || destination > chunk->count || destination == jump_destination(chunk, offset))
+            continue;
+
+        // conditional jumps only go forward, unconditional ones may turn into a loop
+        const int end = offset + chunk_t_instruction_length(chunk, offset);
+        const bool unconditional = op == OP_JUMP || op == OP_LOOP;
+        uint8_t threaded = op;
+        int distance = destination - end;
+        if (destination < end) {
+            if (!unconditional)
+                continue;
+            threaded = OP_LOOP;
+            distance = end - destination;
+        } else if (unconditional) {
+            threaded = OP_JUMP;
+        }
+        if (distance > UINT16_MAX)
+            continue;
+        chunk->code[offset] = threaded;
+        chunk->code[end - 2] = (distance >> 8) & 0xff;
+        chunk->code[end - 1] = distance & 0xff;
+    }
+}
+
+static local_t *push_local(void)
+{
+    if (current->local_count == current->local_capacity) {
+        const int old_capacity = current->local_capacity;
+        current->local_capacity = GROW_CAPACITY(old_capacity);
+        current->locals = GROW_ARRAY(local_t, current->locals, old_capacity, current->local_capacity);
+    }
+    local_t *local = &current->locals[current->local_count++];
+    if (current->local_count > current->function->slot_count)
+        current->function->slot_count = current->local_count;
+    return local;
 }
 
 static void compiler_t_init(compiler_t *compiler, const function_type_t type)
@@ -248,6 +747,18 @@ static void compiler_t_init(compiler_t *compiler, const function_type_t type)
     compiler->type = type;
     compiler->local_count = 0;
     compiler->scope_depth = 0;
+    compiler->operand_push_count = 0;
+    compiler->jump_target = 0;
+    compiler->operators[0] = compiler->operators[1] = -1;
+    compiler->last_call = -1;
+    compiler->last_store = -1;
+    compiler->locals = NULL;
+    compiler->local_capacity = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalue_capacity = 0;
+    compiler->pending_jumps = NULL;
+    compiler->pending_jump_count = 0;
+    compiler->pending_jump_capacity = 0;
     compiler->function = obj_function_t_allocate();
     table_t_init(&compiler->string_constants);
 
@@ -257,7 +768,7 @@ static void compiler_t_init(compiler_t *compiler, const function_type_t type)
         current->function->name = obj_string_t_copy_from(parser.previous.start, parser.previous.length, true);
     }
 
-    local_t *local = &current->locals[current->local_count++];
+    local_t *local = push_local();
     local->depth = 0;
     local->is_captured = false;
     if (type != TYPE_FUNCTION) {
@@ -269,10 +780,22 @@ static void compiler_t_init(compiler_t *compiler, const function_type_t type)
     }
 }
 
+// the upvalues outlive the compiler until its closure has been emitted
+static void compiler_t_free_upvalues(compiler_t *compiler)
+{
+    FREE_ARRAY(upvalue_t, compiler->upvalues, compiler->upvalue_capacity);
+    compiler->upvalues = NULL;
+    compiler->upvalue_capacity = 0;
+}
+
 static obj_function_t *compiler_t_end(const bool debug)
 {
     emit_return();
+    if (compiler_optimize && !parser.had_error)
+        thread_jumps(current_chunk());
     table_t_free(&current->string_constants);
+    FREE_ARRAY(local_t, current->locals, current->local_capacity);
+    FREE_ARRAY(pending_jump_t, current->pending_jumps, current->pending_jump_capacity);
     obj_function_t *function_obj = current->function;
     if (debug || parser.had_error) {
         chunk_t_disassemble(current_chunk(), function_obj->name != NULL ? function_obj->name->chars : "<main>");
@@ -282,6 +805,13 @@ static obj_function_t *compiler_t_end(const bool debug)
     return function_obj;
 }
 
+static void emit_popn(int count)
+{
+    for (; count > UINT8_MAX; count -= UINT8_MAX)
+        emit_bytes(OP_POPN, UINT8_MAX);
+    emit_bytes(OP_POPN, (uint8_t)count);
+}
+
 static void begin_scope(void)
 {
     current->scope_depth++;
@@ -291,12 +821,12 @@ static void end_scope(void)
 {
     current->scope_depth--;
 
-    uint8_t to_pop = 0;
+    int to_pop = 0;
     while (current->local_count > 0 && current->locals[current->local_count - 1].depth > current->scope_depth) {
         if (current->locals[current->local_count - 1].is_captured) {
             // flush any to pop before the OP_CLOSE_UPVALUEA
             if (to_pop) {
-                emit_bytes(OP_POPN, to_pop);
+                emit_popn(to_pop);
                 to_pop = 0;
             }
             emit_byte(OP_CLOSE_UPVALUE);
@@ -307,7 +837,7 @@ static void end_scope(void)
     }
     if (to_pop > 0) {
         // flush remaining pops
-        emit_bytes(OP_POPN, to_pop);
+        emit_popn(to_pop);
     }
 }
 
@@ -316,15 +846,16 @@ static void statement(void);
 static void declaration(void);
 static const parse_rule_t *get_rule(const token_type_t type);
 static void parse_precedence(const precedence_t precedence);
+static void parse_precedence_from_previous(const precedence_t precedence);
 
-static uint8_t identifier_constant(const token_t *name)
+static int identifier_constant(const token_t *name)
 {
     obj_string_t *constant_str = obj_string_t_copy_from(name->start, name->length, true);
     value_t existing_index;
     if (table_t_get(&current->string_constants, OBJ_VAL(constant_str), &existing_index)) {
-        return (uint8_t)AS_NUMBER(existing_index);
+        return (int)AS_NUMBER(existing_index);
     }
-    uint8_t index = make_constant(OBJ_VAL(constant_str));
+    const int index = make_constant(OBJ_VAL(constant_str));
     table_t_set(&current->string_constants, OBJ_VAL(constant_str), NUMBER_VAL(index));
     return index;
 }
@@ -350,7 +881,7 @@ static int resolve_local(compiler_t *compiler, const token_t *name)
     return -1;
 }
 
-static int add_upvalue(compiler_t *compiler, const uint8_t index, const bool is_local)
+static int add_upvalue(compiler_t *compiler, const int index, const bool is_local)
 {
     int upvalue_count = compiler->function->upvalue_count;
     for (int i = 0; i < upvalue_count; i++) {
@@ -359,10 +890,15 @@ static int add_upvalue(compiler_t *compiler, const uint8_t index, const bool is_
             return i;
         }
     }
-    if (upvalue_count == UINT8_COUNT) {
+    if (upvalue_count == MAX_LOCALS) {
         error(gettext("Too many closure variables in function."));
         return 0;
     }
+    if (upvalue_count == compiler->upvalue_capacity) {
+        const int old_capacity = compiler->upvalue_capacity;
+        compiler->upvalue_capacity = GROW_CAPACITY(old_capacity);
+        compiler->upvalues = GROW_ARRAY(upvalue_t, compiler->upvalues, old_capacity, compiler->upvalue_capacity);
+    }
     compiler->upvalues[upvalue_count].is_local = is_local;
     compiler->upvalues[upvalue_count].index = index;
     return compiler->function->upvalue_count++;
@@ -377,14 +913,14 @@ static int resolve_upvalue(compiler_t *compiler, const token_t *name)
     const int local = resolve_local(compiler->enclosing, name);
     if (local != -1) {
         compiler->enclosing->locals[local].is_captured = true;
-        return add_upvalue(compiler, (uint8_t)local, true);
+        return add_upvalue(compiler, local, true);
     }
 
     // try enclosing... in which case every enclosing scope will have
     // it's own upvalue that the enclosed scopes then reference.
     const int upvalue = resolve_upvalue(compiler->enclosing, name);
     if (upvalue != -1) {
-        return add_upvalue(compiler, (uint8_t)upvalue, false);
+        return add_upvalue(compiler, upvalue, false);
     }
 
     return -1;
@@ -392,11 +928,11 @@ static int resolve_upvalue(compiler_t *compiler, const token_t *name)
 
 static void add_local(const token_t name)
 {
-    if (current->local_count == UINT8_COUNT) {
+    if (current->local_count == MAX_LOCALS) {
         error(gettext("Too many local variables in function."));
         return;
     }
-    local_t *local = &current->locals[current->local_count++];
+    local_t *local = push_local();
     local->name = name;
     // NOTE here use use a depth of -1 to indicate uninitialized, see mark_initialized and resolve_local
     // local->depth = current->scope_depth;
@@ -422,7 +958,7 @@ static void declare_variable(void)
     add_local(*name);
 }
 
-static uint8_t parse_variable(const char *message)
+static int parse_variable(const char *message)
 {
     consume(TOKEN_IDENTIFIER, message);
     declare_variable();
@@ -440,13 +976,13 @@ static void mark_initialized(void)
     current->locals[current->local_count - 1].depth = current->scope_depth;
 }
 
-static void define_variable(const uint8_t variable)
+static void define_variable(const int variable)
 {
     if (current->scope_depth > 0) {
         mark_initialized();
         return;
     }
-    emit_bytes(OP_DEFINE_GLOBAL, variable);
+    emit_indexed(OP_DEFINE_GLOBAL, variable);
 }
 
 static uint8_t argument_list(void)
@@ -473,11 +1009,21 @@ static uint8_t argument_list(void)
 
 static void and_expr(const bool) // can_assign
 {
-    const int end_jump = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
+    const int known = constant_condition();
+    if (known != -1) {
+        // true and x is x, false and x never looks at x
+        const int loop_end = inner_most_loop_end;
+        if (known)
+            drop_condition();
+        const int start = current_chunk()->count;
+        parse_precedence(PREC_AND);
+        if (!known)
+            discard_code(start, loop_end);
+        return;
+    }
 
+    const int end_jump = emit_jump(OP_JUMP_IF_FALSE_OR_POP);
     parse_precedence(PREC_AND);
-
     patch_jump(end_jump);
 }
 
@@ -491,16 +1037,13 @@ static token_t synthetic_token(const char *text)
 
 static void ternary(const bool)
 {
-    const int then_jump = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
+    const int then_jump = emit_condition_jump();
     expression();
 
     const int else_jump = emit_jump(OP_JUMP);
 
     patch_jump(then_jump);
 
-    emit_byte(OP_POP);
-
     consume(TOKEN_COLON, gettext("Expected colon with expression."));
     expression();
 
@@ -513,22 +1056,22 @@ static void binary(const bool)
     const parse_rule_t *rule = get_rule(operator_type);
     parse_precedence((precedence_t)(rule->precedence + 1));
     switch (operator_type) {
-        case TOKEN_BANG_EQUAL: emit_bytes(OP_EQUAL, OP_NOT); break;
-        case TOKEN_EQUAL_EQUAL: emit_byte(OP_EQUAL); break;
-        case TOKEN_GREATER: emit_byte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emit_bytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS: emit_byte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL: emit_bytes(OP_GREATER, OP_NOT); break;
-        case TOKEN_PLUS: emit_byte(OP_ADD); break;
-        case TOKEN_MOD: emit_byte(OP_MOD); break;
-        case TOKEN_BIT_XOR: emit_byte(OP_BITWISE_XOR); break;
-        case TOKEN_BIT_AND: emit_byte(OP_BITWISE_AND); break;
-        case TOKEN_BIT_OR: emit_byte(OP_BITWISE_OR); break;
-        case TOKEN_SHIFT_LEFT: emit_byte(OP_SHIFT_LEFT); break;
-        case TOKEN_SHIFT_RIGHT: emit_byte(OP_SHIFT_RIGHT); break;
-        case TOKEN_MINUS: emit_byte(OP_SUBTRACT); break;
-        case TOKEN_STAR: emit_byte(OP_MULTIPLY); break;
-        case TOKEN_SLASH: emit_byte(OP_DIVIDE); break;
+        case TOKEN_BANG_EQUAL: emit_operator(OP_EQUAL); emit_operator(OP_NOT); break;
+        case TOKEN_EQUAL_EQUAL: emit_operator(OP_EQUAL); break;
+        case TOKEN_GREATER: emit_operator(OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL: emit_operator(OP_LESS); emit_operator(OP_NOT); break;
+        case TOKEN_LESS: emit_operator(OP_LESS); break;
+        case TOKEN_LESS_EQUAL: emit_operator(OP_GREATER); emit_operator(OP_NOT); break;
+        case TOKEN_PLUS: emit_operator(OP_ADD); break;
+        case TOKEN_MOD: emit_operator(OP_MOD); break;
+        case TOKEN_BIT_XOR: emit_operator(OP_BITWISE_XOR); break;
+        case TOKEN_BIT_AND: emit_operator(OP_BITWISE_AND); break;
+        case TOKEN_BIT_OR: emit_operator(OP_BITWISE_OR); break;
+        case TOKEN_SHIFT_LEFT: emit_operator(OP_SHIFT_LEFT); break;
+        case TOKEN_SHIFT_RIGHT: emit_operator(OP_SHIFT_RIGHT); break;
+        case TOKEN_MINUS: emit_operator(OP_SUBTRACT); break;
+        case TOKEN_STAR: emit_operator(OP_MULTIPLY); break;
+        case TOKEN_SLASH: emit_operator(OP_DIVIDE); break;
         default: return; // unreachable
     }
 }
@@ -536,81 +1079,11 @@ static void binary(const bool)
 static void call(const bool)
 {
     const uint8_t arg_count = argument_list();
+    current->last_call = current_chunk()->count;
     emit_bytes(OP_CALL, arg_count);
 }
 
-static void map(const bool)
-{
-    token_t map_token = synthetic_token(KEYWORD_MAP);
-    const uint8_t map = identifier_constant(&map_token);
-    emit_bytes(OP_GET_GLOBAL, map);
-    int arg_count = 0;
-
-    if (!match(TOKEN_RIGHT_BRACE)) {
-        do {
-            expression();
-            match(TOKEN_COLON);
-            expression();
-            arg_count += 2;
-        } while (match(TOKEN_COMMA));
-        consume(TOKEN_RIGHT_BRACE, "Expect '}' after expression.");
-    }
-    emit_bytes(OP_CALL, arg_count);
-}
-
-static void list(const bool)
-{
-    token_t list_token = synthetic_token(KEYWORD_LIST);
-    const uint8_t list = identifier_constant(&list_token);
-    emit_bytes(OP_GET_GLOBAL, list);
-
-    int arg_count = 0;
-    if (!match(TOKEN_RIGHT_BRACKET)) {
-        bool trailing = false; // trailing comma is ok
-        do {
-            if (match(TOKEN_RIGHT_BRACKET)) {
-                trailing = true;
-                break;
-            }
-            expression();
-            arg_count++;
-        } while (match(TOKEN_COMMA));
-        if (!trailing)
-            consume(TOKEN_RIGHT_BRACKET, "Expect ']' after expression.");
-    }
-    emit_bytes(OP_CALL, arg_count);
-}
-
-static void subscript(const bool can_assign)
-{
-    uint8_t arg_count = 0;
-    expression();
-    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after expression.");
-    arg_count++;
-
-    if (can_assign && match(TOKEN_EQUAL)) {
-        expression();
-        arg_count++;
-    }
-    token_t subscript_token = synthetic_token(KEYWORD_SUBSCRIPT);
-    const uint8_t subscript = identifier_constant(&subscript_token);
-    emit_bytes(OP_INVOKE, subscript);
-    emit_byte(arg_count);
-}
-
-static void increment(const bool)
-{
-    emit_constant(NUMBER_VAL(1));
-    emit_byte(OP_ADD);
-}
-
-static void decrement(const bool)
-{
-    emit_constant(NUMBER_VAL(-1));
-    emit_byte(OP_ADD);
-}
-
-static void number(const bool)
+static value_t number_value(void)
 {
     bool cleaned = false;
     char *str = NULL;
@@ -632,53 +1105,261 @@ static void number(const bool)
     if (str == NULL)
         str = (char *)parser.previous.start;
 
+    double value;
     if (str[0] == '0' && str[1] == 'x') {
-        double value = (double)strtoll(str, NULL, 16);
-        emit_constant(NUMBER_VAL(value));
+        value = (double)strtoll(str, NULL, 16);
     } else if (str[0] == '0' && str[1] == 'b') {
-        double value = (double)strtoll(str + 2, NULL, 2);
-        emit_constant(NUMBER_VAL(value));
+        value = (double)strtoll(str + 2, NULL, 2);
     } else if (str[0] == '0' && str[1] == 'o') {
-        double value = (double)strtoll(str + 2, NULL, 8);
-        emit_constant(NUMBER_VAL(value));
+        value = (double)strtoll(str + 2, NULL, 8);
     } else {
-        const double value = strtod(str, NULL);
-        emit_constant(NUMBER_VAL(value));
+        value = number_parse(str, cleaned ? (int)strlen(str) : parser.previous.length);
     }
 
     if (cleaned)
         free(str);
+    return NUMBER_VAL(value);
 }
 
-static void string(const bool)
+// literal elements are collected on the stack and moved into the container a batch at a time
+typedef struct {
+    uint8_t op_build;
+    uint8_t op_build_long;
+    uint8_t op_extend;
+    int total;
+    int pending;
+    int long_offset; // wide build operand patched with the final total, -1 until the first batch
+} literal_builder_t;
+
+static void literal_builder_t_flush(literal_builder_t *builder)
+{
+    if (builder->long_offset == -1) {
+        emit_byte(builder->op_build_long);
+        builder->long_offset = current_chunk()->count;
+        emit_bytes(0, 0);
+        emit_bytes(0, (uint8_t)builder->pending);
+    } else {
+        emit_bytes(builder->op_extend, (uint8_t)builder->pending);
+    }
+    builder->pending = 0;
+}
+
+static void literal_builder_t_pushed(literal_builder_t *builder)
 {
-    emit_constant(OBJ_VAL(obj_string_t_copy_from(parser.previous.start + 1, parser.previous.length - 2, true)));
+    builder->total++;
+    if (++builder->pending == UINT8_MAX)
+        literal_builder_t_flush(builder);
 }
 
-static bool match_for_load_and_modify(void)
+static void literal_builder_t_finish(literal_builder_t *builder)
 {
-    if (match(TOKEN_PLUS_EQUAL) ||
-        match(TOKEN_MINUS_EQUAL) ||
-        match(TOKEN_STAR_EQUAL) ||
-        match(TOKEN_SLASH_EQUAL) ||
-        match(TOKEN_AND_EQUAL) ||
-        match(TOKEN_OR_EQUAL) ||
-        match(TOKEN_XOR_EQUAL) ||
-        match(TOKEN_SHIFT_LEFT_EQUAL) ||
-        match(TOKEN_SHIFT_RIGHT_EQUAL) ||
-        match(TOKEN_PLUS_PLUS) ||
-        match(TOKEN_MINUS_MINUS)
-    )
-        return true;
-    return false;
+    if (builder->long_offset == -1) {
+        emit_bytes(builder->op_build, (uint8_t)builder->pending);
+        return;
+    }
+    if (builder->pending > 0)
+        emit_bytes(builder->op_extend, (uint8_t)builder->pending);
+    if (builder->total > 0xffffff) {
+        error(gettext("Too many elements in literal."));
+        return;
+    }
+    uint8_t *code = current_chunk()->code + builder->long_offset;
+    code[0] = builder->total & 0xff;
+    code[1] = (builder->total >> 8) & 0xff;
+    code[2] = (builder->total >> 16) & 0xff;
 }
 
-static void load_and_modify(const uint8_t name, const token_type_t match, const uint8_t get_op, const uint8_t set_op)
+static value_t literal_value(void)
 {
-    emit_bytes(get_op, name);
-    switch (match) {
-        case TOKEN_PLUS_EQUAL: expression(); emit_byte(OP_ADD); break;
-        case TOKEN_MINUS_EQUAL: expression(); emit_byte(OP_SUBTRACT); break;
+    switch (parser.previous.type) {
+        case TOKEN_NUMBER: return number_value();
+        case TOKEN_STRING: return OBJ_VAL(obj_string_t_copy_from(parser.previous.start + 1, parser.previous.length - 2, true));
+        case TOKEN_TRUE: return TRUE_VAL;
+        case TOKEN_FALSE: return FALSE_VAL;
+        default: return NIL_VAL;
+    }
+}
+
+// a lone number, string, boolean or nil is a compile time constant, otherwise started says
+// whether the first token of the element expression has already been consumed
+static bool literal_constant(value_t *value, const token_type_t end, const token_type_t other_end, bool *started)
+{
+    *started = false;
+    switch (parser.current.type) {
+        case TOKEN_NUMBER: case TOKEN_STRING: case TOKEN_TRUE: case TOKEN_FALSE: case TOKEN_NIL:
+            advance();
+            if (check(end) || check(other_end)) {
+                *value = literal_value();
+                return true;
+            }
+            *started = true;
+            return false;
+        default:
+            return false;
+    }
+}
+
+static void literal_expression(const bool started)
+{
+    if (started)
+        parse_precedence_from_previous(PREC_ASSIGNMENT);
+    else
+        expression();
+}
+
+// constant-only literals are built once here and copied by OP_COPY_LITERAL
+static void emit_literal_template(const value_t template)
+{
+    emit_constant(template);
+    emit_byte(OP_COPY_LITERAL);
+}
+
+static void map_template_spill(obj_map_t *template, literal_builder_t *builder)
+{
+    int cursor = 0;
+    value_t key, value;
+    while (obj_map_t_next(template, &cursor, &key, &value)) {
+        emit_value(key);
+        emit_value(value);
+        literal_builder_t_pushed(builder);
+    }
+}
+
+static void map(const bool)
+{
+    literal_builder_t builder = {OP_BUILD_MAP, OP_BUILD_MAP_LONG, OP_EXTEND_MAP, 0, 0, -1};
+    obj_map_t *template = obj_map_t_allocate();
+    vm_push(OBJ_VAL(template));
+    bool constant = true;
+
+    if (!match(TOKEN_RIGHT_BRACE)) {
+        do {
+            value_t key, value;
+            bool started = false;
+            if (constant && literal_constant(&key, TOKEN_COLON, TOKEN_COLON, &started)) {
+                vm_push(key);
+                match(TOKEN_COLON);
+                if (literal_constant(&value, TOKEN_COMMA, TOKEN_RIGHT_BRACE, &started)) {
+                    vm_push(value);
+                    obj_map_t_set(template, key, value);
+                    vm_pop();
+                    vm_pop();
+                    continue;
+                }
+                constant = false;
+                map_template_spill(template, &builder);
+                emit_value(key);
+                vm_pop();
+                literal_expression(started);
+            } else {
+                if (constant) {
+                    constant = false;
+                    map_template_spill(template, &builder);
+                }
+                literal_expression(started);
+                match(TOKEN_COLON);
+                expression();
+            }
+            literal_builder_t_pushed(&builder);
+        } while (match(TOKEN_COMMA));
+        consume(TOKEN_RIGHT_BRACE, "Expect '}' after expression.");
+    }
+
+    if (constant && obj_map_t_count(template) > 0)
+        emit_literal_template(OBJ_VAL(template));
+    else
+        literal_builder_t_finish(&builder);
+    vm_pop();
+}
+
+static void list(const bool)
+{
+    literal_builder_t builder = {OP_BUILD_LIST, OP_BUILD_LIST_LONG, OP_EXTEND_LIST, 0, 0, -1};
+    obj_list_t *template = obj_list_t_allocate();
+    vm_push(OBJ_VAL(template));
+    bool constant = true;
+
+    if (!match(TOKEN_RIGHT_BRACKET)) {
+        bool trailing = false; // trailing comma is ok
+        do {
+            if (match(TOKEN_RIGHT_BRACKET)) {
+                trailing = true;
+                break;
+            }
+            value_t value;
+            bool started = false;
+            if (constant && literal_constant(&value, TOKEN_COMMA, TOKEN_RIGHT_BRACKET, &started)) {
+                vm_push(value);
+                value_list_t_add(&template->elements, value);
+                vm_pop();
+                continue;
+            }
+            if (constant) {
+                constant = false;
+                for (int i = 0; i < template->elements.count; i++) {
+                    emit_value(template->elements.values[i]);
+                    literal_builder_t_pushed(&builder);
+                }
+            }
+            literal_expression(started);
+            literal_builder_t_pushed(&builder);
+        } while (match(TOKEN_COMMA));
+        if (!trailing)
+            consume(TOKEN_RIGHT_BRACKET, "Expect ']' after expression.");
+    }
+
+    if (constant && template->elements.count > 0)
+        emit_literal_template(OBJ_VAL(template));
+    else
+        literal_builder_t_finish(&builder);
+    vm_pop();
+}
+
+static void increment(const bool)
+{
+    emit_constant(NUMBER_VAL(1));
+    emit_byte(OP_ADD);
+}
+
+static void decrement(const bool)
+{
+    emit_constant(NUMBER_VAL(-1));
+    emit_byte(OP_ADD);
+}
+
+static void number(const bool)
+{
+    emit_constant(number_value());
+}
+
+static void string(const bool)
+{
+    emit_constant(OBJ_VAL(obj_string_t_copy_from(parser.previous.start + 1, parser.previous.length - 2, true)));
+}
+
+static bool match_for_load_and_modify(void)
+{
+    if (match(TOKEN_PLUS_EQUAL) ||
+        match(TOKEN_MINUS_EQUAL) ||
+        match(TOKEN_STAR_EQUAL) ||
+        match(TOKEN_SLASH_EQUAL) ||
+        match(TOKEN_AND_EQUAL) ||
+        match(TOKEN_OR_EQUAL) ||
+        match(TOKEN_XOR_EQUAL) ||
+        match(TOKEN_SHIFT_LEFT_EQUAL) ||
+        match(TOKEN_SHIFT_RIGHT_EQUAL) ||
+        match(TOKEN_PLUS_PLUS) ||
+        match(TOKEN_MINUS_MINUS)
+    )
+        return true;
+    return false;
+}
+
+static void modify(const token_type_t match)
+{
+    switch (match) {
+        case TOKEN_PLUS_EQUAL: expression(); emit_byte(OP_ADD); break;
+        case TOKEN_MINUS_EQUAL: expression(); emit_byte(OP_SUBTRACT); break;
         case TOKEN_STAR_EQUAL: expression(); emit_byte(OP_MULTIPLY); break;
         case TOKEN_SLASH_EQUAL: expression(); emit_byte(OP_DIVIDE); break;
         case TOKEN_XOR_EQUAL: expression(); emit_byte(OP_BITWISE_XOR); break;
@@ -693,67 +1374,117 @@ static void load_and_modify(const uint8_t name, const token_type_t match, const
             break;
         default: ;
     }
-    emit_bytes(set_op, name);
 }
 
-static void subscript_modify_in_place(const int slot, const uint8_t get_op)
+static uint8_t increment_op(const uint8_t get_op)
 {
-    uint8_t arg_count = 0;
-    expression();
-    token_t saved_expression = parser.previous;
-    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after expression.");
-    arg_count++;
-
-    // if we have a load and modify coming
-    if (match_for_load_and_modify()) {
-        // save it off
-        const token_t match_token = parser.previous;
-
-        // emit another invoke to load the current value to modify
-        emit_bytes(get_op, (uint8_t)slot);
-        if (saved_expression.type == TOKEN_STRING) {
-            parser.previous = saved_expression;
-            string(true);
-        } else if (saved_expression.type == TOKEN_NUMBER) {
-            parser.previous = saved_expression;
-            number(true);
-        } else {
-            error(gettext("Invalid subscript."));
-        }
-        token_t subscript_token = synthetic_token(KEYWORD_SUBSCRIPT);
-        const uint8_t subscript_v = identifier_constant(&subscript_token);
-        emit_bytes(OP_INVOKE, subscript_v);
-        emit_byte(arg_count);
+    switch (get_op) {
+        case OP_GET_LOCAL: return OP_INC_LOCAL;
+        case OP_GET_UPVALUE: return OP_INC_UPVALUE;
+        case OP_GET_GLOBAL: return OP_INC_GLOBAL;
+        default: return OP_INC_PROPERTY;
+    }
+}
 
-        switch (match_token.type) {
-            case TOKEN_PLUS_EQUAL: expression(); emit_byte(OP_ADD); break;
-            case TOKEN_MINUS_EQUAL: expression(); emit_byte(OP_SUBTRACT); break;
-            case TOKEN_STAR_EQUAL: expression(); emit_byte(OP_MULTIPLY); break;
-            case TOKEN_SLASH_EQUAL: expression(); emit_byte(OP_DIVIDE); break;
-            case TOKEN_XOR_EQUAL: expression(); emit_byte(OP_BITWISE_XOR); break;
-            case TOKEN_OR_EQUAL: expression(); emit_byte(OP_BITWISE_OR); break;
-            case TOKEN_AND_EQUAL: expression(); emit_byte(OP_BITWISE_AND); break;
-            case TOKEN_SHIFT_LEFT_EQUAL: expression(); emit_byte(OP_SHIFT_LEFT); break;
-            case TOKEN_SHIFT_RIGHT_EQUAL: expression(); emit_byte(OP_SHIFT_RIGHT); break;
-            case TOKEN_PLUS_PLUS:
-            case TOKEN_MINUS_MINUS:
-                emit_constant(NUMBER_VAL(match_token.type == TOKEN_PLUS_PLUS ? 1 : -1));
-                emit_byte(OP_ADD);
-                break;
-            default: ;
+// += or -= of a constant, updated in place by the vm instead of load, add and store
+static bool add_in_place(const int name, const token_type_t match, const uint8_t get_op, const int start, const int operand)
+{
+    value_t value;
+    int end;
+    const int count = current->operand_push_count;
+    if (count == 0 || current->operand_pushes[count - 1] != operand || current->jump_target > operand)
+        return false;
+    if (!constant_at(operand, &value, &end) || end != current_chunk()->count)
+        return false;
 
+    if (IS_NUMBER(value)) {
+        const double delta = match == TOKEN_MINUS_EQUAL ? -AS_NUMBER(value) : AS_NUMBER(value);
+        if (delta >= INT8_MIN && delta <= INT8_MAX && delta == floor(delta)) {
+            release_constant(operand);
+            discard_code(start, inner_most_loop_end);
+            emit_indexed(increment_op(get_op), name);
+            emit_byte((uint8_t)(int8_t)delta);
+            return true;
         }
-        arg_count++;
     }
-    else if (match(TOKEN_EQUAL)) {
+
+    if (get_op != OP_GET_LOCAL || !(IS_NUMBER(value) || (IS_STRING(value) && match == TOKEN_PLUS_EQUAL)))
+        return false;
+    // both operands are single bytes, wide ones keep the plain form
+    const chunk_t *chunk = current_chunk();
+    if (name > UINT8_MAX || chunk->code[operand] != OP_CONSTANT || chunk->constants.count > UINT8_MAX)
+        return false;
+    uint8_t constant = chunk->code[operand + 1];
+    if (match == TOKEN_MINUS_EQUAL) {
+        release_constant(operand);
+        constant = (uint8_t)make_constant(NUMBER_VAL(-AS_NUMBER(value)));
+    }
+    discard_code(start, inner_most_loop_end);
+    emit_bytes(OP_ADD_LOCAL_CONST, (uint8_t)name);
+    emit_byte(constant);
+    return true;
+}
+
+static void emit_store(const uint8_t set_op, const int name)
+{
+    if (set_op == OP_SET_LOCAL && name <= UINT8_MAX)
+        current->last_store = current_chunk()->count;
+    emit_indexed(set_op, name);
+}
+
+// the value of an expression statement is dropped, a local store right before keeps it off the stack instead
+static void emit_pop_result(void)
+{
+    const int store = current->last_store;
+    if (compiler_optimize && store >= 0 && store + 2 == current_chunk()->count && current->jump_target <= store) {
+        current_chunk()->code[store] = OP_SET_LOCAL_POP;
+        current->last_store = -1;
+        return;
+    }
+    emit_byte(OP_POP);
+}
+
+static void load_and_modify(const int name, const token_type_t match, const uint8_t get_op, const uint8_t set_op)
+{
+    const int start = current_chunk()->count;
+    if (compiler_optimize && (match == TOKEN_PLUS_PLUS || match == TOKEN_MINUS_MINUS)) {
+        emit_indexed(increment_op(get_op), name);
+        emit_byte((uint8_t)(match == TOKEN_PLUS_PLUS ? 1 : -1));
+        return;
+    }
+
+    if (get_op == OP_GET_PROPERTY)
+        emit_byte(OP_DUP); // the instance is reused for the store
+    emit_indexed(get_op, name);
+    if (compiler_optimize && (match == TOKEN_PLUS_EQUAL || match == TOKEN_MINUS_EQUAL)) {
+        const int operand = current_chunk()->count;
         expression();
-        arg_count++;
+        if (add_in_place(name, match, get_op, start, operand))
+            return;
+        emit_byte(match == TOKEN_PLUS_EQUAL ? OP_ADD : OP_SUBTRACT);
+    } else {
+        modify(match);
     }
+    emit_store(set_op, name);
+}
 
-    token_t subscript_token = synthetic_token(KEYWORD_SUBSCRIPT);
-    const uint8_t subscript_v = identifier_constant(&subscript_token);
-    emit_bytes(OP_INVOKE, subscript_v);
-    emit_byte(arg_count);
+static void subscript(const bool can_assign)
+{
+    expression();
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after expression.");
+
+    if (can_assign && match(TOKEN_EQUAL)) {
+        expression();
+        emit_byte(OP_SET_INDEX);
+    } else if (can_assign && match_for_load_and_modify()) {
+        // container and index are evaluated once and reused for the store
+        emit_byte(OP_DUP2);
+        emit_byte(OP_GET_INDEX);
+        modify(parser.previous.type);
+        emit_byte(OP_SET_INDEX);
+    } else {
+        emit_byte(OP_GET_INDEX);
+    }
 }
 
 static void named_variable(const token_t name, const bool can_assign)
@@ -774,46 +1505,42 @@ static void named_variable(const token_t name, const bool can_assign)
 
     if (can_assign && match(TOKEN_EQUAL)) {
         expression();
-        emit_bytes(set_op, (uint8_t)arg);
+        emit_store(set_op, arg);
     } else if (can_assign && match_for_load_and_modify()) {
         load_and_modify(arg, parser.previous.type, get_op, set_op);
-    } else if (can_assign && match(TOKEN_LEFT_BRACKET)) {
-        emit_bytes(get_op, (uint8_t)arg);
-        subscript_modify_in_place(arg, get_op);
     } else {
-        emit_bytes(get_op, (uint8_t)arg);
+        if (get_op == OP_GET_LOCAL)
+            note_operand_push(current_chunk()->count);
+        emit_indexed(get_op, arg);
     }
 }
 
 static void dot(const bool can_assign)
 {
     consume(TOKEN_IDENTIFIER, gettext("Expect property name after '.'."));
-    const uint8_t name = identifier_constant(&parser.previous);
+    const int name = identifier_constant(&parser.previous);
 
     if (can_assign && match(TOKEN_EQUAL)) {
         expression();
-        emit_bytes(OP_SET_PROPERTY, name);
+        emit_indexed(OP_SET_PROPERTY, name);
     } else if (match(TOKEN_LEFT_PAREN)) { // optimization here since we are immediately calling the method
         const uint8_t arg_count = argument_list();
-        emit_bytes(OP_INVOKE, name);
+        current->last_call = current_chunk()->count;
+        emit_indexed(OP_INVOKE, name);
         emit_byte(arg_count);
     } else if (can_assign && match_for_load_and_modify()) {
-        named_variable(synthetic_token(token_keyword_names[TOKEN_SELF]), false);
         load_and_modify(name, parser.previous.type, OP_GET_PROPERTY, OP_SET_PROPERTY);
-    } else if (can_assign && match(TOKEN_LEFT_BRACKET)) {
-        emit_bytes(OP_GET_PROPERTY, (uint8_t)name);
-        subscript_modify_in_place(name, OP_GET_PROPERTY);
     } else {
-        emit_bytes(OP_GET_PROPERTY, name);
+        emit_indexed(OP_GET_PROPERTY, name);
     }
 }
 
 static void literal(const bool)
 {
     switch (parser.previous.type) {
-        case TOKEN_FALSE: emit_byte(OP_FALSE); break;
-        case TOKEN_NIL: emit_byte(OP_NIL); break;
-        case TOKEN_TRUE: emit_byte(OP_TRUE); break;
+        case TOKEN_FALSE: emit_value(FALSE_VAL); break;
+        case TOKEN_NIL: emit_value(NIL_VAL); break;
+        case TOKEN_TRUE: emit_value(TRUE_VAL); break;
         default: return; // unreachable
     }
 }
@@ -826,12 +1553,19 @@ static void grouping(const bool)
 
 static void or_expr(const bool) // can_assign
 {
-    const int else_jump = emit_jump(OP_JUMP_IF_FALSE);
-    const int end_jump = emit_jump(OP_JUMP);
-
-    patch_jump(else_jump);
-    emit_byte(OP_POP);
+    const int known = constant_condition();
+    if (known != -1) {
+        const int loop_end = inner_most_loop_end;
+        if (!known)
+            drop_condition();
+        const int start = current_chunk()->count;
+        parse_precedence(PREC_OR);
+        if (known)
+            discard_code(start, loop_end);
+        return;
+    }
 
+    const int end_jump = emit_jump(OP_JUMP_IF_TRUE_OR_POP);
     parse_precedence(PREC_OR);
     patch_jump(end_jump);
 }
@@ -851,7 +1585,7 @@ static void super_expr(const bool)
 
     consume(TOKEN_DOT, gettext("Expect '.' after 'super'."));
     consume(TOKEN_IDENTIFIER, gettext("Expect supertype method name."));
-    const uint8_t method_name = identifier_constant(&parser.previous);
+    const int method_name = identifier_constant(&parser.previous);
 
     // capture self and super in case we are in a closure
     named_variable(synthetic_token(token_keyword_names[TOKEN_SELF]), false);
@@ -860,11 +1594,12 @@ static void super_expr(const bool)
     if (match(TOKEN_LEFT_PAREN)) {
         const uint8_t arg_count = argument_list();
         named_variable(synthetic_token(token_keyword_names[TOKEN_SUPER]), false);
-        emit_bytes(OP_SUPER_INVOKE, method_name);
+        current->last_call = current_chunk()->count;
+        emit_indexed(OP_SUPER_INVOKE, method_name);
         emit_byte(arg_count);
     } else { // slow path
         named_variable(synthetic_token(token_keyword_names[TOKEN_SUPER]), false);
-        emit_bytes(OP_GET_SUPER, method_name);
+        emit_indexed(OP_GET_SUPER, method_name);
     }
 }
 
@@ -887,9 +1622,9 @@ static void unary(const bool)
 
     // emit the operator instruction
     switch (operator_type) {
-        case TOKEN_BANG: emit_byte(OP_NOT); break;
-        case TOKEN_MINUS: emit_byte(OP_NEGATE); break;
-        case TOKEN_BIT_NOT : emit_byte(OP_BITWISE_NOT); break;
+        case TOKEN_BANG: emit_operator(OP_NOT); break;
+        case TOKEN_MINUS: emit_operator(OP_NEGATE); break;
+        case TOKEN_BIT_NOT : emit_operator(OP_BITWISE_NOT); break;
         default: return; // unreachable
     }
 }
@@ -960,9 +1695,9 @@ const parse_rule_t rules[] = {
     [TOKEN_EOF]                 = {NULL,        NULL,       PREC_NONE},
 };
 
-static void parse_precedence(const precedence_t precedence)
+// parse with the first token of the expression already consumed
+static void parse_precedence_from_previous(const precedence_t precedence)
 {
-    advance();
     const parse_fn_t prefix_rule = get_rule(parser.previous.type)->prefix;
     if (prefix_rule == NULL) {
         error(gettext("Expect expression."));
@@ -987,6 +1722,12 @@ static void parse_precedence(const precedence_t precedence)
     }
 }
 
+static void parse_precedence(const precedence_t precedence)
+{
+    advance();
+    parse_precedence_from_previous(precedence);
+}
+
 static const parse_rule_t *get_rule(const token_type_t type)
 {
     return &rules[type];
@@ -997,19 +1738,32 @@ static void expression(void)
     parse_precedence(PREC_ASSIGNMENT);
 }
 
+// whatever follows a return, exit, break or continue in the same block is checked and then dropped
+static void unreachable_declarations(void)
+{
+    const int start = current_chunk()->count;
+    const int loop_end = inner_most_loop_end;
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+        declaration();
+    }
+    discard_code(start, loop_end);
+}
+
 static void block(void)
 {
     while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+        const bool terminal = check(TOKEN_RETURN) || check(TOKEN_EXIT) || check(TOKEN_BREAK) || check(TOKEN_CONTINUE);
         declaration();
+        if (terminal && compiler_optimize)
+            unreachable_declarations();
     }
     consume(TOKEN_RIGHT_BRACE, gettext("Expect '}' after block."));
     match(TOKEN_SEMICOLON);
 }
 
-static void function(function_type_t type)
+static obj_function_t *function_body(compiler_t *compiler, const function_type_t type)
 {
-    compiler_t compiler;
-    compiler_t_init(&compiler, type);
+    compiler_t_init(compiler, type);
     begin_scope();
 
     consume(TOKEN_LEFT_PAREN, gettext("Expect '(' after function name."));
@@ -1019,7 +1773,7 @@ static void function(function_type_t type)
             if (current->function->arity > MAX_PARAMETERS) {
                 error_at_current(gettext("Exceeded maximum number of parameters."));
             }
-            const uint8_t constant = parse_variable(gettext("Expect parameter name."));
+            const int constant = parse_variable(gettext("Expect parameter name."));
             define_variable(constant);
         } while (match(TOKEN_COMMA));
     }
@@ -1027,32 +1781,122 @@ static void function(function_type_t type)
     consume(TOKEN_LEFT_BRACE, gettext("Expect '{' before function body."));
     block();
 
-    obj_function_t *function = compiler_t_end(compiler_debug); // no end_scope required here
-    emit_bytes(OP_CLOSURE, make_constant(OBJ_VAL(function)));
+    return compiler_t_end(compiler_debug); // no end_scope required here
+}
+
+static void emit_closure(const obj_function_t *function, const compiler_t *compiler)
+{
+    const int constant = make_constant(OBJ_VAL(function));
+    bool wide = constant > UINT8_MAX;
+    for (int i = 0; i < function->upvalue_count; i++)
+        wide |= compiler->upvalues[i].index > UINT8_MAX;
 
+    // the wide form has three byte captures as well
+    if (wide) {
+        emit_bytes(OP_WIDE, OP_CLOSURE);
+        emit_wide_operand(constant);
+    } else {
+        emit_bytes(OP_CLOSURE, (uint8_t)constant);
+    }
     for (int i = 0; i < function->upvalue_count; i++) {
-        emit_byte(compiler.upvalues[i].is_local ? 1 : 0);
-        emit_byte(compiler.upvalues[i].index);
+        emit_byte(compiler->upvalues[i].is_local ? 1 : 0);
+        if (wide)
+            emit_wide_operand(compiler->upvalues[i].index);
+        else
+            emit_byte((uint8_t)compiler->upvalues[i].index);
     }
 }
 
+// only bodies that can capture nothing are deferred: script level functions and methods of types without a supertype
+static bool lazy_body(void)
+{
+    if (!(vm.flags & VM_FLAG_LAZY_COMPILE) || compiler_debug)
+        return false;
+    if (current->type != TYPE_SCRIPT || current->scope_depth > 0)
+        return false;
+    return current_type == NULL || !current_type->has_supertype;
+}
+
+// scan past the parameters and the body, matching braces, and emit a closure over a placeholder compiled on first call
+static void lazy_function(const function_type_t type)
+{
+    const token_t name = parser.previous;
+    const token_t open = parser.current;
+    int arity = 0;
+
+    consume(TOKEN_LEFT_PAREN, gettext("Expect '(' after function name."));
+    if (!check(TOKEN_RIGHT_PAREN)) {
+        do {
+            if (++arity > MAX_PARAMETERS) {
+                error_at_current(gettext("Exceeded maximum number of parameters."));
+            }
+            consume(TOKEN_IDENTIFIER, gettext("Expect parameter name."));
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, gettext("Expect ')' after parameters."));
+    consume(TOKEN_LEFT_BRACE, gettext("Expect '{' before function body."));
+
+    int depth = 1;
+    while (depth > 0 && !check(TOKEN_EOF)) {
+        if (check(TOKEN_LEFT_BRACE))
+            depth++;
+        else if (check(TOKEN_RIGHT_BRACE))
+            depth--;
+        advance();
+    }
+    if (depth > 0) {
+        error_at_current(gettext("Expect '}' after block."));
+        return;
+    }
+    const char *end = parser.previous.start + parser.previous.length;
+    match(TOKEN_SEMICOLON);
+
+    if (lazy_source == NULL)
+        lazy_source = obj_string_t_copy_from(source_start, (int)strlen(source_start), false);
+    obj_string_t *body = obj_string_t_slice(lazy_source, (int)(open.start - source_start), (int)(end - open.start));
+    vm_push(OBJ_VAL(body));
+    obj_function_t *function = obj_function_t_allocate();
+    vm_push(OBJ_VAL(function));
+    function->name = obj_string_t_copy_from(name.start, name.length, true);
+    function->arity = arity;
+    function->lazy_source = body;
+    function->lazy_line = open.line;
+    function->lazy_type = type;
+    emit_closure(function, NULL);
+    vm_pop();
+    vm_pop();
+}
+
+static void function(function_type_t type)
+{
+    if (lazy_body()) {
+        lazy_function(type);
+        return;
+    }
+
+    compiler_t compiler;
+    obj_function_t *function = function_body(&compiler, type);
+    emit_closure(function, &compiler);
+    compiler_t_free_upvalues(&compiler);
+}
+
 static void field(void)
 {
     consume(TOKEN_IDENTIFIER, gettext("Expect field name."));
-    const uint8_t field_name = identifier_constant(&parser.previous);
+    const int field_name = identifier_constant(&parser.previous);
     if (match(TOKEN_EQUAL)) {
         expression();
     } else {
         emit_byte(OP_NIL);
     }
     consume(TOKEN_SEMICOLON, gettext("Expect ';' after field declaration."));
-    emit_bytes(OP_FIELD, field_name);
+    emit_indexed(OP_FIELD, field_name);
 }
 
 static void method(void)
 {
     consume(TOKEN_IDENTIFIER, gettext("Expect method name."));
-    const uint8_t constant = identifier_constant(&parser.previous);
+    const int constant = identifier_constant(&parser.previous);
 
     function_type_t type = TYPE_METHOD;
     if (parser.previous.length == KEYWORD_INIT_LEN && memcmp(parser.previous.start, KEYWORD_INIT, KEYWORD_INIT_LEN) == 0) {
@@ -1060,20 +1904,19 @@ static void method(void)
     }
     function(type);
 
-    emit_bytes(OP_METHOD, constant);
+    emit_indexed(OP_METHOD, constant);
 }
 
 static void fun_declaration(void)
 {
-    const uint8_t global = parse_variable(gettext("Expect function name."));
+    const int global = parse_variable(gettext("Expect function name."));
     mark_initialized(); // so we can support recursion before we compile the body
     function(TYPE_FUNCTION);
     define_variable(global);
 }
 
-static void var_declaration(void)
+static void var_initializer(const int global)
 {
-    const uint8_t global = parse_variable(gettext("Expect variable name."));
     if (match(TOKEN_EQUAL)) {
         expression();
     } else {
@@ -1084,14 +1927,20 @@ static void var_declaration(void)
     define_variable(global);
 }
 
+static void var_declaration(void)
+{
+    const int global = parse_variable(gettext("Expect variable name."));
+    var_initializer(global);
+}
+
 static void type_declaration(void)
 {
     consume(TOKEN_IDENTIFIER, gettext("Expect type name."));
     const token_t type_name = parser.previous;
-    const uint8_t name_constant = identifier_constant(&parser.previous);
+    const int name_constant = identifier_constant(&parser.previous);
     declare_variable();
 
-    emit_bytes(OP_TYPE, name_constant);
+    emit_indexed(OP_TYPE, name_constant);
     define_variable(name_constant);
 
     // setup a type compiler instance while we do the work
@@ -1154,30 +2003,72 @@ static void expression_statement(void)
     }
     expression();
     consume(TOKEN_SEMICOLON, gettext("Expect ';' after expression."));
-    emit_byte(OP_POP);
+    emit_pop_result();
 }
 
-int inner_most_loop_start = -1;
-int inner_most_loop_end = -1;
-int inner_most_loop_scope_depth = 0;
 
-static void for_statement(void)
+static bool check_in(void)
 {
-    int surrounding_loop_start = inner_most_loop_start;
-    int surrounding_loop_end = inner_most_loop_end;
-    int surrounding_loop_scope_depth = inner_most_loop_scope_depth;
+    return check(TOKEN_IDENTIFIER) && parser.current.length == 2 && memcmp(parser.current.start, "in", 2) == 0;
+}
 
+// for (x in iterable) or for (k, v in iterable), with the first name already consumed
+static void for_in_statement(const token_t first)
+{
+    token_t second = first;
+    uint8_t vars = 1;
+    if (match(TOKEN_COMMA)) {
+        consume(TOKEN_IDENTIFIER, gettext("Expect variable name after ','."));
+        second = parser.previous;
+        vars = 2;
+    }
+    if (!check_in()) {
+        error_at_current(gettext("Expect 'in' after loop variables."));
+        return;
+    }
+    advance();
+    expression();
+    consume(TOKEN_RIGHT_PAREN, gettext("Expect ')' after for iterable."));
+
+    // hidden locals, named so they can never be resolved: the iterable, a cursor and a guard
+    add_local(synthetic_token("for iterable"));
+    mark_initialized();
+    emit_constant(NUMBER_VAL(0));
+    add_local(synthetic_token("for cursor"));
+    mark_initialized();
+    emit_byte(OP_NIL);
+    add_local(synthetic_token("for guard"));
+    mark_initialized();
+
+    inner_most_loop_start = current_chunk()->count;
+    inner_most_loop_end = -1;
+    inner_most_loop_scope_depth = current->scope_depth;
+
+    emit_indexed(OP_FOR_ITER, current->local_count - 3);
+    emit_byte(vars);
+    const int exit_jump = emit_jump_operand();
+
+    // the loop variables get a fresh scope each time around so closures capture that iteration's values
     begin_scope();
+    add_local(first);
+    mark_initialized();
+    if (vars == 2) {
+        add_local(second);
+        mark_initialized();
+    }
+    statement();
+    end_scope();
+    emit_loop(inner_most_loop_start);
 
-    consume(TOKEN_LEFT_PAREN, gettext("Expect '(' after 'for'."));
-    if (match(TOKEN_SEMICOLON)) {
-        // no loop initializer
-    } else if (match(TOKEN_LET)) {
-        var_declaration();
-    } else {
-        expression_statement();
+    patch_jump(exit_jump);
+    if (inner_most_loop_end != -1) {
+        patch_jump(inner_most_loop_end);
     }
+}
 
+// the initializer has been compiled, compile the condition, increment and body
+static void for_clauses(void)
+{
     inner_most_loop_start = current_chunk()->count;
     inner_most_loop_scope_depth = current->scope_depth;
 
@@ -1187,8 +2078,7 @@ static void for_statement(void)
         consume(TOKEN_SEMICOLON, gettext("Expect ';' after loop condition."));
 
         // jump out of the loop if the condition is false
-        exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-        emit_byte(OP_POP); // condition
+        exit_jump = emit_condition_jump();
     }
 
     if (!match(TOKEN_RIGHT_PAREN)) { // increment clause
@@ -1197,7 +2087,7 @@ static void for_statement(void)
 
         expression();
 
-        emit_byte(OP_POP);
+        emit_pop_result();
         consume(TOKEN_RIGHT_PAREN, gettext("Expect ')' after for clauses."));
 
         emit_loop(inner_most_loop_start);
@@ -1208,14 +2098,47 @@ static void for_statement(void)
     statement();
     emit_loop(inner_most_loop_start);
 
-    if (exit_jump != -1) {
+    if (exit_jump != -1)
         patch_jump(exit_jump);
-        emit_byte(OP_POP);
-    }
 
     if (inner_most_loop_end != -1) {
         patch_jump(inner_most_loop_end);
     }
+}
+
+static void for_statement(void)
+{
+    int surrounding_loop_start = inner_most_loop_start;
+    int surrounding_loop_end = inner_most_loop_end;
+    int surrounding_loop_scope_depth = inner_most_loop_scope_depth;
+
+    begin_scope();
+
+    consume(TOKEN_LEFT_PAREN, gettext("Expect '(' after 'for'."));
+    if (match(TOKEN_SEMICOLON)) {
+        for_clauses(); // no loop initializer
+    } else if (match(TOKEN_LET)) {
+        consume(TOKEN_IDENTIFIER, gettext("Expect variable name."));
+        if (check_in() || check(TOKEN_COMMA)) {
+            for_in_statement(parser.previous);
+        } else {
+            declare_variable();
+            var_initializer(0);
+            for_clauses();
+        }
+    } else if (match(TOKEN_IDENTIFIER)) {
+        if (check_in() || check(TOKEN_COMMA)) {
+            for_in_statement(parser.previous);
+        } else {
+            parse_precedence_from_previous(PREC_ASSIGNMENT);
+            consume(TOKEN_SEMICOLON, gettext("Expect ';' after expression."));
+            emit_pop_result();
+            for_clauses();
+        }
+    } else {
+        expression_statement();
+        for_clauses();
+    }
 
     inner_most_loop_start = surrounding_loop_start;
     inner_most_loop_end = surrounding_loop_end;
@@ -1229,20 +2152,35 @@ static void if_statement(void)
     expression();
     consume(TOKEN_RIGHT_PAREN, gettext("Expect ')' after condition."));
 
-    const int then_jump = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
-    statement();
-
-    const int else_jump = emit_jump(OP_JUMP);
-
-    patch_jump(then_jump);
+    const int known = constant_condition();
+    if (known != -1) {
+        // only the branch that can run is kept
+        const int loop_end = inner_most_loop_end;
+        drop_condition();
+        int start = current_chunk()->count;
+        statement();
+        if (!known)
+            discard_code(start, loop_end);
+        if (match(TOKEN_ELSE)) {
+            start = current_chunk()->count;
+            statement();
+            if (known)
+                discard_code(start, loop_end);
+        }
+        return;
+    }
 
-    emit_byte(OP_POP);
+    const int then_jump = emit_condition_jump();
+    statement();
 
-    if (match(TOKEN_ELSE))
+    if (match(TOKEN_ELSE)) {
+        const int else_jump = emit_jump(OP_JUMP);
+        patch_jump(then_jump);
         statement();
-
-    patch_jump(else_jump);
+        patch_jump(else_jump);
+    } else {
+        patch_jump(then_jump);
+    }
 }
 
 static void print_statement(void)
@@ -1259,6 +2197,21 @@ static void perror_statement(void)
     emit_byte(OP_ERROR);
 }
 
+// a call whose result is returned straight away can reuse the frame of the caller
+static void tail_call(void)
+{
+    chunk_t *chunk = current_chunk();
+    const int call = current->last_call;
+    if (call < 0 || current->jump_target > call || call + chunk_t_instruction_length(chunk, call) != chunk->count)
+        return;
+    switch (chunk->code[call]) {
+        case OP_CALL: chunk->code[call] = OP_TAIL_CALL; break;
+        case OP_INVOKE: chunk->code[call] = OP_TAIL_INVOKE; break;
+        case OP_SUPER_INVOKE: chunk->code[call] = OP_TAIL_SUPER_INVOKE; break;
+        default: break;
+    }
+}
+
 static void return_statement(void)
 {
     if (current->type == TYPE_SCRIPT) {
@@ -1274,6 +2227,8 @@ static void return_statement(void)
         }
         expression();
         consume(TOKEN_SEMICOLON, gettext("Expect ';' after return value."));
+        if (compiler_optimize)
+            tail_call();
         emit_byte(OP_RETURN);
     }
 }
@@ -1285,20 +2240,25 @@ static void while_statement(void)
     int surrounding_loop_scope_depth = inner_most_loop_scope_depth;
 
     inner_most_loop_start = current_chunk()->count;
+    inner_most_loop_end = -1;
     inner_most_loop_scope_depth = current->scope_depth;
 
     consume(TOKEN_LEFT_PAREN, gettext("Expect '(' after 'while'."));
     expression();
     consume(TOKEN_RIGHT_PAREN, gettext("Expect ')' after condition."));
 
-    const int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
+    int exit_jump = -1;
+    if (constant_condition() == 1) {
+        drop_condition();
+    } else {
+        exit_jump = emit_condition_jump();
+    }
     statement();
 
     emit_loop(inner_most_loop_start);
 
-    patch_jump(exit_jump);
-    emit_byte(OP_POP);
+    if (exit_jump != -1)
+        patch_jump(exit_jump);
 
     if (inner_most_loop_end != -1) {
         patch_jump(inner_most_loop_end);
@@ -1336,6 +2296,7 @@ static void synchronize(void)
 
 static void declaration(void)
 {
+    emit_jump_islands();
     if (match(TOKEN_TYPE)) {
         type_declaration();
     } else if (match(TOKEN_FN)) {
@@ -1350,6 +2311,43 @@ static void declaration(void)
 
 #define MAX_CASES 256
 
+// a case label known at compile time: a number, string, bool or nil literal. type fields are left to the compare
+// chain, the global naming the type can be rebound by any later script run on the same vm
+static bool case_label_constant(const int start, value_t *value)
+{
+    int end;
+    if (current->jump_target > start)
+        return false;
+    return constant_at(start, value, &end) && end == current_chunk()->count;
+}
+
+// OP_SWITCH_TABLE map default, the map holds label -> offset past the instruction
+static int emit_switch_table(void)
+{
+    obj_map_t *targets = obj_map_t_allocate();
+    const int table = current_chunk()->count;
+    emit_bytes(OP_SWITCH_TABLE, (uint8_t)make_constant(OBJ_VAL(targets)));
+    emit_jump_operand(); // the default is patched like any forward jump
+    return table;
+}
+
+static void add_switch_target(const int table, const value_t label)
+{
+    chunk_t *chunk = current_chunk();
+    obj_map_t *targets = AS_MAP(chunk->constants.values[chunk->code[table + 1]]);
+    value_t existing;
+    if (!obj_map_t_get(targets, label, &existing)) // the first matching case wins
+        obj_map_t_set(targets, label, NUMBER_VAL(chunk->count - table - 4));
+    current->jump_target = chunk->count;
+}
+
+static void patch_switch_default(const int table, const int target)
+{
+    patch_jump_to(table + 2, target);
+    if (target > current->jump_target)
+        current->jump_target = target;
+}
+
 static void switch_statement(void)
 {
     consume(TOKEN_LEFT_PAREN, gettext("Expect '(' after 'switch'."));
@@ -1357,9 +2355,17 @@ static void switch_statement(void)
     consume(TOKEN_RIGHT_PAREN, gettext("Expect ')' after value."));
     consume(TOKEN_LEFT_BRACE, gettext("Expect '{' before switch cases."));
 
+    // the value is a hidden local so a break or continue out of an enclosing loop pops it
+    begin_scope();
+    add_local(synthetic_token("switch value"));
+    mark_initialized();
+
     int case_ends[MAX_CASES];
     int case_count = 0;
     bool seen_default = false;
+    // leading constant labels dispatch through one table lookup, anything after them compares in order
+    int table = -1;
+    bool table_open = compiler_optimize;
 
     while (!match(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
         if (seen_default) {
@@ -1372,16 +2378,36 @@ static void switch_statement(void)
                 error(gettext("Too many case statements."));
                 return;
             }
+            const int test = current_chunk()->count;
             emit_byte(OP_DUP); // dup the switch value to compare against
             expression();
             consume(TOKEN_COLON, gettext("Expect ':' after case value."));
-            emit_byte(OP_EQUAL);
-            jump = emit_jump(OP_JUMP_IF_FALSE);
-            emit_byte(OP_POP); // Pop the comparison result.
+            value_t label;
+            // the table is a one byte constant
+            if (table == -1 && current_chunk()->constants.count > UINT8_MAX)
+                table_open = false;
+            if (table_open && case_label_constant(test + 1, &label)) {
+                vm_push(label); // make GC happy
+                release_constant(test + 1);
+                discard_code(test, inner_most_loop_end);
+                if (table == -1)
+                    table = emit_switch_table();
+                add_switch_target(table, label);
+                vm_pop();
+            } else {
+                if (table != -1 && table_open)
+                    patch_switch_default(table, test);
+                table_open = false;
+                emit_operator(OP_EQUAL);
+                jump = emit_condition_jump();
+            }
         } else {
             consume(TOKEN_DEFAULT, gettext("Expect 'case' or 'default'."));
             consume(TOKEN_COLON, gettext("Expect ':' after default."));
             seen_default = true;
+            if (table != -1 && table_open)
+                patch_switch_default(table, current_chunk()->count);
+            table_open = false;
         }
 
         while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_CASE) && !check(TOKEN_DEFAULT)) {
@@ -1390,18 +2416,21 @@ static void switch_statement(void)
 
         case_ends[case_count++] = emit_jump(OP_JUMP);
 
-        if (jump != -1) {
+        if (jump != -1)
             patch_jump(jump);
-            emit_byte(OP_POP);
-        }
     }
 
     // Patch all the case jumps to the end.
     for (int i = 0; i < case_count; i++) {
         patch_jump(case_ends[i]);
     }
+    if (table != -1 && table_open)
+        patch_switch_default(table, current_chunk()->count);
 
-    emit_byte(OP_POP); // The switch value.
+    // The switch value.
+    current->scope_depth--;
+    current->local_count--;
+    emit_byte(OP_POP);
 }
 #undef MAX_CASES
 
@@ -1412,11 +2441,12 @@ static void break_statement(void)
     }
     consume(TOKEN_SEMICOLON, gettext("Expect ';' after 'break'."));
 
-    uint8_t pop_count = 0;
+    int pop_count = 0;
     for (int i = current->local_count - 1; i >=0 && current->locals[i].depth > inner_most_loop_scope_depth; i--) {
         pop_count++;
     }
-    emit_bytes(OP_POPN, pop_count);
+    if (pop_count > 0)
+        emit_popn(pop_count);
     inner_most_loop_end = emit_jump(OP_JUMP);
 }
 
@@ -1427,11 +2457,12 @@ static void continue_statement(void)
     }
     consume(TOKEN_SEMICOLON, gettext("Expect ';' after 'continue'."));
 
-    uint8_t pop_count = 0;
+    int pop_count = 0;
     for (int i = current->local_count - 1; i >=0 && current->locals[i].depth > inner_most_loop_scope_depth; i--) {
         pop_count++;
     }
-    emit_bytes(OP_POPN, pop_count);
+    if (pop_count > 0)
+        emit_popn(pop_count);
     emit_loop(inner_most_loop_start);
 }
 
@@ -1464,7 +2495,7 @@ static void assert_statement(void)
     char errbuf[255];
     snprintf(errbuf, 255, "[line %d] Assertion failed", parser.current.line);
     obj_string_t *constant_str = obj_string_t_copy_from(errbuf, strlen(errbuf), true);
-    emit_bytes(OP_CONSTANT, make_constant(OBJ_VAL(constant_str)));
+    emit_load_constant(make_constant(OBJ_VAL(constant_str)));
     emit_byte(OP_PRINT);
 
     emit_constant(NUMBER_VAL(-1));
@@ -1474,6 +2505,7 @@ static void assert_statement(void)
 
 static void statement(void)
 {
+    emit_jump_islands();
     if (match(TOKEN_PRINT)) {
         print_statement();
     } else if (match(TOKEN_PERROR)) {
@@ -1508,6 +2540,8 @@ static void statement(void)
 obj_function_t *compiler_t_compile(const char *source, const bool debug)
 {
     scanner_t_init(source);
+    source_start = source;
+    lazy_source = NULL;
 
     compiler_t compiler;
     compiler_t_init(&compiler, TYPE_SCRIPT);
@@ -1515,6 +2549,11 @@ obj_function_t *compiler_t_compile(const char *source, const bool debug)
     parser.had_error = false;
     parser.panic_mode = false;
     compiler_debug = debug;
+    compiler_optimize = !(vm.flags & VM_FLAG_NO_OPTIMIZE);
+    // a failed compile can leave a stray break behind
+    inner_most_loop_start = -1;
+    inner_most_loop_end = -1;
+    inner_most_loop_scope_depth = 0;
 
     advance();
 
@@ -1523,9 +2562,693 @@ obj_function_t *compiler_t_compile(const char *source, const bool debug)
     }
 
     obj_function_t *function_obj = compiler_t_end(debug);
+    lazy_source = NULL; // the placeholders keep it alive from here on
     return parser.had_error ? NULL : function_obj;
 }
 
+bool compiler_t_compile_lazy(obj_function_t *function)
+{
+    scanner_t_resume(obj_string_t_cstring(function->lazy_source), function->lazy_line);
+
+    parser.had_error = false;
+    parser.panic_mode = false;
+    compiler_debug = false;
+    compiler_optimize = !(vm.flags & VM_FLAG_NO_OPTIMIZE);
+    inner_most_loop_start = -1;
+    inner_most_loop_end = -1;
+    inner_most_loop_scope_depth = 0;
+
+    type_compiler_t type_compiler = {.enclosing = NULL, .has_supertype = false};
+    if (function->lazy_type != TYPE_FUNCTION)
+        current_type = &type_compiler;
+
+    // advance the name into the previous token, compiler_t_init names the function after it
+    parser.current = (token_t){
+        .type = TOKEN_IDENTIFIER, .start = function->name->chars, .length = function->name->length, .line = function->lazy_line
+    };
+    advance();
+
+    compiler_t compiler;
+    obj_function_t *compiled = function_body(&compiler, (function_type_t)function->lazy_type);
+    compiler_t_free_upvalues(&compiler);
+    current_type = NULL;
+    if (parser.had_error)
+        return false;
+
+    function->slot_count = compiled->slot_count;
+    function->chunk = compiled->chunk;
+    chunk_t_init(&compiled->chunk);
+    function->lazy_source = NULL;
+    return true;
+}
+
+// register translation: the finished chunk is walked once with a model of its stack, every stack position becomes
+// the register of the same number, and values are only copied into their position when something needs them there
+#define REGISTER_LIMIT (UINT8_COUNT - 8) // headroom for what the slow paths of register instructions push
+
+typedef enum {
+    ENTRY_REGISTER, // the value is in the register of its own position
+    ENTRY_ALIAS, // the value is in a lower register that is not written while the alias lives
+    ENTRY_CONSTANT,
+    ENTRY_NIL,
+    ENTRY_TRUE,
+    ENTRY_FALSE,
+} entry_kind_t;
+
+typedef struct {
+    entry_kind_t kind;
+    int index; // the aliased register or the constant
+} entry_t;
+
+typedef struct {
+    const chunk_t *chunk;
+    register_code_t *code;
+    entry_t stack[UINT8_COUNT];
+    int depth;
+    int origin; // the chunk offset being translated
+    int last_write; // the word whose destination is the top register, a store straight after may retarget it
+    bool captured[UINT8_COUNT]; // locals a closure may write behind our back are never aliased
+    bool *targets;
+    int *depths; // the stack depth at each jump target, -1 until a jump or the walk gets there
+    int *words; // the word each chunk offset starts at
+    int *patches; // jump offset words, paired with the chunk offset they jump to
+    int patch_count;
+    int patch_capacity;
+    bool failed;
+} translator_t;
+
+static int register_emit(translator_t *t, const uint32_t word)
+{
+    register_code_t *code = t->code;
+    if (code->count == code->capacity) {
+        const int old_capacity = code->capacity;
+        code->capacity = GROW_CAPACITY(old_capacity);
+        code->code = GROW_ARRAY(uint32_t, code->code, old_capacity, code->capacity);
+        code->origins = GROW_ARRAY(int, code->origins, old_capacity, code->capacity);
+    }
+    code->code[code->count] = word;
+    code->origins[code->count] = t->origin;
+    return code->count++;
+}
+
+static void register_push(translator_t *t, const entry_kind_t kind, const int index)
+{
+    if (t->depth >= REGISTER_LIMIT) {
+        t->failed = true;
+        return;
+    }
+    t->stack[t->depth++] = (entry_t){kind, index};
+    if (t->depth > t->code->register_count)
+        t->code->register_count = t->depth;
+}
+
+// the position a result lands in
+static int register_push_result(translator_t *t)
+{
+    register_push(t, ENTRY_REGISTER, 0);
+    return t->depth - 1;
+}
+
+static void register_pop(translator_t *t, const int count)
+{
+    if (t->depth < count) {
+        t->failed = true;
+        return;
+    }
+    t->depth -= count;
+}
+
+static void register_materialize(translator_t *t, const int position)
+{
+    entry_t *entry = &t->stack[position];
+    switch (entry->kind) {
+        case ENTRY_REGISTER: return;
+        case ENTRY_ALIAS: register_emit(t, REG_ENCODE(REG_MOVE, position, entry->index, 0)); break;
+        case ENTRY_CONSTANT: register_emit(t, REG_ENCODE(REG_LOAD_CONSTANT, position, entry->index, 0)); break;
+        case ENTRY_NIL: register_emit(t, REG_ENCODE(REG_LOAD_NIL, position, 0, 0)); break;
+        case ENTRY_TRUE: register_emit(t, REG_ENCODE(REG_LOAD_BOOL, position, 1, 0)); break;
+        case ENTRY_FALSE: register_emit(t, REG_ENCODE(REG_LOAD_BOOL, position, 0, 0)); break;
+        default: t->failed = true; break;
+    }
+    *entry = (entry_t){ENTRY_REGISTER, 0};
+}
+
+// control flow only ever meets with every value in its own register
+static void register_materialize_from(translator_t *t, const int position)
+{
+    for (int i = position; i < t->depth; i++)
+        register_materialize(t, i);
+}
+
+// the register holding the value at a stack position
+static int register_operand(translator_t *t, const int position)
+{
+    if (position < 0 || position >= t->depth) {
+        t->failed = true;
+        return 0;
+    }
+    if (t->stack[position].kind == ENTRY_ALIAS)
+        return t->stack[position].index;
+    register_materialize(t, position);
+    return position;
+}
+
+// before a local is written everything still reading it through an alias gets its own copy
+static bool register_release(translator_t *t, const int local)
+{
+    bool released = false;
+    for (int i = 0; i < t->depth; i++) {
+        if (t->stack[i].kind == ENTRY_ALIAS && t->stack[i].index == local) {
+            register_materialize(t, i);
+            released = true;
+        }
+    }
+    return released;
+}
+
+static void register_get_local(translator_t *t, const int local)
+{
+    if (local >= t->depth) {
+        t->failed = true;
+        return;
+    }
+    const entry_t entry = t->stack[local];
+    if (entry.kind != ENTRY_REGISTER) {
+        register_push(t, entry.kind, entry.index);
+    } else if (t->captured[local]) {
+        const int position = register_push_result(t);
+        register_emit(t, REG_ENCODE(REG_MOVE, position, local, 0));
+    } else {
+        register_push(t, ENTRY_ALIAS, local);
+    }
+}
+
+// the top of the stack is written to a local, retargeting the instruction that just computed it when possible
+static void register_store(translator_t *t, const int local, const bool keep)
+{
+    const int top = t->depth - 1;
+    if (local >= top) {
+        t->failed = local > top;
+        register_materialize(t, top);
+        return;
+    }
+    const bool released = register_release(t, local);
+    const entry_t entry = t->stack[top];
+    const bool forward = !released && entry.kind == ENTRY_REGISTER && t->last_write >= 0 &&
+        t->last_write == t->code->count - 1 && (int)REG_A(t->code->code[t->last_write]) == top;
+    if (forward) {
+        uint32_t *word = &t->code->code[t->last_write];
+        *word = (*word & ~(uint32_t)0xff00) | ((uint32_t)local << 8);
+        t->stack[top] = (entry_t){ENTRY_ALIAS, local}; // the top register was never written
+    } else {
+        switch (entry.kind) {
+            case ENTRY_REGISTER: register_emit(t, REG_ENCODE(REG_MOVE, local, top, 0)); break;
+            case ENTRY_ALIAS: register_emit(t, REG_ENCODE(REG_MOVE, local, entry.index, 0)); break;
+            default: // a constant is loaded straight into the local
+                t->stack[local] = entry;
+                register_materialize(t, local);
+                break;
+        }
+    }
+    t->stack[local] = (entry_t){ENTRY_REGISTER, 0};
+    t->last_write = -1;
+    if (keep && t->captured[local]) // a closure may change it, the value left on the stack is a copy
+        register_materialize(t, top);
+}
+
+// the stack instruction after this one discards its result, both are dropped
+static bool register_pop_follows(translator_t *t, int *offset)
+{
+    const int next = *offset;
+    if (next >= t->chunk->count || t->targets[next] || t->chunk->code[next] != OP_POP)
+        return false;
+    *offset = next + 1;
+    return true;
+}
+
+// a local updated in place, the value left on the stack reads it back
+static void register_update_local(translator_t *t, const int local, const uint8_t op, const int operand)
+{
+    if (local >= t->depth) {
+        t->failed = true;
+        return;
+    }
+    const int source = register_operand(t, local);
+    register_release(t, local);
+    register_emit(t, REG_ENCODE(op, local, source, operand));
+    t->stack[local] = (entry_t){ENTRY_REGISTER, 0};
+    register_get_local(t, local);
+}
+
+static void register_jump(translator_t *t, const uint32_t word, const int target)
+{
+    register_emit(t, word);
+    if (t->patch_count + 2 > t->patch_capacity) {
+        const int old_capacity = t->patch_capacity;
+        t->patch_capacity = GROW_CAPACITY(old_capacity);
+        t->patches = GROW_ARRAY(int, t->patches, old_capacity, t->patch_capacity);
+    }
+    t->patches[t->patch_count++] = register_emit(t, 0);
+    t->patches[t->patch_count++] = target;
+    if (target < 0 || target > t->chunk->count) {
+        t->failed = true;
+    } else if (t->depths[target] < 0) {
+        t->depths[target] = t->depth;
+    } else if (t->depths[target] != t->depth) {
+        t->failed = true;
+    }
+}
+
+// the comparison of two stack values behind a fused jump, against a constant operand when there is one
+static void register_compare_jump(translator_t *t, const uint8_t kind, const int target)
+{
+    const int top = t->depth - 1;
+    if (top < 1) {
+        t->failed = true;
+        return;
+    }
+    const bool constant = t->stack[top].kind == ENTRY_CONSTANT;
+    const int a = register_operand(t, top - 1);
+    const int b = constant ? t->stack[top].index : register_operand(t, top);
+    register_pop(t, 2);
+    register_materialize_from(t, 0);
+    register_jump(t, REG_ENCODE(constant ? REG_JUMP_IF_K : REG_JUMP_IF, kind, a, b), target);
+}
+
+static void register_binary(translator_t *t, const uint8_t op, const uint8_t constant_op)
+{
+    const int top = t->depth - 1;
+    if (top < 1) {
+        t->failed = true;
+        return;
+    }
+    const bool constant = constant_op != INVALID_REG_OPCODE && t->stack[top].kind == ENTRY_CONSTANT;
+    const int a = register_operand(t, top - 1);
+    const int b = constant ? t->stack[top].index : register_operand(t, top);
+    register_pop(t, 2);
+    const int position = register_push_result(t);
+    t->last_write = register_emit(t, REG_ENCODE(constant ? constant_op : op, position, a, b));
+}
+
+static void register_unary(translator_t *t, const uint8_t op)
+{
+    const int value = register_operand(t, t->depth - 1);
+    register_pop(t, 1);
+    const int position = register_push_result(t);
+    t->last_write = register_emit(t, REG_ENCODE(op, position, value, 0));
+}
+
+// a call window: the values from base up are copied into their own registers and the result lands on base
+static int register_window(translator_t *t, const int count)
+{
+    const int base = t->depth - count;
+    if (base < 0) {
+        t->failed = true;
+        return 0;
+    }
+    register_materialize_from(t, base);
+    register_pop(t, count);
+    register_push_result(t);
+    return base;
+}
+
+// a store whose value stays on the stack in place of its operands
+static void register_leave_value(translator_t *t, const int operands, int *offset)
+{
+    const entry_t value = t->stack[t->depth - 1];
+    const int position = t->depth - operands;
+    const int from = value.kind == ENTRY_REGISTER ? position + operands - 1 : value.index;
+    register_pop(t, operands);
+    if (register_pop_follows(t, offset))
+        return;
+    if (value.kind != ENTRY_REGISTER && value.kind != ENTRY_ALIAS) {
+        register_push(t, value.kind, value.index);
+    } else if (from < position) {
+        register_push(t, ENTRY_ALIAS, from);
+    } else {
+        register_push_result(t);
+        if (from != position)
+            register_emit(t, REG_ENCODE(REG_MOVE, position, from, 0));
+    }
+}
+
+static uint8_t register_binary_op(const uint8_t op)
+{
+    switch (op) {
+        case OP_EQUAL: return REG_EQUAL;
+        case OP_GREATER: case OP_GREATER_NUM: return REG_GREATER;
+        case OP_LESS: case OP_LESS_NUM: return REG_LESS;
+        case OP_ADD: case OP_ADD_NUM: case OP_ADD_STR: return REG_ADD;
+        case OP_SUBTRACT: case OP_SUBTRACT_NUM: return REG_SUBTRACT;
+        case OP_MULTIPLY: return REG_MULTIPLY;
+        case OP_DIVIDE: return REG_DIVIDE;
+        case OP_MOD: return REG_MOD;
+        case OP_BITWISE_AND: return REG_BITWISE_AND;
+        case OP_BITWISE_OR: return REG_BITWISE_OR;
+        case OP_BITWISE_XOR: return REG_BITWISE_XOR;
+        case OP_SHIFT_LEFT: return REG_SHIFT_LEFT;
+        case OP_SHIFT_RIGHT: return REG_SHIFT_RIGHT;
+        default: return INVALID_REG_OPCODE;
+    }
+}
+
+// the constant operand form, in the same order as the register forms from REG_EQUAL
+static uint8_t register_constant_op(const uint8_t op)
+{
+    return op >= REG_EQUAL && op <= REG_MOD ? (uint8_t)(op - REG_EQUAL + REG_EQUAL_K) : INVALID_REG_OPCODE;
+}
+
+// jump targets and the locals closures capture, anything register code cannot express fails the translation
+static bool register_scan(translator_t *t)
+{
+    const chunk_t *chunk = t->chunk;
+    for (int offset = 0; offset < chunk->count;) {
+        const uint8_t *code = chunk->code + offset;
+        const int next = offset + chunk_t_instruction_length(chunk, offset);
+        int target = -1;
+        switch (code[0]) {
+            case OP_CONSTANT_LONG: case OP_WIDE: case OP_GET_SUPER: case OP_SUPER_INVOKE: case OP_TAIL_SUPER_INVOKE:
+            case OP_BUILD_LIST_LONG: case OP_BUILD_MAP_LONG: case OP_EXTEND_LIST: case OP_EXTEND_MAP:
+            case OP_SWITCH_TABLE: case OP_ASSERT:
+                return false;
+            case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_JUMP_IF_FALSE_POP: case OP_JUMP_IF_FALSE_OR_POP:
+            case OP_JUMP_IF_TRUE_OR_POP: case OP_JUMP_IF_NOT_LESS: case OP_JUMP_IF_NOT_GREATER:
+            case OP_JUMP_IF_NOT_EQUAL: case OP_JUMP_IF_LESS: case OP_JUMP_IF_GREATER: case OP_JUMP_IF_EQUAL:
+                target = next + ((code[1] << 8) | code[2]);
+                break;
+            case OP_LOOP: target = next - ((code[1] << 8) | code[2]); break;
+            case OP_JUMP_IF_LOCAL_CONST: case OP_JUMP_IF_LOCAL_LOCAL: target = next + ((code[4] << 8) | code[5]); break;
+            case OP_FOR_ITER: target = next + ((code[3] << 8) | code[4]); break;
+            case OP_CLOSURE:
+                for (int capture = offset + 2; capture < next; capture += 2) {
+                    if (chunk->code[capture])
+                        t->captured[chunk->code[capture + 1]] = true;
+                }
+                break;
+            default:
+                if (code[0] >= INVALID_OPCODE)
+                    return false;
+                break;
+        }
+        if (target >= 0) {
+            if (target > chunk->count)
+                return false;
+            t->targets[target] = true;
+        }
+        offset = next;
+    }
+    return true;
+}
+
+static void register_translate(translator_t *t)
+{
+    const chunk_t *chunk = t->chunk;
+    bool live = true;
+    for (int offset = 0; offset < chunk->count && !t->failed;) {
+        const uint8_t *code = chunk->code + offset;
+        const int next = offset + chunk_t_instruction_length(chunk, offset);
+        t->origin = offset;
+        if (t->targets[offset]) {
+            if (live) {
+                register_materialize_from(t, 0);
+                if (t->depths[offset] >= 0 && t->depths[offset] != t->depth) {
+                    t->failed = true;
+                    break;
+                }
+            } else if (t->depths[offset] >= 0) {
+                t->depth = t->depths[offset];
+            }
+            for (int i = 0; i < t->depth; i++)
+                t->stack[i] = (entry_t){ENTRY_REGISTER, 0};
+            t->depths[offset] = t->depth;
+            t->last_write = -1;
+            live = true;
+        }
+        t->words[offset] = t->code->count;
+        int after = next; // past anything this instruction folds in
+        const int top = t->depth - 1;
+        if (code[0] != OP_SET_LOCAL && code[0] != OP_SET_LOCAL_POP)
+            t->last_write = -1;
+        switch (code[0]) {
+            case OP_CONSTANT: register_push(t, ENTRY_CONSTANT, code[1]); break;
+            case OP_NIL: register_push(t, ENTRY_NIL, 0); break;
+            case OP_TRUE: register_push(t, ENTRY_TRUE, 0); break;
+            case OP_FALSE: register_push(t, ENTRY_FALSE, 0); break;
+            case OP_POP: register_pop(t, 1); break;
+            case OP_POPN: register_pop(t, code[1]); break;
+            case OP_DUP: case OP_DUP2: {
+                const int count = code[0] == OP_DUP ? 1 : 2;
+                if (top + 1 < count) {
+                    t->failed = true;
+                    break;
+                }
+                for (int i = top + 1 - count; i <= top; i++)
+                    register_get_local(t, i);
+                break;
+            }
+            case OP_GET_LOCAL: register_get_local(t, code[1]); break;
+            case OP_GET_LOCALS: register_get_local(t, code[1]); register_get_local(t, code[2]); break;
+            case OP_SET_LOCAL: register_store(t, code[1], true); break;
+            case OP_SET_LOCAL_POP: register_store(t, code[1], false); register_pop(t, 1); break;
+            case OP_GET_GLOBAL: {
+                const int position = register_push_result(t);
+                t->last_write = register_emit(t, REG_ENCODE(REG_GET_GLOBAL, position, code[1], 0));
+                break;
+            }
+            case OP_DEFINE_GLOBAL:
+                register_emit(t, REG_ENCODE(REG_DEFINE_GLOBAL, code[1], register_operand(t, top), 0));
+                register_pop(t, 1);
+                break;
+            case OP_SET_GLOBAL:
+                register_emit(t, REG_ENCODE(REG_SET_GLOBAL, code[1], register_operand(t, top), 0));
+                break;
+            case OP_GET_UPVALUE: {
+                const int position = register_push_result(t);
+                t->last_write = register_emit(t, REG_ENCODE(REG_GET_UPVALUE, position, code[1], 0));
+                break;
+            }
+            case OP_SET_UPVALUE:
+                register_emit(t, REG_ENCODE(REG_SET_UPVALUE, code[1], register_operand(t, top), 0));
+                break;
+            case OP_GET_PROPERTY: case OP_GET_PROPERTY_INSTANCE: {
+                const int object = register_operand(t, top);
+                register_pop(t, 1);
+                const int position = register_push_result(t);
+                t->last_write = register_emit(t, REG_ENCODE(REG_GET_PROPERTY, position, object, code[1]));
+                break;
+            }
+            case OP_SET_PROPERTY: {
+                const int object = register_operand(t, top - 1);
+                const int value = register_operand(t, top);
+                register_emit(t, REG_ENCODE(REG_SET_PROPERTY, object, code[1], value));
+                register_leave_value(t, 2, &after);
+                break;
+            }
+            case OP_EQUAL: case OP_GREATER: case OP_LESS: case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY:
+            case OP_DIVIDE: case OP_MOD: case OP_ADD_NUM: case OP_ADD_STR: case OP_SUBTRACT_NUM: case OP_LESS_NUM:
+            case OP_GREATER_NUM: case OP_BITWISE_AND: case OP_BITWISE_OR: case OP_BITWISE_XOR: case OP_SHIFT_LEFT:
+            case OP_SHIFT_RIGHT: {
+                const uint8_t op = register_binary_op(code[0]);
+                register_binary(t, op, register_constant_op(op));
+                break;
+            }
+            case OP_NOT: register_unary(t, REG_NOT); break;
+            case OP_NEGATE: register_unary(t, REG_NEGATE); break;
+            case OP_BITWISE_NOT: register_unary(t, REG_BITWISE_NOT); break;
+            case OP_PRINT: case OP_ERROR:
+                register_emit(t, REG_ENCODE(code[0] == OP_PRINT ? REG_PRINT : REG_ERROR, register_operand(t, top), 0, 0));
+                register_pop(t, 1);
+                break;
+            case OP_JUMP:
+                register_materialize_from(t, 0);
+                register_jump(t, REG_ENCODE(REG_JUMP, 0, 0, 0), next + ((code[1] << 8) | code[2]));
+                live = false;
+                break;
+            case OP_LOOP:
+                register_materialize_from(t, 0);
+                register_jump(t, REG_ENCODE(REG_JUMP, 0, 0, 0), next - ((code[1] << 8) | code[2]));
+                live = false;
+                break;
+            case OP_JUMP_IF_FALSE: case OP_JUMP_IF_FALSE_OR_POP: case OP_JUMP_IF_TRUE_OR_POP: {
+                // the value stays on the stack where it jumps to
+                register_materialize_from(t, 0);
+                const uint8_t op = code[0] == OP_JUMP_IF_TRUE_OR_POP ? REG_JUMP_IF_TRUE : REG_JUMP_IF_FALSE;
+                register_jump(t, REG_ENCODE(op, top, 0, 0), next + ((code[1] << 8) | code[2]));
+                if (code[0] != OP_JUMP_IF_FALSE)
+                    register_pop(t, 1);
+                break;
+            }
+            case OP_JUMP_IF_FALSE_POP: {
+                const int value = register_operand(t, top);
+                register_pop(t, 1);
+                register_materialize_from(t, 0);
+                register_jump(t, REG_ENCODE(REG_JUMP_IF_FALSE, value, 0, 0), next + ((code[1] << 8) | code[2]));
+                break;
+            }
+            case OP_JUMP_IF_NOT_LESS: case OP_JUMP_IF_NOT_GREATER: case OP_JUMP_IF_NOT_EQUAL: case OP_JUMP_IF_LESS:
+            case OP_JUMP_IF_GREATER: case OP_JUMP_IF_EQUAL:
+                register_compare_jump(t, code[0], next + ((code[1] << 8) | code[2]));
+                break;
+            case OP_JUMP_IF_LOCAL_CONST: case OP_JUMP_IF_LOCAL_LOCAL: {
+                register_materialize_from(t, 0);
+                const int a = register_operand(t, code[1]);
+                const bool constant = code[0] == OP_JUMP_IF_LOCAL_CONST;
+                const int b = constant ? code[2] : register_operand(t, code[2]);
+                register_jump(t, REG_ENCODE(constant ? REG_JUMP_IF_K : REG_JUMP_IF, code[3], a, b),
+                    next + ((code[4] << 8) | code[5]));
+                break;
+            }
+            case OP_CALL: case OP_TAIL_CALL: {
+                const int base = register_window(t, code[1] + 1);
+                register_emit(t, REG_ENCODE(code[0] == OP_CALL ? REG_CALL : REG_TAIL_CALL, base, code[1], 0));
+                break;
+            }
+            case OP_INVOKE: case OP_TAIL_INVOKE: {
+                const int base = register_window(t, code[2] + 1);
+                register_emit(t, REG_ENCODE(code[0] == OP_INVOKE ? REG_INVOKE : REG_TAIL_INVOKE, base, code[2], code[1]));
+                break;
+            }
+            case OP_CLOSURE: {
+                for (int capture = offset + 2; capture < next; capture += 2) {
+                    if (chunk->code[capture] && chunk->code[capture + 1] < t->depth)
+                        register_materialize(t, chunk->code[capture + 1]);
+                    else if (chunk->code[capture])
+                        t->failed = true;
+                }
+                const int position = register_push_result(t);
+                register_emit(t, REG_ENCODE(REG_CLOSURE, position, code[1], 0));
+                for (int capture = offset + 2; capture < next; capture += 2)
+                    register_emit(t, (uint32_t)chunk->code[capture] | ((uint32_t)chunk->code[capture + 1] << 8));
+                break;
+            }
+            case OP_CLOSE_UPVALUE: // closes from the captured register itself, never from an alias
+                register_materialize(t, top);
+                register_emit(t, REG_ENCODE(REG_CLOSE_UPVALUE, top, 0, 0));
+                register_pop(t, 1);
+                break;
+            case OP_RETURN: case OP_EXIT:
+                register_emit(t, REG_ENCODE(code[0] == OP_RETURN ? REG_RETURN : REG_EXIT, register_operand(t, top), 0, 0));
+                register_pop(t, 1);
+                live = false;
+                break;
+            case OP_TYPE: {
+                const int position = register_push_result(t);
+                register_emit(t, REG_ENCODE(REG_TYPE, position, code[1], 0));
+                break;
+            }
+            case OP_INHERIT:
+                register_emit(t, REG_ENCODE(REG_INHERIT, register_operand(t, top - 1), register_operand(t, top), 0));
+                register_pop(t, 1);
+                break;
+            case OP_METHOD: case OP_FIELD: {
+                const uint8_t op = code[0] == OP_METHOD ? REG_METHOD : REG_FIELD;
+                register_emit(t, REG_ENCODE(op, register_operand(t, top - 1), register_operand(t, top), code[1]));
+                register_pop(t, 1);
+                break;
+            }
+            case OP_GET_INDEX: {
+                const int container = register_operand(t, top - 1);
+                const int index = register_operand(t, top);
+                register_pop(t, 2);
+                const int position = register_push_result(t);
+                t->last_write = register_emit(t, REG_ENCODE(REG_GET_INDEX, position, container, index));
+                break;
+            }
+            case OP_SET_INDEX: // a window, subscript() may leave something other than the value
+                register_emit(t, REG_ENCODE(REG_SET_INDEX, register_window(t, 3), 0, 0));
+                break;
+            case OP_FOR_ITER: {
+                register_materialize_from(t, 0);
+                register_jump(t, REG_ENCODE(REG_FOR_ITER, code[1], code[2], t->depth), next + ((code[3] << 8) | code[4]));
+                for (int i = 0; i < code[2]; i++)
+                    register_push_result(t);
+                break;
+            }
+            case OP_BUILD_LIST: case OP_BUILD_MAP: {
+                const int count = code[0] == OP_BUILD_LIST ? code[1] : code[1] * 2;
+                const int base = register_window(t, count);
+                register_emit(t, REG_ENCODE(code[0] == OP_BUILD_LIST ? REG_BUILD_LIST : REG_BUILD_MAP, base, code[1], 0));
+                break;
+            }
+            case OP_COPY_LITERAL: register_unary(t, REG_COPY_LITERAL); break;
+            case OP_INC_LOCAL: register_update_local(t, code[1], REG_INCREMENT, code[2]); break;
+            case OP_ADD_LOCAL_CONST: register_update_local(t, code[1], REG_ADD_K, code[2]); break;
+            case OP_INC_UPVALUE: case OP_INC_GLOBAL: {
+                const int position = register_push_result(t);
+                const uint8_t op = code[0] == OP_INC_UPVALUE ? REG_INC_UPVALUE : REG_INC_GLOBAL;
+                register_emit(t, REG_ENCODE(op, position, code[1], code[2]));
+                break;
+            }
+            case OP_INC_PROPERTY: {
+                const int object = register_operand(t, top);
+                register_pop(t, 1);
+                const int position = register_push_result(t);
+                register_emit(t, REG_ENCODE(REG_INC_PROPERTY, position, object, code[1]));
+                register_emit(t, (uint32_t)(int32_t)(int8_t)code[2]);
+                break;
+            }
+            default:
+                t->failed = true;
+                break;
+        }
+        if (t->depth < 0)
+            t->failed = true;
+        offset = after;
+    }
+}
+
+// translate a function's chunk into register code on its first call, false leaves it to the stack loop
+bool compiler_t_registers(obj_function_t *function)
+{
+    function->registers_tried = true;
+    const chunk_t *chunk = &function->chunk;
+    if (function->arity + 1 > REGISTER_LIMIT || chunk->count == 0)
+        return false;
+
+    translator_t *t = ALLOCATE(translator_t, 1);
+    memset(t, 0, sizeof *t);
+    t->chunk = chunk;
+    t->last_write = -1;
+    t->targets = ALLOCATE(bool, chunk->count + 1);
+    t->depths = ALLOCATE(int, chunk->count + 1);
+    t->words = ALLOCATE(int, chunk->count + 1);
+    for (int i = 0; i <= chunk->count; i++) {
+        t->targets[i] = false;
+        t->depths[i] = -1;
+        t->words[i] = -1;
+    }
+    t->code = ALLOCATE(register_code_t, 1);
+    *t->code = (register_code_t){0, 0, NULL, NULL, 0};
+    t->depth = function->arity + 1; // the callee and its arguments
+    t->code->register_count = t->depth;
+    for (int i = 0; i < t->depth; i++)
+        t->stack[i] = (entry_t){ENTRY_REGISTER, 0};
+
+    t->failed = !register_scan(t);
+    if (!t->failed)
+        register_translate(t);
+    for (int i = 0; i < t->patch_count && !t->failed; i += 2) {
+        const int target = t->words[t->patches[i + 1]];
+        if (target < 0)
+            t->failed = true;
+        else
+            t->code->code[t->patches[i]] = (uint32_t)(int32_t)(target - (t->patches[i] + 1));
+    }
+
+    const bool translated = !t->failed;
+    if (translated)
+        function->registers = t->code;
+    else
+        register_code_t_free(t->code);
+    FREE_ARRAY(int, t->patches, t->patch_capacity);
+    FREE_ARRAY(int, t->words, chunk->count + 1);
+    FREE_ARRAY(int, t->depths, chunk->count + 1);
+    FREE_ARRAY(bool, t->targets, chunk->count + 1);
+    FREE(translator_t, t);
+    return translated;
+}
+#undef REGISTER_LIMIT
+
 void compiler_t_mark_roots(void)
 {
     compiler_t *compiler = current;
@@ -1533,6 +3256,11 @@ void compiler_t_mark_roots(void)
         obj_t_mark((obj_t*)compiler->function);
         compiler = compiler->enclosing;
     }
+    obj_t_mark((obj_t*)lazy_source);
 }
 #undef MAX_COMPILERS
+#undef MAX_OPERAND_PUSHES
 #undef MAX_PARAMETERS
+#undef MAX_LOCALS
+#undef MAX_WIDE_OPERAND
+#undef JUMP_ISLAND_DISTANCE
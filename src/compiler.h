@@ -24,5 +24,7 @@
 #include "vmopcodes.h"
 
 obj_function_t *compiler_t_compile(const char *source, const bool debug);
+bool compiler_t_compile_lazy(obj_function_t *function);
+bool compiler_t_registers(obj_function_t *function);
 void compiler_t_mark_roots(void);
 #endif
@@ -23,6 +23,60 @@
 #include "compiler.h"
 #include "scanner.h"
 
+static uint32_t wide_operand(const chunk_t *chunk, const int offset)
+{
+    return chunk->code[offset] | (chunk->code[offset + 1] << 8) | (chunk->code[offset + 2] << 16);
+}
+
+// OP_WIDE widens the first operand of the instruction after it to three bytes, jump distances from two
+static int wide_instruction_length(const chunk_t *chunk, const int offset)
+{
+    switch (chunk->code[offset + 1]) {
+        case OP_INVOKE: case OP_SUPER_INVOKE:
+        case OP_INC_LOCAL: case OP_INC_UPVALUE: case OP_INC_GLOBAL: case OP_INC_PROPERTY:
+            return 6;
+        case OP_FOR_ITER:
+            return 8;
+        case OP_CLOSURE:
+            return 5 + 4 * AS_FUNCTION(chunk->constants.values[wide_operand(chunk, offset + 2)])->upvalue_count;
+        default:
+            return 5;
+    }
+}
+
+// operand sizes without the printing, for passes that walk a chunk
+int chunk_t_instruction_length(const chunk_t *chunk, const int offset)
+{
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT: case OP_POPN: case OP_GET_LOCAL: case OP_SET_LOCAL:
+        case OP_GET_GLOBAL: case OP_DEFINE_GLOBAL: case OP_SET_GLOBAL: case OP_GET_UPVALUE: case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY: case OP_SET_PROPERTY: case OP_GET_SUPER: case OP_CALL: case OP_TAIL_CALL: case OP_TYPE:
+        case OP_GET_PROPERTY_INSTANCE: case OP_SET_LOCAL_POP:
+        case OP_METHOD: case OP_FIELD: case OP_BUILD_LIST: case OP_EXTEND_LIST: case OP_BUILD_MAP: case OP_EXTEND_MAP:
+            return 2;
+        case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_LOOP: case OP_INVOKE: case OP_SUPER_INVOKE: case OP_ASSERT:
+        case OP_TAIL_INVOKE: case OP_TAIL_SUPER_INVOKE:
+        case OP_JUMP_IF_FALSE_POP: case OP_JUMP_IF_FALSE_OR_POP: case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_NOT_LESS: case OP_JUMP_IF_NOT_GREATER: case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_LESS: case OP_JUMP_IF_GREATER: case OP_JUMP_IF_EQUAL:
+        case OP_INC_LOCAL: case OP_INC_UPVALUE: case OP_INC_GLOBAL: case OP_INC_PROPERTY: case OP_ADD_LOCAL_CONST:
+        case OP_GET_LOCALS:
+            return 3;
+        case OP_CONSTANT_LONG: case OP_SWITCH_TABLE:
+            return 4;
+        case OP_FOR_ITER: case OP_BUILD_LIST_LONG: case OP_BUILD_MAP_LONG:
+            return 5;
+        case OP_JUMP_IF_LOCAL_CONST: case OP_JUMP_IF_LOCAL_LOCAL:
+            return 6;
+        case OP_CLOSURE:
+            return 2 + 2 * AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]])->upvalue_count;
+        case OP_WIDE:
+            return wide_instruction_length(chunk, offset);
+        default:
+            return 1;
+    }
+}
+
 void chunk_t_disassemble(const chunk_t *chunk, const char *name)
 {
     printf(gettext("== start %s ==\n"), name);
@@ -79,18 +133,139 @@ static int jump_instruction(const char *name, const int sign, const chunk_t *chu
     return offset + 3;
 }
 
+static int for_iter_instruction(const char *name, const chunk_t *chunk, const int offset)
+{
+    assert(chunk->count > 0);
+    const uint8_t slot = chunk->code[offset + 1];
+    const uint8_t vars = chunk->code[offset + 2];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+    jump |= chunk->code[offset + 4];
+    printf("%-16s %4d %d %4d -> %d\n", name, slot, vars, offset, offset + 5 + jump);
+    return offset + 5;
+}
+
+static int build_long_instruction(const char *name, const chunk_t *chunk, const int offset)
+{
+    assert(chunk->count > 0);
+    const uint32_t total = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8) | (chunk->code[offset + 3] << 16);
+    const uint8_t count = chunk->code[offset + 4];
+    printf("%-16s %4d of %d\n", name, count, total);
+    return offset + 5;
+}
+
+static int compare_jump_instruction(const char *name, const chunk_t *chunk, const int offset)
+{
+    assert(chunk->count > 0);
+    const uint8_t slot = chunk->code[offset + 1];
+    const uint8_t operand = chunk->code[offset + 2];
+    const uint8_t kind = chunk->code[offset + 3];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 4] << 8);
+    jump |= chunk->code[offset + 5];
+    printf("%-16s %4d %4d %s %4d -> %d\n", name, slot, operand, op_code_name[kind], offset, offset + 6 + jump);
+    return offset + 6;
+}
+
+static int increment_instruction(const char *name, const chunk_t *chunk, const int offset, const bool named)
+{
+    assert(chunk->count > 0);
+    const uint8_t operand = chunk->code[offset + 1];
+    const int8_t delta = (int8_t)chunk->code[offset + 2];
+    printf("%-16s %4d ", name, operand);
+    if (named) {
+        printf("'");
+        value_t_print(stdout, chunk->constants.values[operand]);
+        printf("' ");
+    }
+    printf("%+d\n", delta);
+    return offset + 3;
+}
+
+static int locals_instruction(const char *name, const chunk_t *chunk, const int offset)
+{
+    assert(chunk->count > 0);
+    printf("%-16s %4d %4d\n", name, chunk->code[offset + 1], chunk->code[offset + 2]);
+    return offset + 3;
+}
+
+static int add_constant_instruction(const char *name, const chunk_t *chunk, const int offset)
+{
+    assert(chunk->count > 0);
+    const uint8_t slot = chunk->code[offset + 1];
+    const uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    value_t_print(stdout, chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+static int switch_table_instruction(const char *name, const chunk_t *chunk, const int offset)
+{
+    assert(chunk->count > 0);
+    const uint8_t constant = chunk->code[offset + 1];
+    uint16_t otherwise = (uint16_t)(chunk->code[offset + 2] << 8);
+    otherwise |= chunk->code[offset + 3];
+    obj_map_t *targets = AS_MAP(chunk->constants.values[constant]);
+    printf("%-16s %4d (%d cases) default -> %d\n", name, constant, obj_map_t_count(targets), offset + 4 + otherwise);
+    int cursor = 0;
+    value_t label, target;
+    while (obj_map_t_next(targets, &cursor, &label, &target)) {
+        printf("%04d      |                     ", offset);
+        value_t_print(stdout, label);
+        printf(" -> %d\n", offset + 4 + (int)AS_NUMBER(target));
+    }
+    return offset + 4;
+}
+
 static int long_constant_instruction(const char *name, const chunk_t *chunk, const int offset)
 {
     assert(chunk->count > 0);
     const uint32_t constant = chunk->code[offset + 1] |
         (chunk->code[offset + 2] << 8) |
         (chunk->code[offset + 3] << 16);
-    printf("%-16s %4ud '", name, constant);
+    printf("%-16s %4u '", name, constant);
     value_t_print(stdout, chunk->constants.values[constant]);
     printf("'\n");
     return offset + 4;
 }
 
+static int wide_instruction(const char *name, const chunk_t *chunk, const int offset)
+{
+    assert(chunk->count > 0);
+    const uint8_t instruction = chunk->code[offset + 1];
+    const uint32_t operand = wide_operand(chunk, offset + 2);
+    printf("%s %-16s %4u", name, op_code_name[instruction], operand);
+    switch (instruction) {
+        case OP_JUMP: printf(" -> %u\n", offset + 5 + operand); break;
+        case OP_LOOP: printf(" -> %u\n", offset + 5 - operand); break;
+        case OP_GET_LOCAL: case OP_SET_LOCAL: case OP_GET_UPVALUE: case OP_SET_UPVALUE: printf("\n"); break;
+        case OP_INC_LOCAL: case OP_INC_UPVALUE: printf(" %+d\n", (int8_t)chunk->code[offset + 5]); break;
+        case OP_FOR_ITER: {
+            const uint16_t jump = (uint16_t)((chunk->code[offset + 6] << 8) | chunk->code[offset + 7]);
+            printf(" %d -> %d\n", chunk->code[offset + 5], offset + 8 + jump);
+            break;
+        }
+        default:
+            printf(" '");
+            value_t_print(stdout, chunk->constants.values[operand]);
+            printf("'");
+            if (instruction == OP_INVOKE || instruction == OP_SUPER_INVOKE)
+                printf(" (%d args)", chunk->code[offset + 5]);
+            else if (instruction == OP_INC_GLOBAL || instruction == OP_INC_PROPERTY)
+                printf(" %+d", (int8_t)chunk->code[offset + 5]);
+            printf("\n");
+            break;
+    }
+    if (instruction == OP_CLOSURE) {
+        const obj_function_t *function = AS_FUNCTION(chunk->constants.values[operand]);
+        for (int j = 0; j < function->upvalue_count; j++) {
+            const int capture = offset + 5 + 4 * j;
+            printf("%04d      |                     %s %u\n", capture, chunk->code[capture] ? "local" : "upvalue",
+                wide_operand(chunk, capture + 1));
+        }
+    }
+    return offset + wide_instruction_length(chunk, offset);
+}
+
 int chunk_t_disassemble_instruction(const chunk_t *chunk, int offset)
 {
     printf("%04d ", offset);
@@ -169,9 +344,187 @@ int chunk_t_disassemble_instruction(const chunk_t *chunk, int offset)
         case OP_CONSTANT_LONG: return long_constant_instruction(op_code_name[instruction], chunk, offset);
         case OP_POPN: return byte_instruction(op_code_name[instruction], chunk, offset);
         case OP_DUP: return simple_instruction(op_code_name[instruction], offset);
+        case OP_DUP2: return simple_instruction(op_code_name[instruction], offset);
+        case OP_GET_INDEX: return simple_instruction(op_code_name[instruction], offset);
+        case OP_SET_INDEX: return simple_instruction(op_code_name[instruction], offset);
+        case OP_FOR_ITER: return for_iter_instruction(op_code_name[instruction], chunk, offset);
+        case OP_BUILD_LIST: return byte_instruction(op_code_name[instruction], chunk, offset);
+        case OP_BUILD_LIST_LONG: return build_long_instruction(op_code_name[instruction], chunk, offset);
+        case OP_EXTEND_LIST: return byte_instruction(op_code_name[instruction], chunk, offset);
+        case OP_BUILD_MAP: return byte_instruction(op_code_name[instruction], chunk, offset);
+        case OP_BUILD_MAP_LONG: return build_long_instruction(op_code_name[instruction], chunk, offset);
+        case OP_EXTEND_MAP: return byte_instruction(op_code_name[instruction], chunk, offset);
+        case OP_COPY_LITERAL: return simple_instruction(op_code_name[instruction], offset);
+        case OP_JUMP_IF_FALSE_POP:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_EQUAL: return jump_instruction(op_code_name[instruction], 1, chunk, offset);
+        case OP_JUMP_IF_LOCAL_CONST:
+        case OP_JUMP_IF_LOCAL_LOCAL: return compare_jump_instruction(op_code_name[instruction], chunk, offset);
+        case OP_INC_LOCAL:
+        case OP_INC_UPVALUE: return increment_instruction(op_code_name[instruction], chunk, offset, false);
+        case OP_INC_GLOBAL:
+        case OP_INC_PROPERTY: return increment_instruction(op_code_name[instruction], chunk, offset, true);
+        case OP_ADD_LOCAL_CONST: return add_constant_instruction(op_code_name[instruction], chunk, offset);
+        case OP_SWITCH_TABLE: return switch_table_instruction(op_code_name[instruction], chunk, offset);
+        case OP_TAIL_CALL: return byte_instruction(op_code_name[instruction], chunk, offset);
+        case OP_TAIL_INVOKE: return invoke_instruction(op_code_name[instruction], chunk, offset);
+        case OP_TAIL_SUPER_INVOKE: return invoke_instruction(op_code_name[instruction], chunk, offset);
+        case OP_WIDE: return wide_instruction(op_code_name[instruction], chunk, offset);
+        // quickened by the vm in place of the generic instruction
+        case OP_ADD_NUM:
+        case OP_ADD_STR:
+        case OP_SUBTRACT_NUM:
+        case OP_LESS_NUM:
+        case OP_GREATER_NUM: return simple_instruction(op_code_name[instruction], offset);
+        case OP_GET_PROPERTY_INSTANCE: return constant_instruction(op_code_name[instruction], chunk, offset);
+        case OP_GET_LOCALS: return locals_instruction(op_code_name[instruction], chunk, offset);
+        case OP_SET_LOCAL_POP: return byte_instruction(op_code_name[instruction], chunk, offset);
         default: {
             printf(gettext("Unknown opcode %d\n"), instruction);
             return offset + 1;
         }
     }
 }
+
+static void register_constant(const chunk_t *chunk, const int constant)
+{
+    printf("%4d '", constant);
+    value_t_print(stdout, chunk->constants.values[constant]);
+    printf("'");
+}
+
+// jumps keep their distance in the word after them
+static int register_jump_target(const register_code_t *code, const int index)
+{
+    return index + 2 + (int32_t)code->code[index + 1];
+}
+
+int register_code_t_disassemble_instruction(const obj_function_t *function, const int index)
+{
+    const register_code_t *code = function->registers;
+    const chunk_t *chunk = &function->chunk;
+    const uint32_t word = code->code[index];
+    const int a = REG_A(word);
+    const int b = REG_B(word);
+    const int c = REG_C(word);
+    printf("%04d ", index);
+    const int line = chunk_t_get_line(chunk, code->origins[index]);
+    if (index > 0 && line == chunk_t_get_line(chunk, code->origins[index - 1]))
+        printf("     | ");
+    else
+        printf("%4d ", line);
+    printf("%-18s ", reg_op_code_name[REG_OP(word)]);
+
+    switch (REG_OP(word)) {
+        case REG_MOVE: case REG_NOT: case REG_NEGATE: case REG_BITWISE_NOT: case REG_COPY_LITERAL: case REG_INHERIT:
+            printf("r%d r%d\n", a, b);
+            return index + 1;
+        case REG_LOAD_CONSTANT: case REG_GET_GLOBAL: case REG_TYPE:
+            printf("r%d ", a);
+            register_constant(chunk, b);
+            printf("\n");
+            return index + 1;
+        case REG_LOAD_NIL: case REG_PRINT: case REG_ERROR: case REG_CLOSE_UPVALUE: case REG_RETURN: case REG_EXIT:
+        case REG_SET_INDEX:
+            printf("r%d\n", a);
+            return index + 1;
+        case REG_LOAD_BOOL:
+            printf("r%d %s\n", a, b ? "true" : "false");
+            return index + 1;
+        case REG_DEFINE_GLOBAL: case REG_SET_GLOBAL:
+            register_constant(chunk, a);
+            printf(" r%d\n", b);
+            return index + 1;
+        case REG_GET_UPVALUE:
+            printf("r%d u%d\n", a, b);
+            return index + 1;
+        case REG_SET_UPVALUE:
+            printf("u%d r%d\n", a, b);
+            return index + 1;
+        case REG_SET_PROPERTY:
+            printf("r%d ", a);
+            register_constant(chunk, b);
+            printf(" r%d\n", c);
+            return index + 1;
+        case REG_GET_PROPERTY: case REG_METHOD: case REG_FIELD:
+        case REG_EQUAL_K: case REG_GREATER_K: case REG_LESS_K: case REG_ADD_K: case REG_SUBTRACT_K:
+        case REG_MULTIPLY_K: case REG_DIVIDE_K: case REG_MOD_K:
+            printf("r%d r%d ", a, b);
+            register_constant(chunk, c);
+            printf("\n");
+            return index + 1;
+        case REG_INCREMENT:
+            printf("r%d r%d %+d\n", a, b, (int8_t)c);
+            return index + 1;
+        case REG_INC_UPVALUE:
+            printf("r%d u%d %+d\n", a, b, (int8_t)c);
+            return index + 1;
+        case REG_INC_GLOBAL:
+            printf("r%d ", a);
+            register_constant(chunk, b);
+            printf(" %+d\n", (int8_t)c);
+            return index + 1;
+        case REG_INC_PROPERTY:
+            printf("r%d r%d ", a, b);
+            register_constant(chunk, c);
+            printf(" %+d\n", (int32_t)code->code[index + 1]);
+            return index + 2;
+        case REG_JUMP:
+            printf("-> %d\n", register_jump_target(code, index));
+            return index + 2;
+        case REG_JUMP_IF_FALSE: case REG_JUMP_IF_TRUE:
+            printf("r%d -> %d\n", a, register_jump_target(code, index));
+            return index + 2;
+        case REG_JUMP_IF:
+            printf("%s r%d r%d -> %d\n", op_code_name[a], b, c, register_jump_target(code, index));
+            return index + 2;
+        case REG_JUMP_IF_K:
+            printf("%s r%d ", op_code_name[a], b);
+            register_constant(chunk, c);
+            printf(" -> %d\n", register_jump_target(code, index));
+            return index + 2;
+        case REG_FOR_ITER:
+            printf("r%d %d r%d -> %d\n", a, b, c, register_jump_target(code, index));
+            return index + 2;
+        case REG_CALL: case REG_TAIL_CALL:
+            printf("r%d (%d args)\n", a, b);
+            return index + 1;
+        case REG_INVOKE: case REG_TAIL_INVOKE:
+            printf("r%d ", a);
+            register_constant(chunk, c);
+            printf(" (%d args)\n", b);
+            return index + 1;
+        case REG_BUILD_LIST: case REG_BUILD_MAP:
+            printf("r%d %d\n", a, b);
+            return index + 1;
+        case REG_CLOSURE: {
+            printf("r%d ", a);
+            register_constant(chunk, b);
+            printf("\n");
+            const int captures = AS_FUNCTION(chunk->constants.values[b])->upvalue_count;
+            for (int j = 1; j <= captures; j++) {
+                const uint32_t capture = code->code[index + j];
+                printf("%04d      |                     %s %u\n", index + j, capture & 0xff ? "local" : "upvalue", capture >> 8);
+            }
+            return index + 1 + captures;
+        }
+        default:
+            printf("r%d r%d r%d\n", a, b, c);
+            return index + 1;
+    }
+}
+
+void register_code_t_disassemble(const obj_function_t *function)
+{
+    const char *name = function->name != NULL ? function->name->chars : "<main>";
+    printf(gettext("== start registers %s (%d registers) ==\n"), name, function->registers->register_count);
+    for (int index = 0; index < function->registers->count;)
+        index = register_code_t_disassemble_instruction(function, index);
+    printf(gettext("==   end registers %s ==\n"), name);
+}
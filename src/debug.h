@@ -24,5 +24,8 @@
 
 void chunk_t_disassemble(const chunk_t *chunk, const char *name);
 int chunk_t_disassemble_instruction(const chunk_t *chunk, int offset);
+int chunk_t_instruction_length(const chunk_t *chunk, const int offset);
+void register_code_t_disassemble(const obj_function_t *function);
+int register_code_t_disassemble_instruction(const obj_function_t *function, const int index);
 
 #endif
@@ -33,6 +33,7 @@
 
 #define TATER_PROMPT "tater> "
 #define TATER_HISTORY_FILE ".tater_history"
+#define TATER_CACHE_SUFFIX "c" // script.tot is cached as script.totc
 
 static void completion(const char *input, linenoiseCompletions *completions)
 {
@@ -176,10 +177,15 @@ static char *read_file(const char *file_path)
     return buffer;
 }
 
-static int run_file(const char *file_path)
+static int run_file(const char *file_path, const bool cache)
 {
     char *source = read_file(file_path);
-    vm_t_interpret_result_t r = vm_t_interpret(source);
+    vm_t_interpret_result_t r;
+    char cache_path[PATH_MAX];
+    if (cache && snprintf(cache_path, sizeof cache_path, "%s%s", file_path, TATER_CACHE_SUFFIX) < (int)sizeof cache_path)
+        r = vm_t_interpret_cached(source, file_path, cache_path);
+    else
+        r = vm_t_interpret(source);
     free(source);
     switch (r) {
         case INTERPRET_OK:
@@ -212,32 +218,54 @@ static void version(const char *name)
 static void help(const char *name)
 {
     printf(gettext("Usage: %s [options] [path | -]\n"), name);
+    printf("  -c, %s\n", gettext("Disable the compiled bytecode cache"));
     printf("  -d, %s\n", gettext("Enable debugging"));
+    printf("  -l, %s\n", gettext("Compile function bodies on their first call"));
+    printf("  -O0, -O1, %s\n", gettext("Disable or enable bytecode optimization (default -O1)"));
+    printf("  -r, %s\n", gettext("Run functions as register code where they translate"));
     printf("  -s, %s\n", gettext("Enable garbage collector stress testing"));
     printf("  -t, %s\n", gettext("Enable garbage collector tracing"));
     printf("  -v, %s\n", gettext("Show version"));
     printf("  -h, %s\n", gettext("This help"));
 }
 
+#define CACHE_OPT 'c'
 #define HELP_OPT 'h'
 #define VERSION_OPT 'v'
 #define DEBUG_OPT 'd'
+#define LAZY_OPT 'l'
 #define GC_STRESS_OPT 's'
 #define GC_TRACE_OPT 't'
+#define OPTIMIZE_OPT 'O'
+#define REGISTERS_OPT 'r'
 
 int main(const int argc, const char *argv[])
 {
     bool debug = false;
     bool gc_trace = false;
     bool gc_stress = false;
+    bool optimize = true;
+    bool cache = true;
+    bool lazy = false;
+    bool registers = false;
 
     opterr = 0; // silence warnings
     int option = -1;
-    while((option = getopt(argc, (char **)argv, "+dtsvh")) != -1) {
+    while((option = getopt(argc, (char **)argv, "+cdlrtsvhO:")) != -1) {
         switch (option) {
+            case CACHE_OPT: cache = false; break;
             case DEBUG_OPT: debug = true; break;
+            case LAZY_OPT: lazy = true; break;
+            case REGISTERS_OPT: registers = true; break;
             case GC_TRACE_OPT: gc_trace = true; break;
             case GC_STRESS_OPT: gc_stress = true; break;
+            case OPTIMIZE_OPT:
+                if (strcmp(optarg, "0") != 0 && strcmp(optarg, "1") != 0) {
+                    help(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                optimize = optarg[0] == '1';
+                break;
             case VERSION_OPT: version(argv[0]); return EXIT_SUCCESS;
             case HELP_OPT: help(argv[0]); return EXIT_SUCCESS;
             default: help(argv[0]); return EXIT_FAILURE;
@@ -248,6 +276,9 @@ int main(const int argc, const char *argv[])
     if (debug) vm_toggle_stack_trace();
     if (gc_trace) vm_toggle_gc_trace();
     if (gc_stress) vm_toggle_gc_stress();
+    if (!optimize) vm_toggle_optimize();
+    if (lazy) vm_toggle_lazy_compile();
+    if (registers) vm_toggle_registers();
 
     int rv = 0;
     if (optind == argc) { // no args
@@ -257,7 +288,7 @@ int main(const int argc, const char *argv[])
     } else {
         vm_set_argc_argv(argc - optind, argv + optind);
         vm_inherit_env();
-        rv = run_file(argv[optind]);
+        rv = run_file(argv[optind], cache && !debug); // debugging wants the compiler's disassembly
     }
 
     vm_t_free();
@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2022-2024 Jason Woodward <woodwardj at jaos dot org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+#include "common.h"
+#include "number.h"
+
+// Grisu3 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers"):
+// shortest digits that round trip, using a 64 bit significand and cached powers of ten, with an exact fallback
+typedef struct {
+    uint64_t f;
+    int e;
+} diy_fp_t;
+
+#define DP_SIGNIFICAND_MASK 0x000fffffffffffffull
+#define DP_HIDDEN_BIT 0x0010000000000000ull
+#define DP_EXPONENT_BIAS (0x3ff + 52)
+
+// 10^k for k = -348, -340, ..., 340
+static const diy_fp_t cached_powers[] = {
+    {0xfa8fd5a0081c0288ull, -1220}, {0xbaaee17fa23ebf76ull, -1193}, {0x8b16fb203055ac76ull, -1166},
+    {0xcf42894a5dce35eaull, -1140}, {0x9a6bb0aa55653b2dull, -1113}, {0xe61acf033d1a45dfull, -1087},
+    {0xab70fe17c79ac6caull, -1060}, {0xff77b1fcbebcdc4full, -1034}, {0xbe5691ef416bd60cull, -1007},
+    {0x8dd01fad907ffc3cull, -980}, {0xd3515c2831559a83ull, -954}, {0x9d71ac8fada6c9b5ull, -927},
+    {0xea9c227723ee8bcbull, -901}, {0xaecc49914078536dull, -874}, {0x823c12795db6ce57ull, -847},
+    {0xc21094364dfb5637ull, -821}, {0x9096ea6f3848984full, -794}, {0xd77485cb25823ac7ull, -768},
+    {0xa086cfcd97bf97f4ull, -741}, {0xef340a98172aace5ull, -715}, {0xb23867fb2a35b28eull, -688},
+    {0x84c8d4dfd2c63f3bull, -661}, {0xc5dd44271ad3cdbaull, -635}, {0x936b9fcebb25c996ull, -608},
+    {0xdbac6c247d62a584ull, -582}, {0xa3ab66580d5fdaf6ull, -555}, {0xf3e2f893dec3f126ull, -529},
+    {0xb5b5ada8aaff80b8ull, -502}, {0x87625f056c7c4a8bull, -475}, {0xc9bcff6034c13053ull, -449},
+    {0x964e858c91ba2655ull, -422}, {0xdff9772470297ebdull, -396}, {0xa6dfbd9fb8e5b88full, -369},
+    {0xf8a95fcf88747d94ull, -343}, {0xb94470938fa89bcfull, -316}, {0x8a08f0f8bf0f156bull, -289},
+    {0xcdb02555653131b6ull, -263}, {0x993fe2c6d07b7facull, -236}, {0xe45c10c42a2b3b06ull, -210},
+    {0xaa242499697392d3ull, -183}, {0xfd87b5f28300ca0eull, -157}, {0xbce5086492111aebull, -130},
+    {0x8cbccc096f5088ccull, -103}, {0xd1b71758e219652cull, -77}, {0x9c40000000000000ull, -50},
+    {0xe8d4a51000000000ull, -24}, {0xad78ebc5ac620000ull, 3}, {0x813f3978f8940984ull, 30},
+    {0xc097ce7bc90715b3ull, 56}, {0x8f7e32ce7bea5c70ull, 83}, {0xd5d238a4abe98068ull, 109},
+    {0x9f4f2726179a2245ull, 136}, {0xed63a231d4c4fb27ull, 162}, {0xb0de65388cc8ada8ull, 189},
+    {0x83c7088e1aab65dbull, 216}, {0xc45d1df942711d9aull, 242}, {0x924d692ca61be758ull, 269},
+    {0xda01ee641a708deaull, 295}, {0xa26da3999aef774aull, 322}, {0xf209787bb47d6b85ull, 348},
+    {0xb454e4a179dd1877ull, 375}, {0x865b86925b9bc5c2ull, 402}, {0xc83553c5c8965d3dull, 428},
+    {0x952ab45cfa97a0b3ull, 455}, {0xde469fbd99a05fe3ull, 481}, {0xa59bc234db398c25ull, 508},
+    {0xf6c69a72a3989f5cull, 534}, {0xb7dcbf5354e9beceull, 561}, {0x88fcf317f22241e2ull, 588},
+    {0xcc20ce9bd35c78a5ull, 614}, {0x98165af37b2153dfull, 641}, {0xe2a0b5dc971f303aull, 667},
+    {0xa8d9d1535ce3b396ull, 694}, {0xfb9b7cd9a4a7443cull, 720}, {0xbb764c4ca7a44410ull, 747},
+    {0x8bab8eefb6409c1aull, 774}, {0xd01fef10a657842cull, 800}, {0x9b10a4e5e9913129ull, 827},
+    {0xe7109bfba19c0c9dull, 853}, {0xac2820d9623bf429ull, 880}, {0x80444b5e7aa7cf85ull, 907},
+    {0xbf21e44003acdd2dull, 933}, {0x8e679c2f5e44ff8full, 960}, {0xd433179d9c8cb841ull, 986},
+    {0x9e19db92b4e31ba9ull, 1013}, {0xeb96bf6ebadf77d9ull, 1039}, {0xaf87023b9bf0ee6bull, 1066},
+};
+
+static const uint64_t pow10_u64[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull,
+    10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull, 100000000000000ull,
+    1000000000000000ull, 10000000000000000ull, 100000000000000000ull, 1000000000000000000ull,
+    10000000000000000000ull,
+};
+
+static diy_fp_t diy_fp_multiply(const diy_fp_t x, const diy_fp_t y)
+{
+    const uint64_t m32 = 0xffffffffull;
+    const uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    const uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+    tmp += 1ull << 31; // round
+    return (diy_fp_t){ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+}
+
+static diy_fp_t diy_fp_normalize(diy_fp_t x)
+{
+    while (!(x.f & (1ull << 63))) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+// step the last digit down toward w while that stays inside the interval, then only accept the digits when the
+// rounding is safe for every value the one unit imprecision of the products allows
+static bool round_weed(char *buffer, const int length, const uint64_t distance_too_high_w, const uint64_t unsafe_interval,
+    uint64_t rest, const uint64_t ten_kappa, const uint64_t unit)
+{
+    const uint64_t small_distance = distance_too_high_w - unit;
+    const uint64_t big_distance = distance_too_high_w + unit;
+    while (rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)) {
+        buffer[length - 1]--;
+        rest += ten_kappa;
+    }
+    if (rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance))
+        return false;
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+static int count_digits(const uint32_t n)
+{
+    int digits = 1;
+    for (uint32_t limit = 10; digits < 10 && n >= limit; limit *= 10)
+        digits++;
+    return digits;
+}
+
+// false for the few doubles (about 0.5%) whose shortest digits can't be proven with 64 bit integers
+static bool grisu3(const double value, char *buffer, int *length, int *k)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const int biased_e = (int)((bits >> 52) & 0x7ff);
+    const uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+    const diy_fp_t v = biased_e != 0
+        ? (diy_fp_t){significand + DP_HIDDEN_BIT, biased_e - DP_EXPONENT_BIAS}
+        : (diy_fp_t){significand, 1 - DP_EXPONENT_BIAS};
+
+    // the boundaries halfway to the neighbouring doubles
+    diy_fp_t plus = {(v.f << 1) + 1, v.e - 1};
+    while (!(plus.f & (DP_HIDDEN_BIT << 1))) {
+        plus.f <<= 1;
+        plus.e--;
+    }
+    plus.f <<= 10;
+    plus.e -= 10;
+    diy_fp_t minus = v.f == DP_HIDDEN_BIT ? (diy_fp_t){(v.f << 2) - 1, v.e - 2} : (diy_fp_t){(v.f << 1) - 1, v.e - 1};
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    // scale into the range where the digits can be generated with 64 bit integers
+    const double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    int cached_k = (int)dk;
+    if (dk - cached_k > 0.0)
+        cached_k++;
+    const unsigned index = (unsigned)((cached_k >> 3) + 1);
+    *k = -(-348 + (int)(index << 3));
+    const diy_fp_t c_mk = cached_powers[index];
+
+    const diy_fp_t w = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+    const diy_fp_t wp = diy_fp_multiply(plus, c_mk);
+    const diy_fp_t wm = diy_fp_multiply(minus, c_mk);
+
+    // each product is within a unit of the exact one, so digits are generated for the widest interval it could be
+    uint64_t unit = 1;
+    const uint64_t too_high = wp.f + unit;
+    uint64_t unsafe_interval = too_high - (wm.f - unit);
+    const int shift = -w.e;
+    const uint64_t one = 1ull << shift;
+    uint32_t p1 = (uint32_t)(too_high >> shift);
+    uint64_t p2 = too_high & (one - 1);
+    int kappa = count_digits(p1);
+    *length = 0;
+
+    while (kappa > 0) {
+        const uint32_t divisor = (uint32_t)pow10_u64[kappa - 1];
+        buffer[(*length)++] = (char)('0' + p1 / divisor);
+        p1 %= divisor;
+        kappa--;
+        const uint64_t rest = ((uint64_t)p1 << shift) + p2;
+        if (rest < unsafe_interval) {
+            *k += kappa;
+            return round_weed(buffer, *length, too_high - w.f, unsafe_interval, rest, (uint64_t)divisor << shift, unit);
+        }
+    }
+
+    for (;;) {
+        p2 *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+        buffer[(*length)++] = (char)('0' + (p2 >> shift));
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < unsafe_interval) {
+            *k += kappa;
+            return round_weed(buffer, *length, (too_high - w.f) * unit, unsafe_interval, p2, one, unit);
+        }
+    }
+}
+
+// the digits of printf's correctly rounded output, %.*e is d.ddde[+-]x
+static int printed_digits(const double value, const int precision, char *buffer, int *k)
+{
+    char printed[40];
+    snprintf(printed, sizeof printed, "%.*e", precision - 1, value);
+    int length = 0;
+    const char *p = printed;
+    for (; *p != 'e'; p++) {
+        if (*p != '.')
+            buffer[length++] = *p;
+    }
+    *k = atoi(p + 1) - (length - 1);
+    return length;
+}
+
+static bool digits_round_trip(const char *digits, const int length, const int k, const double value)
+{
+    char printed[40];
+    snprintf(printed, sizeof printed, "%.*se%d", length, digits, k);
+    return strtod(printed, NULL) == value;
+}
+
+// the nearest decimal with this many digits, or failing that the next one up, when it reads back as the same double:
+// at a power of two the gap below is half the one above, so the nearest can miss while the one above still fits
+static int round_trip_digits(const double value, const int precision, char *buffer, int *k)
+{
+    const int length = printed_digits(value, precision, buffer, k);
+    if (digits_round_trip(buffer, length, *k, value))
+        return length;
+    char up[18];
+    memcpy(up, buffer, (size_t)length);
+    int up_k = *k;
+    int i = length - 1;
+    while (i >= 0 && up[i] == '9')
+        up[i--] = '0';
+    if (i < 0) {
+        up[0] = '1';
+        up_k++;
+    } else {
+        up[i]++;
+    }
+    if (!digits_round_trip(up, length, up_k, value))
+        return 0;
+    int up_length = length;
+    while (up_length > 1 && up[up_length - 1] == '0') {
+        up_length--;
+        up_k++;
+    }
+    memcpy(buffer, up, (size_t)up_length);
+    *k = up_k;
+    return up_length;
+}
+
+// the exact fallback for what Grisu3 rejects: a precision that reads back still does with one more digit, so the
+// fewest digits are a binary search away
+static int shortest_exact(const double value, char *buffer, int *k)
+{
+    int low = 1, high = 17;
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        if (round_trip_digits(value, middle, buffer, k))
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return round_trip_digits(value, low, buffer, k);
+}
+
+static int format_integer(uint64_t n, char *buffer)
+{
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+    for (int i = 0; i < count; i++)
+        buffer[i] = digits[count - 1 - i];
+    return count;
+}
+
+// %.17g layout: positional for exponents -4 through 16, scientific otherwise
+int number_format(const double value, char *buffer)
+{
+    char *out = buffer;
+    if (isnan(value)) {
+        memcpy(buffer, "nan", 4);
+        return 3;
+    }
+    if (signbit(value))
+        *out++ = '-';
+    const double magnitude = fabs(value);
+    if (isinf(magnitude)) {
+        memcpy(out, "inf", 4);
+        return (int)(out - buffer) + 3;
+    }
+
+    // integral values below 2^53 are exact in a uint64_t
+    if (magnitude < 9007199254740992.0 && magnitude == floor(magnitude)) {
+        out += format_integer((uint64_t)magnitude, out);
+        *out = '\0';
+        return (int)(out - buffer);
+    }
+
+    char digits[18];
+    int k = 0;
+    int length;
+    if (!grisu3(magnitude, digits, &length, &k))
+        length = shortest_exact(magnitude, digits, &k);
+    const int point = length + k; // the decimal point sits after this many digits
+    const int exponent = point - 1;
+
+    if (exponent >= -4 && exponent < 17) {
+        if (point <= 0) {
+            *out++ = '0';
+            *out++ = '.';
+            memset(out, '0', (size_t)-point);
+            out += -point;
+            memcpy(out, digits, (size_t)length);
+            out += length;
+        } else if (point >= length) {
+            memcpy(out, digits, (size_t)length);
+            out += length;
+            memset(out, '0', (size_t)(point - length));
+            out += point - length;
+        } else {
+            memcpy(out, digits, (size_t)point);
+            out += point;
+            *out++ = '.';
+            memcpy(out, digits + point, (size_t)(length - point));
+            out += length - point;
+        }
+    } else {
+        *out++ = digits[0];
+        if (length > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, (size_t)(length - 1));
+            out += length - 1;
+        }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        const int e = abs(exponent);
+        if (e < 10)
+            *out++ = '0';
+        out += format_integer((uint64_t)e, out);
+    }
+    *out = '\0';
+    return (int)(out - buffer);
+}
+
+static const double pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline bool is_digit(const char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static double parse_fallback(const char *chars, const int length)
+{
+    char small[64];
+    char *buffer = length < (int)sizeof(small) ? small : malloc((size_t)length + 1);
+    if (buffer == NULL)
+        return 0;
+    memcpy(buffer, chars, (size_t)length);
+    buffer[length] = '\0';
+    const double value = strtod(buffer, NULL);
+    if (buffer != small)
+        free(buffer);
+    return value;
+}
+
+// decimal prefix parse with the same results as strtod: the mantissa and power of ten are both exact
+// doubles in the common case so one multiply or divide rounds correctly (Clinger's fast path)
+double number_parse(const char *chars, const int length)
+{
+    const char *p = chars;
+    const char *end = chars + length;
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p + 1 < end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        return parse_fallback(chars, length);
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    bool inexact = false;
+    for (; p < end && is_digit(*p); p++) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa != 0)
+                digits++;
+        } else {
+            exponent++;
+            inexact = true;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa != 0)
+                    digits++;
+                exponent--;
+            } else {
+                inexact = true;
+            }
+        }
+    }
+    if (!any) // inf, nan and garbage
+        return parse_fallback(chars, length);
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *e = p + 1;
+        bool negative_exponent = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            negative_exponent = *e == '-';
+            e++;
+        }
+        if (e < end && is_digit(*e)) {
+            int value = 0;
+            for (; e < end && is_digit(*e); e++) {
+                if (value < 100000)
+                    value = value * 10 + (*e - '0');
+            }
+            exponent += negative_exponent ? -value : value;
+        }
+    }
+
+    if (mantissa == 0)
+        return negative ? -0.0 : 0.0;
+    if (inexact || mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+        return parse_fallback(chars, length);
+
+    double value = (double)mantissa;
+    if (exponent < 0)
+        value /= pow10_exact[-exponent];
+    else
+        value *= pow10_exact[exponent];
+    return negative ? -value : value;
+}
@@ -38,6 +38,13 @@ void scanner_t_init(const char *source)
     scanner.line = 1;
 }
 
+// pick the scan back up partway into a script, for bodies compiled after the rest of it
+void scanner_t_resume(const char *source, const int line)
+{
+    scanner_t_init(source);
+    scanner.line = line;
+}
+
 static token_t make_token(const token_type_t type)
 {
     token_t token;
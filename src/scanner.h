@@ -170,6 +170,7 @@ typedef struct {
 } token_t;
 
 void scanner_t_init(const char *source);
+void scanner_t_resume(const char *source, const int line);
 token_t scanner_t_scan_token(void);
 
 #endif
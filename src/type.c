@@ -17,11 +17,14 @@
  */
 #include <assert.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "debug.h"
 #include "memory.h"
+#include "number.h"
 #include "type.h"
 #include "vm.h"
 
@@ -87,10 +90,226 @@ obj_list_t *obj_list_t_allocate(void)
 obj_map_t *obj_map_t_allocate(void)
 {
     obj_map_t *map = ALLOCATE_OBJ(obj_map_t, OBJ_MAP);
+    value_list_t_init(&map->array);
+    map->array_count = 0;
     table_t_init(&map->table);
+    map->modifications = 0;
     return map;
 }
 
+obj_array_t *obj_array_t_allocate(void)
+{
+    obj_array_t *array = ALLOCATE_OBJ(obj_array_t, OBJ_ARRAY);
+    array->count = 0;
+    array->capacity = 0;
+    array->values = NULL;
+    return array;
+}
+
+void obj_array_t_reserve(obj_array_t *array, const int capacity)
+{
+    if (array->capacity >= capacity)
+        return;
+    array->values = GROW_ARRAY(double, array->values, array->capacity, capacity);
+    if (array->values == NULL) {
+        fprintf(stderr, gettext("Could not allocate array storage."));
+        exit(EXIT_FAILURE);
+    }
+    array->capacity = capacity;
+}
+
+void obj_array_t_add(obj_array_t *array, const double value)
+{
+    if (array->capacity < array->count + 1)
+        obj_array_t_reserve(array, GROW_CAPACITY(array->capacity));
+    array->values[array->count++] = value;
+}
+
+obj_range_t *obj_range_t_allocate(const double start, const double stop, const double step)
+{
+    obj_range_t *range = ALLOCATE_OBJ(obj_range_t, OBJ_RANGE);
+    range->start = start;
+    range->stop = stop;
+    range->step = step;
+    return range;
+}
+
+obj_set_t *obj_set_t_allocate(void)
+{
+    obj_set_t *set = ALLOCATE_OBJ(obj_set_t, OBJ_SET);
+    value_set_t_init(&set->keys);
+    set->modifications = 0;
+    return set;
+}
+
+int obj_range_t_count(const obj_range_t *range)
+{
+    const double count = ceil((range->stop - range->start) / range->step);
+    if (!(count > 0))
+        return 0;
+    return count > INT_MAX ? INT_MAX : (int)count;
+}
+
+#define MAP_ARRAY_MAX (1 << 30)
+#define MAP_ARRAY_MIN_DEMOTE 32
+
+static inline bool map_array_index(const value_t key, int *index)
+{
+    if (!IS_NUMBER(key))
+        return false;
+    const double n = AS_NUMBER(key);
+    if (!(n >= 0 && n < MAP_ARRAY_MAX)) // also rejects nan
+        return false;
+    *index = (int)n;
+    return (double)*index == n;
+}
+
+static void map_array_append(obj_map_t *map, const value_t value)
+{
+    value_list_t_add(&map->array, value);
+    map->array_count++;
+
+    // pull keys that now extend the array out of the table
+    value_t next;
+    while (map->table.count > 0 && table_t_get(&map->table, NUMBER_VAL(map->array.count), &next)) {
+        value_list_t_add(&map->array, next); // may gc, next is still in the table
+        table_t_delete(&map->table, NUMBER_VAL(map->array.count - 1));
+        map->array_count++;
+    }
+}
+
+static void map_array_demote(obj_map_t *map)
+{
+    for (int i = 0; i < map->array.count; i++) {
+        if (!IS_EMPTY(map->array.values[i]))
+            table_t_set(&map->table, NUMBER_VAL(i), map->array.values[i]); // may gc, values are still in the array
+    }
+    value_list_t_free(&map->array);
+    map->array_count = 0;
+}
+
+bool obj_map_t_get(obj_map_t *map, const value_t key, value_t *value)
+{
+    int index;
+    if (map_array_index(key, &index) && index < map->array.count) {
+        if (IS_EMPTY(map->array.values[index]))
+            return false;
+        *value = map->array.values[index];
+        return true;
+    }
+    return table_t_get(&map->table, key, value);
+}
+
+static bool map_set(obj_map_t *map, const value_t key, const value_t value)
+{
+    int index;
+    if (map_array_index(key, &index)) {
+        if (index < map->array.count) {
+            const bool is_new_key = IS_EMPTY(map->array.values[index]);
+            if (is_new_key)
+                map->array_count++;
+            map->array.values[index] = value;
+            return is_new_key;
+        }
+        if (index == map->array.count) {
+            // only after a demotion can the next array key be sitting in the table
+            const bool is_new_key = !(map->table.count > 0 && table_t_delete(&map->table, key));
+            map_array_append(map, value);
+            return is_new_key;
+        }
+    }
+    return table_t_set(&map->table, key, value);
+}
+
+bool obj_map_t_set(obj_map_t *map, const value_t key, const value_t value)
+{
+    const bool is_new_key = map_set(map, key, value);
+    if (is_new_key)
+        map->modifications++;
+    return is_new_key;
+}
+
+// an exact copy of the layout, both parts are cloned without rehashing
+obj_map_t *obj_map_t_copy(const obj_map_t *from)
+{
+    obj_map_t *map = obj_map_t_allocate();
+    vm_push(OBJ_VAL(map));
+    if (from->array.count > 0) {
+        value_list_t_reserve(&map->array, from->array.count);
+        memcpy(map->array.values, from->array.values, sizeof(value_t) * from->array.count);
+        map->array.count = from->array.count;
+        map->array_count = from->array_count;
+    }
+    if (from->table.capacity > 0) {
+        map->table.entries = ALLOCATE(table_entry_t, from->table.capacity);
+        memcpy(map->table.entries, from->table.entries, sizeof(table_entry_t) * from->table.capacity);
+        map->table.capacity = from->table.capacity;
+        map->table.count = from->table.count;
+    }
+    vm_pop();
+    return map;
+}
+
+static bool map_delete(obj_map_t *map, const value_t key)
+{
+    int index;
+    if (map_array_index(key, &index) && index < map->array.count) {
+        if (IS_EMPTY(map->array.values[index]))
+            return false;
+        map->array.values[index] = EMPTY_VAL;
+        map->array_count--;
+        while (map->array.count > 0 && IS_EMPTY(map->array.values[map->array.count - 1]))
+            map->array.count--;
+        if (map->array.count >= MAP_ARRAY_MIN_DEMOTE && map->array_count < map->array.count / 4)
+            map_array_demote(map);
+        return true;
+    }
+    return table_t_delete(&map->table, key);
+}
+
+bool obj_map_t_delete(obj_map_t *map, const value_t key)
+{
+    const bool removed = map_delete(map, key);
+    if (removed)
+        map->modifications++;
+    return removed;
+}
+
+int obj_map_t_count(const obj_map_t *map)
+{
+    int count = map->array_count;
+    for (int i = 0; i < map->table.capacity; i++) {
+        if (!IS_EMPTY(map->table.entries[i].key))
+            count++;
+    }
+    return count;
+}
+
+// cursor starts at 0 and walks the array part and then the table
+bool obj_map_t_next(const obj_map_t *map, int *cursor, value_t *key, value_t *value)
+{
+    while (*cursor < map->array.count) {
+        const int index = (*cursor)++;
+        if (!IS_EMPTY(map->array.values[index])) {
+            *key = NUMBER_VAL(index);
+            *value = map->array.values[index];
+            return true;
+        }
+    }
+    while (*cursor - map->array.count < map->table.capacity) {
+        const table_entry_t *entry = &map->table.entries[(*cursor)++ - map->array.count];
+        if (!IS_EMPTY(entry->key)) {
+            *key = entry->key;
+            *value = entry->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+#undef MAP_ARRAY_MAX
+#undef MAP_ARRAY_MIN_DEMOTE
+
 obj_file_t *obj_file_t_allocate(obj_string_t *path, obj_string_t *mode)
 {
     obj_file_t *file = ALLOCATE_OBJ(obj_file_t, OBJ_FILE);
@@ -142,7 +361,13 @@ obj_function_t *obj_function_t_allocate(void)
     obj_function_t *function = ALLOCATE_OBJ(obj_function_t, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalue_count = 0;
+    function->slot_count = 0;
     function->name = NULL;
+    function->lazy_source = NULL;
+    function->lazy_line = 0;
+    function->lazy_type = 0;
+    function->registers = NULL;
+    function->registers_tried = false;
     chunk_t_init(&function->chunk);
     return function;
 }
@@ -161,30 +386,118 @@ static obj_string_t *allocate_string(char *chars, const int length, const uint32
     string->length = length;
     string->chars = chars;
     string->hash = hash;
+    string->parent = NULL;
 
     if (intern) {
         vm_push(OBJ_VAL(string));
-        table_t_set(&vm.strings, OBJ_VAL(string), NIL_VAL);
+        string_set_t_add(&vm.strings, string);
         vm_pop();
     }
 
     return string;
 }
 
-static uint32_t hash_string(const char *key, const int length)
+// wyhash style: 64 bit multiply-xor mixing a word at a time, 48 byte blocks with three independent lanes
+static const uint64_t hash_secret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull,
+};
+
+static inline void hash_multiply(uint64_t *a, uint64_t *b)
 {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i];
-        hash *= 16777619;
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 uint128_t;
+    const uint128_t r = (uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    const uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    const uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+    hash_multiply(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t hash_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash_string(const char *key, const int length)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    const size_t len = (size_t)length;
+    uint64_t seed = hash_mix(hash_secret[0], hash_secret[1]);
+    uint64_t a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            const size_t middle = (len >> 3) << 2;
+            a = (hash_read32(p) << 32) | hash_read32(p + middle);
+            b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - middle);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t lane1 = seed, lane2 = seed;
+            do {
+                seed = hash_mix(hash_read64(p) ^ hash_secret[1], hash_read64(p + 8) ^ seed);
+                lane1 = hash_mix(hash_read64(p + 16) ^ hash_secret[2], hash_read64(p + 24) ^ lane1);
+                lane2 = hash_mix(hash_read64(p + 32) ^ hash_secret[3], hash_read64(p + 40) ^ lane2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= lane1 ^ lane2;
+        }
+        while (i > 16) {
+            seed = hash_mix(hash_read64(p) ^ hash_secret[1], hash_read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = hash_read64(p + i - 16);
+        b = hash_read64(p + i - 8);
     }
-    return hash;
+
+    a ^= hash_secret[1];
+    b ^= seed;
+    hash_multiply(&a, &b);
+    const uint64_t h = hash_mix(a ^ hash_secret[0] ^ len, b ^ hash_secret[1]);
+    return (uint32_t)(h ^ (h >> 32));
 }
 
 obj_string_t *obj_string_t_copy_own(char *chars, const int length, const bool intern)
 {
+    if (length == 1 && vm.char_strings[(uint8_t)chars[0]] != NULL) {
+        obj_string_t *c = vm.char_strings[(uint8_t)chars[0]];
+        FREE_ARRAY(char, chars, length + 1);
+        return c;
+    }
+
     const uint32_t hash = hash_string(chars, length);
-    obj_string_t *interned = table_t_find_key_by_str(&vm.strings, chars, length, hash);
+    obj_string_t *interned = string_set_t_find(&vm.strings, chars, length, hash);
     if (interned != NULL) {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
@@ -195,8 +508,12 @@ obj_string_t *obj_string_t_copy_own(char *chars, const int length, const bool in
 
 obj_string_t *obj_string_t_copy_from(const char *chars, const int length, const bool intern)
 {
+    if (length == 1 && vm.char_strings[(uint8_t)chars[0]] != NULL) {
+        return vm.char_strings[(uint8_t)chars[0]];
+    }
+
     const uint32_t hash = hash_string(chars, length);
-    obj_string_t *interned = table_t_find_key_by_str(&vm.strings, chars, length, hash);
+    obj_string_t *interned = string_set_t_find(&vm.strings, chars, length, hash);
     if (interned != NULL) {
         return interned;
     }
@@ -207,6 +524,37 @@ obj_string_t *obj_string_t_copy_from(const char *chars, const int length, const
     return allocate_string(str, length, hash, intern);
 }
 
+// short fragments are copied and interned instead, so they do not pin a large parent buffer
+#define STRING_SLICE_MIN 32
+
+obj_string_t *obj_string_t_slice(obj_string_t *string, const int start, const int length)
+{
+    if (start == 0 && length == string->length)
+        return string;
+    if (length < STRING_SLICE_MIN)
+        return obj_string_t_copy_from(string->chars + start, length, true);
+
+    obj_string_t *slice = ALLOCATE_OBJ(obj_string_t, OBJ_STRING);
+    slice->length = length;
+    slice->chars = string->chars + start;
+    slice->hash = hash_string(slice->chars, length);
+    slice->parent = string->parent != NULL ? string->parent : string; // slices of slices share the root buffer
+    return slice;
+}
+
+const char *obj_string_t_cstring(obj_string_t *string)
+{
+    if (string->parent == NULL)
+        return string->chars;
+
+    char *chars = ALLOCATE(char, string->length + 1);
+    memcpy(chars, string->chars, string->length);
+    chars[string->length] = '\0';
+    string->chars = chars;
+    string->parent = NULL;
+    return chars;
+}
+
 obj_upvalue_t *obj_upvalue_t_allocate(value_t *slot)
 {
     obj_upvalue_t *upvalue = ALLOCATE_OBJ(obj_upvalue_t, OBJ_UPVALUE);
@@ -272,10 +620,7 @@ obj_string_t *obj_t_to_obj_string_t(const value_t value)
             snprintf(buffer, 255, "<native fn %s>", AS_NATIVE(value)->name->chars);
             break;
         }
-        case OBJ_STRING: {
-            snprintf(buffer, 255, "%s", AS_CSTRING(value));
-            break;
-        }
+        case OBJ_STRING: return AS_STRING(value);
         case OBJ_UPVALUE: {
             snprintf(buffer, 255, "<upvalue>");
             break;
@@ -287,7 +632,19 @@ obj_string_t *obj_t_to_obj_string_t(const value_t value)
         }
         case OBJ_MAP: {
             obj_map_t *map = AS_MAP(value);
-            snprintf(buffer, 255, "<map %d>", map->table.count);
+            snprintf(buffer, 255, "<map %d>", obj_map_t_count(map));
+            break;
+        }
+        case OBJ_ARRAY: {
+            snprintf(buffer, 255, "<array %d>", AS_ARRAY(value)->count);
+            break;
+        }
+        case OBJ_RANGE: {
+            snprintf(buffer, 255, "<range %d>", obj_range_t_count(AS_RANGE(value)));
+            break;
+        }
+        case OBJ_SET: {
+            snprintf(buffer, 255, "<set %d>", AS_SET(value)->keys.count);
             break;
         }
         case OBJ_FILE: {
@@ -319,7 +676,7 @@ void obj_t_print(FILE *stream, const value_t value)
         case OBJ_FUNCTION: obj_function_t_print(stream, AS_FUNCTION(value)); break;
         case OBJ_INSTANCE: fprintf(stream, "<type %s instance %p>", AS_INSTANCE(value)->typeobj->name->chars, (void*)AS_OBJ(value)); break;
         case OBJ_NATIVE: fprintf(stream, "<native fn %s>", AS_NATIVE(value)->name->chars); break;
-        case OBJ_STRING: fprintf(stream, "%s", AS_CSTRING(value)); break;
+        case OBJ_STRING: fprintf(stream, "%.*s", AS_STRING(value)->length, AS_STRING(value)->chars); break;
         case OBJ_UPVALUE: fprintf(stream, "<upvalue>"); break;
         case OBJ_LIST: {
             obj_list_t *list = AS_LIST(value);
@@ -337,21 +694,22 @@ void obj_t_print(FILE *stream, const value_t value)
         }
         case OBJ_MAP: {
             obj_map_t *map = AS_MAP(value);
-            if (map->table.count > 24) {
-                fprintf(stream, "<map %d>", map->table.count);
+            const int count = obj_map_t_count(map);
+            if (count > 24) {
+                fprintf(stream, "<map %d>", count);
             } else {
                 bool comma = false;
                 fprintf(stream, "{");
-                for (int i = 0; i < map->table.capacity; i++) {
-                    table_entry_t e = map->table.entries[i];
-                    if (IS_EMPTY(e.key)) continue;
+                int cursor = 0;
+                value_t key, v;
+                while (obj_map_t_next(map, &cursor, &key, &v)) {
                     if (comma)
                         fprintf(stream, ",");
                     else
                         comma = true;
-                    value_t_print(stream, e.key);
+                    value_t_print(stream, key);
                     fprintf(stream, ":");
-                    value_t_print(stream, e.value);
+                    value_t_print(stream, v);
                 }
                 fprintf(stream, "}");
             }
@@ -366,6 +724,48 @@ void obj_t_print(FILE *stream, const value_t value)
             }
             break;
         }
+        case OBJ_ARRAY: {
+            obj_array_t *array = AS_ARRAY(value);
+            if (array->count > 64) {
+                fprintf(stream, "<array %d>", array->count);
+            } else {
+                fprintf(stream, "array[");
+                for (int i = 0; i < array->count; i++) {
+                    if (i > 0) fprintf(stream, ",");
+                    value_t_print(stream, NUMBER_VAL(array->values[i]));
+                }
+                fprintf(stream, "]");
+            }
+            break;
+        }
+        case OBJ_RANGE: {
+            const obj_range_t *range = AS_RANGE(value);
+            fprintf(stream, "range(");
+            value_t_print(stream, NUMBER_VAL(range->start));
+            fprintf(stream, ", ");
+            value_t_print(stream, NUMBER_VAL(range->stop));
+            fprintf(stream, ", ");
+            value_t_print(stream, NUMBER_VAL(range->step));
+            fprintf(stream, ")");
+            break;
+        }
+        case OBJ_SET: {
+            const value_set_t *keys = &AS_SET(value)->keys;
+            if (keys->count > 24) {
+                fprintf(stream, "<set %d>", keys->count);
+            } else {
+                fprintf(stream, "set{");
+                int cursor = 0;
+                value_t key;
+                for (bool comma = false; value_set_t_next(keys, &cursor, &key); comma = true) {
+                    if (comma)
+                        fprintf(stream, ",");
+                    value_t_print(stream, key);
+                }
+                fprintf(stream, "}");
+            }
+            break;
+        }
         default: {
             DEBUG_LOGGER("Unhandled default for object type %d (%p)\n", OBJ_TYPE(value), (void *)&value);
             exit(EXIT_FAILURE);
@@ -380,7 +780,14 @@ bool value_t_equal(const value_t a, const value_t b)
         case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL: return true;
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_OBJ: {
+            if (AS_OBJ(a) == AS_OBJ(b)) return true;
+            // interned strings compare by identity, slices and uninterned buffers by content
+            if (!IS_STRING(a) || !IS_STRING(b)) return false;
+            const obj_string_t *sa = AS_STRING(a);
+            const obj_string_t *sb = AS_STRING(b);
+            return sa->length == sb->length && sa->hash == sb->hash && memcmp(sa->chars, sb->chars, sa->length) == 0;
+        }
         case VAL_EMPTY: return true;
         default: return false; // unreachable
     }
@@ -388,13 +795,16 @@ bool value_t_equal(const value_t a, const value_t b)
 
 static uint32_t hash_double(const double value)
 {
-    union bitcast {
-        double value;
-        uint32_t ints[2];
-    };
-    union bitcast cast;
-    cast.value = (value) + 1.0;
-    return cast.ints[0] + cast.ints[1];
+    // a 64 bit finalizer over the bits, so consecutive integers do not cluster
+    const double normalized = value == 0 ? 0 : value; // -0.0 and 0.0 are the same key
+    uint64_t bits;
+    memcpy(&bits, &normalized, sizeof(bits));
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
 }
 
 uint32_t value_t_hash(const value_t value)
@@ -403,7 +813,12 @@ uint32_t value_t_hash(const value_t value)
         case VAL_BOOL: return AS_BOOL(value) ? 3 : 5; // arbitrary hash values
         case VAL_NIL: return 7; // arbitrary hash value
         case VAL_NUMBER: return hash_double(AS_NUMBER(value));
-        case VAL_OBJ: return AS_STRING(value)->hash;
+        case VAL_OBJ: {
+            if (IS_STRING(value))
+                return AS_STRING(value)->hash;
+            const uintptr_t address = (uintptr_t)AS_OBJ(value); // everything else compares by identity
+            return (uint32_t)((address >> 4) ^ ((uint64_t)address >> 32));
+        }
         case VAL_EMPTY: return 0; // arbitrary hash value
         default: return 0; // unreachable
     }
@@ -432,6 +847,18 @@ void value_list_t_add(value_list_t *array, const value_t value)
     array->count++;
 }
 
+void value_list_t_reserve(value_list_t *array, const int capacity)
+{
+    if (array->capacity >= capacity)
+        return;
+    array->values = GROW_ARRAY(value_t, array->values, array->capacity, capacity);
+    if (array->values == NULL) {
+        fprintf(stderr, gettext("Could not allocate value array storage."));
+        exit(EXIT_FAILURE);
+    }
+    array->capacity = capacity;
+}
+
 void value_list_t_free(value_list_t *array)
 {
     FREE_ARRAY(value_t, array->values, array->capacity);
@@ -444,7 +871,7 @@ obj_string_t *value_t_to_obj_string_t(const value_t value)
     switch (value.type) {
         case VAL_BOOL: snprintf(buffer, 255, "%s", AS_BOOL(value) ? "true" : "false"); break;
         case VAL_NIL: snprintf(buffer, 255, "nil"); break;
-        case VAL_NUMBER: snprintf(buffer, 255, "%g", AS_NUMBER(value)); break;
+        case VAL_NUMBER: return obj_string_t_copy_from(buffer, number_format(AS_NUMBER(value), buffer), true);
         case VAL_OBJ: return obj_t_to_obj_string_t(value);
         case VAL_EMPTY: snprintf(buffer, 255, "<empty>"); break;
         default: DEBUG_LOGGER("Unhandled default\n",); exit(EXIT_FAILURE);
@@ -458,7 +885,11 @@ void value_t_print(FILE *stream, const value_t value)
     switch (value.type) {
         case VAL_BOOL: fprintf(stream, AS_BOOL(value) ? "true" : "false"); break;
         case VAL_NIL: fprintf(stream, "nil"); break;
-        case VAL_NUMBER: fprintf(stream, "%.16g", AS_NUMBER(value)); break;
+        case VAL_NUMBER: {
+            char buffer[NUMBER_FORMAT_MAX];
+            fwrite(buffer, 1, (size_t)number_format(AS_NUMBER(value), buffer), stream);
+            break;
+        }
         case VAL_OBJ: obj_t_print(stream, value); break;
         case VAL_EMPTY: fprintf(stream, "<empty>"); break;
         default: DEBUG_LOGGER("Unhandled default\n",); exit(EXIT_FAILURE);
@@ -513,6 +944,17 @@ bool table_t_get(table_t *table, const value_t key, value_t *value)
     return true;
 }
 
+// the stored value for in place updates, only valid until the table is next modified
+value_t *table_t_get_ref(table_t *table, const value_t key)
+{
+    if (table->count == 0)
+        return NULL;
+    table_entry_t *table_entry = find_table_entry(table->entries, table->capacity, key);
+    if (IS_EMPTY(table_entry->key))
+        return NULL;
+    return &table_entry->value;
+}
+
 static void adjust_capacity(table_t *table, const int capacity)
 {
     table_entry_t *entries = ALLOCATE(table_entry_t, capacity);
@@ -553,6 +995,16 @@ bool table_t_set(table_t *table, const value_t key, const value_t value)
     return is_new_key;
 }
 
+// size the table once for count keys so bulk inserts never rehash
+void table_t_reserve(table_t *table, const int count)
+{
+    int capacity = table->capacity < 8 ? 8 : table->capacity;
+    while (count > capacity * TABLE_MAX_LOAD)
+        capacity *= 2;
+    if (capacity > table->capacity)
+        adjust_capacity(table, capacity);
+}
+
 bool table_t_delete(table_t *table, const value_t key)
 {
     if (table->count == 0)
@@ -564,7 +1016,7 @@ bool table_t_delete(table_t *table, const value_t key)
 
     // place a tombstone table_entry
     table_entry->key = EMPTY_VAL;
-    table_entry->value = NIL_VAL;
+    table_entry->value = TRUE_VAL;
     return true;
 }
 
@@ -578,46 +1030,222 @@ void table_t_copy_to(const table_t *from, table_t *to)
     }
 }
 
-obj_string_t *table_t_find_key_by_str(const table_t *table, const char *chars, const int length, const uint32_t hash)
+void table_t_mark(table_t *table)
 {
-    if (table->count == 0)
-        return NULL;
+    for (int i = 0; i < table->capacity; i++) {
+        table_entry_t *table_entry = &table->entries[i];
+        value_t_mark(table_entry->key);
+        value_t_mark(table_entry->value);
+    }
+}
+
+#define VALUE_SET_TOMBSTONE ((value_t){VAL_EMPTY, {.boolean = true}})
+#define IS_VALUE_SET_TOMBSTONE(value) (IS_EMPTY(value) && (value).as.boolean)
+
+void value_set_t_init(value_set_t *set)
+{
+    set->count = 0;
+    set->used = 0;
+    set->capacity = 0;
+    set->keys = NULL;
+}
+
+void value_set_t_free(value_set_t *set)
+{
+    FREE_ARRAY(value_t, set->keys, set->capacity);
+    value_set_t_init(set);
+}
 
-    uint32_t index = hash & (table->capacity - 1);
+// the matching slot, or the slot an insert should use
+static value_t *find_value_set_slot(value_t *keys, const int capacity, const value_t key)
+{
+    uint32_t index = value_t_hash(key) & (capacity - 1);
+    value_t *tombstone = NULL;
     for (;;) {
-        table_entry_t *table_entry = &table->entries[index];
+        value_t *slot = &keys[index];
+        if (IS_EMPTY(*slot)) {
+            if (!IS_VALUE_SET_TOMBSTONE(*slot))
+                return tombstone != NULL ? tombstone : slot;
+            if (tombstone == NULL)
+                tombstone = slot;
+        } else if (value_t_equal(*slot, key)) {
+            return slot;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
 
-        if (IS_EMPTY(table_entry->key)) {
-            return NULL;
+static void value_set_adjust_capacity(value_set_t *set, const int capacity)
+{
+    value_t *keys = ALLOCATE(value_t, capacity);
+    for (int i = 0; i < capacity; i++)
+        keys[i] = EMPTY_VAL;
+    for (int i = 0; i < set->capacity; i++) {
+        if (!IS_EMPTY(set->keys[i]))
+            *find_value_set_slot(keys, capacity, set->keys[i]) = set->keys[i];
+    }
+    FREE_ARRAY(value_t, set->keys, set->capacity);
+    set->keys = keys;
+    set->capacity = capacity;
+    set->used = set->count; // tombstones are dropped
+}
+
+bool value_set_t_add(value_set_t *set, const value_t key)
+{
+    if (set->used + 1 > set->capacity * TABLE_MAX_LOAD) {
+        // only grow when live keys need the room, otherwise just sweep the tombstones
+        const int capacity = set->count + 1 > set->capacity * TABLE_MAX_LOAD / 2 ? GROW_CAPACITY(set->capacity) : set->capacity;
+        value_set_adjust_capacity(set, capacity);
+    }
+    value_t *slot = find_value_set_slot(set->keys, set->capacity, key);
+    if (!IS_EMPTY(*slot))
+        return false;
+    if (!IS_VALUE_SET_TOMBSTONE(*slot))
+        set->used++;
+    set->count++;
+    *slot = key;
+    return true;
+}
+
+bool value_set_t_has(const value_set_t *set, const value_t key)
+{
+    if (set->count == 0)
+        return false;
+    return !IS_EMPTY(*find_value_set_slot(set->keys, set->capacity, key));
+}
+
+bool value_set_t_remove(value_set_t *set, const value_t key)
+{
+    if (set->count == 0)
+        return false;
+    value_t *slot = find_value_set_slot(set->keys, set->capacity, key);
+    if (IS_EMPTY(*slot))
+        return false;
+    *slot = VALUE_SET_TOMBSTONE;
+    set->count--;
+    return true;
+}
+
+// cursor starts at 0 and walks the slots
+bool value_set_t_next(const value_set_t *set, int *cursor, value_t *key)
+{
+    while (*cursor < set->capacity) {
+        const value_t slot = set->keys[(*cursor)++];
+        if (!IS_EMPTY(slot)) {
+            *key = slot;
+            return true;
         }
-        obj_string_t *string = AS_STRING(table_entry->key);
-        if (string->hash == hash && string->length == length && memcmp(string->chars, chars, length) == 0) {
-            return string;
+    }
+    return false;
+}
+
+void value_set_t_mark(value_set_t *set)
+{
+    for (int i = 0; i < set->capacity; i++)
+        value_t_mark(set->keys[i]);
+}
+
+#undef VALUE_SET_TOMBSTONE
+#undef IS_VALUE_SET_TOMBSTONE
+
+#define STRING_SET_EMPTY 0
+#define STRING_SET_TOMBSTONE 1
+
+void string_set_t_init(string_set_t *set)
+{
+    set->count = 0;
+    set->capacity = 0;
+    set->entries = NULL;
+    set->hits = 0;
+    set->misses = 0;
+}
+
+void string_set_t_free(string_set_t *set)
+{
+    FREE_ARRAY(string_set_entry_t, set->entries, set->capacity);
+    string_set_t_init(set);
+}
+
+obj_string_t *string_set_t_find(string_set_t *set, const char *chars, const int length, const uint32_t hash)
+{
+    if (set->count == 0) {
+        set->misses++;
+        return NULL;
+    }
+
+    uint32_t index = hash & (set->capacity - 1);
+    for (;;) {
+        const string_set_entry_t *entry = &set->entries[index];
+        if (entry->key == NULL) {
+            if (entry->hash == STRING_SET_EMPTY) {
+                set->misses++;
+                return NULL;
+            }
+        } else if (entry->hash == hash && entry->key->length == length && memcmp(entry->key->chars, chars, length) == 0) {
+            set->hits++;
+            return entry->key;
         }
+        index = (index + 1) & (set->capacity - 1);
+    }
+}
 
-        index = (index + 1) & (table->capacity - 1);
+static string_set_entry_t *find_free_entry(string_set_entry_t *entries, const int capacity, const uint32_t hash)
+{
+    uint32_t index = hash & (capacity - 1);
+    while (entries[index].key != NULL) {
+        index = (index + 1) & (capacity - 1);
     }
+    return &entries[index];
 }
 
-void table_t_remove_unmarked(table_t *table)
+static void string_set_adjust_capacity(string_set_t *set, const int capacity)
 {
-    for (int i = 0; i < table->capacity; i++) {
-        table_entry_t *table_entry = &table->entries[i];
-        if (!IS_EMPTY(table_entry->key) && IS_OBJ(table_entry->key) && !AS_OBJ(table_entry->key)->is_marked) {
-            table_t_delete(table, table_entry->key);
-        }
+    string_set_entry_t *entries = ALLOCATE(string_set_entry_t, capacity); // may gc and sweep set->entries
+    for (int i = 0; i < capacity; i++) {
+        entries[i].key = NULL;
+        entries[i].hash = STRING_SET_EMPTY;
+    }
+    set->count = 0;
+    for (int i = 0; i < set->capacity; i++) {
+        const string_set_entry_t *entry = &set->entries[i];
+        if (entry->key == NULL)
+            continue;
+        *find_free_entry(entries, capacity, entry->hash) = *entry;
+        set->count++;
     }
+
+    FREE_ARRAY(string_set_entry_t, set->entries, set->capacity);
+    set->entries = entries;
+    set->capacity = capacity;
 }
 
-void table_t_mark(table_t *table)
+// the caller has already checked that the string is not present
+void string_set_t_add(string_set_t *set, obj_string_t *string)
 {
-    for (int i = 0; i < table->capacity; i++) {
-        table_entry_t *table_entry = &table->entries[i];
-        value_t_mark(table_entry->key);
-        value_t_mark(table_entry->value);
+    if (set->count + 1 > set->capacity * TABLE_MAX_LOAD) {
+        string_set_adjust_capacity(set, GROW_CAPACITY(set->capacity));
+    }
+
+    string_set_entry_t *entry = find_free_entry(set->entries, set->capacity, string->hash);
+    if (entry->hash == STRING_SET_EMPTY)
+        set->count++; // tombstones are already counted
+    entry->key = string;
+    entry->hash = string->hash;
+}
+
+void string_set_t_remove_unmarked(string_set_t *set)
+{
+    for (int i = 0; i < set->capacity; i++) {
+        string_set_entry_t *entry = &set->entries[i];
+        if (entry->key != NULL && !entry->key->obj.is_marked) {
+            entry->key = NULL;
+            entry->hash = STRING_SET_TOMBSTONE;
+        }
     }
 }
 
+#undef STRING_SET_EMPTY
+#undef STRING_SET_TOMBSTONE
 
 void chunk_t_init(chunk_t *chunk)
 {
@@ -671,6 +1299,14 @@ void chunk_t_write(chunk_t *chunk, const uint8_t byte, const int line)
     line_info->line = line;
 }
 
+// drop code from count onwards, along with line runs that start there
+void chunk_t_truncate(chunk_t *chunk, const int count)
+{
+    chunk->count = count;
+    while (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].offset >= count)
+        chunk->line_count--;
+}
+
 int chunk_t_get_line(const chunk_t *chunk, const int instruction)
 {
     int start = 0;
@@ -688,6 +1324,15 @@ int chunk_t_get_line(const chunk_t *chunk, const int instruction)
     }
 }
 
+void register_code_t_free(register_code_t *code)
+{
+    if (code == NULL)
+        return;
+    FREE_ARRAY(uint32_t, code->code, code->capacity);
+    FREE_ARRAY(int, code->origins, code->capacity);
+    FREE(register_code_t, code);
+}
+
 int chunk_t_add_constant(chunk_t *chunk, const value_t value)
 {
     vm_push(value); // make GC happy
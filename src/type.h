@@ -33,6 +33,9 @@
 #define IS_LIST(value) is_obj_type(value, OBJ_LIST)
 #define IS_MAP(value) is_obj_type(value, OBJ_MAP)
 #define IS_FILE(value) is_obj_type(value, OBJ_FILE)
+#define IS_ARRAY(value) is_obj_type(value, OBJ_ARRAY)
+#define IS_RANGE(value) is_obj_type(value, OBJ_RANGE)
+#define IS_SET(value) is_obj_type(value, OBJ_SET)
 
 #define AS_BOUND_METHOD(value) ((obj_bound_method_t*)AS_OBJ(value))
 #define AS_TYPECLASS(value) ((obj_typeobj_t*)AS_OBJ(value))
@@ -48,6 +51,9 @@
 #define AS_LIST(value) (((obj_list_t*)AS_OBJ(value)))
 #define AS_MAP(value) (((obj_map_t*)AS_OBJ(value)))
 #define AS_FILE(value) (((obj_file_t*)AS_OBJ(value)))
+#define AS_ARRAY(value) (((obj_array_t*)AS_OBJ(value)))
+#define AS_RANGE(value) (((obj_range_t*)AS_OBJ(value)))
+#define AS_SET(value) (((obj_set_t*)AS_OBJ(value)))
 
 #define IS_BOOL(value)   ((value).type == VAL_BOOL)
 #define IS_NIL(value)    ((value).type == VAL_NIL)
@@ -83,6 +89,9 @@ typedef enum {
     OBJ_MAP,
     OBJ_BOUND_NATIVE_METHOD,
     OBJ_FILE,
+    OBJ_ARRAY,
+    OBJ_RANGE,
+    OBJ_SET,
 } obj_type_t;
 
 static const char *const obj_type_names[] = {
@@ -98,6 +107,9 @@ static const char *const obj_type_names[] = {
     [OBJ_MAP] = "OBJ_MAP",
     [OBJ_BOUND_NATIVE_METHOD] = "OBJ_BOUND_NATIVE_METHOD",
     [OBJ_FILE] = "OBJ_FILE",
+    [OBJ_ARRAY] = "OBJ_ARRAY",
+    [OBJ_RANGE] = "OBJ_RANGE",
+    [OBJ_SET] = "OBJ_SET",
 };
 
 typedef struct obj_t {
@@ -111,6 +123,7 @@ typedef struct obj_string_t {
     int length;
     uint32_t hash;
     char *chars;
+    struct obj_string_t *parent; // set for a slice: chars points into parent and is not NUL terminated
 } obj_string_t;
 
 typedef enum {
@@ -164,18 +177,55 @@ typedef struct {
     value_t value;
 } table_entry_t;
 
+// keys only, EMPTY_VAL marks a free slot and an EMPTY_VAL carrying true a deleted one
+typedef struct {
+    int count; // live keys
+    int used; // live keys and tombstones
+    int capacity;
+    value_t *keys;
+} value_set_t;
+
 typedef struct {
     int count;
     int capacity;
     table_entry_t *entries;
 } table_t;
 
+typedef struct {
+    obj_string_t *key;
+    uint32_t hash;
+} string_set_entry_t;
+
+// interned strings, entries are weak references removed by the gc
+typedef struct {
+    int count;
+    int capacity;
+    string_set_entry_t *entries;
+    uint64_t hits;
+    uint64_t misses;
+} string_set_t;
+
+// the register form of a function, every stack position is a register and instructions name them directly
+typedef struct {
+    int count;
+    int capacity;
+    uint32_t *code;
+    int *origins; // the chunk offset each word was translated from, for error lines
+    int register_count;
+} register_code_t;
+
 typedef struct {
     obj_t obj;
     int arity;
     int upvalue_count;
+    int slot_count; // most locals live at once, the stack room a call needs
     chunk_t chunk;
     obj_string_t *name;
+    obj_string_t *lazy_source; // parameters and body still to be compiled on the first call, NULL once compiled
+    int lazy_line;
+    int lazy_type; // the compiler's function type for the body
+    register_code_t *registers; // translated on the first call when the vm runs register code, NULL otherwise
+    bool registers_tried; // translation is attempted once, functions it cannot express stay on the stack loop
 } obj_function_t;
 
 typedef bool (*native_fn_t)(const int arg_count, const value_t *args);
@@ -235,9 +285,13 @@ typedef struct {
     value_list_t elements;
 } obj_list_t;
 
+// integer keys 0..n live in a dense array part (EMPTY_VAL marks a hole), everything else in the table
 typedef struct {
     obj_t obj;
+    value_list_t array;
+    int array_count;
     table_t table;
+    uint32_t modifications; // bumped on every insert or delete, iteration checks it
 } obj_map_t;
 
 typedef struct {
@@ -247,6 +301,28 @@ typedef struct {
     int fd;
 } obj_file_t;
 
+// unboxed doubles stored contiguously for bulk numeric work
+typedef struct {
+    obj_t obj;
+    int count;
+    int capacity;
+    double *values;
+} obj_array_t;
+
+// start, start + step, ... up to but not including stop, computed on demand
+typedef struct {
+    obj_t obj;
+    double start;
+    double stop;
+    double step;
+} obj_range_t;
+
+typedef struct {
+    obj_t obj;
+    value_set_t keys;
+    uint32_t modifications; // bumped on every insert or delete, iteration checks it
+} obj_set_t;
+
 obj_bound_method_t *obj_bound_method_t_allocate(value_t receiving_instance, obj_closure_t *method);
 obj_bound_native_method_t * obj_bound_native_method_t_allocate(value_t receiving_instance, obj_string_t *name, native_method_fn_t function);
 obj_function_t *obj_function_t_allocate(void);
@@ -258,9 +334,26 @@ obj_instance_t *obj_instance_t_allocate(obj_typeobj_t *typeobj);
 obj_list_t *obj_list_t_allocate(void);
 obj_map_t *obj_map_t_allocate(void);
 obj_file_t *obj_file_t_allocate(obj_string_t *path, obj_string_t *mode);
+obj_array_t *obj_array_t_allocate(void);
+obj_range_t *obj_range_t_allocate(const double start, const double stop, const double step);
+obj_set_t *obj_set_t_allocate(void);
+
+void obj_array_t_reserve(obj_array_t *array, const int capacity);
+void obj_array_t_add(obj_array_t *array, const double value);
+
+int obj_range_t_count(const obj_range_t *range);
+
+bool obj_map_t_get(obj_map_t *map, const value_t key, value_t *value);
+bool obj_map_t_set(obj_map_t *map, const value_t key, const value_t value);
+bool obj_map_t_delete(obj_map_t *map, const value_t key);
+obj_map_t *obj_map_t_copy(const obj_map_t *from);
+int obj_map_t_count(const obj_map_t *map);
+bool obj_map_t_next(const obj_map_t *map, int *cursor, value_t *key, value_t *value);
 
 obj_string_t *obj_string_t_copy_own(char *chars, const int length, const bool intern);
 obj_string_t *obj_string_t_copy_from(const char *chars, const int length, const bool intern);
+obj_string_t *obj_string_t_slice(obj_string_t *string, const int start, const int length);
+const char *obj_string_t_cstring(obj_string_t *string);
 void obj_t_print(FILE *stream, const value_t value);
 obj_string_t *obj_t_to_obj_string_t(const value_t value);
 void obj_t_mark(obj_t *obj);
@@ -273,26 +366,45 @@ static inline bool is_obj_type(const value_t value, const obj_type_t type)
 bool value_t_equal(const value_t a, const value_t b);
 void value_list_t_init(value_list_t *array);
 void value_list_t_add(value_list_t *array, const value_t value);
+void value_list_t_reserve(value_list_t *array, const int capacity);
 void value_list_t_free(value_list_t *array);
 void value_t_print(FILE *stream, const value_t value);
 obj_string_t *value_t_to_obj_string_t(const value_t value);
 uint32_t value_t_hash(const value_t value);
+uint32_t hash_string(const char *key, const int length);
 void value_t_mark(value_t value);
 
 void table_t_init(table_t *table);
 void table_t_free(table_t *table);
 bool table_t_set(table_t *table, value_t key, const value_t value);
 bool table_t_get(table_t *table, const value_t key, value_t *value);
+value_t *table_t_get_ref(table_t *table, const value_t key);
 bool table_t_delete(table_t *table, const value_t key);
-obj_string_t *table_t_find_key_by_str(const table_t *table, const char *chars, const int length, const uint32_t hash);
-void table_t_remove_unmarked(table_t *table);
+void table_t_reserve(table_t *table, const int count);
 void table_t_mark(table_t *table);
 void table_t_copy_to(const table_t *from, table_t *to);
 
+void value_set_t_init(value_set_t *set);
+void value_set_t_free(value_set_t *set);
+bool value_set_t_add(value_set_t *set, const value_t key);
+bool value_set_t_has(const value_set_t *set, const value_t key);
+bool value_set_t_remove(value_set_t *set, const value_t key);
+bool value_set_t_next(const value_set_t *set, int *cursor, value_t *key);
+void value_set_t_mark(value_set_t *set);
+
+void string_set_t_init(string_set_t *set);
+void string_set_t_free(string_set_t *set);
+obj_string_t *string_set_t_find(string_set_t *set, const char *chars, const int length, const uint32_t hash);
+void string_set_t_add(string_set_t *set, obj_string_t *string);
+void string_set_t_remove_unmarked(string_set_t *set);
+
 void chunk_t_init(chunk_t *chunk);
 void chunk_t_free(chunk_t *chunk);
 void chunk_t_write(chunk_t *chunk, const uint8_t byte, const int line);
+void chunk_t_truncate(chunk_t *chunk, const int count);
 int chunk_t_add_constant(chunk_t *chunk, const value_t value);
 int chunk_t_get_line(const chunk_t *chunk, const int instruction);
 
+void register_code_t_free(register_code_t *code);
+
 #endif
@@ -16,7 +16,11 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#define _GNU_SOURCE // memmem, memrchr
 #include <assert.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -26,10 +30,12 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include "cache.h"
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
 #include "memory.h"
+#include "number.h"
 #include "type.h"
 #include "vm.h"
 
@@ -37,6 +43,50 @@
 
 vm_t vm;
 
+#ifdef DISPATCH_COUNTS
+// executed opcode counts for comparing instruction streams, printed to stderr when the vm is freed
+static uint64_t dispatch_counts[INVALID_OPCODE];
+static uint64_t register_dispatch_counts[INVALID_REG_OPCODE];
+#define COUNT_DISPATCH(op) (dispatch_counts[(op)]++)
+#define COUNT_REGISTER_DISPATCH(op) (register_dispatch_counts[(op)]++)
+
+typedef struct {
+    uint64_t count;
+    const char *name;
+} dispatch_count_t;
+
+static int dispatch_count_compare(const void *a, const void *b)
+{
+    const uint64_t x = ((const dispatch_count_t *)a)->count;
+    const uint64_t y = ((const dispatch_count_t *)b)->count;
+    return (x < y) - (x > y);
+}
+
+// both instruction sets are counted together so the total compares one backend against the other
+static void dispatch_counts_print(void)
+{
+    dispatch_count_t counts[INVALID_OPCODE + INVALID_REG_OPCODE];
+    uint64_t total = 0;
+    for (int i = 0; i < INVALID_OPCODE; i++) {
+        counts[i] = (dispatch_count_t){dispatch_counts[i], op_code_name[i]};
+        total += dispatch_counts[i];
+    }
+    for (int i = 0; i < INVALID_REG_OPCODE; i++) {
+        counts[INVALID_OPCODE + i] = (dispatch_count_t){register_dispatch_counts[i], reg_op_code_name[i]};
+        total += register_dispatch_counts[i];
+    }
+    qsort(counts, INVALID_OPCODE + INVALID_REG_OPCODE, sizeof(dispatch_count_t), dispatch_count_compare);
+    fprintf(stderr, "dispatches %" PRIu64 "\n", total);
+    for (int i = 0; i < INVALID_OPCODE + INVALID_REG_OPCODE && counts[i].count > 0; i++)
+        fprintf(stderr, "%12" PRIu64 " %s\n", counts[i].count, counts[i].name);
+    memset(dispatch_counts, 0, sizeof dispatch_counts);
+    memset(register_dispatch_counts, 0, sizeof register_dispatch_counts);
+}
+#else
+#define COUNT_DISPATCH(op) ((void)0)
+#define COUNT_REGISTER_DISPATCH(op) ((void)0)
+#endif
+
 void vm_toggle_gc_stress(void)
 {
     vm.flags ^= VM_FLAG_GC_STRESS;
@@ -47,6 +97,21 @@ void vm_toggle_gc_trace(void)
     vm.flags ^= VM_FLAG_GC_TRACE;
 }
 
+void vm_toggle_optimize(void)
+{
+    vm.flags ^= VM_FLAG_NO_OPTIMIZE;
+}
+
+void vm_toggle_lazy_compile(void)
+{
+    vm.flags ^= VM_FLAG_LAZY_COMPILE;
+}
+
+void vm_toggle_registers(void)
+{
+    vm.flags ^= VM_FLAG_REGISTERS;
+}
+
 void vm_toggle_stack_trace(void)
 {
     vm.flags ^= VM_FLAG_STACK_TRACE;
@@ -82,7 +147,9 @@ static void runtime_error(const char *format, ...)
     for (int i = vm.frame_count - 1; i >= 0; i--) {
         const call_frame_t *frame = &vm.frames[i];
         const obj_function_t *function = frame->closure->function;
-        const size_t instruction = frame->ip - function->chunk.code - 1; // previous failed instruction
+        size_t instruction = frame->ip - function->chunk.code - 1; // previous failed instruction
+        if (function->registers != NULL) // the stack instruction it was translated from
+            instruction = function->registers->origins[frame->pc - function->registers->code - 1];
         fprintf(stderr, "[line %d] in %s\n",
             chunk_t_get_line(&function->chunk, instruction),
             function->name == NULL ? "script" : function->name->chars
@@ -137,6 +204,15 @@ static bool is_instance_native(const int argc, const value_t *args)
     if (!IS_LIST(args[0]) && IS_NATIVE(args[1]) && memcmp(AS_NATIVE(args[1])->name->chars, "list", 4) == 0) {
         vm_push(FALSE_VAL); return true;
     }
+    if (IS_NATIVE(args[1]) && AS_NATIVE(args[1])->name->length == 5 && memcmp(AS_NATIVE(args[1])->name->chars, "array", 5) == 0) {
+        vm_push(BOOL_VAL(IS_ARRAY(args[0]))); return true;
+    }
+    if (IS_NATIVE(args[1]) && AS_NATIVE(args[1])->name->length == 5 && memcmp(AS_NATIVE(args[1])->name->chars, "range", 5) == 0) {
+        vm_push(BOOL_VAL(IS_RANGE(args[0]))); return true;
+    }
+    if (IS_NATIVE(args[1]) && AS_NATIVE(args[1])->name->length == 3 && memcmp(AS_NATIVE(args[1])->name->chars, "set", 3) == 0) {
+        vm_push(BOOL_VAL(IS_SET(args[0]))); return true;
+    }
     if (!IS_BOOL(args[0]) && IS_NATIVE(args[1]) && memcmp(AS_NATIVE(args[1])->name->chars, "bool", 4) == 0) {
         vm_push(FALSE_VAL); return true;
     }
@@ -155,10 +231,10 @@ static bool is_instance_native(const int argc, const value_t *args)
     if (!IS_BOOL(args[0]) && IS_BOOL(args[1])) {
         vm_push(FALSE_VAL); return true;
     }
-    if (IS_NUMBER(args[0]) && IS_NATIVE(args[1]) && memcmp(AS_NATIVE(args[1])->name->chars, "number", 6) == 0) {
+    if (IS_NUMBER(args[0]) && IS_NATIVE(args[1]) && AS_NATIVE(args[1])->name->length == 6 && memcmp(AS_NATIVE(args[1])->name->chars, "number", 6) == 0) {
         vm_push(TRUE_VAL); return true;
     }
-    if (!IS_NUMBER(args[0]) && IS_NATIVE(args[1]) && memcmp(AS_NATIVE(args[1])->name->chars, "number", 6) == 0) {
+    if (!IS_NUMBER(args[0]) && IS_NATIVE(args[1]) && AS_NATIVE(args[1])->name->length == 6 && memcmp(AS_NATIVE(args[1])->name->chars, "number", 6) == 0) {
         vm_push(FALSE_VAL); return true;
     }
     if (IS_MAP(args[0]) && IS_NATIVE(args[1]) && memcmp(AS_NATIVE(args[1])->name->chars, "map", 3) == 0) {
@@ -204,11 +280,7 @@ static bool contains_native(const int argc, const value_t *args)
     if (IS_STRING(args[0]) && IS_STRING(args[1])) {
         obj_string_t *args_0 = AS_STRING(args[0]);
         obj_string_t *args_1 = AS_STRING(args[1]);
-        if (args_0->length == 1) {
-            vm_push((strchr(args_1->chars, args_0->chars[0]) != NULL) ? TRUE_VAL : FALSE_VAL);
-        } else {
-            vm_push((strstr(args_1->chars, args_0->chars) != NULL) ? TRUE_VAL : FALSE_VAL);
-        }
+        vm_push(memmem(args_1->chars, args_1->length, args_0->chars, args_0->length) != NULL ? TRUE_VAL : FALSE_VAL);
         return true;
     }
     else if (IS_LIST(args[1])) {
@@ -223,11 +295,37 @@ static bool contains_native(const int argc, const value_t *args)
         vm_push(found);
         return true;
     }
+    else if (IS_ARRAY(args[1])) {
+        const obj_array_t *array = AS_ARRAY(args[1]);
+        value_t found = FALSE_VAL;
+        for (int i = 0; IS_NUMBER(args[0]) && i < array->count; i++) {
+            if (array->values[i] == AS_NUMBER(args[0])) {
+                found = TRUE_VAL;
+                break;
+            }
+        }
+        vm_push(found);
+        return true;
+    }
+    else if (IS_SET(args[1])) {
+        vm_push(BOOL_VAL(value_set_t_has(&AS_SET(args[1])->keys, args[0])));
+        return true;
+    }
+    else if (IS_RANGE(args[1])) {
+        const obj_range_t *range = AS_RANGE(args[1]);
+        bool found = false;
+        if (IS_NUMBER(args[0])) {
+            const double offset = (AS_NUMBER(args[0]) - range->start) / range->step;
+            found = offset >= 0 && offset < obj_range_t_count(range) && offset == floor(offset);
+        }
+        vm_push(BOOL_VAL(found));
+        return true;
+    }
     else if (IS_MAP(args[1])) {
         obj_map_t *map = AS_MAP(args[1]);
         value_t found = FALSE_VAL;
         value_t v;
-        if (table_t_get(&map->table, args[0], &v)) {
+        if (obj_map_t_get(map, args[0], &v)) {
             found = TRUE_VAL;
         }
         vm_push(found);
@@ -289,6 +387,79 @@ static bool str_native(const int argc, const value_t *args)
     return true;
 }
 
+// results longer than this are built without interning, they are rarely compared or used as keys
+#define FORMAT_INTERN_MAX 128
+
+// format("{} is {}", a, b): every {} takes the next argument, {{ and }} are literal braces
+static bool format_native(const int argc, const value_t *args)
+{
+    if (argc < 1 || !IS_STRING(args[0])) {
+        runtime_error(gettext("format requires a format string."));
+        return false;
+    }
+    const obj_string_t *fmt = AS_STRING(args[0]);
+    value_t *values = (value_t *)args + 1;
+    char number[NUMBER_FORMAT_MAX];
+
+    // size the result first, converting anything that is not a string or number in place
+    int length = 0;
+    int placeholders = 0;
+    for (int i = 0; i < fmt->length; i++) {
+        const char c = fmt->chars[i];
+        if ((c == '{' || c == '}') && i + 1 < fmt->length && fmt->chars[i + 1] == c) {
+            length++;
+            i++;
+        } else if (c == '{' && i + 1 < fmt->length && fmt->chars[i + 1] == '}') {
+            if (placeholders >= argc - 1) {
+                runtime_error(gettext("format has more placeholders than arguments."));
+                return false;
+            }
+            value_t *v = &values[placeholders++];
+            if (IS_NUMBER(*v)) {
+                length += number_format(AS_NUMBER(*v), number);
+            } else {
+                if (!IS_STRING(*v))
+                    *v = OBJ_VAL(value_t_to_obj_string_t(*v));
+                length += AS_STRING(*v)->length;
+            }
+            i++;
+        } else if (c == '{' || c == '}') {
+            runtime_error(gettext("format has an unmatched brace."));
+            return false;
+        } else {
+            length++;
+        }
+    }
+    if (placeholders != argc - 1) {
+        runtime_error(gettext("format has more arguments than placeholders."));
+        return false;
+    }
+
+    char *chars = ALLOCATE(char, length + 1);
+    char *dest = chars;
+    int next = 0;
+    for (int i = 0; i < fmt->length; i++) {
+        const char c = fmt->chars[i];
+        if (c == '{' && i + 1 < fmt->length && fmt->chars[i + 1] == '}') {
+            const value_t v = values[next++];
+            if (IS_NUMBER(v)) {
+                dest += number_format(AS_NUMBER(v), dest);
+            } else {
+                memcpy(dest, AS_STRING(v)->chars, AS_STRING(v)->length);
+                dest += AS_STRING(v)->length;
+            }
+            i++;
+        } else {
+            *dest++ = c;
+            if (c == '{' || c == '}')
+                i++; // escaped brace
+        }
+    }
+    chars[length] = '\0';
+    vm_push(OBJ_VAL(obj_string_t_copy_own(chars, length, length <= FORMAT_INTERN_MAX)));
+    return true;
+}
+
 static bool list_native(const int argc, const value_t *args)
 {
     obj_list_t *list = obj_list_t_allocate();
@@ -299,6 +470,24 @@ static bool list_native(const int argc, const value_t *args)
     return true;
 }
 
+static bool set_native(const int argc, const value_t *args)
+{
+    obj_set_t *set = obj_set_t_allocate();
+    vm_push(OBJ_VAL(set));
+    if (argc == 1 && IS_SET(args[0])) {
+        const value_set_t *from = &AS_SET(args[0])->keys;
+        int cursor = 0;
+        value_t key;
+        while (value_set_t_next(from, &cursor, &key))
+            value_set_t_add(&set->keys, key);
+        return true;
+    }
+    for (int i = 0 ; i < argc; i++) {
+        value_set_t_add(&set->keys, args[i]);
+    }
+    return true;
+}
+
 static bool map_native(const int argc, const value_t *args)
 {
     if (argc == 1 && IS_MAP(args[0])) {
@@ -306,11 +495,10 @@ static bool map_native(const int argc, const value_t *args)
 
         obj_map_t *map = obj_map_t_allocate();
         vm_push(OBJ_VAL(map));
-        for (int i = 0; i < from_map->table.capacity; i++) {
-            table_entry_t table_entry = from_map->table.entries[i];
-            if (IS_EMPTY(table_entry.key))
-                continue;
-            table_t_set(&map->table, table_entry.key, table_entry.value);
+        int cursor = 0;
+        value_t key, value;
+        while (obj_map_t_next(from_map, &cursor, &key, &value)) {
+            obj_map_t_set(map, key, value);
         }
         return true;
     }
@@ -323,8 +511,74 @@ static bool map_native(const int argc, const value_t *args)
     obj_map_t *map = obj_map_t_allocate();
     vm_push(OBJ_VAL(map));
     for (int i = 0; i < argc; i += 2) {
-        table_t_set(&map->table, args[i], args[i+1]);
+        obj_map_t_set(map, args[i], args[i+1]);
+    }
+    return true;
+}
+
+static bool array_native(const int argc, const value_t *args)
+{
+    // array(), array(count), array(count, value), array(list) or array(array)
+    if (argc > 2 || (argc == 2 && (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])))
+        || (argc == 1 && !IS_NUMBER(args[0]) && !IS_LIST(args[0]) && !IS_ARRAY(args[0]))) {
+        runtime_error(gettext("array requires a count and optional value, or a list of numbers."));
+        return false;
+    }
+
+    obj_array_t *array = obj_array_t_allocate();
+    vm_push(OBJ_VAL(array));
+    if (argc == 0)
+        return true;
+
+    if (IS_NUMBER(args[0])) {
+        const int count = (int)AS_NUMBER(args[0]);
+        if (count < 0) {
+            runtime_error(gettext("array requires a count and optional value, or a list of numbers."));
+            return false;
+        }
+        const double value = argc == 2 ? AS_NUMBER(args[1]) : 0;
+        obj_array_t_reserve(array, count);
+        for (int i = 0; i < count; i++)
+            array->values[i] = value;
+        array->count = count;
+    } else if (IS_ARRAY(args[0])) {
+        const obj_array_t *from = AS_ARRAY(args[0]);
+        obj_array_t_reserve(array, from->count);
+        if (from->count > 0)
+            memcpy(array->values, from->values, sizeof(double) * (size_t)from->count);
+        array->count = from->count;
+    } else {
+        const value_list_t *elements = &AS_LIST(args[0])->elements;
+        obj_array_t_reserve(array, elements->count);
+        for (int i = 0; i < elements->count; i++) {
+            if (!IS_NUMBER(elements->values[i])) {
+                runtime_error(gettext("array requires a count and optional value, or a list of numbers."));
+                return false;
+            }
+            array->values[i] = AS_NUMBER(elements->values[i]);
+        }
+        array->count = elements->count;
+    }
+    return true;
+}
+
+static bool range_native(const int argc, const value_t *args)
+{
+    // range(stop), range(start, stop) or range(start, stop, step)
+    for (int i = 0; i < argc; i++) {
+        if (!IS_NUMBER(args[i])) {
+            runtime_error(gettext("range requires numerical arguments."));
+            return false;
+        }
+    }
+    if (argc < 1 || argc > 3 || (argc == 3 && AS_NUMBER(args[2]) == 0)) {
+        runtime_error(gettext("range requires a stop, a start and stop, or a start, stop and non-zero step."));
+        return false;
     }
+    const double start = argc == 1 ? 0 : AS_NUMBER(args[0]);
+    const double stop = argc == 1 ? AS_NUMBER(args[0]) : AS_NUMBER(args[1]);
+    const double step = argc == 3 ? AS_NUMBER(args[2]) : 1;
+    vm_push(OBJ_VAL(obj_range_t_allocate(start, stop, step)));
     return true;
 }
 
@@ -340,7 +594,7 @@ static bool number_native(const int argc, const value_t *args)
         return true;
     }
     if (IS_STRING(args[0])) {
-        double n = strtod(AS_CSTRING(args[0]), NULL);
+        double n = number_parse(AS_STRING(args[0])->chars, AS_STRING(args[0])->length);
         vm_push(NUMBER_VAL(n));
         return true;
     }
@@ -404,8 +658,23 @@ static bool bool_native(const int argc, const value_t *args)
         return true;
     }
 
+    else if (IS_ARRAY(args[0])) {
+        vm_push(BOOL_VAL(AS_ARRAY(args[0])->count > 0));
+        return true;
+    }
+
+    else if (IS_RANGE(args[0])) {
+        vm_push(BOOL_VAL(obj_range_t_count(AS_RANGE(args[0])) > 0));
+        return true;
+    }
+
+    else if (IS_SET(args[0])) {
+        vm_push(BOOL_VAL(AS_SET(args[0])->keys.count > 0));
+        return true;
+    }
+
     else if (IS_MAP(args[0])) {
-        if (AS_MAP(args[0])->table.count > 0)
+        if (obj_map_t_count(AS_MAP(args[0])) > 0)
             vm_push(TRUE_VAL);
         else
             vm_push(FALSE_VAL);
@@ -429,6 +698,140 @@ static bool bool_native(const int argc, const value_t *args)
     return false;
 }
 
+// glibc memchr/memmem/memrchr are vectorized and pick SSE2/AVX2/EVEX at load time
+static int string_find(const obj_string_t *str, const obj_string_t *sub, const int start)
+{
+    if (start > str->length)
+        return -1;
+    const char *found = memmem(str->chars + start, str->length - start, sub->chars, sub->length);
+    return found == NULL ? -1 : (int)(found - str->chars);
+}
+
+static int string_rfind(const obj_string_t *str, const obj_string_t *sub)
+{
+    if (sub->length == 0)
+        return str->length;
+    int end = str->length - sub->length + 1; // candidate starts are before end
+    while (end > 0) {
+        const char *candidate = memrchr(str->chars, sub->chars[0], end);
+        if (candidate == NULL)
+            return -1;
+        if (memcmp(candidate, sub->chars, sub->length) == 0)
+            return (int)(candidate - str->chars);
+        end = (int)(candidate - str->chars);
+    }
+    return -1;
+}
+
+static int string_count(const obj_string_t *str, const obj_string_t *sub)
+{
+    if (sub->length == 0)
+        return str->length + 1;
+    int count = 0;
+    for (int i = string_find(str, sub, 0); i != -1; i = string_find(str, sub, i + sub->length))
+        count++;
+    return count;
+}
+
+static bool string_split(obj_string_t *str, const obj_string_t *sep)
+{
+    const int parts = string_count(str, sep) + 1;
+    obj_list_t *list = obj_list_t_allocate();
+    vm_push(OBJ_VAL(list));
+    value_list_t_reserve(&list->elements, parts);
+
+    int start = 0;
+    for (int i = 0; i < parts - 1; i++) {
+        const int end = string_find(str, sep, start);
+        value_list_t_add(&list->elements, OBJ_VAL(obj_string_t_slice(str, start, end - start)));
+        start = end + sep->length;
+    }
+    value_list_t_add(&list->elements, OBJ_VAL(obj_string_t_slice(str, start, str->length - start)));
+    return true;
+}
+
+static bool string_split_whitespace(obj_string_t *str)
+{
+    int parts = 0;
+    for (int i = 0; i < str->length; i++) {
+        if (!isspace((unsigned char)str->chars[i]) && (i == 0 || isspace((unsigned char)str->chars[i - 1])))
+            parts++;
+    }
+    obj_list_t *list = obj_list_t_allocate();
+    vm_push(OBJ_VAL(list));
+    value_list_t_reserve(&list->elements, parts);
+
+    int i = 0;
+    while (list->elements.count < parts) {
+        while (isspace((unsigned char)str->chars[i]))
+            i++;
+        const int start = i;
+        while (i < str->length && !isspace((unsigned char)str->chars[i]))
+            i++;
+        value_list_t_add(&list->elements, OBJ_VAL(obj_string_t_slice(str, start, i - start)));
+    }
+    return true;
+}
+
+static bool string_replace(obj_string_t *str, const obj_string_t *old, const obj_string_t *new)
+{
+    const int count = string_count(str, old);
+    if (count == 0) {
+        vm_push(OBJ_VAL(str));
+        return true;
+    }
+
+    const int length = str->length + count * (new->length - old->length);
+    char *chars = ALLOCATE(char, length + 1);
+    char *dest = chars;
+    int start = 0;
+    for (int i = 0; i < count; i++) {
+        const int end = string_find(str, old, start);
+        memcpy(dest, str->chars + start, end - start);
+        dest += end - start;
+        memcpy(dest, new->chars, new->length);
+        dest += new->length;
+        start = end + old->length;
+    }
+    memcpy(dest, str->chars + start, str->length - start);
+    chars[length] = '\0';
+    vm_push(OBJ_VAL(obj_string_t_copy_own(chars, length, true)));
+    return true;
+}
+
+static bool string_join(const obj_string_t *sep, const obj_list_t *list)
+{
+    const int count = list->elements.count;
+    if (count == 0) {
+        vm_push(OBJ_VAL(obj_string_t_copy_from("", 0, true)));
+        return true;
+    }
+
+    int length = sep->length * (count - 1);
+    for (int i = 0; i < count; i++) {
+        if (!IS_STRING(list->elements.values[i])) {
+            runtime_error(gettext("str.join requires a list of strings."));
+            return false;
+        }
+        length += AS_STRING(list->elements.values[i])->length;
+    }
+
+    char *chars = ALLOCATE(char, length + 1);
+    char *dest = chars;
+    for (int i = 0; i < count; i++) {
+        const obj_string_t *part = AS_STRING(list->elements.values[i]);
+        if (i > 0) {
+            memcpy(dest, sep->chars, sep->length);
+            dest += sep->length;
+        }
+        memcpy(dest, part->chars, part->length);
+        dest += part->length;
+    }
+    chars[length] = '\0';
+    vm_push(OBJ_VAL(obj_string_t_copy_own(chars, length, true)));
+    return true;
+}
+
 static bool string_method_invoke(const obj_string_t *method, const int argc, const value_t *args)
 {
     obj_string_t *str = AS_STRING(args[0]);
@@ -460,7 +863,7 @@ static bool string_method_invoke(const obj_string_t *method, const int argc, con
             runtime_error(gettext("invalid str.substr end position."));
             return false;
         }
-        vm_push(OBJ_VAL(obj_string_t_copy_from(str->chars + start, end-start, true)));
+        vm_push(OBJ_VAL(obj_string_t_slice(str, start, end-start)));
         return true;
     }
 
@@ -478,251 +881,1194 @@ static bool string_method_invoke(const obj_string_t *method, const int argc, con
             runtime_error(gettext("invalid str.substr end position."));
             return false;
         }
-        vm_push(OBJ_VAL(obj_string_t_copy_from(str->chars + start, end-start, true)));
+        vm_push(OBJ_VAL(vm.char_strings[(uint8_t)str->chars[start]]));
         return true;
     }
 
-    runtime_error(gettext("No such str method %.*s"), method->length, method->chars);
-    return false;
-}
-
-static bool list_method_invoke(const obj_string_t *method, const int argc, const value_t *args)
-{
-    obj_list_t *list = AS_LIST(args[0]);
-
-    if (method->length == 3) {
-        if (memcmp(method->chars, KEYWORD_LEN, KEYWORD_LEN_LEN) == 0) {
-            if (argc > 1) {
-                runtime_error(gettext("list.len takes no arguments."));
-                return false;
-            }
-            vm_push(NUMBER_VAL(list->elements.count));
-            return true;
+    else if (method->length == 4 && memcmp(method->chars, "find", 4) == 0) {
+        if (argc < 2 || argc > 3 || !IS_STRING(args[1]) || (argc == 3 && !IS_NUMBER(args[2]))) {
+            runtime_error(gettext("str.find requires a string argument and an optional start position."));
+            return false;
         }
-        else if (memcmp(method->chars, KEYWORD_GET, KEYWORD_GET_LEN) == 0) {
-            if (argc != 2) {
-                runtime_error(gettext("list.get requires a single numerical argument."));
-                return false;
-            }
-            if (!IS_NUMBER(args[1])) {
-                runtime_error(gettext("list.get requires a single numerical argument."));
-                return false;
-            }
-            int index = (int)AS_NUMBER(args[1]);
-            if (index < 0) {
-                index += list->elements.count;
-            }
-            if (index < 0 || index > list->elements.count - 1) {
-                runtime_error(gettext("invalid list.get index."));
-                return false;
-            }
-            value_t v = list->elements.values[index];
-            vm_push(v);
-            return true;
+        int start = argc == 3 ? (int)AS_NUMBER(args[2]) : 0;
+        if (start < 0) {
+            start += str->length;
+            if (start < 0)
+                start = 0;
         }
+        vm_push(NUMBER_VAL(string_find(str, AS_STRING(args[1]), start)));
+        return true;
     }
 
-    else if (method->length == 5) {
-        if (memcmp(method->chars, KEYWORD_CLEAR, KEYWORD_CLEAR_LEN) == 0) {
-            if (argc != 1) {
-                runtime_error(gettext("list.clear requires no arguments."));
-                return false;
-            }
-            list->elements.count = 0;
-            vm_push(NIL_VAL);
-            return true;
+    else if (method->length == 5 && memcmp(method->chars, "rfind", 5) == 0) {
+        if (argc != 2 || !IS_STRING(args[1])) {
+            runtime_error(gettext("str.rfind requires a string argument."));
+            return false;
         }
+        vm_push(NUMBER_VAL(string_rfind(str, AS_STRING(args[1]))));
+        return true;
     }
 
-    else if (method->length == 6) {
-        if (memcmp(method->chars, KEYWORD_APPEND, KEYWORD_APPEND_LEN) == 0) {
-            if (argc != 2) {
-                runtime_error(gettext("list.append requires a single argument."));
-                return false;
-            }
-            value_t to_add = args[1];
-            value_list_t_add(&list->elements, to_add);
-            vm_push(to_add);
-            return true;
-        }
-        if (memcmp(method->chars, KEYWORD_REMOVE, KEYWORD_REMOVE_LEN) == 0) {
-            if (list->elements.count == 0) {
-                vm_push(NUMBER_VAL(list->elements.count));
-                return true;
-            }
-            if (argc != 2) {
-                runtime_error(gettext("list.remove requires a single argument."));
-                return false;
-            }
-            if (!IS_NUMBER(args[1])) {
-                runtime_error(gettext("list.remove requires a single numerical argument."));
-                return false;
-            }
-            int index = (int)AS_NUMBER(args[1]);
-            if (index < 0) {
-                index += list->elements.count;
-            }
-            if (index < 0 || index > list->elements.count - 1) {
-                runtime_error(gettext("invalid list.remove index."));
-                return false;
-            }
-            if (index == list->elements.count - 1) {
-                list->elements.count--;
-                vm_push(NUMBER_VAL(list->elements.count));
-                return true;
-            } else {
-                for (int i = index; i < list->elements.count; i++) {
-                    value_t v = list->elements.values[i];
-                    list->elements.values[i] = list->elements.values[i + 1];
-                    list->elements.values[i + 1] = v;
-                }
-                list->elements.count--;
-                vm_push(NUMBER_VAL(list->elements.count));
-                return true;
-            }
+    else if (method->length == 5 && memcmp(method->chars, "count", 5) == 0) {
+        if (argc != 2 || !IS_STRING(args[1])) {
+            runtime_error(gettext("str.count requires a string argument."));
+            return false;
         }
+        vm_push(NUMBER_VAL(string_count(str, AS_STRING(args[1]))));
+        return true;
     }
 
-    else if (method->length == 9 && memcmp(method->chars, KEYWORD_SUBSCRIPT, KEYWORD_SUBSCRIPT_LEN) == 0) {
-        if (!(argc == 2 || argc == 3)) {
-            runtime_error(gettext("list.subscript requires a single index or an index and a value."));
-            return false;
+    else if (method->length == 5 && memcmp(method->chars, "split", 5) == 0) {
+        if (argc == 1) {
+            return string_split_whitespace(str);
         }
-        if (!IS_NUMBER(args[1])) {
-            runtime_error(gettext("list.subscript requires a numerical index."));
+        if (argc != 2 || !IS_STRING(args[1]) || AS_STRING(args[1])->length == 0) {
+            runtime_error(gettext("str.split requires a non-empty separator string."));
+            return false;
+        }
+        return string_split(str, AS_STRING(args[1]));
+    }
+
+    else if (method->length == 5 && memcmp(method->chars, "strip", 5) == 0) {
+        if (argc != 1) {
+            runtime_error(gettext("str.strip takes no arguments."));
+            return false;
+        }
+        int start = 0;
+        int end = str->length;
+        while (start < end && isspace((unsigned char)str->chars[start]))
+            start++;
+        while (end > start && isspace((unsigned char)str->chars[end - 1]))
+            end--;
+        vm_push(OBJ_VAL(obj_string_t_slice(str, start, end - start)));
+        return true;
+    }
+
+    else if (method->length == 7 && memcmp(method->chars, "replace", 7) == 0) {
+        if (argc != 3 || !IS_STRING(args[1]) || !IS_STRING(args[2]) || AS_STRING(args[1])->length == 0) {
+            runtime_error(gettext("str.replace requires a non-empty string to replace and a replacement string."));
+            return false;
+        }
+        return string_replace(str, AS_STRING(args[1]), AS_STRING(args[2]));
+    }
+
+    else if (method->length == 10 && memcmp(method->chars, "startswith", 10) == 0) {
+        if (argc != 2 || !IS_STRING(args[1])) {
+            runtime_error(gettext("str.startswith requires a string argument."));
+            return false;
+        }
+        const obj_string_t *prefix = AS_STRING(args[1]);
+        vm_push(BOOL_VAL(prefix->length <= str->length && memcmp(str->chars, prefix->chars, prefix->length) == 0));
+        return true;
+    }
+
+    else if (method->length == 8 && memcmp(method->chars, "endswith", 8) == 0) {
+        if (argc != 2 || !IS_STRING(args[1])) {
+            runtime_error(gettext("str.endswith requires a string argument."));
+            return false;
+        }
+        const obj_string_t *suffix = AS_STRING(args[1]);
+        vm_push(BOOL_VAL(suffix->length <= str->length && memcmp(str->chars + str->length - suffix->length, suffix->chars, suffix->length) == 0));
+        return true;
+    }
+
+    else if (method->length == 4 && memcmp(method->chars, "join", 4) == 0) {
+        if (argc != 2 || !IS_LIST(args[1])) {
+            runtime_error(gettext("str.join requires a list of strings."));
+            return false;
+        }
+        return string_join(str, AS_LIST(args[1]));
+    }
+
+    runtime_error(gettext("No such str method %.*s"), method->length, method->chars);
+    return false;
+}
+
+static bool call_value(const value_t callee, const int argc);
+static vm_t_interpret_result_t run(const int base_frame);
+static vm_t_interpret_result_t run_registers(const int base_frame);
+
+// call a closure or native from inside a native and wait for its result
+static bool call_from_native(const value_t callee, const int argc, const value_t *args, value_t *result)
+{
+    vm_push(callee);
+    for (int i = 0; i < argc; i++)
+        vm_push(args[i]);
+    const int base_frame = vm.frame_count;
+    if (!call_value(callee, argc))
+        return false;
+    if (vm.frame_count > base_frame && run(base_frame) != INTERPRET_OK)
+        return false;
+    *result = vm_pop();
+    return true;
+}
+
+typedef struct {
+    value_t key;
+    value_t value;
+} sort_item_t;
+
+typedef struct sort_t {
+    int (*compare)(struct sort_t *sort, const sort_item_t *a, const sort_item_t *b);
+    value_t comparator;
+    bool failed;
+} sort_t;
+
+static int sort_compare_strings(sort_t *, const sort_item_t *a, const sort_item_t *b)
+{
+    const obj_string_t *x = AS_STRING(a->key);
+    const obj_string_t *y = AS_STRING(b->key);
+    if (x == y) // interned, or the very same slice
+        return 0;
+    const int result = memcmp(x->chars, y->chars, x->length < y->length ? x->length : y->length);
+    return result != 0 ? result : x->length - y->length;
+}
+
+static int sort_compare_closure(sort_t *sort, const sort_item_t *a, const sort_item_t *b)
+{
+    if (sort->failed)
+        return 0; // unwind quickly, the order no longer matters
+    const value_t args[2] = {a->value, b->value};
+    value_t result;
+    if (!call_from_native(sort->comparator, 2, args, &result)) {
+        sort->failed = true;
+        return 0;
+    }
+    if (!IS_NUMBER(result)) {
+        runtime_error(gettext("list.sort comparator must return a number."));
+        sort->failed = true;
+        return 0;
+    }
+    return AS_NUMBER(result) < 0 ? -1 : (AS_NUMBER(result) > 0 ? 1 : 0);
+}
+
+#define SORT_INSERTION_MAX 16
+
+static void sort_insertion(sort_t *sort, sort_item_t *items, const int count)
+{
+    for (int i = 1; i < count; i++) {
+        const sort_item_t item = items[i];
+        int j = i;
+        for (; j > 0 && sort->compare(sort, &item, &items[j - 1]) < 0; j--)
+            items[j] = items[j - 1];
+        items[j] = item;
+    }
+}
+
+static void sort_sift_down(sort_t *sort, sort_item_t *items, int root, const int count)
+{
+    for (int child = 2 * root + 1; child < count; child = 2 * root + 1) {
+        if (child + 1 < count && sort->compare(sort, &items[child], &items[child + 1]) < 0)
+            child++;
+        if (sort->compare(sort, &items[root], &items[child]) >= 0)
+            return;
+        const sort_item_t swap = items[root];
+        items[root] = items[child];
+        items[child] = swap;
+        root = child;
+    }
+}
+
+static void sort_heap(sort_t *sort, sort_item_t *items, const int count)
+{
+    for (int i = count / 2 - 1; i >= 0; i--)
+        sort_sift_down(sort, items, i, count);
+    for (int end = count - 1; end > 0; end--) {
+        const sort_item_t swap = items[0];
+        items[0] = items[end];
+        items[end] = swap;
+        sort_sift_down(sort, items, 0, end);
+    }
+}
+
+// introsort: median of three quicksort, heapsort once the depth budget is spent, insertion sort for short runs
+static void sort_intro(sort_t *sort, sort_item_t *items, int count, int depth)
+{
+    while (count > SORT_INSERTION_MAX) {
+        if (depth-- == 0) {
+            sort_heap(sort, items, count);
+            return;
+        }
+        sort_item_t *mid = &items[count / 2];
+        sort_item_t *last = &items[count - 1];
+        if (sort->compare(sort, mid, items) < 0) { const sort_item_t t = *mid; *mid = items[0]; items[0] = t; }
+        if (sort->compare(sort, last, mid) < 0) { const sort_item_t t = *last; *last = *mid; *mid = t; }
+        if (sort->compare(sort, mid, items) < 0) { const sort_item_t t = *mid; *mid = items[0]; items[0] = t; }
+        const sort_item_t pivot = *mid;
+
+        // the scans are bounded, a script comparator need not agree with the median of three that would stop them
+        int i = 0;
+        int j = count - 1;
+        for (;;) {
+            while (i < count - 1 && sort->compare(sort, &items[i], &pivot) < 0)
+                i++;
+            while (j > 0 && sort->compare(sort, &pivot, &items[j]) < 0)
+                j--;
+            if (i >= j)
+                break;
+            const sort_item_t t = items[i];
+            items[i] = items[j];
+            items[j] = t;
+            i++;
+            j--;
+        }
+        // recurse into the smaller half, loop on the larger one, both halves non-empty whatever the comparator said
+        const int left = j + 1 < 1 ? 1 : (j + 1 > count - 1 ? count - 1 : j + 1);
+        if (left < count - left) {
+            sort_intro(sort, items, left, depth);
+            items += left;
+            count -= left;
+        } else {
+            sort_intro(sort, items + left, count - left, depth);
+            count = left;
+        }
+    }
+    sort_insertion(sort, items, count);
+}
+
+// stable top down merge sort, insertion sort (also stable) for short runs
+static void sort_merge(sort_t *sort, sort_item_t *items, sort_item_t *scratch, const int count)
+{
+    if (count <= SORT_INSERTION_MAX) {
+        sort_insertion(sort, items, count);
+        return;
+    }
+    const int half = count / 2;
+    sort_merge(sort, items, scratch, half);
+    sort_merge(sort, items + half, scratch, count - half);
+    if (sort->compare(sort, &items[half], &items[half - 1]) >= 0)
+        return; // already in order
+
+    memcpy(scratch, items, sizeof(sort_item_t) * (size_t)half);
+    int i = 0, j = half, k = 0;
+    while (i < half && j < count) {
+        if (sort->compare(sort, &items[j], &scratch[i]) < 0)
+            items[k++] = items[j++];
+        else
+            items[k++] = scratch[i++];
+    }
+    while (i < half)
+        items[k++] = scratch[i++];
+}
+
+#undef SORT_INSERTION_MAX
+
+typedef struct {
+    uint64_t bits;
+    int index;
+} radix_item_t;
+
+// order preserving map from doubles to unsigned integers: flip everything for negatives, just the sign otherwise
+static inline uint64_t sort_double_bits(const double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & (1ull << 63)) ? ~bits : bits | (1ull << 63);
+}
+
+// LSD radix sort a byte at a time, skipping bytes that are the same in every key (the low mantissa bytes of integers)
+static void sort_radix(radix_item_t *items, radix_item_t *scratch, const int count)
+{
+    static int histogram[8][256];
+    memset(histogram, 0, sizeof(histogram));
+    for (int i = 0; i < count; i++) {
+        for (int pass = 0; pass < 8; pass++)
+            histogram[pass][(items[i].bits >> (pass * 8)) & 0xff]++;
+    }
+
+    radix_item_t *from = items;
+    radix_item_t *to = scratch;
+    for (int pass = 0; pass < 8; pass++) {
+        int *counts = histogram[pass];
+        if (counts[(from[0].bits >> (pass * 8)) & 0xff] == count)
+            continue;
+        int offset = 0;
+        for (int bucket = 0; bucket < 256; bucket++) {
+            const int n = counts[bucket];
+            counts[bucket] = offset;
+            offset += n;
+        }
+        for (int i = 0; i < count; i++)
+            to[counts[(from[i].bits >> (pass * 8)) & 0xff]++] = from[i];
+        radix_item_t *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != items)
+        memcpy(items, from, sizeof(radix_item_t) * (size_t)count);
+}
+
+// list.sort([key or comparator], [stable]): a one argument function is a key, two arguments a comparator, anything
+// callable that takes a variable number of arguments is used as a key
+static bool list_sort(obj_list_t *list, const int argc, const value_t *args)
+{
+    const value_t function = argc > 1 ? args[1] : NIL_VAL;
+    int arity = 0;
+    if (IS_CLOSURE(function))
+        arity = AS_CLOSURE(function)->function->arity;
+    else if (IS_BOUND_METHOD(function))
+        arity = AS_BOUND_METHOD(function)->method->function->arity;
+    else if (IS_NATIVE(function))
+        arity = AS_NATIVE(function)->arity < 0 ? 1 : AS_NATIVE(function)->arity;
+    else if (IS_BOUND_NATIVE_METHOD(function))
+        arity = 1;
+    if (argc > 3 || (!IS_NIL(function) && arity != 1 && arity != 2) || (argc == 3 && !IS_BOOL(args[2]))) {
+        runtime_error(gettext("list.sort takes an optional key or comparator function and an optional stable flag."));
+        return false;
+    }
+    const bool stable = argc == 3 && AS_BOOL(args[2]);
+    const int count = list->elements.count;
+    if (count < 2) {
+        vm_push(NIL_VAL);
+        return true;
+    }
+
+    // move the elements into a rooted work list so a comparator that changes the list cannot pull them out from under us
+    obj_list_t *work = obj_list_t_allocate();
+    work->elements = list->elements;
+    value_list_t_init(&list->elements);
+    vm_push(OBJ_VAL(work));
+
+    // decorate with keys, computed once per element
+    obj_list_t *keys = work;
+    if (arity == 1) {
+        keys = obj_list_t_allocate();
+        vm_push(OBJ_VAL(keys));
+        value_list_t_reserve(&keys->elements, count);
+        for (int i = 0; i < count; i++) {
+            value_t key;
+            if (!call_from_native(function, 1, &work->elements.values[i], &key)) {
+                value_list_t_free(&list->elements);
+                list->elements = work->elements;
+                value_list_t_init(&work->elements);
+                return false;
+            }
+            value_list_t_add(&keys->elements, key);
+        }
+    }
+
+    bool numbers = arity != 2;
+    bool strings = arity != 2;
+    for (int i = 0; i < count && (numbers || strings); i++) {
+        numbers = numbers && IS_NUMBER(keys->elements.values[i]);
+        strings = strings && IS_STRING(keys->elements.values[i]);
+    }
+    if (arity != 2 && count > 0 && !numbers && !strings) {
+        runtime_error(gettext("list.sort requires all numbers or all strings, or a comparator."));
+        value_list_t_free(&list->elements);
+        list->elements = work->elements;
+        value_list_t_init(&work->elements);
+        return false;
+    }
+
+    sort_t sort = {.compare = strings ? sort_compare_strings : sort_compare_closure, .comparator = function, .failed = false};
+    value_t *sorted = ALLOCATE(value_t, count);
+    if (numbers) {
+        // radix sort is stable, so one path serves both
+        radix_item_t *items = ALLOCATE(radix_item_t, count * 2);
+        for (int i = 0; i < count; i++)
+            items[i] = (radix_item_t){sort_double_bits(AS_NUMBER(keys->elements.values[i])), i};
+        sort_radix(items, items + count, count);
+        for (int i = 0; i < count; i++)
+            sorted[i] = work->elements.values[items[i].index];
+        FREE_ARRAY(radix_item_t, items, count * 2);
+    } else {
+        sort_item_t *items = ALLOCATE(sort_item_t, stable ? count + count / 2 + 1 : count);
+        for (int i = 0; i < count; i++)
+            items[i] = (sort_item_t){keys->elements.values[i], work->elements.values[i]};
+        if (stable) {
+            sort_merge(&sort, items, items + count, count);
+        } else {
+            int depth = 0;
+            for (int n = count; n > 1; n >>= 1)
+                depth += 2;
+            sort_intro(&sort, items, count, depth);
+        }
+        for (int i = 0; i < count && !sort.failed; i++)
+            sorted[i] = items[i].value;
+        FREE_ARRAY(sort_item_t, items, stable ? count + count / 2 + 1 : count);
+    }
+
+    const bool modified = list->elements.count != 0;
+    value_list_t_free(&list->elements);
+    list->elements = work->elements;
+    value_list_t_init(&work->elements);
+    if (!sort.failed)
+        memcpy(list->elements.values, sorted, sizeof(value_t) * (size_t)count);
+    FREE_ARRAY(value_t, sorted, count);
+    if (sort.failed)
+        return false;
+    if (modified) {
+        runtime_error(gettext("list modified during sort."));
+        return false;
+    }
+    vm.stack_top = (value_t *)args + argc; // drop the work and key lists
+    vm_push(NIL_VAL);
+    return true;
+}
+
+static bool list_method_invoke(const obj_string_t *method, const int argc, const value_t *args)
+{
+    obj_list_t *list = AS_LIST(args[0]);
+
+    if (method->length == 3) {
+        if (memcmp(method->chars, KEYWORD_LEN, KEYWORD_LEN_LEN) == 0) {
+            if (argc > 1) {
+                runtime_error(gettext("list.len takes no arguments."));
+                return false;
+            }
+            vm_push(NUMBER_VAL(list->elements.count));
+            return true;
+        }
+        else if (memcmp(method->chars, KEYWORD_GET, KEYWORD_GET_LEN) == 0) {
+            if (argc != 2) {
+                runtime_error(gettext("list.get requires a single numerical argument."));
+                return false;
+            }
+            if (!IS_NUMBER(args[1])) {
+                runtime_error(gettext("list.get requires a single numerical argument."));
+                return false;
+            }
+            int index = (int)AS_NUMBER(args[1]);
+            if (index < 0) {
+                index += list->elements.count;
+            }
+            if (index < 0 || index > list->elements.count - 1) {
+                runtime_error(gettext("invalid list.get index."));
+                return false;
+            }
+            value_t v = list->elements.values[index];
+            vm_push(v);
+            return true;
+        }
+        else if (memcmp(method->chars, "pop", 3) == 0) {
+            if (argc > 2 || (argc == 2 && !IS_NUMBER(args[1]))) {
+                runtime_error(gettext("list.pop takes an optional index."));
+                return false;
+            }
+            int index = argc == 2 ? (int)AS_NUMBER(args[1]) : -1;
+            if (index < 0) {
+                index += list->elements.count;
+            }
+            if (index < 0 || index > list->elements.count - 1) {
+                runtime_error(gettext("invalid list.pop index."));
+                return false;
+            }
+            const value_t v = list->elements.values[index];
+            memmove(&list->elements.values[index], &list->elements.values[index + 1],
+                sizeof(value_t) * (size_t)(list->elements.count - index - 1));
+            list->elements.count--;
+            vm_push(v);
+            return true;
+        }
+    }
+
+    else if (method->length == 5) {
+        if (memcmp(method->chars, KEYWORD_CLEAR, KEYWORD_CLEAR_LEN) == 0) {
+            if (argc != 1) {
+                runtime_error(gettext("list.clear requires no arguments."));
+                return false;
+            }
+            list->elements.count = 0;
+            vm_push(NIL_VAL);
+            return true;
+        }
+        else if (memcmp(method->chars, "slice", 5) == 0) {
+            if (argc < 2 || argc > 3 || !IS_NUMBER(args[1]) || (argc == 3 && !IS_NUMBER(args[2]))) {
+                runtime_error(gettext("list.slice requires a start and an optional end position."));
+                return false;
+            }
+            const int count = list->elements.count;
+            int start = (int)AS_NUMBER(args[1]);
+            int end = argc == 3 ? (int)AS_NUMBER(args[2]) : count;
+            if (start < 0)
+                start += count;
+            if (end < 0)
+                end += count;
+            start = start < 0 ? 0 : (start > count ? count : start);
+            end = end < start ? start : (end > count ? count : end);
+
+            obj_list_t *slice = obj_list_t_allocate();
+            vm_push(OBJ_VAL(slice));
+            value_list_t_reserve(&slice->elements, end - start);
+            if (end > start)
+                memcpy(slice->elements.values, list->elements.values + start, sizeof(value_t) * (size_t)(end - start));
+            slice->elements.count = end - start;
+            return true;
+        }
+        else if (memcmp(method->chars, "index", 5) == 0) {
+            if (argc != 2) {
+                runtime_error(gettext("list.index requires a single argument."));
+                return false;
+            }
+            int found = -1;
+            for (int i = 0; i < list->elements.count; i++) {
+                if (value_t_equal(list->elements.values[i], args[1])) {
+                    found = i;
+                    break;
+                }
+            }
+            vm_push(NUMBER_VAL(found));
+            return true;
+        }
+    }
+
+    else if (method->length == 6) {
+        if (memcmp(method->chars, KEYWORD_APPEND, KEYWORD_APPEND_LEN) == 0) {
+            if (argc != 2) {
+                runtime_error(gettext("list.append requires a single argument."));
+                return false;
+            }
+            value_t to_add = args[1];
+            value_list_t_add(&list->elements, to_add);
+            vm_push(to_add);
+            return true;
+        }
+        if (memcmp(method->chars, KEYWORD_REMOVE, KEYWORD_REMOVE_LEN) == 0) {
+            if (list->elements.count == 0) {
+                vm_push(NUMBER_VAL(list->elements.count));
+                return true;
+            }
+            if (argc != 2) {
+                runtime_error(gettext("list.remove requires a single argument."));
+                return false;
+            }
+            if (!IS_NUMBER(args[1])) {
+                runtime_error(gettext("list.remove requires a single numerical argument."));
+                return false;
+            }
+            int index = (int)AS_NUMBER(args[1]);
+            if (index < 0) {
+                index += list->elements.count;
+            }
+            if (index < 0 || index > list->elements.count - 1) {
+                runtime_error(gettext("invalid list.remove index."));
+                return false;
+            }
+            memmove(&list->elements.values[index], &list->elements.values[index + 1],
+                sizeof(value_t) * (size_t)(list->elements.count - index - 1));
+            list->elements.count--;
+            vm_push(NUMBER_VAL(list->elements.count));
+            return true;
+        }
+        if (memcmp(method->chars, "insert", 6) == 0) {
+            if (argc != 3 || !IS_NUMBER(args[1])) {
+                runtime_error(gettext("list.insert requires an index and a value."));
+                return false;
+            }
+            int index = (int)AS_NUMBER(args[1]);
+            if (index < 0) {
+                index += list->elements.count;
+            }
+            if (index < 0 || index > list->elements.count) {
+                runtime_error(gettext("invalid list.insert index."));
+                return false;
+            }
+            value_list_t_add(&list->elements, args[2]); // grow by one, then shift into place
+            memmove(&list->elements.values[index + 1], &list->elements.values[index],
+                sizeof(value_t) * (size_t)(list->elements.count - index - 1));
+            list->elements.values[index] = args[2];
+            vm_push(args[2]);
+            return true;
+        }
+        if (memcmp(method->chars, "extend", 6) == 0) {
+            if (argc != 2 || !IS_LIST(args[1])) {
+                runtime_error(gettext("list.extend requires a list argument."));
+                return false;
+            }
+            const obj_list_t *other = AS_LIST(args[1]);
+            const int count = other->elements.count; // other may be the list itself
+            value_list_t_reserve(&list->elements, list->elements.count + count);
+            if (count > 0)
+                memcpy(&list->elements.values[list->elements.count], other->elements.values, sizeof(value_t) * (size_t)count);
+            list->elements.count += count;
+            vm_push(args[0]);
+            return true;
+        }
+    }
+
+    else if (method->length == 7) {
+        if (memcmp(method->chars, "reserve", 7) == 0) {
+            if (argc != 2 || !IS_NUMBER(args[1]) || AS_NUMBER(args[1]) < 0 || AS_NUMBER(args[1]) > INT_MAX) {
+                runtime_error(gettext("list.reserve requires a non-negative capacity."));
+                return false;
+            }
+            value_list_t_reserve(&list->elements, (int)AS_NUMBER(args[1]));
+            vm_push(args[0]);
+            return true;
+        }
+        if (memcmp(method->chars, "reverse", 7) == 0) {
+            if (argc != 1) {
+                runtime_error(gettext("list.reverse takes no arguments."));
+                return false;
+            }
+            value_t *values = list->elements.values;
+            for (int i = 0, j = list->elements.count - 1; i < j; i++, j--) {
+                const value_t v = values[i];
+                values[i] = values[j];
+                values[j] = v;
+            }
+            vm_push(args[0]);
+            return true;
+        }
+    }
+
+    else if (method->length == 4 && memcmp(method->chars, "sort", 4) == 0) {
+        return list_sort(list, argc, args);
+    }
+
+    else if (method->length == 9 && memcmp(method->chars, KEYWORD_SUBSCRIPT, KEYWORD_SUBSCRIPT_LEN) == 0) {
+        if (!(argc == 2 || argc == 3)) {
+            runtime_error(gettext("list.subscript requires a single index or an index and a value."));
+            return false;
+        }
+        if (!IS_NUMBER(args[1])) {
+            runtime_error(gettext("list.subscript requires a numerical index."));
             return false;
         }
         int index = (int)AS_NUMBER(args[1]);
         if (index < 0) {
             index += list->elements.count;
         }
-        if (index < 0 || index > list->elements.count - 1) {
-            runtime_error(gettext("invalid list.subscript index."));
+        if (index < 0 || index > list->elements.count - 1) {
+            runtime_error(gettext("invalid list.subscript index."));
+            return false;
+        }
+        if (argc == 3) {
+            list->elements.values[index] = args[2];
+            vm_push(args[2]);
+        } else {
+            value_t v = list->elements.values[index];
+            vm_push(v);
+        }
+        return true;
+    }
+
+    runtime_error(gettext("No such list method %.*s"), method->length, method->chars);
+    return false;
+}
+
+static bool map_method_invoke(const obj_string_t *method, const int argc, const value_t *args)
+{
+    obj_map_t *map = AS_MAP(args[0]);
+
+    if (method->length == 3) {
+        if (memcmp(method->chars, KEYWORD_LEN, KEYWORD_LEN_LEN) == 0) {
+            if (argc > 1) {
+                runtime_error(gettext("map.len takes no arguments."));
+                return false;
+            }
+            vm_push(NUMBER_VAL(obj_map_t_count(map)));
+            return true;
+        }
+        else if (memcmp(method->chars, KEYWORD_GET, KEYWORD_GET_LEN) == 0) {
+            if (argc != 2 || !IS_STRING(args[1])) {
+                runtime_error(gettext("map.get requires a single string argument."));
+                return false;
+            }
+            value_t v;
+            if (obj_map_t_get(map, args[1], &v)) {
+                vm_push(v);
+            } else {
+                vm_push(NIL_VAL);
+            }
+            return true;
+        }
+        else if (memcmp(method->chars, KEYWORD_SET, KEYWORD_SET_LEN) == 0) {
+            if (argc != 3) {
+                runtime_error(gettext("map.set requires a key and a value argument."));
+                return false;
+            }
+            value_t v = args[2];
+            obj_map_t_set(map, args[1], v);
+            vm_push(v);
+            return true;
+        }
+    }
+
+    else if (method->length == 4 && memcmp(method->chars, KEYWORD_KEYS, KEYWORD_KEYS_LEN) == 0) {
+        if (argc > 1) {
+            runtime_error(gettext("map.keys takes no arguments."));
+            return false;
+        }
+        obj_list_t *keys = obj_list_t_allocate();
+        vm_push(OBJ_VAL(keys));
+        int cursor = 0;
+        value_t key, value;
+        while (obj_map_t_next(map, &cursor, &key, &value)) {
+            value_list_t_add(&keys->elements, key);
+        }
+        return true;
+    }
+
+    else if (method->length == 6) {
+        if (memcmp(method->chars, KEYWORD_REMOVE, KEYWORD_REMOVE_LEN) == 0) {
+            if (argc != 2) {
+                runtime_error(gettext("map.remove requires a single key argument."));
+                return false;
+            }
+            obj_map_t_delete(map, args[1]);
+            vm_push(NIL_VAL);
+            return true;
+        }
+        else if (memcmp(method->chars, KEYWORD_VALUES, KEYWORD_VALUES_LEN) == 0) {
+            if (argc != 1) {
+                runtime_error(gettext("map.values requires no arguments."));
+                return false;
+            }
+            obj_list_t *values = obj_list_t_allocate();
+            vm_push(OBJ_VAL(values));
+            int cursor = 0;
+            value_t key, value;
+            while (obj_map_t_next(map, &cursor, &key, &value)) {
+                value_list_t_add(&values->elements, value);
+            }
+            return true;
+        }
+    }
+
+    else if (method->length == 9 && memcmp(method->chars, KEYWORD_SUBSCRIPT, KEYWORD_SUBSCRIPT_LEN) == 0) {
+        if (!(argc == 2 || argc == 3)) {
+            runtime_error(gettext("map.subscript requires a single key argument or a key and a value."));
+            return false;
+        }
+        if (argc == 3) {
+            obj_map_t_set(map, args[1], args[2]);
+            vm_push(args[2]);
+            return true;
+        }
+
+        value_t v;
+        if (obj_map_t_get(map, args[1], &v)) {
+            vm_push(v);
+        } else {
+            vm_push(NIL_VAL);
+        }
+        return true;
+    }
+
+    runtime_error(gettext("No such map method %.*s"), method->length, method->chars);
+    return false;
+}
+
+// gcc/clang vector extension: two doubles per SSE2/NEON register, two registers in flight
+typedef double double2_t __attribute__((vector_size(2 * sizeof(double))));
+
+static inline double2_t load_double2(const double *values)
+{
+    double2_t v;
+    memcpy(&v, values, sizeof(v));
+    return v;
+}
+
+static double array_sum(const double *values, const int count)
+{
+    double2_t a = {0, 0};
+    double2_t b = {0, 0};
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        a += load_double2(values + i);
+        b += load_double2(values + i + 2);
+    }
+    a += b;
+    double sum = a[0] + a[1];
+    for (; i < count; i++)
+        sum += values[i];
+    return sum;
+}
+
+static double array_dot(const double *x, const double *y, const int count)
+{
+    double2_t a = {0, 0};
+    double2_t b = {0, 0};
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        a += load_double2(x + i) * load_double2(y + i);
+        b += load_double2(x + i + 2) * load_double2(y + i + 2);
+    }
+    a += b;
+    double sum = a[0] + a[1];
+    for (; i < count; i++)
+        sum += x[i] * y[i];
+    return sum;
+}
+
+static double array_extreme(const double *values, const int count, const bool max)
+{
+    // independent lanes so the comparisons do not serialize on one register
+    double lanes[4] = {values[0], values[0], values[0], values[0]};
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (int lane = 0; lane < 4; lane++) {
+            const double v = values[i + lane];
+            if (max ? v > lanes[lane] : v < lanes[lane])
+                lanes[lane] = v;
+        }
+    }
+    for (; i < count; i++) {
+        if (max ? values[i] > lanes[0] : values[i] < lanes[0])
+            lanes[0] = values[i];
+    }
+    double result = lanes[0];
+    for (int lane = 1; lane < 4; lane++) {
+        if (max ? lanes[lane] > result : lanes[lane] < result)
+            result = lanes[lane];
+    }
+    return result;
+}
+
+static bool array_method_invoke(const obj_string_t *method, const int argc, const value_t *args)
+{
+    obj_array_t *array = AS_ARRAY(args[0]);
+
+    if (method->length == 3 && memcmp(method->chars, KEYWORD_LEN, KEYWORD_LEN_LEN) == 0) {
+        if (argc != 1) {
+            runtime_error(gettext("array.len takes no arguments."));
+            return false;
+        }
+        vm_push(NUMBER_VAL(array->count));
+        return true;
+    }
+
+    else if (method->length == 9 && memcmp(method->chars, KEYWORD_SUBSCRIPT, KEYWORD_SUBSCRIPT_LEN) == 0) {
+        if (!(argc == 2 || argc == 3) || !IS_NUMBER(args[1]) || (argc == 3 && !IS_NUMBER(args[2]))) {
+            runtime_error(gettext("array.subscript requires a numerical index and an optional number to set."));
+            return false;
+        }
+        int index = (int)AS_NUMBER(args[1]);
+        if (index < 0) {
+            index += array->count;
+        }
+        if (index < 0 || index > array->count - 1) {
+            runtime_error(gettext("invalid array.subscript index."));
             return false;
         }
-        if (argc == 3) {
-            list->elements.values[index] = args[2];
-            vm_push(args[2]);
+        if (argc == 3)
+            array->values[index] = AS_NUMBER(args[2]);
+        vm_push(NUMBER_VAL(array->values[index]));
+        return true;
+    }
+
+    else if (method->length == 6 && memcmp(method->chars, KEYWORD_APPEND, KEYWORD_APPEND_LEN) == 0) {
+        if (argc != 2 || !IS_NUMBER(args[1])) {
+            runtime_error(gettext("array.append requires a number."));
+            return false;
+        }
+        obj_array_t_add(array, AS_NUMBER(args[1]));
+        vm_push(args[1]);
+        return true;
+    }
+
+    else if (method->length == 5 && memcmp(method->chars, "slice", 5) == 0) {
+        if (argc < 2 || argc > 3 || !IS_NUMBER(args[1]) || (argc == 3 && !IS_NUMBER(args[2]))) {
+            runtime_error(gettext("array.slice requires a start and an optional end position."));
+            return false;
+        }
+        int start = (int)AS_NUMBER(args[1]);
+        int end = argc == 3 ? (int)AS_NUMBER(args[2]) : array->count;
+        if (start < 0)
+            start += array->count;
+        if (end < 0)
+            end += array->count;
+        start = start < 0 ? 0 : (start > array->count ? array->count : start);
+        end = end < start ? start : (end > array->count ? array->count : end);
+
+        obj_array_t *slice = obj_array_t_allocate();
+        vm_push(OBJ_VAL(slice));
+        obj_array_t_reserve(slice, end - start);
+        if (end > start)
+            memcpy(slice->values, array->values + start, sizeof(double) * (size_t)(end - start));
+        slice->count = end - start;
+        return true;
+    }
+
+    else if (method->length == 6 && memcmp(method->chars, "tolist", 6) == 0) {
+        if (argc != 1) {
+            runtime_error(gettext("array.tolist takes no arguments."));
+            return false;
+        }
+        obj_list_t *list = obj_list_t_allocate();
+        vm_push(OBJ_VAL(list));
+        value_list_t_reserve(&list->elements, array->count);
+        for (int i = 0; i < array->count; i++)
+            list->elements.values[i] = NUMBER_VAL(array->values[i]);
+        list->elements.count = array->count;
+        return true;
+    }
+
+    else if ((method->length == 3 && memcmp(method->chars, "sum", 3) == 0) || (method->length == 4 && memcmp(method->chars, "mean", 4) == 0)) {
+        if (argc != 1) {
+            runtime_error(gettext("array.%.*s takes no arguments."), method->length, method->chars);
+            return false;
+        }
+        const double sum = array_sum(array->values, array->count);
+        if (method->length == 3)
+            vm_push(NUMBER_VAL(sum));
+        else
+            vm_push(array->count > 0 ? NUMBER_VAL(sum / array->count) : NIL_VAL);
+        return true;
+    }
+
+    else if (method->length == 3 && (memcmp(method->chars, "min", 3) == 0 || memcmp(method->chars, "max", 3) == 0)) {
+        if (argc != 1) {
+            runtime_error(gettext("array.%.*s takes no arguments."), method->length, method->chars);
+            return false;
+        }
+        if (array->count == 0)
+            vm_push(NIL_VAL);
+        else
+            vm_push(NUMBER_VAL(array_extreme(array->values, array->count, method->chars[1] == 'a')));
+        return true;
+    }
+
+    else if (method->length == 3 && memcmp(method->chars, "dot", 3) == 0) {
+        if (argc != 2 || !IS_ARRAY(args[1]) || AS_ARRAY(args[1])->count != array->count) {
+            runtime_error(gettext("array.dot requires an array of the same length."));
+            return false;
+        }
+        vm_push(NUMBER_VAL(array_dot(array->values, AS_ARRAY(args[1])->values, array->count)));
+        return true;
+    }
+
+    // in place bulk updates return the array so they can be chained
+    else if (method->length == 5 && memcmp(method->chars, "scale", 5) == 0) {
+        if (argc != 2 || !IS_NUMBER(args[1])) {
+            runtime_error(gettext("array.scale requires a number."));
+            return false;
+        }
+        const double factor = AS_NUMBER(args[1]);
+        double *values = array->values;
+        for (int i = 0; i < array->count; i++)
+            values[i] *= factor;
+        vm_push(args[0]);
+        return true;
+    }
+
+    else if (method->length == 3 && memcmp(method->chars, "add", 3) == 0) {
+        if (argc != 2 || !(IS_NUMBER(args[1]) || (IS_ARRAY(args[1]) && AS_ARRAY(args[1])->count == array->count))) {
+            runtime_error(gettext("array.add requires a number or an array of the same length."));
+            return false;
+        }
+        double *values = array->values;
+        if (IS_NUMBER(args[1])) {
+            const double addend = AS_NUMBER(args[1]);
+            for (int i = 0; i < array->count; i++)
+                values[i] += addend;
         } else {
-            value_t v = list->elements.values[index];
-            vm_push(v);
+            const double *other = AS_ARRAY(args[1])->values;
+            for (int i = 0; i < array->count; i++)
+                values[i] += other[i];
+        }
+        vm_push(args[0]);
+        return true;
+    }
+
+    else if (method->length == 4 && memcmp(method->chars, "fill", 4) == 0) {
+        if (argc != 2 || !IS_NUMBER(args[1])) {
+            runtime_error(gettext("array.fill requires a number."));
+            return false;
         }
+        const double value = AS_NUMBER(args[1]);
+        double *values = array->values;
+        for (int i = 0; i < array->count; i++)
+            values[i] = value;
+        vm_push(args[0]);
         return true;
     }
 
-    runtime_error(gettext("No such list method %.*s"), method->length, method->chars);
+    runtime_error(gettext("No such array method %.*s"), method->length, method->chars);
     return false;
 }
 
-static bool map_method_invoke(const obj_string_t *method, const int argc, const value_t *args)
+// add every element of a list, array, set or range
+static bool set_add_all(value_set_t *keys, const value_t from)
 {
-    obj_map_t *map = AS_MAP(args[0]);
+    if (IS_LIST(from)) {
+        const value_list_t *elements = &AS_LIST(from)->elements;
+        for (int i = 0; i < elements->count; i++)
+            value_set_t_add(keys, elements->values[i]);
+    } else if (IS_SET(from)) {
+        const value_set_t *other = &AS_SET(from)->keys;
+        int cursor = 0;
+        value_t key;
+        while (value_set_t_next(other, &cursor, &key))
+            value_set_t_add(keys, key);
+    } else if (IS_ARRAY(from)) {
+        const obj_array_t *array = AS_ARRAY(from);
+        for (int i = 0; i < array->count; i++)
+            value_set_t_add(keys, NUMBER_VAL(array->values[i]));
+    } else if (IS_RANGE(from)) {
+        const obj_range_t *range = AS_RANGE(from);
+        const int count = obj_range_t_count(range);
+        for (int i = 0; i < count; i++)
+            value_set_t_add(keys, NUMBER_VAL(range->start + i * range->step));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool set_method_invoke(const obj_string_t *method, const int argc, const value_t *args)
+{
+    obj_set_t *set = AS_SET(args[0]);
 
     if (method->length == 3) {
         if (memcmp(method->chars, KEYWORD_LEN, KEYWORD_LEN_LEN) == 0) {
-            if (argc > 1) {
-                runtime_error(gettext("map.len takes no arguments."));
+            if (argc != 1) {
+                runtime_error(gettext("set.len takes no arguments."));
                 return false;
             }
-            size_t count = 0;
-            for (int i = 0; i < map->table.capacity; i++) {
-                table_entry_t table_entry = map->table.entries[i];
-                if (!IS_EMPTY(table_entry.key)) {
-                    count++;
-                }
-            }
-            vm_push(NUMBER_VAL(count));
+            vm_push(NUMBER_VAL(set->keys.count));
             return true;
         }
-        else if (memcmp(method->chars, KEYWORD_GET, KEYWORD_GET_LEN) == 0) {
-            if (argc != 2 || !IS_STRING(args[1])) {
-                runtime_error(gettext("map.get requires a single string argument."));
+        else if (memcmp(method->chars, "add", 3) == 0) {
+            if (argc != 2) {
+                runtime_error(gettext("set.add requires a single argument."));
                 return false;
             }
-            value_t v;
-            if (table_t_get(&map->table, args[1], &v)) {
-                vm_push(v);
-            } else {
-                vm_push(NIL_VAL);
-            }
+            const bool added = value_set_t_add(&set->keys, args[1]);
+            if (added)
+                set->modifications++;
+            vm_push(BOOL_VAL(added));
             return true;
         }
-        else if (memcmp(method->chars, KEYWORD_SET, KEYWORD_SET_LEN) == 0) {
-            if (argc != 3) {
-                runtime_error(gettext("map.set requires a key and a value argument."));
+        else if (memcmp(method->chars, "has", 3) == 0) {
+            if (argc != 2) {
+                runtime_error(gettext("set.has requires a single argument."));
                 return false;
             }
-            value_t v = args[2];
-            table_t_set(&map->table, args[1], v);
-            vm_push(v);
+            vm_push(BOOL_VAL(value_set_t_has(&set->keys, args[1])));
             return true;
         }
     }
 
-    else if (method->length == 4 && memcmp(method->chars, KEYWORD_KEYS, KEYWORD_KEYS_LEN) == 0) {
-        if (argc > 1) {
-            runtime_error(gettext("map.keys takes no arguments."));
+    else if (method->length == 6 && memcmp(method->chars, KEYWORD_REMOVE, KEYWORD_REMOVE_LEN) == 0) {
+        if (argc != 2) {
+            runtime_error(gettext("set.remove requires a single argument."));
             return false;
         }
-        obj_list_t *keys = obj_list_t_allocate();
-        vm_push(OBJ_VAL(keys));
-        for (int i = 0; i < map->table.capacity; i++) {
-            table_entry_t table_entry = map->table.entries[i];
-            if (!IS_EMPTY(table_entry.key)) {
-                value_list_t_add(&keys->elements, table_entry.key);
-            }
+        const bool removed = value_set_t_remove(&set->keys, args[1]);
+        if (removed)
+            set->modifications++;
+        vm_push(BOOL_VAL(removed));
+        return true;
+    }
+
+    else if (method->length == 5 && memcmp(method->chars, KEYWORD_CLEAR, KEYWORD_CLEAR_LEN) == 0) {
+        if (argc != 1) {
+            runtime_error(gettext("set.clear takes no arguments."));
+            return false;
         }
+        value_set_t_free(&set->keys);
+        set->modifications++;
+        vm_push(NIL_VAL);
         return true;
     }
 
-    else if (method->length == 6) {
-        if (memcmp(method->chars, KEYWORD_REMOVE, KEYWORD_REMOVE_LEN) == 0) {
-            if (argc != 2) {
-                runtime_error(gettext("map.remove requires a single key argument."));
-                return false;
-            }
-            table_t_delete(&map->table, args[1]);
-            vm_push(NIL_VAL);
-            return true;
+    else if (method->length == 6 && memcmp(method->chars, "update", 6) == 0) {
+        const int count = set->keys.count;
+        if (argc != 2 || !set_add_all(&set->keys, args[1])) {
+            runtime_error(gettext("set.update requires a list, array, set or range."));
+            return false;
         }
-        else if (memcmp(method->chars, KEYWORD_VALUES, KEYWORD_VALUES_LEN) == 0) {
-            if (argc != 1) {
-                runtime_error(gettext("map.values requires no arguments."));
-                return false;
-            }
-            obj_list_t *values = obj_list_t_allocate();
-            vm_push(OBJ_VAL(values));
-            for (int i = 0; i < map->table.capacity; i++) {
-                table_entry_t table_entry = map->table.entries[i];
-                if (!IS_EMPTY(table_entry.key)) {
-                    value_list_t_add(&values->elements, table_entry.value);
-                }
-            }
+        if (set->keys.count != count)
+            set->modifications++;
+        vm_push(args[0]);
+        return true;
+    }
+
+    else if (method->length == 6 && memcmp(method->chars, "tolist", 6) == 0) {
+        if (argc != 1) {
+            runtime_error(gettext("set.tolist takes no arguments."));
+            return false;
+        }
+        obj_list_t *list = obj_list_t_allocate();
+        vm_push(OBJ_VAL(list));
+        value_list_t_reserve(&list->elements, set->keys.count);
+        int cursor = 0;
+        value_t key;
+        while (value_set_t_next(&set->keys, &cursor, &key))
+            list->elements.values[list->elements.count++] = key;
+        return true;
+    }
+
+    else if ((method->length == 5 && memcmp(method->chars, "union", 5) == 0)
+        || (method->length == 12 && memcmp(method->chars, "intersection", 12) == 0)
+        || (method->length == 10 && memcmp(method->chars, "difference", 10) == 0)) {
+        if (argc != 2 || !IS_SET(args[1])) {
+            runtime_error(gettext("set.%.*s requires a set argument."), method->length, method->chars);
+            return false;
+        }
+        const value_set_t *other = &AS_SET(args[1])->keys;
+        obj_set_t *result = obj_set_t_allocate();
+        vm_push(OBJ_VAL(result));
+        if (method->length == 5) {
+            set_add_all(&result->keys, args[0]);
+            set_add_all(&result->keys, args[1]);
             return true;
         }
+        // walk the smaller side for intersections
+        const bool intersection = method->length == 12;
+        const value_set_t *walk = intersection && other->count < set->keys.count ? other : &set->keys;
+        const value_set_t *probe = walk == other ? &set->keys : other;
+        int cursor = 0;
+        value_t key;
+        while (value_set_t_next(walk, &cursor, &key)) {
+            if (value_set_t_has(probe, key) == intersection)
+                value_set_t_add(&result->keys, key);
+        }
+        return true;
+    }
+
+    runtime_error(gettext("No such set method %.*s"), method->length, method->chars);
+    return false;
+}
+
+static bool range_method_invoke(const obj_string_t *method, const int argc, const value_t *args)
+{
+    const obj_range_t *range = AS_RANGE(args[0]);
+    const int count = obj_range_t_count(range);
+
+    if (method->length == 3 && memcmp(method->chars, KEYWORD_LEN, KEYWORD_LEN_LEN) == 0) {
+        if (argc != 1) {
+            runtime_error(gettext("range.len takes no arguments."));
+            return false;
+        }
+        vm_push(NUMBER_VAL(count));
+        return true;
     }
 
     else if (method->length == 9 && memcmp(method->chars, KEYWORD_SUBSCRIPT, KEYWORD_SUBSCRIPT_LEN) == 0) {
-        if (!(argc == 2 || argc == 3)) {
-            runtime_error(gettext("map.subscript requires a single key argument or a key and a value."));
+        if (argc != 2 || !IS_NUMBER(args[1])) {
+            runtime_error(gettext("range.subscript requires a numerical index."));
             return false;
         }
-        if (argc == 3) {
-            table_t_set(&map->table, args[1], args[2]);
-            vm_push(args[2]);
-            return true;
+        int index = (int)AS_NUMBER(args[1]);
+        if (index < 0)
+            index += count;
+        if (index < 0 || index >= count) {
+            runtime_error(gettext("invalid range.subscript index."));
+            return false;
         }
+        vm_push(NUMBER_VAL(range->start + index * range->step));
+        return true;
+    }
 
-        value_t v;
-        if (table_t_get(&map->table, args[1], &v)) {
-            vm_push(v);
-        } else {
-            vm_push(NIL_VAL);
+    else if (method->length == 6 && memcmp(method->chars, "tolist", 6) == 0) {
+        if (argc != 1) {
+            runtime_error(gettext("range.tolist takes no arguments."));
+            return false;
         }
+        obj_list_t *list = obj_list_t_allocate();
+        vm_push(OBJ_VAL(list));
+        value_list_t_reserve(&list->elements, count);
+        for (int i = 0; i < count; i++)
+            list->elements.values[i] = NUMBER_VAL(range->start + i * range->step);
+        list->elements.count = count;
         return true;
     }
 
-    runtime_error(gettext("No such map method %.*s"), method->length, method->chars);
+    runtime_error(gettext("No such range method %.*s"), method->length, method->chars);
     return false;
 }
 
@@ -733,6 +2079,8 @@ static bool file_native(const int argc, const value_t *args)
         return false;
     }
 
+    obj_string_t_cstring(AS_STRING(args[0]));
+    obj_string_t_cstring(AS_STRING(args[1]));
     obj_file_t *file = obj_file_t_allocate(AS_STRING(args[0]), AS_STRING(args[1]));
     vm_push(OBJ_VAL(file));
     return true;
@@ -839,6 +2187,7 @@ static bool file_method_invoke(const obj_string_t *method, const int argc, const
                 return false;
             }
             obj_string_t *str = AS_STRING(args[1]);
+            obj_string_t_cstring(str);
 
             off_t fixed_up = 0;
             ssize_t written = 0;
@@ -1003,9 +2352,16 @@ void vm_t_init(void)
     vm.gray_stack = NULL;
 
     table_t_init(&vm.globals);
-    table_t_init(&vm.strings);
+    string_set_t_init(&vm.strings);
     vm.init_string = NULL; // in case of GC race inside obj_string_t_copy_from that allocates
     vm.init_string = obj_string_t_copy_from(KEYWORD_INIT, KEYWORD_INIT_LEN, true);
+    vm.subscript_string = NULL;
+    vm.subscript_string = obj_string_t_copy_from(KEYWORD_SUBSCRIPT, KEYWORD_SUBSCRIPT_LEN, true);
+    memset(vm.char_strings, 0, sizeof vm.char_strings);
+    for (int c = 0; c < 256; c++) {
+        const char ch = (char)c;
+        vm.char_strings[c] = obj_string_t_copy_from(&ch, 1, true);
+    }
 
     vm_define_native("clock", clock_native, 0);
     vm_define_native("has_field", has_field_native, 2);
@@ -1014,10 +2370,14 @@ void vm_t_init(void)
     vm_define_native("get_field", get_field_native, 2);
     vm_define_native("set_field", set_field_native, 3);
     vm_define_native("str", str_native, -1);
+    vm_define_native("format", format_native, -1);
     vm_define_native("bool", bool_native, 1);
     vm_define_native("list", list_native, -1);
     vm_define_native("number", number_native, 1);
     vm_define_native("map", map_native, -1);
+    vm_define_native("array", array_native, -1);
+    vm_define_native("range", range_native, -1);
+    vm_define_native("set", set_native, -1);
     vm_define_native("in", contains_native, 2);
     vm_define_native("file", file_native, 2);
 }
@@ -1048,7 +2408,6 @@ void vm_set_argc_argv(const int argc, const char *argv[])
     vm_pop();
 }
 
-extern char **environ;
 void vm_inherit_env(void)
 {
     char **env = environ;
@@ -1068,7 +2427,7 @@ void vm_inherit_env(void)
         vm_push(env_name);
         value_t env_value = OBJ_VAL(obj_string_t_copy_from(delim_offset, from_delim_len, true));
         vm_push(env_value);
-        table_t_set(&AS_MAP(env_map)->table, env_name, env_value);
+        obj_map_t_set(AS_MAP(env_map), env_name, env_value);
         vm_pop();
         vm_pop();
 
@@ -1095,7 +2454,7 @@ void vm_collect_garbage(void)
 
     mark_roots();
     trace_references();
-    table_t_remove_unmarked(&vm.strings);
+    string_set_t_remove_unmarked(&vm.strings);
     sweep();
 
     vm.next_garbage_collect = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
@@ -1107,6 +2466,11 @@ void vm_collect_garbage(void)
             before,
             vm.bytes_allocated,
             vm.next_garbage_collect);
+        printf("           interned %d/%d strings, %" PRIu64 " hits %" PRIu64 " misses\n",
+            vm.strings.count,
+            vm.strings.capacity,
+            vm.strings.hits,
+            vm.strings.misses);
     }
     vm_gc_toggle_active();
 }
@@ -1124,15 +2488,20 @@ static void vm_t_free_objects(void)
 void vm_t_free(void)
 {
     table_t_free(&vm.globals);
-    table_t_free(&vm.strings);
+    string_set_t_free(&vm.strings);
     vm.init_string = NULL; // before free_objects so it cleans it up for us
+    vm.subscript_string = NULL;
+    memset(vm.char_strings, 0, sizeof vm.char_strings);
     vm_t_free_objects();
     free(vm.gray_stack);
+#ifdef DISPATCH_COUNTS
+    dispatch_counts_print();
+#endif
 }
 
 void vm_push(const value_t value)
 {
-    assert(((uintptr_t)vm.stack_top - (uintptr_t)&vm.stack) <= (sizeof(value_t) * 256));
+    assert(vm.stack_top < vm.stack + STACK_MAX);
     *vm.stack_top = value;
     vm.stack_top++;
 }
@@ -1160,14 +2529,49 @@ static bool call(obj_closure_t *closure, const int argc)
         runtime_error(gettext("Expected %d arguments but got %d."), closure->function->arity, argc);
         return false;
     }
-    if (vm.frame_count == FRAMES_MAX) {
+    if (closure->function->lazy_source != NULL) {
+        // the compiler roots a few values of its own on the stack
+        if (vm.stack_top + UINT8_COUNT > vm.stack + STACK_MAX) {
+            runtime_error(gettext("Stack overflow."));
+            return false;
+        }
+        if (!compiler_t_compile_lazy(closure->function)) {
+            runtime_error(gettext("Could not compile the body of '%s'."), closure->function->name->chars);
+            return false;
+        }
+    }
+    // room for the locals plus what a single frame used to be capped at for temporaries
+    if (vm.frame_count == FRAMES_MAX || vm.stack_top + closure->function->slot_count + UINT8_COUNT > vm.stack + STACK_MAX) {
         runtime_error(gettext("Stack overflow."));
         return false;
     }
+    if ((vm.flags & VM_FLAG_REGISTERS) && !closure->function->registers_tried && compiler_t_registers(closure->function)
+        && (vm.flags & VM_FLAG_STACK_TRACE))
+        register_code_t_disassemble(closure->function);
     call_frame_t *frame = &vm.frames[vm.frame_count++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
     frame->slots = vm.stack_top - argc - 1;
+    const register_code_t *registers = closure->function->registers;
+    if (registers != NULL) {
+        // every register is a gc root from the start, the ones past the arguments begin as nil
+        frame->pc = registers->code;
+        value_t *top = frame->slots + registers->register_count;
+        while (vm.stack_top < top)
+            *vm.stack_top++ = NIL_VAL;
+    }
+    return true;
+}
+
+static bool call_native_method(const native_method_fn_t function, const obj_string_t *name, const int argc)
+{
+    // the receiver and arguments stay on the stack while the method runs so the gc can see them
+    value_t *args = vm.stack_top - argc - 1;
+    if (!function(name, argc + 1, args))
+        return false;
+    const value_t result = vm_pop();
+    vm.stack_top = args;
+    vm_push(result);
     return true;
 }
 
@@ -1183,9 +2587,7 @@ static bool call_value(const value_t callee, const int argc)
             case OBJ_BOUND_NATIVE_METHOD: {
                 obj_bound_native_method_t *bound_native_method = AS_BOUND_NATIVE_METHOD(callee);
                 vm.stack_top[-argc - 1] = bound_native_method->receiving_instance; // swap out our instance
-                value_t *args = vm.stack_top - argc - 1;
-                vm.stack_top -= argc + 1;
-                return bound_native_method->function(bound_native_method->name, argc + 1, args);
+                return call_native_method(bound_native_method->function, bound_native_method->name, argc);
             }
             case OBJ_TYPECLASS: {
                 obj_typeobj_t *typeobj = AS_TYPECLASS(callee);
@@ -1239,28 +2641,25 @@ static bool invoke(const obj_string_t *name, const int argc)
 
     /* dispatch to native helpers*/
     if (IS_STRING(receiving_instance)) {
-        value_t *args = vm.stack_top - argc - 1;
-        vm.stack_top -= argc + 1;
-        bool rv = string_method_invoke(name, argc + 1, args); // leaving arg on the stack
-        return rv;
+        return call_native_method(string_method_invoke, name, argc);
     }
     else if (IS_LIST(receiving_instance)) {
-        value_t *args = vm.stack_top - argc - 1;
-        vm.stack_top -= argc + 1;
-        bool rv = list_method_invoke(name, argc + 1, args); // leaving arg on the stack
-        return rv;
+        return call_native_method(list_method_invoke, name, argc);
     }
     else if (IS_MAP(receiving_instance)) {
-        value_t *args = vm.stack_top - argc - 1;
-        vm.stack_top -= argc + 1;
-        bool rv = map_method_invoke(name, argc + 1, args); // leaving arg on the stack
-        return rv;
+        return call_native_method(map_method_invoke, name, argc);
     }
     else if (IS_FILE(receiving_instance)) {
-        value_t *args = vm.stack_top - argc - 1;
-        vm.stack_top -= argc + 1;
-        bool rv = file_method_invoke(name, argc + 1, args); // leaving arg on the stack
-        return rv;
+        return call_native_method(file_method_invoke, name, argc);
+    }
+    else if (IS_ARRAY(receiving_instance)) {
+        return call_native_method(array_method_invoke, name, argc);
+    }
+    else if (IS_RANGE(receiving_instance)) {
+        return call_native_method(range_method_invoke, name, argc);
+    }
+    else if (IS_SET(receiving_instance)) {
+        return call_native_method(set_method_invoke, name, argc);
     }
     // TODO number, bool?
 
@@ -1332,6 +2731,23 @@ static void close_upvalues(const value_t *last)
     }
 }
 
+// a call in tail position slides the frame it just pushed down over the caller, natives have already finished
+static call_frame_t *tail_frame(call_frame_t *frame)
+{
+    call_frame_t *callee = &vm.frames[vm.frame_count - 1];
+    if (callee == frame)
+        return frame;
+    close_upvalues(frame->slots);
+    const ptrdiff_t count = vm.stack_top - callee->slots;
+    memmove(frame->slots, callee->slots, sizeof(value_t) * count);
+    vm.stack_top = frame->slots + count;
+    frame->closure = callee->closure;
+    frame->ip = callee->ip;
+    frame->pc = callee->pc;
+    vm.frame_count--;
+    return frame;
+}
+
 static void define_field(obj_string_t *field_name)
 {
     value_t default_value = peek(0);
@@ -1353,6 +2769,27 @@ static bool is_falsey(const value_t value)
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)) || (IS_NUMBER(value) && fabs(AS_NUMBER(value)) == 0);
 }
 
+// the comparison behind a fused compare-and-branch, kind is the jump it stands for: 1 to jump, 0 to fall through, -1 on bad operands
+static inline int compare_for_jump(const uint8_t kind, const value_t a, const value_t b)
+{
+    switch (kind) {
+        case OP_JUMP_IF_NOT_EQUAL: return !value_t_equal(a, b);
+        case OP_JUMP_IF_EQUAL: return value_t_equal(a, b);
+        default: break;
+    }
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))
+        return -1;
+    const double x = AS_NUMBER(a);
+    const double y = AS_NUMBER(b);
+    switch (kind) {
+        case OP_JUMP_IF_NOT_LESS: return !(x < y);
+        case OP_JUMP_IF_NOT_GREATER: return !(x > y);
+        case OP_JUMP_IF_LESS: return x < y;
+        case OP_JUMP_IF_GREATER: return x > y;
+        default: return -1;
+    }
+}
+
 static void concatenate(void)
 {
     obj_string_t *b = AS_STRING(peek(0));
@@ -1370,7 +2807,206 @@ static void concatenate(void)
     vm_push(OBJ_VAL(result));
 }
 
-static void dump_tracing(const call_frame_t *frame, const uint8_t *ip)
+// literal construction: the top count values become a list with room for total elements
+static void build_list(const int total, const int count)
+{
+    obj_list_t *list = obj_list_t_allocate();
+    vm_push(OBJ_VAL(list));
+    value_list_t_reserve(&list->elements, total);
+    if (count > 0)
+        memcpy(list->elements.values, vm.stack_top - 1 - count, sizeof(value_t) * count);
+    list->elements.count = count;
+    vm.stack_top -= count + 1;
+    vm_push(OBJ_VAL(list));
+}
+
+static void extend_list(const int count)
+{
+    obj_list_t *list = AS_LIST(peek(count));
+    value_list_t_reserve(&list->elements, list->elements.count + count);
+    memcpy(list->elements.values + list->elements.count, vm.stack_top - count, sizeof(value_t) * count);
+    list->elements.count += count;
+    vm.stack_top -= count;
+}
+
+// the top count key/value pairs become a map, only keys that miss the array part are sized for
+static void build_map(const int total, const int count)
+{
+    obj_map_t *map = obj_map_t_allocate();
+    vm_push(OBJ_VAL(map));
+    const value_t *pairs = vm.stack_top - 1 - count * 2;
+    int keyed = 0;
+    for (int i = 0; i < count; i++) {
+        if (!IS_NUMBER(pairs[i * 2]))
+            keyed++;
+    }
+    if (keyed > 0)
+        table_t_reserve(&map->table, (int)((int64_t)keyed * total / count));
+    for (int i = 0; i < count; i++)
+        obj_map_t_set(map, pairs[i * 2], pairs[i * 2 + 1]);
+    vm.stack_top -= count * 2 + 1;
+    vm_push(OBJ_VAL(map));
+}
+
+static void extend_map(const int count)
+{
+    obj_map_t *map = AS_MAP(peek(count * 2));
+    const value_t *pairs = vm.stack_top - count * 2;
+    for (int i = 0; i < count; i++)
+        obj_map_t_set(map, pairs[i * 2], pairs[i * 2 + 1]);
+    vm.stack_top -= count * 2;
+}
+
+// constant-only literals are prebuilt by the compiler, each evaluation gets its own shallow copy
+static void copy_literal(void)
+{
+    const value_t template = peek(0);
+    if (IS_MAP(template)) {
+        obj_map_t *map = obj_map_t_copy(AS_MAP(template));
+        vm.stack_top[-1] = OBJ_VAL(map);
+        return;
+    }
+    const obj_list_t *from = AS_LIST(template);
+    obj_list_t *list = obj_list_t_allocate();
+    vm_push(OBJ_VAL(list));
+    value_list_t_reserve(&list->elements, from->elements.count);
+    memcpy(list->elements.values, from->elements.values, sizeof(value_t) * from->elements.count);
+    list->elements.count = from->elements.count;
+    vm_pop();
+    vm.stack_top[-1] = OBJ_VAL(list);
+}
+
+// replace the value on top of the stack with its property, binding methods to it
+static bool load_property(obj_string_t *name)
+{
+    const value_t receiver = peek(0);
+    native_method_fn_t native_method = NULL;
+    if (IS_STRING(receiver))
+        native_method = string_method_invoke;
+    else if (IS_LIST(receiver))
+        native_method = list_method_invoke;
+    else if (IS_MAP(receiver))
+        native_method = map_method_invoke;
+    else if (IS_ARRAY(receiver))
+        native_method = array_method_invoke;
+    else if (IS_RANGE(receiver))
+        native_method = range_method_invoke;
+    else if (IS_SET(receiver))
+        native_method = set_method_invoke;
+    // TODO number, bool?
+    if (native_method != NULL) {
+        obj_bound_native_method_t *m = obj_bound_native_method_t_allocate(receiver, name, native_method);
+        vm.stack_top[-1] = OBJ_VAL(m);
+        return true;
+    }
+
+    if (IS_INSTANCE(receiver)) {
+        obj_instance_t *instance = AS_INSTANCE(receiver);
+        // fields (priority, may shadow methods)
+        value_t value;
+        if (table_t_get(&instance->fields, OBJ_VAL(name), &value)) {
+            vm.stack_top[-1] = value;
+            return true;
+        }
+        // otherwise methods
+        return bind_method(instance->typeobj, name);
+    }
+
+    // try class fields
+    if (IS_TYPECLASS(receiver)) {
+        obj_typeobj_t *type = AS_TYPECLASS(receiver);
+        value_t type_field;
+        if (table_t_get(&type->fields, OBJ_VAL(name), &type_field)) {
+            vm.stack_top[-1] = type_field;
+            return true;
+        }
+        runtime_error(gettext("%s does not have a %s field."), type->name->chars, name->chars);
+        return false;
+    }
+
+    runtime_error(gettext("Only instances have properties."));
+    return false;
+}
+
+// one step of a for loop over its hidden locals: the iterable, a cursor and a guard against maps and sets changing
+// underneath it. 1 with the next key and value, 0 once done, -1 after a runtime error
+static inline int for_iter_next(value_t *state, const int vars, value_t *key, value_t *v)
+{
+    const value_t iterable = state[0];
+    int cursor = (int)AS_NUMBER(state[1]);
+    *key = NUMBER_VAL(cursor);
+    if (IS_LIST(iterable)) {
+        const value_list_t *elements = &AS_LIST(iterable)->elements;
+        if (cursor >= elements->count)
+            return 0;
+        *v = elements->values[cursor++];
+    } else if (IS_RANGE(iterable)) {
+        const obj_range_t *range = AS_RANGE(iterable);
+        if (cursor >= obj_range_t_count(range))
+            return 0;
+        *v = NUMBER_VAL(range->start + cursor++ * range->step);
+    } else if (IS_STRING(iterable)) {
+        const obj_string_t *str = AS_STRING(iterable);
+        if (cursor >= str->length)
+            return 0;
+        *v = OBJ_VAL(vm.char_strings[(uint8_t)str->chars[cursor++]]);
+    } else if (IS_ARRAY(iterable)) {
+        const obj_array_t *array = AS_ARRAY(iterable);
+        if (cursor >= array->count)
+            return 0;
+        *v = NUMBER_VAL(array->values[cursor++]);
+    } else if (IS_MAP(iterable)) {
+        const obj_map_t *map = AS_MAP(iterable);
+        if (cursor == 0) {
+            state[2] = NUMBER_VAL(map->modifications);
+        } else if (AS_NUMBER(state[2]) != map->modifications) {
+            runtime_error(gettext("map changed during iteration."));
+            return -1;
+        }
+        if (!obj_map_t_next(map, &cursor, key, v))
+            return 0;
+        if (vars == 1)
+            *v = *key; // a single variable walks the keys
+    } else if (IS_SET(iterable)) {
+        const obj_set_t *set = AS_SET(iterable);
+        if (vars == 2) {
+            runtime_error(gettext("Sets iterate with a single loop variable."));
+            return -1;
+        }
+        if (cursor == 0) {
+            state[2] = NUMBER_VAL(set->modifications);
+        } else if (AS_NUMBER(state[2]) != set->modifications) {
+            runtime_error(gettext("set changed during iteration."));
+            return -1;
+        }
+        if (!value_set_t_next(&set->keys, &cursor, v))
+            return 0;
+    } else {
+        runtime_error(gettext("Can only iterate over lists, maps, sets, strings, arrays and ranges."));
+        return -1;
+    }
+    state[1] = NUMBER_VAL(cursor);
+    return 1;
+}
+
+static void dump_tracing(const call_frame_t *frame, const uint8_t *ip)
+{
+    if (vm.flags & VM_FLAG_STACK_TRACE) {
+        printf("           ");
+        for (value_t *slot = vm.stack; slot < vm.stack_top; slot++) {
+            printf("[ ");
+            value_t_print(stdout, *slot);
+            printf(" ]");
+        }
+        printf("\n");
+        chunk_t_disassemble_instruction(
+            &frame->closure->function->chunk,
+            (int)(ip - frame->closure->function->chunk.code)
+        );
+    }
+}
+
+static void dump_register_tracing(const call_frame_t *frame, const uint32_t *pc)
 {
     if (vm.flags & VM_FLAG_STACK_TRACE) {
         printf("           ");
@@ -1380,23 +3016,25 @@ static void dump_tracing(const call_frame_t *frame, const uint8_t *ip)
             printf(" ]");
         }
         printf("\n");
-        chunk_t_disassemble_instruction(
-            &frame->closure->function->chunk,
-            (int)(ip - frame->closure->function->chunk.code)
-        );
+        register_code_t_disassemble_instruction(frame->closure->function, (int)(pc - frame->closure->function->registers->code));
     }
 }
 
-static vm_t_interpret_result_t run(void)
+static vm_t_interpret_result_t run_stack(const int base_frame)
 {
     call_frame_t *frame = &vm.frames[vm.frame_count - 1];
     register uint8_t *ip = frame->ip;
+    uint32_t operand; // the index operand, read by the short or OP_WIDE entry of a shared handler
 
 #define READ_BYTE() (*ip++)
 #define READ_SHORT() \
     (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_WIDE() \
+    (ip += 3, (uint32_t)(ip[-3] | (ip[-2] << 8) | (ip[-1] << 16)))
 #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define OPERAND_CONSTANT() (frame->closure->function->chunk.constants.values[operand])
+#define OPERAND_STRING() AS_STRING(OPERAND_CONSTANT())
 #define BINARY_OP(value_type_wrapper, op) \
     do { \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
@@ -1408,6 +3046,53 @@ static vm_t_interpret_result_t run(void)
         const double a = AS_NUMBER(vm_pop()); \
         vm_push(value_type_wrapper(a op b)); \
     } while (false)
+#define COMPARE_JUMP(kind) \
+    do { \
+        const uint16_t offset = READ_SHORT(); \
+        const int jump = compare_for_jump(kind, peek(1), peek(0)); \
+        if (jump < 0) { \
+            frame->ip = ip; \
+            runtime_error(gettext("Operands must be numbers.")); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        vm.stack_top -= 2; \
+        if (jump) \
+            ip += offset; \
+    } while (false)
+// the quickened form of a numeric instruction, back to the generic one when an operand is not a number
+#define NUMBER_OP(generic, value_type_wrapper, op) \
+    do { \
+        const value_t b = peek(0); \
+        const value_t a = peek(1); \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) { \
+            ip[-1] = generic; \
+            goto generic##_LABEL; \
+        } \
+        vm.stack_top[-2] = value_type_wrapper(AS_NUMBER(a) op AS_NUMBER(b)); \
+        vm.stack_top--; \
+    } while (false)
+#define INCREMENT(target) \
+    do { \
+        const int8_t delta = (int8_t)READ_BYTE(); \
+        if (!IS_NUMBER(*(target))) { \
+            frame->ip = ip; \
+            runtime_error(gettext("Operands must be two numbers or two strings.")); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        *(target) = NUMBER_VAL(AS_NUMBER(*(target)) + delta); \
+    } while (false)
+// a frame pushed for register code runs in that loop, leaving its result where the call was
+#define ENTER_FRAME() \
+    do { \
+        frame = &vm.frames[vm.frame_count - 1]; \
+        if (frame->closure->function->registers != NULL) { \
+            const vm_t_interpret_result_t result = run_registers(vm.frame_count - 1); \
+            if (result != INTERPRET_OK) \
+                return result; \
+            frame = &vm.frames[vm.frame_count - 1]; \
+        } \
+        ip = frame->ip; \
+    } while (false)
 #define BINARY_OP_BIT(value_type_wrapper, op) \
     do { \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
@@ -1437,9 +3122,33 @@ static vm_t_interpret_result_t run(void)
             &&OP_NOT_LABEL, &&OP_MOD_LABEL, &&OP_NEGATE_LABEL, &&OP_PRINT_LABEL, &&OP_ERROR_LABEL,
             &&OP_JUMP_LABEL, &&OP_JUMP_IF_FALSE_LABEL, &&OP_LOOP_LABEL, &&OP_CALL_LABEL, &&OP_INVOKE_LABEL,
             &&OP_SUPER_INVOKE_LABEL, &&OP_CLOSURE_LABEL, &&OP_CLOSE_UPVALUE_LABEL, &&OP_RETURN_LABEL, &&OP_EXIT_LABEL,
-            &&OP_TYPE_LABEL, &&OP_INHERIT_LABEL, &&OP_METHOD_LABEL, &&OP_FIELD_LABEL,
+            &&OP_TYPE_LABEL, &&OP_INHERIT_LABEL, &&OP_METHOD_LABEL, &&OP_FIELD_LABEL, &&OP_DUP2_LABEL,
+            &&OP_GET_INDEX_LABEL, &&OP_SET_INDEX_LABEL, &&OP_FOR_ITER_LABEL, &&OP_BUILD_LIST_LABEL,
+            &&OP_BUILD_LIST_LONG_LABEL, &&OP_EXTEND_LIST_LABEL, &&OP_BUILD_MAP_LABEL, &&OP_BUILD_MAP_LONG_LABEL,
+            &&OP_EXTEND_MAP_LABEL, &&OP_COPY_LITERAL_LABEL, &&OP_JUMP_IF_FALSE_POP_LABEL, &&OP_JUMP_IF_FALSE_OR_POP_LABEL,
+            &&OP_JUMP_IF_TRUE_OR_POP_LABEL, &&OP_JUMP_IF_NOT_LESS_LABEL, &&OP_JUMP_IF_NOT_GREATER_LABEL,
+            &&OP_JUMP_IF_NOT_EQUAL_LABEL, &&OP_JUMP_IF_LESS_LABEL, &&OP_JUMP_IF_GREATER_LABEL, &&OP_JUMP_IF_EQUAL_LABEL,
+            &&OP_JUMP_IF_LOCAL_CONST_LABEL, &&OP_JUMP_IF_LOCAL_LOCAL_LABEL, &&OP_INC_LOCAL_LABEL,
+            &&OP_INC_UPVALUE_LABEL, &&OP_INC_GLOBAL_LABEL, &&OP_INC_PROPERTY_LABEL, &&OP_ADD_LOCAL_CONST_LABEL,
+            &&OP_SWITCH_TABLE_LABEL, &&OP_TAIL_CALL_LABEL, &&OP_TAIL_INVOKE_LABEL, &&OP_TAIL_SUPER_INVOKE_LABEL,
+            &&OP_WIDE_LABEL, &&OP_ADD_NUM_LABEL, &&OP_ADD_STR_LABEL, &&OP_SUBTRACT_NUM_LABEL, &&OP_LESS_NUM_LABEL,
+            &&OP_GREATER_NUM_LABEL, &&OP_GET_PROPERTY_INSTANCE_LABEL, &&OP_GET_LOCALS_LABEL, &&OP_SET_LOCAL_POP_LABEL,
         };
-        #define DISPATCH() do { dump_tracing(frame, ip); goto *computed_goto_dispatch[READ_BYTE()]; } while (false);
+        // the instructions OP_WIDE may prefix, the compiler emits no others
+        static void* wide_dispatch[OP_WIDE] __unused__ = {
+            [OP_GET_LOCAL] = &&WIDE_GET_LOCAL_LABEL, [OP_SET_LOCAL] = &&WIDE_SET_LOCAL_LABEL,
+            [OP_GET_GLOBAL] = &&WIDE_GET_GLOBAL_LABEL, [OP_DEFINE_GLOBAL] = &&WIDE_DEFINE_GLOBAL_LABEL,
+            [OP_SET_GLOBAL] = &&WIDE_SET_GLOBAL_LABEL, [OP_GET_UPVALUE] = &&WIDE_GET_UPVALUE_LABEL,
+            [OP_SET_UPVALUE] = &&WIDE_SET_UPVALUE_LABEL, [OP_GET_PROPERTY] = &&WIDE_GET_PROPERTY_LABEL,
+            [OP_SET_PROPERTY] = &&WIDE_SET_PROPERTY_LABEL, [OP_GET_SUPER] = &&WIDE_GET_SUPER_LABEL,
+            [OP_JUMP] = &&WIDE_JUMP_LABEL, [OP_LOOP] = &&WIDE_LOOP_LABEL, [OP_INVOKE] = &&WIDE_INVOKE_LABEL,
+            [OP_SUPER_INVOKE] = &&WIDE_SUPER_INVOKE_LABEL, [OP_CLOSURE] = &&WIDE_CLOSURE_LABEL,
+            [OP_TYPE] = &&WIDE_TYPE_LABEL, [OP_METHOD] = &&WIDE_METHOD_LABEL, [OP_FIELD] = &&WIDE_FIELD_LABEL,
+            [OP_FOR_ITER] = &&WIDE_FOR_ITER_LABEL, [OP_INC_LOCAL] = &&WIDE_INC_LOCAL_LABEL,
+            [OP_INC_UPVALUE] = &&WIDE_INC_UPVALUE_LABEL, [OP_INC_GLOBAL] = &&WIDE_INC_GLOBAL_LABEL,
+            [OP_INC_PROPERTY] = &&WIDE_INC_PROPERTY_LABEL,
+        };
+        #define DISPATCH() do { dump_tracing(frame, ip); COUNT_DISPATCH(*ip); goto *computed_goto_dispatch[READ_BYTE()]; } while (false);
 
         DISPATCH();
         while (1) {
@@ -1452,18 +3161,34 @@ static vm_t_interpret_result_t run(void)
             OP_TRUE_LABEL: vm_push(TRUE_VAL); DISPATCH();
             OP_FALSE_LABEL: vm_push(FALSE_VAL); DISPATCH();
             OP_POP_LABEL: vm_pop(); DISPATCH();
-            OP_GET_LOCAL_LABEL: {
-                const uint8_t slot = READ_BYTE();
-                vm_push(frame->slots[slot]);
+            WIDE_GET_LOCAL_LABEL: operand = READ_WIDE(); goto get_local;
+            OP_GET_LOCAL_LABEL: operand = READ_BYTE();
+            get_local: {
+                vm_push(frame->slots[operand]);
+                DISPATCH();
+            }
+            WIDE_SET_LOCAL_LABEL: operand = READ_WIDE(); goto set_local;
+            OP_SET_LOCAL_LABEL: operand = READ_BYTE();
+            set_local: {
+                frame->slots[operand] = peek(0);
+                DISPATCH();
+            }
+            // two locals read as the operands of the next instruction, and a store whose value is not used
+            OP_GET_LOCALS_LABEL: {
+                vm.stack_top[0] = frame->slots[ip[0]];
+                vm.stack_top[1] = frame->slots[ip[1]];
+                vm.stack_top += 2;
+                ip += 2;
                 DISPATCH();
             }
-            OP_SET_LOCAL_LABEL: {
-                const uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(0);
+            OP_SET_LOCAL_POP_LABEL: {
+                frame->slots[READ_BYTE()] = *--vm.stack_top;
                 DISPATCH();
             }
-            OP_GET_GLOBAL_LABEL: {
-                const obj_string_t *name = READ_STRING();
+            WIDE_GET_GLOBAL_LABEL: operand = READ_WIDE(); goto get_global;
+            OP_GET_GLOBAL_LABEL: operand = READ_BYTE();
+            get_global: {
+                const obj_string_t *name = OPERAND_STRING();
                 value_t value;
                 if (!table_t_get(&vm.globals, OBJ_VAL(name), &value)) {
                     frame->ip = ip;
@@ -1473,14 +3198,18 @@ static vm_t_interpret_result_t run(void)
                 vm_push(value);
                 DISPATCH();
             }
-            OP_DEFINE_GLOBAL_LABEL: {
-                obj_string_t *name = READ_STRING();
+            WIDE_DEFINE_GLOBAL_LABEL: operand = READ_WIDE(); goto define_global;
+            OP_DEFINE_GLOBAL_LABEL: operand = READ_BYTE();
+            define_global: {
+                obj_string_t *name = OPERAND_STRING();
                 table_t_set(&vm.globals, OBJ_VAL(name), peek(0));
                 vm_pop();
                 DISPATCH();
             }
-            OP_SET_GLOBAL_LABEL: {
-                obj_string_t *name = READ_STRING();
+            WIDE_SET_GLOBAL_LABEL: operand = READ_WIDE(); goto set_global;
+            OP_SET_GLOBAL_LABEL: operand = READ_BYTE();
+            set_global: {
+                obj_string_t *name = OPERAND_STRING();
                 if (table_t_set(&vm.globals, OBJ_VAL(name), peek(0))) {
                     table_t_delete(&vm.globals, OBJ_VAL(name));
                     frame->ip = ip;
@@ -1489,84 +3218,33 @@ static vm_t_interpret_result_t run(void)
                 }
                 DISPATCH();
             }
-            OP_GET_UPVALUE_LABEL: {
-                const uint8_t slot = READ_BYTE();
-                vm_push(*frame->closure->upvalues[slot]->location);
+            WIDE_GET_UPVALUE_LABEL: operand = READ_WIDE(); goto get_upvalue;
+            OP_GET_UPVALUE_LABEL: operand = READ_BYTE();
+            get_upvalue: {
+                vm_push(*frame->closure->upvalues[operand]->location);
                 DISPATCH();
             }
-            OP_SET_UPVALUE_LABEL: {
-                const uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
+            WIDE_SET_UPVALUE_LABEL: operand = READ_WIDE(); goto set_upvalue;
+            OP_SET_UPVALUE_LABEL: operand = READ_BYTE();
+            set_upvalue: {
+                *frame->closure->upvalues[operand]->location = peek(0);
                 DISPATCH();
             }
-            OP_GET_PROPERTY_LABEL: {
+            WIDE_GET_PROPERTY_LABEL: operand = READ_WIDE(); goto get_property;
+            OP_GET_PROPERTY_LABEL: operand = READ_BYTE();
+            if (IS_INSTANCE(peek(0))) { // quicken, later runs go straight to the instance
+                ip[-2] = OP_GET_PROPERTY_INSTANCE;
+                goto get_property_instance;
+            }
+            get_property: {
                 frame->ip = ip; // if it calls runtime_error, we need this restored
-
-                // native helpers
-                if (IS_STRING(peek(0))) {
-                    obj_string_t *name = READ_STRING();
-                    obj_bound_native_method_t *m = obj_bound_native_method_t_allocate(peek(0), name, string_method_invoke);
-                    vm_pop();
-                    vm_push(OBJ_VAL(m));
-                    DISPATCH();
-                }
-                else if (IS_LIST(peek(0))) {
-                    obj_string_t *name = READ_STRING();
-                    obj_bound_native_method_t *m = obj_bound_native_method_t_allocate(peek(0), name, list_method_invoke);
-                    vm_pop();
-                    vm_push(OBJ_VAL(m));
-                    DISPATCH();
-                }
-                else if (IS_MAP(peek(0))) {
-                    obj_string_t *name = READ_STRING();
-                    obj_bound_native_method_t *m = obj_bound_native_method_t_allocate(peek(0), name, map_method_invoke);
-                    vm_pop();
-                    vm_push(OBJ_VAL(m));
-                    DISPATCH();
-                }
-                // TODO number, bool?
-
-                // otherwise native type
-                else if (IS_INSTANCE(peek(0))) {
-                    obj_instance_t *instance = AS_INSTANCE(peek(0));
-                    const obj_string_t *name = READ_STRING();
-
-                    // fields (priority, may shadow methods)
-                    value_t value;
-                    if (table_t_get(&instance->fields, OBJ_VAL(name), &value)) {
-                        vm_pop(); // instance
-                        vm_push(value);
-                        DISPATCH();
-                    }
-
-                    // otherwise methods
-                    if (!bind_method(instance->typeobj, name)) {
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-
-                }
-
-                // try class fields
-                else if (IS_TYPECLASS(peek(0))) {
-                    obj_typeobj_t *type = AS_TYPECLASS(peek(0));
-                    const obj_string_t *name = READ_STRING();
-                    value_t type_field;
-                    if (table_t_get(&type->fields, OBJ_VAL(name), &type_field)) {
-                        vm_pop(); // type
-                        vm_push(type_field);
-                        DISPATCH();
-                    }
-                    runtime_error(gettext("%s does not have a %s field."), type->name->chars, name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-
-                else {
-                    runtime_error(gettext("Only instances have properties."));
+                if (!load_property(OPERAND_STRING()))
                     return INTERPRET_RUNTIME_ERROR;
-                }
                 DISPATCH();
             }
-            OP_SET_PROPERTY_LABEL: {
+            WIDE_SET_PROPERTY_LABEL: operand = READ_WIDE(); goto set_property;
+            OP_SET_PROPERTY_LABEL: operand = READ_BYTE();
+            set_property: {
                 frame->ip = ip;
                 if (IS_TYPECLASS(peek(1))) {
                     runtime_error(gettext("Type fields are read only."));
@@ -1576,15 +3254,17 @@ static vm_t_interpret_result_t run(void)
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 obj_instance_t *instance = AS_INSTANCE(peek(1));
-                table_t_set(&instance->fields, OBJ_VAL(READ_STRING()), peek(0)); // read name, peek the value to set
+                table_t_set(&instance->fields, OBJ_VAL(OPERAND_STRING()), peek(0)); // read name, peek the value to set
                 const value_t value = vm_pop(); // pop the value
                 vm_pop(); // pop the instance
                 vm_push(value); // push the value so we leave the value as the return
                 DISPATCH();
             }
-            OP_GET_SUPER_LABEL: {
+            WIDE_GET_SUPER_LABEL: operand = READ_WIDE(); goto get_super;
+            OP_GET_SUPER_LABEL: operand = READ_BYTE();
+            get_super: {
                 frame->ip = ip; // if it calls runtime_error, we need this restored
-                const obj_string_t *method_name = READ_STRING();
+                const obj_string_t *method_name = OPERAND_STRING();
                 obj_typeobj_t *super_type_obj = AS_TYPECLASS(vm_pop());
                 // NOTE this is only for methods, not fields
                 if (!bind_method(super_type_obj, method_name)) {
@@ -1598,12 +3278,15 @@ static vm_t_interpret_result_t run(void)
                 vm_push(BOOL_VAL(value_t_equal(a,b)));
                 DISPATCH();
             }
-            OP_GREATER_LABEL: BINARY_OP(BOOL_VAL, >); DISPATCH();
-            OP_LESS_LABEL: BINARY_OP(BOOL_VAL, <); DISPATCH();
+            // the generic forms quicken themselves once the operands have been seen
+            OP_GREATER_LABEL: BINARY_OP(BOOL_VAL, >); ip[-1] = OP_GREATER_NUM; DISPATCH();
+            OP_LESS_LABEL: BINARY_OP(BOOL_VAL, <); ip[-1] = OP_LESS_NUM; DISPATCH();
             OP_ADD_LABEL: {
                 if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                    ip[-1] = OP_ADD_STR;
                     concatenate();
                 } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+                    ip[-1] = OP_ADD_NUM;
                     const double b = AS_NUMBER(vm_pop());
                     const double a = AS_NUMBER(vm_pop());
                     vm_push(NUMBER_VAL(a + b));
@@ -1614,7 +3297,7 @@ static vm_t_interpret_result_t run(void)
                 }
                 DISPATCH();
             }
-            OP_SUBTRACT_LABEL: BINARY_OP(NUMBER_VAL, -); DISPATCH();
+            OP_SUBTRACT_LABEL: BINARY_OP(NUMBER_VAL, -); ip[-1] = OP_SUBTRACT_NUM; DISPATCH();
             OP_MULTIPLY_LABEL: BINARY_OP(NUMBER_VAL, *); DISPATCH();
             OP_DIVIDE_LABEL: {
                 if (IS_NUMBER(peek(0)) && AS_NUMBER(peek(0)) == 0) {
@@ -1646,61 +3329,490 @@ static vm_t_interpret_result_t run(void)
             OP_NEGATE_LABEL: {
                 if (!IS_NUMBER(peek(0))) {
                     frame->ip = ip;
-                    runtime_error(gettext("Operand must be a number."));
+                    runtime_error(gettext("Operand must be a number."));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                value_t *v = vm.stack_top - 1;
+                v->as.number = -v->as.number;
+                DISPATCH();
+            }
+            OP_PRINT_LABEL: {
+                value_t_print(stdout, vm_pop());
+                printf("\n");
+                DISPATCH();
+            }
+            OP_ERROR_LABEL: {
+                value_t_print(stderr, vm_pop());
+                fprintf(stderr, "\n");
+                DISPATCH();
+            }
+            OP_JUMP_LABEL: {
+                const uint16_t offset = READ_SHORT();
+                ip += offset;
+                DISPATCH();
+            }
+            OP_JUMP_IF_FALSE_LABEL: {
+                const uint16_t offset = READ_SHORT();
+                if (is_falsey(peek(0)))
+                    ip += offset;
+                DISPATCH();
+            }
+            OP_LOOP_LABEL: {
+                const uint16_t offset = READ_SHORT();
+                ip -= offset;
+                DISPATCH();
+            }
+            WIDE_JUMP_LABEL: operand = READ_WIDE(); ip += operand; DISPATCH();
+            WIDE_LOOP_LABEL: operand = READ_WIDE(); ip -= operand; DISPATCH();
+            OP_CALL_LABEL: {
+                const int argc = READ_BYTE();
+                frame->ip = ip;
+                if (!call_value(peek(argc), argc)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ENTER_FRAME();
+                DISPATCH();
+            }
+            WIDE_INVOKE_LABEL: operand = READ_WIDE(); goto invoke;
+            OP_INVOKE_LABEL: operand = READ_BYTE();
+            invoke: { // combined OP_GET_PROPERTY and OP_CALL
+                const obj_string_t *method_name = OPERAND_STRING();
+                const int argc = READ_BYTE();
+                frame->ip = ip;
+                if (!invoke(method_name, argc)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ENTER_FRAME();
+                DISPATCH();
+            }
+            WIDE_SUPER_INVOKE_LABEL: operand = READ_WIDE(); goto super_invoke;
+            OP_SUPER_INVOKE_LABEL: operand = READ_BYTE();
+            super_invoke: { // combined OP_GET_SUPER and OP_CALL
+                const obj_string_t *method_name = OPERAND_STRING();
+                const int argc = READ_BYTE();
+                obj_typeobj_t *super_type_obj = AS_TYPECLASS(vm_pop());
+                frame->ip = ip;
+                if (!invoke_from_typeobj(super_type_obj, method_name, argc)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ENTER_FRAME();
+                DISPATCH();
+            }
+            OP_CLOSURE_LABEL: {
+                obj_closure_t *closure = obj_closure_t_allocate(AS_FUNCTION(READ_CONSTANT()));
+                vm_push(OBJ_VAL(closure));
+                for (int i = 0; i < closure->upvalue_count; i++) {
+                    const uint8_t is_local = READ_BYTE();
+                    const uint8_t index = READ_BYTE();
+                    if (is_local) {
+                        closure->upvalues[i] = capture_upvalue(frame->slots + index);
+                    } else {
+                        closure->upvalues[i] = frame->closure->upvalues[index];
+                    }
+                }
+                DISPATCH();
+            }
+            WIDE_CLOSURE_LABEL: { // every capture index is wide too
+                obj_closure_t *closure = obj_closure_t_allocate(AS_FUNCTION(frame->closure->function->chunk.constants.values[READ_WIDE()]));
+                vm_push(OBJ_VAL(closure));
+                for (int i = 0; i < closure->upvalue_count; i++) {
+                    const uint8_t is_local = READ_BYTE();
+                    const uint32_t index = READ_WIDE();
+                    if (is_local) {
+                        closure->upvalues[i] = capture_upvalue(frame->slots + index);
+                    } else {
+                        closure->upvalues[i] = frame->closure->upvalues[index];
+                    }
+                }
+                DISPATCH();
+            }
+            OP_CLOSE_UPVALUE_LABEL: {
+                close_upvalues(vm.stack_top - 1);
+                vm_pop();
+                DISPATCH();
+            }
+            OP_RETURN_LABEL: {
+                const value_t result = vm_pop();
+                close_upvalues(frame->slots); // close the remaining open upvalues owned by the returning function
+                vm.frame_count--;
+                if (vm.frame_count == 0) {
+                    vm_pop();
+                    ip = frame->ip;
+                    return INTERPRET_OK;
+                }
+                if (vm.frame_count == base_frame) { // back to the native that called in
+                    vm.stack_top = frame->slots;
+                    vm_push(result);
+                    return INTERPRET_OK;
+                }
+                vm.stack_top = frame->slots;
+                vm_push(result);
+                frame = &vm.frames[vm.frame_count - 1]; // move to new call_frame_t
+                ip = frame->ip;
+                DISPATCH();
+            }
+            OP_EXIT_LABEL: {
+                frame->ip = ip;
+                const value_t exit_code = vm_pop();
+                if (!IS_NUMBER(exit_code)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm.exit_status = AS_NUMBER(exit_code);
+                if (AS_NUMBER(exit_code)) {
+                    return INTERPRET_EXIT;
+                }
+                return INTERPRET_EXIT_OK;
+            }
+            WIDE_TYPE_LABEL: operand = READ_WIDE(); goto type;
+            OP_TYPE_LABEL: operand = READ_BYTE();
+            type: {
+                vm_push(OBJ_VAL(obj_typeobj_t_allocate(OPERAND_STRING())));
+                DISPATCH();
+            }
+            OP_INHERIT_LABEL: {
+                const value_t super_type_obj = peek(1);
+                if (!IS_TYPECLASS(super_type_obj)) {
+                    frame->ip = ip;
+                    runtime_error(gettext("Super type must be a type."));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                obj_typeobj_t *sub_type_obj = AS_TYPECLASS(peek(0));
+                sub_type_obj->super = AS_TYPECLASS(super_type_obj);
+                // initialize the new subclass with copies of the superclass methods, to be optionally overridden later
+                table_t_copy_to(&AS_TYPECLASS(super_type_obj)->fields, &sub_type_obj->fields);
+                table_t_copy_to(&AS_TYPECLASS(super_type_obj)->methods, &sub_type_obj->methods);
+                vm_pop();
+                DISPATCH();
+            }
+            WIDE_METHOD_LABEL: operand = READ_WIDE(); goto method;
+            OP_METHOD_LABEL: operand = READ_BYTE();
+            method: {
+                define_method(OPERAND_STRING());
+                DISPATCH();
+            }
+            WIDE_FIELD_LABEL: operand = READ_WIDE(); goto field;
+            OP_FIELD_LABEL: operand = READ_BYTE();
+            field: {
+                define_field(OPERAND_STRING());
+                DISPATCH();
+            }
+            OP_CONSTANT_LONG_LABEL: {
+                operand = READ_WIDE();
+                vm_push(OPERAND_CONSTANT());
+                DISPATCH();
+            }
+            OP_POPN_LABEL: { uint8_t pop_count = READ_BYTE(); popn(pop_count); DISPATCH();}
+            OP_DUP_LABEL: vm_push(peek(0)); DISPATCH();
+            OP_DUP2_LABEL: vm_push(peek(1)); vm_push(peek(1)); DISPATCH();
+            OP_GET_INDEX_LABEL: {
+                const value_t container = peek(1);
+                const value_t index = peek(0);
+                // fast paths for the builtin containers, anything else (including errors) goes through subscript()
+                if (IS_LIST(container) && IS_NUMBER(index)) {
+                    const value_list_t *elements = &AS_LIST(container)->elements;
+                    int i = (int)AS_NUMBER(index);
+                    if (i < 0)
+                        i += elements->count;
+                    if (i >= 0 && i < elements->count) {
+                        popn(2);
+                        vm_push(elements->values[i]);
+                        DISPATCH();
+                    }
+                } else if (IS_MAP(container)) {
+                    value_t v = NIL_VAL;
+                    obj_map_t_get(AS_MAP(container), index, &v);
+                    popn(2);
+                    vm_push(v);
+                    DISPATCH();
+                } else if (IS_ARRAY(container) && IS_NUMBER(index)) {
+                    const obj_array_t *array = AS_ARRAY(container);
+                    int i = (int)AS_NUMBER(index);
+                    if (i < 0)
+                        i += array->count;
+                    if (i >= 0 && i < array->count) {
+                        popn(2);
+                        vm_push(NUMBER_VAL(array->values[i]));
+                        DISPATCH();
+                    }
+                } else if (IS_STRING(container) && IS_NUMBER(index)) {
+                    const obj_string_t *str = AS_STRING(container);
+                    int i = (int)AS_NUMBER(index);
+                    if (i < 0)
+                        i += str->length;
+                    if (i >= 0 && i < str->length) {
+                        const value_t v = OBJ_VAL(vm.char_strings[(uint8_t)str->chars[i]]);
+                        popn(2);
+                        vm_push(v);
+                        DISPATCH();
+                    }
+                }
+                frame->ip = ip;
+                if (!invoke(vm.subscript_string, 1)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ENTER_FRAME();
+                DISPATCH();
+            }
+            OP_SET_INDEX_LABEL: {
+                const value_t container = peek(2);
+                const value_t index = peek(1);
+                const value_t v = peek(0);
+                if (IS_LIST(container) && IS_NUMBER(index)) {
+                    value_list_t *elements = &AS_LIST(container)->elements;
+                    int i = (int)AS_NUMBER(index);
+                    if (i < 0)
+                        i += elements->count;
+                    if (i >= 0 && i < elements->count) {
+                        elements->values[i] = v;
+                        popn(3);
+                        vm_push(v);
+                        DISPATCH();
+                    }
+                } else if (IS_MAP(container)) {
+                    obj_map_t_set(AS_MAP(container), index, v); // may gc, leave everything on the stack
+                    popn(3);
+                    vm_push(v);
+                    DISPATCH();
+                } else if (IS_ARRAY(container) && IS_NUMBER(index) && IS_NUMBER(v)) {
+                    obj_array_t *array = AS_ARRAY(container);
+                    int i = (int)AS_NUMBER(index);
+                    if (i < 0)
+                        i += array->count;
+                    if (i >= 0 && i < array->count) {
+                        array->values[i] = AS_NUMBER(v);
+                        popn(3);
+                        vm_push(v);
+                        DISPATCH();
+                    }
+                }
+                frame->ip = ip;
+                if (!invoke(vm.subscript_string, 2)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ENTER_FRAME();
+                DISPATCH();
+            }
+            WIDE_FOR_ITER_LABEL: operand = READ_WIDE(); goto for_iter;
+            OP_FOR_ITER_LABEL: operand = READ_BYTE();
+            for_iter: {
+                const uint8_t vars = READ_BYTE();
+                const uint16_t offset = READ_SHORT();
+                value_t key, v;
+                frame->ip = ip;
+                const int next = for_iter_next(&frame->slots[operand], vars, &key, &v);
+                if (next < 0)
+                    return INTERPRET_RUNTIME_ERROR;
+                if (next == 0) {
+                    ip += offset;
+                    DISPATCH();
+                }
+                if (vars == 2)
+                    vm_push(key);
+                vm_push(v);
+                DISPATCH();
+            }
+            OP_BUILD_LIST_LABEL: {
+                const uint8_t count = READ_BYTE();
+                build_list(count, count);
+                DISPATCH();
+            }
+            OP_BUILD_LIST_LONG_LABEL: {
+                const uint8_t p1 = READ_BYTE();
+                const uint8_t p2 = READ_BYTE();
+                const uint8_t p3 = READ_BYTE();
+                const uint8_t count = READ_BYTE();
+                build_list(p1 | (p2 << 8) | (p3 << 16), count);
+                DISPATCH();
+            }
+            OP_EXTEND_LIST_LABEL: extend_list(READ_BYTE()); DISPATCH();
+            OP_BUILD_MAP_LABEL: {
+                const uint8_t count = READ_BYTE();
+                build_map(count, count);
+                DISPATCH();
+            }
+            OP_BUILD_MAP_LONG_LABEL: {
+                const uint8_t p1 = READ_BYTE();
+                const uint8_t p2 = READ_BYTE();
+                const uint8_t p3 = READ_BYTE();
+                const uint8_t count = READ_BYTE();
+                build_map(p1 | (p2 << 8) | (p3 << 16), count);
+                DISPATCH();
+            }
+            OP_EXTEND_MAP_LABEL: extend_map(READ_BYTE()); DISPATCH();
+            OP_COPY_LITERAL_LABEL: copy_literal(); DISPATCH();
+            OP_JUMP_IF_FALSE_POP_LABEL: {
+                const uint16_t offset = READ_SHORT();
+                if (is_falsey(vm_pop()))
+                    ip += offset;
+                DISPATCH();
+            }
+            OP_JUMP_IF_FALSE_OR_POP_LABEL: {
+                const uint16_t offset = READ_SHORT();
+                if (is_falsey(peek(0)))
+                    ip += offset;
+                else
+                    vm.stack_top--;
+                DISPATCH();
+            }
+            OP_JUMP_IF_TRUE_OR_POP_LABEL: {
+                const uint16_t offset = READ_SHORT();
+                if (!is_falsey(peek(0)))
+                    ip += offset;
+                else
+                    vm.stack_top--;
+                DISPATCH();
+            }
+            OP_JUMP_IF_NOT_LESS_LABEL: COMPARE_JUMP(OP_JUMP_IF_NOT_LESS); DISPATCH();
+            OP_JUMP_IF_NOT_GREATER_LABEL: COMPARE_JUMP(OP_JUMP_IF_NOT_GREATER); DISPATCH();
+            OP_JUMP_IF_NOT_EQUAL_LABEL: COMPARE_JUMP(OP_JUMP_IF_NOT_EQUAL); DISPATCH();
+            OP_JUMP_IF_LESS_LABEL: COMPARE_JUMP(OP_JUMP_IF_LESS); DISPATCH();
+            OP_JUMP_IF_GREATER_LABEL: COMPARE_JUMP(OP_JUMP_IF_GREATER); DISPATCH();
+            OP_JUMP_IF_EQUAL_LABEL: COMPARE_JUMP(OP_JUMP_IF_EQUAL); DISPATCH();
+            OP_JUMP_IF_LOCAL_CONST_LABEL: {
+                const value_t a = frame->slots[READ_BYTE()];
+                const value_t b = READ_CONSTANT();
+                const uint8_t kind = READ_BYTE();
+                const uint16_t offset = READ_SHORT();
+                const int jump = compare_for_jump(kind, a, b);
+                if (jump < 0) {
+                    frame->ip = ip;
+                    runtime_error(gettext("Operands must be numbers."));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (jump)
+                    ip += offset;
+                DISPATCH();
+            }
+            OP_JUMP_IF_LOCAL_LOCAL_LABEL: {
+                const value_t a = frame->slots[READ_BYTE()];
+                const value_t b = frame->slots[READ_BYTE()];
+                const uint8_t kind = READ_BYTE();
+                const uint16_t offset = READ_SHORT();
+                const int jump = compare_for_jump(kind, a, b);
+                if (jump < 0) {
+                    frame->ip = ip;
+                    runtime_error(gettext("Operands must be numbers."));
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                value_t *v = vm.stack_top - 1;
-                v->as.number = -v->as.number;
+                if (jump)
+                    ip += offset;
                 DISPATCH();
             }
-            OP_PRINT_LABEL: {
-                value_t_print(stdout, vm_pop());
-                printf("\n");
+            // in place updates for ++, --, += and -= by a small constant, leaving the new value
+            WIDE_INC_LOCAL_LABEL: operand = READ_WIDE(); goto inc_local;
+            OP_INC_LOCAL_LABEL: operand = READ_BYTE();
+            inc_local: {
+                value_t *target = &frame->slots[operand];
+                INCREMENT(target);
+                vm_push(*target);
                 DISPATCH();
             }
-            OP_ERROR_LABEL: {
-                value_t_print(stderr, vm_pop());
-                fprintf(stderr, "\n");
+            WIDE_INC_UPVALUE_LABEL: operand = READ_WIDE(); goto inc_upvalue;
+            OP_INC_UPVALUE_LABEL: operand = READ_BYTE();
+            inc_upvalue: {
+                value_t *target = frame->closure->upvalues[operand]->location;
+                INCREMENT(target);
+                vm_push(*target);
                 DISPATCH();
             }
-            OP_JUMP_LABEL: {
-                const uint16_t offset = READ_SHORT();
-                ip += offset;
+            WIDE_INC_GLOBAL_LABEL: operand = READ_WIDE(); goto inc_global;
+            OP_INC_GLOBAL_LABEL: operand = READ_BYTE();
+            inc_global: {
+                const obj_string_t *name = OPERAND_STRING();
+                value_t *target = table_t_get_ref(&vm.globals, OBJ_VAL(name));
+                if (target == NULL) {
+                    frame->ip = ip;
+                    runtime_error(gettext("Undefined variable '%s'."), name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                INCREMENT(target);
+                vm_push(*target);
                 DISPATCH();
             }
-            OP_JUMP_IF_FALSE_LABEL: {
-                const uint16_t offset = READ_SHORT();
-                if (is_falsey(peek(0)))
-                    ip += offset;
+            WIDE_INC_PROPERTY_LABEL: operand = READ_WIDE(); goto inc_property;
+            OP_INC_PROPERTY_LABEL: operand = READ_BYTE();
+            inc_property: {
+                frame->ip = ip;
+                const obj_string_t *name = OPERAND_STRING();
+                if (IS_TYPECLASS(peek(0))) {
+                    runtime_error(gettext("Type fields are read only."));
+                    return INTERPRET_RUNTIME_ERROR;
+                } else if (!IS_INSTANCE(peek(0))) {
+                    runtime_error(gettext("Only instances have fields."));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                obj_instance_t *instance = AS_INSTANCE(peek(0));
+                value_t *target = table_t_get_ref(&instance->fields, OBJ_VAL(name));
+                if (target == NULL) {
+                    if (table_t_get_ref(&instance->typeobj->methods, OBJ_VAL(name)) == NULL)
+                        runtime_error(gettext("Undefined property '%s'."), name->chars);
+                    else // a bound method plus a number
+                        runtime_error(gettext("Operands must be two numbers or two strings."));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                INCREMENT(target);
+                vm_pop(); // instance
+                vm_push(*target);
                 DISPATCH();
             }
-            OP_LOOP_LABEL: {
-                const uint16_t offset = READ_SHORT();
-                ip -= offset;
+            OP_ADD_LOCAL_CONST_LABEL: {
+                value_t *target = &frame->slots[READ_BYTE()];
+                const value_t b = READ_CONSTANT();
+                if (IS_NUMBER(*target) && IS_NUMBER(b)) {
+                    *target = NUMBER_VAL(AS_NUMBER(*target) + AS_NUMBER(b));
+                    vm_push(*target);
+                } else if (IS_STRING(*target) && IS_STRING(b)) {
+                    vm_push(*target);
+                    vm_push(b);
+                    concatenate();
+                    *target = peek(0);
+                } else {
+                    frame->ip = ip;
+                    runtime_error(gettext("Operands must be two numbers or two strings."));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 DISPATCH();
             }
-            OP_CALL_LABEL: {
+            OP_SWITCH_TABLE_LABEL: {
+                obj_map_t *targets = AS_MAP(READ_CONSTANT());
+                const uint16_t otherwise = READ_SHORT();
+                value_t target;
+                if (obj_map_t_get(targets, peek(0), &target))
+                    ip += (int)AS_NUMBER(target);
+                else
+                    ip += otherwise;
+                DISPATCH();
+            }
+            OP_TAIL_CALL_LABEL: {
                 const int argc = READ_BYTE();
                 frame->ip = ip;
                 if (!call_value(peek(argc), argc)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frame_count - 1]; // move to new call_frame_t
+                if (vm.frames[vm.frame_count - 1].closure->function->registers != NULL) {
+                    ENTER_FRAME(); // register code is not slid over a stack frame, the OP_RETURN after returns its result
+                    DISPATCH();
+                }
+                frame = tail_frame(frame);
                 ip = frame->ip;
                 DISPATCH();
             }
-            OP_INVOKE_LABEL: { // combined OP_GET_PROPERTY and OP_CALL
+            OP_TAIL_INVOKE_LABEL: {
                 const obj_string_t *method_name = READ_STRING();
                 const int argc = READ_BYTE();
                 frame->ip = ip;
                 if (!invoke(method_name, argc)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frame_count - 1]; // move to new call_frame_t
+                if (vm.frames[vm.frame_count - 1].closure->function->registers != NULL) {
+                    ENTER_FRAME();
+                    DISPATCH();
+                }
+                frame = tail_frame(frame);
                 ip = frame->ip;
                 DISPATCH();
             }
-            OP_SUPER_INVOKE_LABEL: { // combined OP_GET_SUPER and OP_CALL
+            OP_TAIL_SUPER_INVOKE_LABEL: {
                 const obj_string_t *method_name = READ_STRING();
                 const int argc = READ_BYTE();
                 obj_typeobj_t *super_type_obj = AS_TYPECLASS(vm_pop());
@@ -1708,119 +3820,647 @@ static vm_t_interpret_result_t run(void)
                 if (!invoke_from_typeobj(super_type_obj, method_name, argc)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frame_count - 1]; // move to new call_frame_t
-                ip = frame->ip;
-                DISPATCH();
-            }
-            OP_CLOSURE_LABEL: {
-                obj_closure_t *closure = obj_closure_t_allocate(AS_FUNCTION(READ_CONSTANT()));
-                vm_push(OBJ_VAL(closure));
-                for (int i = 0; i < closure->upvalue_count; i++) {
-                    const uint8_t is_local = READ_BYTE();
-                    const uint8_t index = READ_BYTE();
-                    if (is_local) {
-                        closure->upvalues[i] = capture_upvalue(frame->slots + index);
-                    } else {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
-                    }
+                if (vm.frames[vm.frame_count - 1].closure->function->registers != NULL) {
+                    ENTER_FRAME();
+                    DISPATCH();
                 }
+                frame = tail_frame(frame);
+                ip = frame->ip;
                 DISPATCH();
             }
-            OP_CLOSE_UPVALUE_LABEL: {
-                close_upvalues(vm.stack_top - 1);
-                vm_pop();
-                DISPATCH();
+            OP_WIDE_LABEL: {
+                goto *wide_dispatch[READ_BYTE()];
             }
-            OP_RETURN_LABEL: {
-                const value_t result = vm_pop();
-                close_upvalues(frame->slots); // close the remaining open upvalues owned by the returning function
-                vm.frame_count--;
-                if (vm.frame_count == 0) {
-                    vm_pop();
-                    ip = frame->ip;
-                    return INTERPRET_OK;
+            OP_ADD_NUM_LABEL: NUMBER_OP(OP_ADD, NUMBER_VAL, +); DISPATCH();
+            OP_ADD_STR_LABEL: {
+                if (!IS_STRING(peek(0)) || !IS_STRING(peek(1))) {
+                    ip[-1] = OP_ADD;
+                    goto OP_ADD_LABEL;
                 }
-                vm.stack_top = frame->slots;
-                vm_push(result);
-                frame = &vm.frames[vm.frame_count - 1]; // move to new call_frame_t
-                ip = frame->ip;
+                concatenate();
                 DISPATCH();
             }
-            OP_EXIT_LABEL: {
+            OP_SUBTRACT_NUM_LABEL: NUMBER_OP(OP_SUBTRACT, NUMBER_VAL, -); DISPATCH();
+            OP_LESS_NUM_LABEL: NUMBER_OP(OP_LESS, BOOL_VAL, <); DISPATCH();
+            OP_GREATER_NUM_LABEL: NUMBER_OP(OP_GREATER, BOOL_VAL, >); DISPATCH();
+            OP_GET_PROPERTY_INSTANCE_LABEL: operand = READ_BYTE();
+            get_property_instance: {
+                if (!IS_INSTANCE(peek(0))) {
+                    ip[-2] = OP_GET_PROPERTY;
+                    goto get_property;
+                }
+                obj_instance_t *instance = AS_INSTANCE(peek(0));
+                const obj_string_t *name = OPERAND_STRING();
+                value_t value;
+                if (table_t_get(&instance->fields, OBJ_VAL(name), &value)) {
+                    vm.stack_top[-1] = value;
+                    DISPATCH();
+                }
                 frame->ip = ip;
-                const value_t exit_code = vm_pop();
-                if (!IS_NUMBER(exit_code)) {
+                if (!bind_method(instance->typeobj, name)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                vm.exit_status = AS_NUMBER(exit_code);
-                if (AS_NUMBER(exit_code)) {
-                    return INTERPRET_EXIT;
-                }
-                return INTERPRET_EXIT_OK;
+                DISPATCH();
             }
-            OP_TYPE_LABEL: {
-                vm_push(OBJ_VAL(obj_typeobj_t_allocate(READ_STRING())));
+        }
+        # pragma GCC diagnostic pop
+    }
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_WIDE
+#undef READ_CONSTANT
+#undef READ_STRING
+#undef OPERAND_CONSTANT
+#undef OPERAND_STRING
+#undef BINARY_OP
+#undef COMPARE_JUMP
+#undef NUMBER_OP
+#undef INCREMENT
+#undef ENTER_FRAME
+#undef BINARY_OP_BIT
+#undef DISPATCH
+}
+
+// the register loop: a frame keeps every register below vm.stack_top so the gc sees them, and only lowers it to the
+// end of a call window while the call runs. register callees run here, stack callees in their own loop
+static vm_t_interpret_result_t run_registers(const int base_frame)
+{
+    call_frame_t *frame = &vm.frames[vm.frame_count - 1];
+    register uint32_t *pc = frame->pc;
+    value_t *slots = frame->slots;
+    const value_t *constants = frame->closure->function->chunk.constants.values;
+    uint32_t word;
+    int caller;
+
+#define A() REG_A(word)
+#define B() REG_B(word)
+#define C() REG_C(word)
+#define RA() (slots[REG_A(word)])
+#define RB() (slots[REG_B(word)])
+#define RC() (slots[REG_C(word)])
+#define KB() (constants[REG_B(word)])
+#define KC() (constants[REG_C(word)])
+#define ERROR(...) \
+    do { \
+        frame->pc = pc; \
+        runtime_error(__VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+#define LOAD_FRAME() \
+    do { \
+        frame = &vm.frames[vm.frame_count - 1]; \
+        pc = frame->pc; \
+        slots = frame->slots; \
+        constants = frame->closure->function->chunk.constants.values; \
+    } while (false)
+// registers a call window left uncovered may hold values the gc has since freed, they come back as nil
+#define RESTORE_TOP() \
+    do { \
+        value_t *top = slots + frame->closure->function->registers->register_count; \
+        while (vm.stack_top < top) \
+            *vm.stack_top++ = NIL_VAL; \
+    } while (false)
+// after a call, a pushed register frame is switched to and a stack frame runs to its return in the stack loop
+#define ENTER_FRAME() \
+    do { \
+        if (vm.frame_count > caller) { \
+            if (vm.frames[vm.frame_count - 1].closure->function->registers != NULL) { \
+                LOAD_FRAME(); \
+                DISPATCH(); \
+            } \
+            const vm_t_interpret_result_t result = run_stack(vm.frame_count - 1); \
+            if (result != INTERPRET_OK) \
+                return result; \
+        } \
+        RESTORE_TOP(); \
+    } while (false)
+// a fallback that calls back into script code and waits for its result on top of the stack
+#define RUN_NESTED() \
+    do { \
+        if (vm.frame_count > caller) { \
+            const vm_t_interpret_result_t result = run(caller); \
+            if (result != INTERPRET_OK) \
+                return result; \
+        } \
+    } while (false)
+#define NUMBER_OP(value_type_wrapper, op, b) \
+    do { \
+        const value_t x = RB(); \
+        const value_t y = (b); \
+        if (!IS_NUMBER(x) || !IS_NUMBER(y)) \
+            ERROR(gettext("Operands must be numbers.")); \
+        RA() = value_type_wrapper(AS_NUMBER(x) op AS_NUMBER(y)); \
+    } while (false)
+#define BIT_OP(op) \
+    do { \
+        const value_t x = RB(); \
+        const value_t y = RC(); \
+        if (!IS_NUMBER(x) || !IS_NUMBER(y)) \
+            ERROR(gettext("Operands must be numbers.")); \
+        RA() = NUMBER_VAL((double)((long long)AS_NUMBER(x) op (long long)AS_NUMBER(y))); \
+    } while (false)
+#define ADD(b) \
+    do { \
+        const value_t x = RB(); \
+        const value_t y = (b); \
+        if (IS_NUMBER(x) && IS_NUMBER(y)) { \
+            RA() = NUMBER_VAL(AS_NUMBER(x) + AS_NUMBER(y)); \
+        } else if (IS_STRING(x) && IS_STRING(y)) { \
+            vm_push(x); \
+            vm_push(y); \
+            concatenate(); \
+            RA() = vm_pop(); \
+        } else { \
+            ERROR(gettext("Operands must be two numbers or two strings.")); \
+        } \
+    } while (false)
+#define DIVIDE(b) \
+    do { \
+        const value_t divisor = (b); \
+        if (IS_NUMBER(divisor) && AS_NUMBER(divisor) == 0) \
+            ERROR(gettext("Illegal divide by zero.")); \
+        NUMBER_OP(NUMBER_VAL, /, divisor); \
+    } while (false)
+#define MOD(b) \
+    do { \
+        const value_t divisor = (b); \
+        if (IS_NUMBER(divisor) && AS_NUMBER(divisor) == 0) \
+            ERROR(gettext("Illegal divide by zero.")); \
+        RA() = NUMBER_VAL(fmod(AS_NUMBER(RB()), AS_NUMBER(divisor))); \
+    } while (false)
+#define INCREMENT(target, delta) \
+    do { \
+        if (!IS_NUMBER(*(target))) \
+            ERROR(gettext("Operands must be two numbers or two strings.")); \
+        *(target) = NUMBER_VAL(AS_NUMBER(*(target)) + (delta)); \
+    } while (false)
+#define COMPARE_JUMP(b) \
+    do { \
+        const int32_t offset = (int32_t)*pc++; \
+        const int jump = compare_for_jump((uint8_t)A(), RB(), (b)); \
+        if (jump < 0) \
+            ERROR(gettext("Operands must be numbers.")); \
+        if (jump) \
+            pc += offset; \
+    } while (false)
+
+    # pragma GCC diagnostic push
+    # pragma GCC diagnostic ignored "-Wpedantic"
+    static void* register_dispatch[] = {
+        [REG_MOVE] = &&REG_MOVE_LABEL, [REG_LOAD_CONSTANT] = &&REG_LOAD_CONSTANT_LABEL,
+        [REG_LOAD_NIL] = &&REG_LOAD_NIL_LABEL, [REG_LOAD_BOOL] = &&REG_LOAD_BOOL_LABEL,
+        [REG_GET_GLOBAL] = &&REG_GET_GLOBAL_LABEL, [REG_DEFINE_GLOBAL] = &&REG_DEFINE_GLOBAL_LABEL,
+        [REG_SET_GLOBAL] = &&REG_SET_GLOBAL_LABEL, [REG_GET_UPVALUE] = &&REG_GET_UPVALUE_LABEL,
+        [REG_SET_UPVALUE] = &&REG_SET_UPVALUE_LABEL, [REG_GET_PROPERTY] = &&REG_GET_PROPERTY_LABEL,
+        [REG_SET_PROPERTY] = &&REG_SET_PROPERTY_LABEL, [REG_EQUAL] = &&REG_EQUAL_LABEL,
+        [REG_GREATER] = &&REG_GREATER_LABEL, [REG_LESS] = &&REG_LESS_LABEL, [REG_ADD] = &&REG_ADD_LABEL,
+        [REG_SUBTRACT] = &&REG_SUBTRACT_LABEL, [REG_MULTIPLY] = &&REG_MULTIPLY_LABEL,
+        [REG_DIVIDE] = &&REG_DIVIDE_LABEL, [REG_MOD] = &&REG_MOD_LABEL, [REG_BITWISE_AND] = &&REG_BITWISE_AND_LABEL,
+        [REG_BITWISE_OR] = &&REG_BITWISE_OR_LABEL, [REG_BITWISE_XOR] = &&REG_BITWISE_XOR_LABEL,
+        [REG_SHIFT_LEFT] = &&REG_SHIFT_LEFT_LABEL, [REG_SHIFT_RIGHT] = &&REG_SHIFT_RIGHT_LABEL,
+        [REG_EQUAL_K] = &&REG_EQUAL_K_LABEL, [REG_GREATER_K] = &&REG_GREATER_K_LABEL,
+        [REG_LESS_K] = &&REG_LESS_K_LABEL, [REG_ADD_K] = &&REG_ADD_K_LABEL,
+        [REG_SUBTRACT_K] = &&REG_SUBTRACT_K_LABEL, [REG_MULTIPLY_K] = &&REG_MULTIPLY_K_LABEL,
+        [REG_DIVIDE_K] = &&REG_DIVIDE_K_LABEL, [REG_MOD_K] = &&REG_MOD_K_LABEL, [REG_NOT] = &&REG_NOT_LABEL,
+        [REG_NEGATE] = &&REG_NEGATE_LABEL, [REG_BITWISE_NOT] = &&REG_BITWISE_NOT_LABEL,
+        [REG_INCREMENT] = &&REG_INCREMENT_LABEL, [REG_INC_UPVALUE] = &&REG_INC_UPVALUE_LABEL,
+        [REG_INC_GLOBAL] = &&REG_INC_GLOBAL_LABEL, [REG_INC_PROPERTY] = &&REG_INC_PROPERTY_LABEL,
+        [REG_PRINT] = &&REG_PRINT_LABEL, [REG_ERROR] = &&REG_ERROR_LABEL, [REG_JUMP] = &&REG_JUMP_LABEL,
+        [REG_JUMP_IF_FALSE] = &&REG_JUMP_IF_FALSE_LABEL, [REG_JUMP_IF_TRUE] = &&REG_JUMP_IF_TRUE_LABEL,
+        [REG_JUMP_IF] = &&REG_JUMP_IF_LABEL, [REG_JUMP_IF_K] = &&REG_JUMP_IF_K_LABEL, [REG_CALL] = &&REG_CALL_LABEL,
+        [REG_INVOKE] = &&REG_INVOKE_LABEL, [REG_TAIL_CALL] = &&REG_TAIL_CALL_LABEL,
+        [REG_TAIL_INVOKE] = &&REG_TAIL_INVOKE_LABEL, [REG_CLOSURE] = &&REG_CLOSURE_LABEL,
+        [REG_CLOSE_UPVALUE] = &&REG_CLOSE_UPVALUE_LABEL, [REG_RETURN] = &&REG_RETURN_LABEL,
+        [REG_EXIT] = &&REG_EXIT_LABEL, [REG_TYPE] = &&REG_TYPE_LABEL, [REG_INHERIT] = &&REG_INHERIT_LABEL,
+        [REG_METHOD] = &&REG_METHOD_LABEL, [REG_FIELD] = &&REG_FIELD_LABEL, [REG_GET_INDEX] = &&REG_GET_INDEX_LABEL,
+        [REG_SET_INDEX] = &&REG_SET_INDEX_LABEL, [REG_FOR_ITER] = &&REG_FOR_ITER_LABEL,
+        [REG_BUILD_LIST] = &&REG_BUILD_LIST_LABEL, [REG_BUILD_MAP] = &&REG_BUILD_MAP_LABEL,
+        [REG_COPY_LITERAL] = &&REG_COPY_LITERAL_LABEL,
+    };
+    #define DISPATCH() \
+        do { \
+            dump_register_tracing(frame, pc); \
+            COUNT_REGISTER_DISPATCH(REG_OP(*pc)); \
+            word = *pc++; \
+            goto *register_dispatch[REG_OP(word)]; \
+        } while (false)
+
+    DISPATCH();
+    REG_MOVE_LABEL: RA() = RB(); DISPATCH();
+    REG_LOAD_CONSTANT_LABEL: RA() = KB(); DISPATCH();
+    REG_LOAD_NIL_LABEL: RA() = NIL_VAL; DISPATCH();
+    REG_LOAD_BOOL_LABEL: RA() = BOOL_VAL(B() != 0); DISPATCH();
+    REG_GET_GLOBAL_LABEL: {
+        const obj_string_t *name = AS_STRING(KB());
+        if (!table_t_get(&vm.globals, OBJ_VAL(name), &RA()))
+            ERROR(gettext("Undefined variable '%s'."), name->chars);
+        DISPATCH();
+    }
+    REG_DEFINE_GLOBAL_LABEL: table_t_set(&vm.globals, constants[A()], RB()); DISPATCH();
+    REG_SET_GLOBAL_LABEL: {
+        const value_t name = constants[A()];
+        if (table_t_set(&vm.globals, name, RB())) {
+            table_t_delete(&vm.globals, name);
+            ERROR(gettext("Undefined variable '%s'."), AS_STRING(name)->chars);
+        }
+        DISPATCH();
+    }
+    REG_GET_UPVALUE_LABEL: RA() = *frame->closure->upvalues[B()]->location; DISPATCH();
+    REG_SET_UPVALUE_LABEL: *frame->closure->upvalues[A()]->location = RB(); DISPATCH();
+    REG_GET_PROPERTY_LABEL: {
+        const value_t receiver = RB();
+        if (IS_INSTANCE(receiver) && table_t_get(&AS_INSTANCE(receiver)->fields, KC(), &RA()))
+            DISPATCH();
+        frame->pc = pc;
+        vm_push(receiver);
+        if (!load_property(AS_STRING(KC())))
+            return INTERPRET_RUNTIME_ERROR;
+        RA() = vm_pop();
+        DISPATCH();
+    }
+    REG_SET_PROPERTY_LABEL: {
+        if (IS_TYPECLASS(RA()))
+            ERROR(gettext("Type fields are read only."));
+        else if (!IS_INSTANCE(RA()))
+            ERROR(gettext("Only instances have fields."));
+        table_t_set(&AS_INSTANCE(RA())->fields, KB(), RC());
+        DISPATCH();
+    }
+    REG_EQUAL_LABEL: RA() = BOOL_VAL(value_t_equal(RB(), RC())); DISPATCH();
+    REG_GREATER_LABEL: NUMBER_OP(BOOL_VAL, >, RC()); DISPATCH();
+    REG_LESS_LABEL: NUMBER_OP(BOOL_VAL, <, RC()); DISPATCH();
+    REG_ADD_LABEL: ADD(RC()); DISPATCH();
+    REG_SUBTRACT_LABEL: NUMBER_OP(NUMBER_VAL, -, RC()); DISPATCH();
+    REG_MULTIPLY_LABEL: NUMBER_OP(NUMBER_VAL, *, RC()); DISPATCH();
+    REG_DIVIDE_LABEL: DIVIDE(RC()); DISPATCH();
+    REG_MOD_LABEL: MOD(RC()); DISPATCH();
+    REG_BITWISE_AND_LABEL: BIT_OP(&); DISPATCH();
+    REG_BITWISE_OR_LABEL: BIT_OP(|); DISPATCH();
+    REG_BITWISE_XOR_LABEL: BIT_OP(^); DISPATCH();
+    REG_SHIFT_LEFT_LABEL: BIT_OP(<<); DISPATCH();
+    REG_SHIFT_RIGHT_LABEL: BIT_OP(>>); DISPATCH();
+    REG_EQUAL_K_LABEL: RA() = BOOL_VAL(value_t_equal(RB(), KC())); DISPATCH();
+    REG_GREATER_K_LABEL: NUMBER_OP(BOOL_VAL, >, KC()); DISPATCH();
+    REG_LESS_K_LABEL: NUMBER_OP(BOOL_VAL, <, KC()); DISPATCH();
+    REG_ADD_K_LABEL: ADD(KC()); DISPATCH();
+    REG_SUBTRACT_K_LABEL: NUMBER_OP(NUMBER_VAL, -, KC()); DISPATCH();
+    REG_MULTIPLY_K_LABEL: NUMBER_OP(NUMBER_VAL, *, KC()); DISPATCH();
+    REG_DIVIDE_K_LABEL: DIVIDE(KC()); DISPATCH();
+    REG_MOD_K_LABEL: MOD(KC()); DISPATCH();
+    REG_NOT_LABEL: RA() = BOOL_VAL(is_falsey(RB())); DISPATCH();
+    REG_NEGATE_LABEL: {
+        if (!IS_NUMBER(RB()))
+            ERROR(gettext("Operand must be a number."));
+        RA() = NUMBER_VAL(-AS_NUMBER(RB()));
+        DISPATCH();
+    }
+    REG_BITWISE_NOT_LABEL: RA() = NUMBER_VAL((double)(~(long long)AS_NUMBER(RB()))); DISPATCH();
+    // in place updates by a small constant, leaving the new value in A as well
+    REG_INCREMENT_LABEL: {
+        const value_t from = RB();
+        if (!IS_NUMBER(from))
+            ERROR(gettext("Operands must be two numbers or two strings."));
+        RA() = NUMBER_VAL(AS_NUMBER(from) + (int8_t)C());
+        DISPATCH();
+    }
+    REG_INC_UPVALUE_LABEL: {
+        value_t *target = frame->closure->upvalues[B()]->location;
+        INCREMENT(target, (int8_t)C());
+        RA() = *target;
+        DISPATCH();
+    }
+    REG_INC_GLOBAL_LABEL: {
+        value_t *target = table_t_get_ref(&vm.globals, KB());
+        if (target == NULL)
+            ERROR(gettext("Undefined variable '%s'."), AS_STRING(KB())->chars);
+        INCREMENT(target, (int8_t)C());
+        RA() = *target;
+        DISPATCH();
+    }
+    REG_INC_PROPERTY_LABEL: {
+        const int32_t delta = (int32_t)*pc++;
+        const obj_string_t *name = AS_STRING(KC());
+        if (IS_TYPECLASS(RB()))
+            ERROR(gettext("Type fields are read only."));
+        else if (!IS_INSTANCE(RB()))
+            ERROR(gettext("Only instances have fields."));
+        obj_instance_t *instance = AS_INSTANCE(RB());
+        value_t *target = table_t_get_ref(&instance->fields, OBJ_VAL(name));
+        if (target == NULL) {
+            if (table_t_get_ref(&instance->typeobj->methods, OBJ_VAL(name)) == NULL)
+                ERROR(gettext("Undefined property '%s'."), name->chars);
+            ERROR(gettext("Operands must be two numbers or two strings.")); // a bound method plus a number
+        }
+        INCREMENT(target, delta);
+        RA() = *target;
+        DISPATCH();
+    }
+    REG_PRINT_LABEL: {
+        value_t_print(stdout, RA());
+        printf("\n");
+        DISPATCH();
+    }
+    REG_ERROR_LABEL: {
+        value_t_print(stderr, RA());
+        fprintf(stderr, "\n");
+        DISPATCH();
+    }
+    REG_JUMP_LABEL: {
+        const int32_t offset = (int32_t)*pc++;
+        pc += offset;
+        DISPATCH();
+    }
+    REG_JUMP_IF_FALSE_LABEL: {
+        const int32_t offset = (int32_t)*pc++;
+        if (is_falsey(RA()))
+            pc += offset;
+        DISPATCH();
+    }
+    REG_JUMP_IF_TRUE_LABEL: {
+        const int32_t offset = (int32_t)*pc++;
+        if (!is_falsey(RA()))
+            pc += offset;
+        DISPATCH();
+    }
+    REG_JUMP_IF_LABEL: COMPARE_JUMP(RC()); DISPATCH();
+    REG_JUMP_IF_K_LABEL: COMPARE_JUMP(KC()); DISPATCH();
+    REG_CALL_LABEL: {
+        frame->pc = pc;
+        caller = vm.frame_count;
+        vm.stack_top = slots + A() + B() + 1;
+        if (!call_value(RA(), B()))
+            return INTERPRET_RUNTIME_ERROR;
+        ENTER_FRAME();
+        DISPATCH();
+    }
+    REG_INVOKE_LABEL: {
+        frame->pc = pc;
+        caller = vm.frame_count;
+        vm.stack_top = slots + A() + B() + 1;
+        if (!invoke(AS_STRING(KC()), B()))
+            return INTERPRET_RUNTIME_ERROR;
+        ENTER_FRAME();
+        DISPATCH();
+    }
+    // a register callee slides down over this frame, anything else runs nested and the REG_RETURN after returns it
+    REG_TAIL_CALL_LABEL: {
+        frame->pc = pc;
+        caller = vm.frame_count;
+        vm.stack_top = slots + A() + B() + 1;
+        if (!call_value(RA(), B()))
+            return INTERPRET_RUNTIME_ERROR;
+        goto tail_call;
+    }
+    REG_TAIL_INVOKE_LABEL: {
+        frame->pc = pc;
+        caller = vm.frame_count;
+        vm.stack_top = slots + A() + B() + 1;
+        if (!invoke(AS_STRING(KC()), B()))
+            return INTERPRET_RUNTIME_ERROR;
+    }
+    tail_call: {
+        if (vm.frame_count > caller && vm.frames[vm.frame_count - 1].closure->function->registers != NULL) {
+            tail_frame(frame);
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        ENTER_FRAME();
+        DISPATCH();
+    }
+    REG_CLOSURE_LABEL: {
+        obj_closure_t *closure = obj_closure_t_allocate(AS_FUNCTION(KB()));
+        RA() = OBJ_VAL(closure); // rooted in its register while the upvalues are captured
+        for (int i = 0; i < closure->upvalue_count; i++) {
+            const uint32_t capture = *pc++;
+            if (capture & 0xff)
+                closure->upvalues[i] = capture_upvalue(slots + (capture >> 8));
+            else
+                closure->upvalues[i] = frame->closure->upvalues[capture >> 8];
+        }
+        DISPATCH();
+    }
+    REG_CLOSE_UPVALUE_LABEL: close_upvalues(&RA()); DISPATCH();
+    REG_RETURN_LABEL: {
+        const value_t result = RA();
+        close_upvalues(slots); // close the remaining open upvalues owned by the returning function
+        vm.frame_count--;
+        vm.stack_top = slots;
+        if (vm.frame_count == 0)
+            return INTERPRET_OK;
+        vm_push(result);
+        if (vm.frame_count == base_frame) // back to the loop or native that called in
+            return INTERPRET_OK;
+        LOAD_FRAME();
+        RESTORE_TOP();
+        DISPATCH();
+    }
+    REG_EXIT_LABEL: {
+        frame->pc = pc;
+        const value_t exit_code = RA();
+        if (!IS_NUMBER(exit_code))
+            return INTERPRET_RUNTIME_ERROR;
+        vm.exit_status = AS_NUMBER(exit_code);
+        if (AS_NUMBER(exit_code))
+            return INTERPRET_EXIT;
+        return INTERPRET_EXIT_OK;
+    }
+    REG_TYPE_LABEL: RA() = OBJ_VAL(obj_typeobj_t_allocate(AS_STRING(KB()))); DISPATCH();
+    REG_INHERIT_LABEL: {
+        if (!IS_TYPECLASS(RA()))
+            ERROR(gettext("Super type must be a type."));
+        obj_typeobj_t *super_type_obj = AS_TYPECLASS(RA());
+        obj_typeobj_t *sub_type_obj = AS_TYPECLASS(RB());
+        sub_type_obj->super = super_type_obj;
+        table_t_copy_to(&super_type_obj->fields, &sub_type_obj->fields);
+        table_t_copy_to(&super_type_obj->methods, &sub_type_obj->methods);
+        DISPATCH();
+    }
+    REG_METHOD_LABEL: table_t_set(&AS_TYPECLASS(RA())->methods, KC(), RB()); DISPATCH();
+    REG_FIELD_LABEL: table_t_set(&AS_TYPECLASS(RA())->fields, KC(), RB()); DISPATCH();
+    REG_GET_INDEX_LABEL: {
+        const value_t container = RB();
+        const value_t index = RC();
+        // the same fast paths as the stack loop, anything else goes through subscript()
+        if (IS_LIST(container) && IS_NUMBER(index)) {
+            const value_list_t *elements = &AS_LIST(container)->elements;
+            int i = (int)AS_NUMBER(index);
+            if (i < 0)
+                i += elements->count;
+            if (i >= 0 && i < elements->count) {
+                RA() = elements->values[i];
                 DISPATCH();
             }
-            OP_INHERIT_LABEL: {
-                const value_t super_type_obj = peek(1);
-                if (!IS_TYPECLASS(super_type_obj)) {
-                    frame->ip = ip;
-                    runtime_error(gettext("Super type must be a type."));
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                obj_typeobj_t *sub_type_obj = AS_TYPECLASS(peek(0));
-                sub_type_obj->super = AS_TYPECLASS(super_type_obj);
-                // initialize the new subclass with copies of the superclass methods, to be optionally overridden later
-                table_t_copy_to(&AS_TYPECLASS(super_type_obj)->fields, &sub_type_obj->fields);
-                table_t_copy_to(&AS_TYPECLASS(super_type_obj)->methods, &sub_type_obj->methods);
-                vm_pop();
+        } else if (IS_MAP(container)) {
+            value_t v = NIL_VAL;
+            obj_map_t_get(AS_MAP(container), index, &v);
+            RA() = v;
+            DISPATCH();
+        } else if (IS_ARRAY(container) && IS_NUMBER(index)) {
+            const obj_array_t *array = AS_ARRAY(container);
+            int i = (int)AS_NUMBER(index);
+            if (i < 0)
+                i += array->count;
+            if (i >= 0 && i < array->count) {
+                RA() = NUMBER_VAL(array->values[i]);
                 DISPATCH();
             }
-            OP_METHOD_LABEL: {
-                define_method(READ_STRING());
+        } else if (IS_STRING(container) && IS_NUMBER(index)) {
+            const obj_string_t *str = AS_STRING(container);
+            int i = (int)AS_NUMBER(index);
+            if (i < 0)
+                i += str->length;
+            if (i >= 0 && i < str->length) {
+                RA() = OBJ_VAL(vm.char_strings[(uint8_t)str->chars[i]]);
                 DISPATCH();
             }
-            OP_FIELD_LABEL: {
-                define_field(READ_STRING());
+        }
+        frame->pc = pc;
+        caller = vm.frame_count;
+        vm_push(container);
+        vm_push(index);
+        if (!invoke(vm.subscript_string, 1))
+            return INTERPRET_RUNTIME_ERROR;
+        RUN_NESTED();
+        RA() = vm_pop();
+        DISPATCH();
+    }
+    REG_SET_INDEX_LABEL: {
+        value_t *window = &RA();
+        const value_t container = window[0];
+        const value_t index = window[1];
+        const value_t v = window[2];
+        if (IS_LIST(container) && IS_NUMBER(index)) {
+            value_list_t *elements = &AS_LIST(container)->elements;
+            int i = (int)AS_NUMBER(index);
+            if (i < 0)
+                i += elements->count;
+            if (i >= 0 && i < elements->count) {
+                elements->values[i] = v;
+                window[0] = v;
                 DISPATCH();
             }
-            OP_CONSTANT_LONG_LABEL: {
-                assert(false);
-                const uint8_t p1 = READ_BYTE();
-                const uint8_t p2 = READ_BYTE();
-                const uint8_t p3 = READ_BYTE();
-                const uint32_t idx = p1 | (p2 << 8) | (p3 << 16);
-                const value_t v = frame->closure->function->chunk.constants.values[idx];
-                vm_push(v);
+        } else if (IS_MAP(container)) {
+            obj_map_t_set(AS_MAP(container), index, v); // may gc, the window is still covered
+            window[0] = v;
+            DISPATCH();
+        } else if (IS_ARRAY(container) && IS_NUMBER(index) && IS_NUMBER(v)) {
+            obj_array_t *array = AS_ARRAY(container);
+            int i = (int)AS_NUMBER(index);
+            if (i < 0)
+                i += array->count;
+            if (i >= 0 && i < array->count) {
+                array->values[i] = AS_NUMBER(v);
+                window[0] = v;
                 DISPATCH();
             }
-            OP_POPN_LABEL: { uint8_t pop_count = READ_BYTE(); popn(pop_count); DISPATCH();}
-            OP_DUP_LABEL: vm_push(peek(0)); DISPATCH();
         }
-        # pragma GCC diagnostic pop
+        frame->pc = pc;
+        caller = vm.frame_count;
+        vm.stack_top = window + 3;
+        if (!invoke(vm.subscript_string, 2))
+            return INTERPRET_RUNTIME_ERROR;
+        RUN_NESTED();
+        RESTORE_TOP();
+        DISPATCH();
     }
-#undef READ_BYTE
-#undef READ_SHORT
-#undef READ_CONSTANT
-#undef READ_STRING
-#undef BINARY_OP
+    REG_FOR_ITER_LABEL: {
+        const int32_t offset = (int32_t)*pc++;
+        value_t key, v;
+        frame->pc = pc;
+        const int next = for_iter_next(&RA(), B(), &key, &v);
+        if (next < 0)
+            return INTERPRET_RUNTIME_ERROR;
+        if (next == 0) {
+            pc += offset;
+            DISPATCH();
+        }
+        if (B() == 2) {
+            RC() = key;
+            slots[C() + 1] = v;
+        } else {
+            RC() = v;
+        }
+        DISPATCH();
+    }
+    REG_BUILD_LIST_LABEL: {
+        vm.stack_top = slots + A() + B();
+        build_list(B(), B());
+        RESTORE_TOP();
+        DISPATCH();
+    }
+    REG_BUILD_MAP_LABEL: {
+        vm.stack_top = slots + A() + B() * 2;
+        build_map(B(), B());
+        RESTORE_TOP();
+        DISPATCH();
+    }
+    REG_COPY_LITERAL_LABEL: {
+        vm_push(RB());
+        copy_literal();
+        RA() = vm_pop();
+        DISPATCH();
+    }
+    # pragma GCC diagnostic pop
+#undef A
+#undef B
+#undef C
+#undef RA
+#undef RB
+#undef RC
+#undef KB
+#undef KC
+#undef ERROR
+#undef LOAD_FRAME
+#undef RESTORE_TOP
+#undef ENTER_FRAME
+#undef RUN_NESTED
+#undef NUMBER_OP
+#undef BIT_OP
+#undef ADD
+#undef DIVIDE
+#undef MOD
+#undef INCREMENT
+#undef COMPARE_JUMP
 #undef DISPATCH
 }
 
-vm_t_interpret_result_t vm_t_interpret(const char *source)
+static vm_t_interpret_result_t run(const int base_frame)
 {
-    obj_function_t *function = compiler_t_compile(source, vm.flags & VM_FLAG_STACK_TRACE);
-    if (function == NULL)
-        return INTERPRET_COMPILE_ERROR;
+    if (vm.frames[vm.frame_count - 1].closure->function->registers != NULL)
+        return run_registers(base_frame);
+    return run_stack(base_frame);
+}
 
+static vm_t_interpret_result_t interpret_function(obj_function_t *function)
+{
     vm_push(OBJ_VAL(function));
     obj_closure_t *closure = obj_closure_t_allocate(function);
     vm_pop();
     vm_push(OBJ_VAL(closure));
     call(closure, 0);
 
-    return run();
+    return run(0);
+}
+
+vm_t_interpret_result_t vm_t_interpret(const char *source)
+{
+    obj_function_t *function = compiler_t_compile(source, vm.flags & VM_FLAG_STACK_TRACE);
+    if (function == NULL)
+        return INTERPRET_COMPILE_ERROR;
+    return interpret_function(function);
+}
+
+// the script compiled earlier is loaded from cache_path when it still matches source, otherwise it is saved there
+vm_t_interpret_result_t vm_t_interpret_cached(const char *source, const char *source_path, const char *cache_path)
+{
+    obj_function_t *function = cache_read(cache_path, source_path, source);
+    if (function == NULL) {
+        function = compiler_t_compile(source, vm.flags & VM_FLAG_STACK_TRACE);
+        if (function == NULL)
+            return INTERPRET_COMPILE_ERROR;
+        cache_write(cache_path, source_path, function, source); // best effort, an unwritable directory just compiles every time
+    }
+    return interpret_function(function);
 }
 
 static void mark_array(value_list_t *array)
@@ -1871,6 +4511,7 @@ static void mark_objects(obj_t *object)
         case OBJ_FUNCTION: {
             obj_function_t *function = (obj_function_t*)object;
             obj_t_mark((obj_t*)function->name);
+            obj_t_mark((obj_t*)function->lazy_source);
             mark_array(&function->chunk.constants);
             break;
         }
@@ -1885,8 +4526,13 @@ static void mark_objects(obj_t *object)
             mark_array(&list->elements);
             break;
         }
+        case OBJ_SET: {
+            value_set_t_mark(&((obj_set_t*)object)->keys);
+            break;
+        }
         case OBJ_MAP: {
             obj_map_t *map = (obj_map_t*)object;
+            mark_array(&map->array);
             table_t_mark(&map->table);
             break;
         }
@@ -1908,7 +4554,7 @@ static void mark_objects(obj_t *object)
             break;
         }
         case OBJ_STRING:
-            obj_t_mark((obj_t*)object);
+            obj_t_mark((obj_t*)((obj_string_t*)object)->parent);
             break;
         default: return;
     }
@@ -1945,6 +4591,7 @@ static void vm_t_free_object(obj_t *o)
         case OBJ_FUNCTION: {
             obj_function_t *function = (obj_function_t*)o;
             chunk_t_free(&function->chunk);
+            register_code_t_free(function->registers);
             FREE(obj_function_t, o);
             break;
         }
@@ -1960,7 +4607,8 @@ static void vm_t_free_object(obj_t *o)
         }
         case OBJ_STRING: {
             obj_string_t *s = (obj_string_t*)o;
-            FREE_ARRAY(char, s->chars, s->length + 1);
+            if (s->parent == NULL) // slices borrow their parent's buffer
+                FREE_ARRAY(char, s->chars, s->length + 1);
             FREE(obj_string_t, o);
             break;
         }
@@ -1974,8 +4622,24 @@ static void vm_t_free_object(obj_t *o)
             FREE(obj_list_t, o);
             break;
         }
+        case OBJ_ARRAY: {
+            obj_array_t *a = (obj_array_t*)o;
+            FREE_ARRAY(double, a->values, a->capacity);
+            FREE(obj_array_t, o);
+            break;
+        }
+        case OBJ_RANGE: {
+            FREE(obj_range_t, o);
+            break;
+        }
+        case OBJ_SET: {
+            value_set_t_free(&((obj_set_t*)o)->keys);
+            FREE(obj_set_t, o);
+            break;
+        }
         case OBJ_MAP: {
             obj_map_t *m = (obj_map_t*)o;
+            value_list_t_free(&m->array);
             table_t_free(&m->table);
             FREE(obj_map_t, o);
             break;
@@ -2006,9 +4670,12 @@ static void mark_roots(void)
     }
 
     table_t_mark(&vm.globals);
-    table_t_mark(&vm.strings);
     compiler_t_mark_roots();
     obj_t_mark((obj_t*)vm.init_string);
+    obj_t_mark((obj_t*)vm.subscript_string);
+    for (int c = 0; c < 256; c++) {
+        obj_t_mark((obj_t*)vm.char_strings[c]);
+    }
 }
 
 static void trace_references(void)
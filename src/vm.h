@@ -28,6 +28,7 @@
 typedef struct {
     obj_closure_t *closure;
     uint8_t *ip;
+    uint32_t *pc; // the next register instruction, for functions running as register code
     value_t *slots;
 } call_frame_t;
 
@@ -37,6 +38,9 @@ typedef enum vm_flag {
     VM_FLAG_GC_TRACE = 0x2,
     VM_FLAG_GC_STRESS = 0x4,
     VM_FLAG_GC_ACTIVE = 0x8,
+    VM_FLAG_NO_OPTIMIZE = 0x10,
+    VM_FLAG_LAZY_COMPILE = 0x20,
+    VM_FLAG_REGISTERS = 0x40,
 } vm_flag_t;
 
 typedef struct {
@@ -45,8 +49,10 @@ typedef struct {
     value_t stack[STACK_MAX];
     value_t *stack_top;
     table_t globals;
-    table_t strings;
+    string_set_t strings;
     obj_string_t *init_string;
+    obj_string_t *subscript_string;
+    obj_string_t *char_strings[256]; // every single byte string, preallocated
     obj_upvalue_t *open_upvalues;
     size_t bytes_allocated;
     size_t next_garbage_collect;
@@ -71,6 +77,7 @@ extern vm_t vm;
 void vm_t_init(void);
 void vm_t_free(void);
 vm_t_interpret_result_t vm_t_interpret(const char *source);
+vm_t_interpret_result_t vm_t_interpret_cached(const char *source, const char *source_path, const char *cache_path);
 void vm_push(const value_t value);
 value_t vm_pop(void);
 
@@ -82,6 +89,9 @@ void vm_inherit_env(void);
 void vm_toggle_gc_stress(void);
 void vm_toggle_gc_trace(void);
 void vm_toggle_stack_trace(void);
+void vm_toggle_optimize(void);
+void vm_toggle_lazy_compile(void);
+void vm_toggle_registers(void);
 void vm_collect_garbage(void);
 
 static inline bool vm_gc_active(void)
@@ -71,6 +71,46 @@ typedef enum {
     OP_INHERIT,
     OP_METHOD,
     OP_FIELD,
+    OP_DUP2,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    OP_FOR_ITER,
+    OP_BUILD_LIST,
+    OP_BUILD_LIST_LONG,
+    OP_EXTEND_LIST,
+    OP_BUILD_MAP,
+    OP_BUILD_MAP_LONG,
+    OP_EXTEND_MAP,
+    OP_COPY_LITERAL,
+    OP_JUMP_IF_FALSE_POP,
+    OP_JUMP_IF_FALSE_OR_POP,
+    OP_JUMP_IF_TRUE_OR_POP,
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_NOT_EQUAL,
+    OP_JUMP_IF_LESS,
+    OP_JUMP_IF_GREATER,
+    OP_JUMP_IF_EQUAL,
+    OP_JUMP_IF_LOCAL_CONST,
+    OP_JUMP_IF_LOCAL_LOCAL,
+    OP_INC_LOCAL,
+    OP_INC_UPVALUE,
+    OP_INC_GLOBAL,
+    OP_INC_PROPERTY,
+    OP_ADD_LOCAL_CONST,
+    OP_SWITCH_TABLE,
+    OP_TAIL_CALL,
+    OP_TAIL_INVOKE,
+    OP_TAIL_SUPER_INVOKE,
+    OP_WIDE,
+    OP_ADD_NUM,
+    OP_ADD_STR,
+    OP_SUBTRACT_NUM,
+    OP_LESS_NUM,
+    OP_GREATER_NUM,
+    OP_GET_PROPERTY_INSTANCE,
+    OP_GET_LOCALS,
+    OP_SET_LOCAL_POP,
     OP_ASSERT,
     INVALID_OPCODE,
 } op_code_t;
@@ -127,7 +167,191 @@ static const char *const op_code_name[] = {
     [OP_INHERIT] = "OP_INHERIT",
     [OP_METHOD] = "OP_METHOD",
     [OP_FIELD] = "OP_FIELD",
+    [OP_DUP2] = "OP_DUP2",
+    [OP_GET_INDEX] = "OP_GET_INDEX",
+    [OP_SET_INDEX] = "OP_SET_INDEX",
+    [OP_FOR_ITER] = "OP_FOR_ITER",
+    [OP_BUILD_LIST] = "OP_BUILD_LIST",
+    [OP_BUILD_LIST_LONG] = "OP_BUILD_LIST_LONG",
+    [OP_EXTEND_LIST] = "OP_EXTEND_LIST",
+    [OP_BUILD_MAP] = "OP_BUILD_MAP",
+    [OP_BUILD_MAP_LONG] = "OP_BUILD_MAP_LONG",
+    [OP_EXTEND_MAP] = "OP_EXTEND_MAP",
+    [OP_COPY_LITERAL] = "OP_COPY_LITERAL",
+    [OP_JUMP_IF_FALSE_POP] = "OP_JUMP_IF_FALSE_POP",
+    [OP_JUMP_IF_FALSE_OR_POP] = "OP_JUMP_IF_FALSE_OR_POP",
+    [OP_JUMP_IF_TRUE_OR_POP] = "OP_JUMP_IF_TRUE_OR_POP",
+    [OP_JUMP_IF_NOT_LESS] = "OP_JUMP_IF_NOT_LESS",
+    [OP_JUMP_IF_NOT_GREATER] = "OP_JUMP_IF_NOT_GREATER",
+    [OP_JUMP_IF_NOT_EQUAL] = "OP_JUMP_IF_NOT_EQUAL",
+    [OP_JUMP_IF_LESS] = "OP_JUMP_IF_LESS",
+    [OP_JUMP_IF_GREATER] = "OP_JUMP_IF_GREATER",
+    [OP_JUMP_IF_EQUAL] = "OP_JUMP_IF_EQUAL",
+    [OP_JUMP_IF_LOCAL_CONST] = "OP_JUMP_IF_LOCAL_CONST",
+    [OP_JUMP_IF_LOCAL_LOCAL] = "OP_JUMP_IF_LOCAL_LOCAL",
+    [OP_INC_LOCAL] = "OP_INC_LOCAL",
+    [OP_INC_UPVALUE] = "OP_INC_UPVALUE",
+    [OP_INC_GLOBAL] = "OP_INC_GLOBAL",
+    [OP_INC_PROPERTY] = "OP_INC_PROPERTY",
+    [OP_ADD_LOCAL_CONST] = "OP_ADD_LOCAL_CONST",
+    [OP_SWITCH_TABLE] = "OP_SWITCH_TABLE",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_TAIL_INVOKE] = "OP_TAIL_INVOKE",
+    [OP_TAIL_SUPER_INVOKE] = "OP_TAIL_SUPER_INVOKE",
+    [OP_WIDE] = "OP_WIDE",
+    [OP_ADD_NUM] = "OP_ADD_NUM",
+    [OP_ADD_STR] = "OP_ADD_STR",
+    [OP_SUBTRACT_NUM] = "OP_SUBTRACT_NUM",
+    [OP_LESS_NUM] = "OP_LESS_NUM",
+    [OP_GREATER_NUM] = "OP_GREATER_NUM",
+    [OP_GET_PROPERTY_INSTANCE] = "OP_GET_PROPERTY_INSTANCE",
+    [OP_GET_LOCALS] = "OP_GET_LOCALS",
+    [OP_SET_LOCAL_POP] = "OP_SET_LOCAL_POP",
     [INVALID_OPCODE] = "INVALID_OPCODE",
 };
 
+// the register instruction set: 32 bit words of an opcode and three byte operands A, B and C, registers are
+// frame slots and K[] the function's constants
+typedef enum {
+    REG_MOVE, // A = B
+    REG_LOAD_CONSTANT, // A = K[B]
+    REG_LOAD_NIL, // A = nil
+    REG_LOAD_BOOL, // A = B != 0
+    REG_GET_GLOBAL, // A = globals[K[B]]
+    REG_DEFINE_GLOBAL, // globals[K[A]] = B
+    REG_SET_GLOBAL, // globals[K[A]] = B, the global must exist
+    REG_GET_UPVALUE, // A = upvalues[B]
+    REG_SET_UPVALUE, // upvalues[A] = B
+    REG_GET_PROPERTY, // A = B.K[C]
+    REG_SET_PROPERTY, // A.K[B] = C
+    REG_EQUAL, // A = B op C
+    REG_GREATER,
+    REG_LESS,
+    REG_ADD,
+    REG_SUBTRACT,
+    REG_MULTIPLY,
+    REG_DIVIDE,
+    REG_MOD,
+    REG_BITWISE_AND,
+    REG_BITWISE_OR,
+    REG_BITWISE_XOR,
+    REG_SHIFT_LEFT,
+    REG_SHIFT_RIGHT,
+    REG_EQUAL_K, // A = B op K[C]
+    REG_GREATER_K,
+    REG_LESS_K,
+    REG_ADD_K,
+    REG_SUBTRACT_K,
+    REG_MULTIPLY_K,
+    REG_DIVIDE_K,
+    REG_MOD_K,
+    REG_NOT, // A = op B
+    REG_NEGATE,
+    REG_BITWISE_NOT,
+    REG_INCREMENT, // A = B + C, C a signed byte
+    REG_INC_UPVALUE, // A = upvalues[B] += C
+    REG_INC_GLOBAL, // A = globals[K[B]] += C
+    REG_INC_PROPERTY, // A = B.K[C] += the signed delta in the next word
+    REG_PRINT, // print A
+    REG_ERROR, // print A to stderr
+    REG_JUMP, // every jump is followed by a word holding its signed distance from the word after it
+    REG_JUMP_IF_FALSE, // jump when A is falsey
+    REG_JUMP_IF_TRUE, // jump when A is not falsey
+    REG_JUMP_IF, // jump when the comparison A (a fused jump opcode) holds for B and C
+    REG_JUMP_IF_K, // same against K[C]
+    REG_CALL, // A = A(A + 1 .. A + B), the callee and its arguments are a window of registers
+    REG_INVOKE, // A = A.K[C](A + 1 .. A + B)
+    REG_TAIL_CALL, // as REG_CALL, reusing the frame when the callee is register code too
+    REG_TAIL_INVOKE,
+    REG_CLOSURE, // A = closure of K[B], one word per capture follows: is_local | index << 8
+    REG_CLOSE_UPVALUE, // close the upvalues from A up
+    REG_RETURN, // return A
+    REG_EXIT, // exit with A
+    REG_TYPE, // A = new type named K[B]
+    REG_INHERIT, // B inherits from A
+    REG_METHOD, // A.methods[K[C]] = B
+    REG_FIELD, // A.fields[K[C]] = B
+    REG_GET_INDEX, // A = B[C]
+    REG_SET_INDEX, // A = (A[A + 1] = A + 2), a window
+    REG_FOR_ITER, // A the hidden loop state, B variables written from C up, jump when done
+    REG_BUILD_LIST, // A = list of the B registers from A
+    REG_BUILD_MAP, // A = map of the B key and value pairs from A
+    REG_COPY_LITERAL, // A = shallow copy of the literal B
+    INVALID_REG_OPCODE,
+} reg_op_code_t;
+
+#define REG_ENCODE(op, a, b, c) ((uint32_t)(op) | ((uint32_t)(a) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 24))
+#define REG_OP(word) ((word) & 0xff)
+#define REG_A(word) (((word) >> 8) & 0xff)
+#define REG_B(word) (((word) >> 16) & 0xff)
+#define REG_C(word) ((word) >> 24)
+
+static const char *const reg_op_code_name[] = {
+    [REG_MOVE] = "REG_MOVE",
+    [REG_LOAD_CONSTANT] = "REG_LOAD_CONSTANT",
+    [REG_LOAD_NIL] = "REG_LOAD_NIL",
+    [REG_LOAD_BOOL] = "REG_LOAD_BOOL",
+    [REG_GET_GLOBAL] = "REG_GET_GLOBAL",
+    [REG_DEFINE_GLOBAL] = "REG_DEFINE_GLOBAL",
+    [REG_SET_GLOBAL] = "REG_SET_GLOBAL",
+    [REG_GET_UPVALUE] = "REG_GET_UPVALUE",
+    [REG_SET_UPVALUE] = "REG_SET_UPVALUE",
+    [REG_GET_PROPERTY] = "REG_GET_PROPERTY",
+    [REG_SET_PROPERTY] = "REG_SET_PROPERTY",
+    [REG_EQUAL] = "REG_EQUAL",
+    [REG_GREATER] = "REG_GREATER",
+    [REG_LESS] = "REG_LESS",
+    [REG_ADD] = "REG_ADD",
+    [REG_SUBTRACT] = "REG_SUBTRACT",
+    [REG_MULTIPLY] = "REG_MULTIPLY",
+    [REG_DIVIDE] = "REG_DIVIDE",
+    [REG_MOD] = "REG_MOD",
+    [REG_BITWISE_AND] = "REG_BITWISE_AND",
+    [REG_BITWISE_OR] = "REG_BITWISE_OR",
+    [REG_BITWISE_XOR] = "REG_BITWISE_XOR",
+    [REG_SHIFT_LEFT] = "REG_SHIFT_LEFT",
+    [REG_SHIFT_RIGHT] = "REG_SHIFT_RIGHT",
+    [REG_EQUAL_K] = "REG_EQUAL_K",
+    [REG_GREATER_K] = "REG_GREATER_K",
+    [REG_LESS_K] = "REG_LESS_K",
+    [REG_ADD_K] = "REG_ADD_K",
+    [REG_SUBTRACT_K] = "REG_SUBTRACT_K",
+    [REG_MULTIPLY_K] = "REG_MULTIPLY_K",
+    [REG_DIVIDE_K] = "REG_DIVIDE_K",
+    [REG_MOD_K] = "REG_MOD_K",
+    [REG_NOT] = "REG_NOT",
+    [REG_NEGATE] = "REG_NEGATE",
+    [REG_BITWISE_NOT] = "REG_BITWISE_NOT",
+    [REG_INCREMENT] = "REG_INCREMENT",
+    [REG_INC_UPVALUE] = "REG_INC_UPVALUE",
+    [REG_INC_GLOBAL] = "REG_INC_GLOBAL",
+    [REG_INC_PROPERTY] = "REG_INC_PROPERTY",
+    [REG_PRINT] = "REG_PRINT",
+    [REG_ERROR] = "REG_ERROR",
+    [REG_JUMP] = "REG_JUMP",
+    [REG_JUMP_IF_FALSE] = "REG_JUMP_IF_FALSE",
+    [REG_JUMP_IF_TRUE] = "REG_JUMP_IF_TRUE",
+    [REG_JUMP_IF] = "REG_JUMP_IF",
+    [REG_JUMP_IF_K] = "REG_JUMP_IF_K",
+    [REG_CALL] = "REG_CALL",
+    [REG_INVOKE] = "REG_INVOKE",
+    [REG_TAIL_CALL] = "REG_TAIL_CALL",
+    [REG_TAIL_INVOKE] = "REG_TAIL_INVOKE",
+    [REG_CLOSURE] = "REG_CLOSURE",
+    [REG_CLOSE_UPVALUE] = "REG_CLOSE_UPVALUE",
+    [REG_RETURN] = "REG_RETURN",
+    [REG_EXIT] = "REG_EXIT",
+    [REG_TYPE] = "REG_TYPE",
+    [REG_INHERIT] = "REG_INHERIT",
+    [REG_METHOD] = "REG_METHOD",
+    [REG_FIELD] = "REG_FIELD",
+    [REG_GET_INDEX] = "REG_GET_INDEX",
+    [REG_SET_INDEX] = "REG_SET_INDEX",
+    [REG_FOR_ITER] = "REG_FOR_ITER",
+    [REG_BUILD_LIST] = "REG_BUILD_LIST",
+    [REG_BUILD_MAP] = "REG_BUILD_MAP",
+    [REG_COPY_LITERAL] = "REG_COPY_LITERAL",
+    [INVALID_REG_OPCODE] = "INVALID_REG_OPCODE",
+};
+
 #endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2022-2024 Jason Woodward <woodwardj at jaos dot org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/common.h"
+#include "../src/type.h"
+#include "../src/vm.h"
+
+#define BYTES_PER_LENGTH (256 * 1024 * 1024)
+#define PROBE_KEYS 50000
+
+static double elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// the previous byte at a time hash, for reference
+static uint32_t fnv1a(const char *key, const int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void throughput(const char *name, uint32_t (*hash)(const char *, const int), const char *buffer, const int length)
+{
+    const int rounds = BYTES_PER_LENGTH / length;
+    uint32_t sink = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; i++) {
+        sink += hash(buffer + (i & 7), length);
+    }
+    const double seconds = elapsed(&start);
+    printf("%-8s %6d bytes %8.2f ns/hash %8.2f GB/s (%u)\n", name, length,
+        seconds * 1e9 / rounds, (double)rounds * length / seconds / 1e9, sink & 1);
+}
+
+static void string_set_probes(const string_set_t *set)
+{
+    long total = 0;
+    int longest = 0;
+    for (int i = 0; i < set->capacity; i++) {
+        const string_set_entry_t *entry = &set->entries[i];
+        if (entry->key == NULL)
+            continue;
+        const int distance = (int)((uint32_t)i - (entry->hash & (uint32_t)(set->capacity - 1))) & (set->capacity - 1);
+        total += distance;
+        if (distance > longest)
+            longest = distance;
+    }
+    printf("string set %d/%d: average probe %.3f, longest %d\n", set->count, set->capacity,
+        set->count ? (double)total / set->count : 0.0, longest);
+}
+
+static void table_probes(const table_t *table)
+{
+    long total = 0;
+    int longest = 0;
+    int count = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        const table_entry_t *entry = &table->entries[i];
+        if (IS_EMPTY(entry->key))
+            continue;
+        const int distance = (int)((uint32_t)i - (value_t_hash(entry->key) & (uint32_t)(table->capacity - 1))) & (table->capacity - 1);
+        total += distance;
+        if (distance > longest)
+            longest = distance;
+        count++;
+    }
+    printf("table %d/%d: average probe %.3f, longest %d\n", count, table->capacity,
+        count ? (double)total / count : 0.0, longest);
+}
+
+int main(void)
+{
+    static const int lengths[] = {3, 8, 16, 32, 64, 256, 1024, 4096, 65536, 1024 * 1024};
+    const int max_length = 1024 * 1024 + 8;
+    char *buffer = malloc(max_length);
+    for (int i = 0; i < max_length; i++)
+        buffer[i] = (char)('a' + (i * 7) % 26);
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        throughput("hash", hash_string, buffer, lengths[i]);
+        throughput("fnv1a", fnv1a, buffer, lengths[i]);
+    }
+    free(buffer);
+
+    // short identifier style keys, the common case for the intern set and type tables
+    vm_t_init();
+    obj_map_t *map = obj_map_t_allocate();
+    vm_push(OBJ_VAL(map));
+    for (int i = 0; i < PROBE_KEYS; i++) {
+        char key[32];
+        const int length = snprintf(key, sizeof(key), "%c%d", 'a' + i % 26, i / 26);
+        const value_t k = OBJ_VAL(obj_string_t_copy_from(key, length, true));
+        vm_push(k);
+        table_t_set(&map->table, k, NUMBER_VAL(i));
+        vm_pop();
+    }
+    string_set_probes(&vm.strings);
+    table_probes(&map->table);
+    vm_pop();
+    vm_t_free();
+    return 0;
+}
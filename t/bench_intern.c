@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2022-2024 Jason Woodward <woodwardj at jaos dot org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/common.h"
+#include "../src/type.h"
+#include "../src/vm.h"
+
+#define UNIQUE_STRINGS 200000
+#define LOOKUP_ROUNDS 5000000
+
+static const char *const identifiers[] = {
+    "self", "init", "len", "append", "subscript", "counter", "name", "value",
+    "type_one", "type_two", "x", "y", "i", "j", "sum", "result",
+};
+
+static double elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void report(const char *name, const double seconds, const int operations)
+{
+    printf("%-24s %10.2f ns/op %12.0f ops/s\n", name, seconds * 1e9 / operations, operations / seconds);
+}
+
+int main(void)
+{
+    vm_t_init();
+
+    // keep everything we intern reachable so we measure the set, not the gc
+    obj_list_t *roots = obj_list_t_allocate();
+    vm_push(OBJ_VAL(roots));
+
+    char buffer[64];
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < UNIQUE_STRINGS; i++) {
+        const int length = snprintf(buffer, sizeof(buffer), "interned_string_%d", i);
+        obj_string_t *s = obj_string_t_copy_from(buffer, length, true);
+        vm_push(OBJ_VAL(s));
+        value_list_t_add(&roots->elements, OBJ_VAL(s));
+        vm_pop();
+    }
+    report("insert unique", elapsed(&start), UNIQUE_STRINGS);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < UNIQUE_STRINGS; i++) {
+        const int length = snprintf(buffer, sizeof(buffer), "interned_string_%d", i);
+        obj_string_t_copy_from(buffer, length, true);
+    }
+    report("lookup existing", elapsed(&start), UNIQUE_STRINGS);
+
+    const int identifier_count = (int)(sizeof(identifiers) / sizeof(identifiers[0]));
+    int lengths[sizeof(identifiers) / sizeof(identifiers[0])];
+    for (int i = 0; i < identifier_count; i++) {
+        lengths[i] = snprintf(buffer, sizeof(buffer), "%s", identifiers[i]);
+        obj_string_t *s = obj_string_t_copy_from(identifiers[i], lengths[i], true);
+        vm_push(OBJ_VAL(s));
+        value_list_t_add(&roots->elements, OBJ_VAL(s));
+        vm_pop();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < LOOKUP_ROUNDS; i++) {
+        const int n = i % identifier_count;
+        obj_string_t_copy_from(identifiers[n], lengths[n], true);
+    }
+    report("lookup identifiers", elapsed(&start), LOOKUP_ROUNDS);
+
+    printf("interned %d/%d, %" PRIu64 " hits, %" PRIu64 " misses\n",
+        vm.strings.count, vm.strings.capacity, vm.strings.hits, vm.strings.misses);
+
+    vm_pop();
+    vm_t_free();
+    return 0;
+}
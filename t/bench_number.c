@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2022-2024 Jason Woodward <woodwardj at jaos dot org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/common.h"
+#include "../src/number.h"
+
+#define VALUES 1000000
+
+static double elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int libc_format(const double value, char *buffer)
+{
+    return snprintf(buffer, NUMBER_FORMAT_MAX, "%.17g", value);
+}
+
+static void format_throughput(const char *name, const char *kind, int (*format)(const double, char *), const double *values)
+{
+    char buffer[NUMBER_FORMAT_MAX];
+    long sink = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < VALUES; i++) {
+        sink += format(values[i], buffer);
+    }
+    const double seconds = elapsed(&start);
+    printf("format %-8s %-10s %8.2f ns/op (%ld)\n", name, kind, seconds * 1e9 / VALUES, sink & 1);
+}
+
+static double libc_parse(const char *chars, const int)
+{
+    return strtod(chars, NULL);
+}
+
+static void parse_throughput(const char *name, const char *kind, double (*parse)(const char *, const int), char (*strings)[NUMBER_FORMAT_MAX], const int *lengths)
+{
+    double sink = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < VALUES; i++) {
+        sink += parse(strings[i], lengths[i]);
+    }
+    const double seconds = elapsed(&start);
+    printf("parse  %-8s %-10s %8.2f ns/op (%d)\n", name, kind, seconds * 1e9 / VALUES, sink > 0);
+}
+
+int main(void)
+{
+    double *values = malloc(sizeof(double) * VALUES);
+    char (*strings)[NUMBER_FORMAT_MAX] = malloc(sizeof(*strings) * VALUES);
+    int *lengths = malloc(sizeof(int) * VALUES);
+    static const char *const kinds[] = {"integers", "prices", "fractions"};
+
+    srand(1);
+    for (int kind = 0; kind < 3; kind++) {
+        for (int i = 0; i < VALUES; i++) {
+            switch (kind) {
+                case 0: values[i] = rand() % 1000000; break;
+                case 1: values[i] = (rand() % 100000) / 100.0; break;
+                default: values[i] = (double)rand() / RAND_MAX * 1000.0; break;
+            }
+            lengths[i] = number_format(values[i], strings[i]);
+        }
+        format_throughput("number", kinds[kind], number_format, values);
+        format_throughput("snprintf", kinds[kind], libc_format, values);
+        parse_throughput("number", kinds[kind], number_parse, strings, lengths);
+        parse_throughput("strtod", kinds[kind], libc_parse, strings, lengths);
+    }
+
+    free(values);
+    free(strings);
+    free(lengths);
+    return 0;
+}
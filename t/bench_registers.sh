@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Copyright (C) 2022-2024 Jason Woodward <woodwardj at jaos dot org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Library General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+set -euo pipefail
+
+# wall time of the stack and register backends over the same scripts, plus the instructions each executed when the
+# binary was built with -Ddispatch_counts=enabled
+if [ -z "${1:-}" ]; then
+    echo "$0 <binary>"
+    exit 1
+fi
+tater=$1
+bench_dir=$(dirname "$0")
+
+TIMEFORMAT=%R
+for bench in bench bench_loop bench_locals bench_tail bench_fields bench_iterate bench_counter; do
+    script="${bench_dir}/${bench}.tot"
+    stack=$( { time ${tater} -c "${script}" > /dev/null 2>&1 ; } 2>&1 )
+    registers=$( { time ${tater} -c -r "${script}" > /dev/null 2>&1 ; } 2>&1 )
+    echo "${bench}: stack ${stack} registers ${registers}"
+    stack_dispatches=$(${tater} -c "${script}" 2>&1 > /dev/null | grep '^dispatches' || true)
+    if [ -n "${stack_dispatches}" ]; then
+        register_dispatches=$(${tater} -c -r "${script}" 2>&1 > /dev/null | grep '^dispatches')
+        echo "${bench}: stack ${stack_dispatches} registers ${register_dispatches}"
+    fi
+done
@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# Copyright (C) 2022-2024 Jason Woodward <woodwardj at jaos dot org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Library General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+set -euo pipefail
+
+# startup of a large script of mostly unused functions compiled from source on every run, with bodies compiled on
+# their first call, and loaded from the bytecode cache, plus the peak memory of compiling it either way
+if [ -z "${1:-}" ]; then
+    echo "$0 <binary>"
+    exit 1
+fi
+tater=$1
+runs=${2:-20}
+
+BENCH_TMPDIR=$(mktemp -d)
+trap "rm -rf ${BENCH_TMPDIR};" err exit
+script="${BENCH_TMPDIR}/startup.tot"
+for i in $(seq 1 3000); do
+    echo "fn helper_${i}(a, b) { let total = a; for (let i = 0; i < b; i++) { total = total + i * ${i}; } return total; }"
+done > "${script}"
+for i in $(seq 1 500); do
+    echo "type Record_${i} { let kind = \"record ${i}\"; fn init(v) { self.v = v; } fn value() { return self.v + ${i}; } }"
+done >> "${script}"
+echo 'print(helper_1(1, 2));' >> "${script}"
+memory="${BENCH_TMPDIR}/memory.tot"
+cp "${script}" "${memory}"
+echo 'let status = file("/proc/self/status", "r");' >> "${memory}"
+echo 'for (let line = status.readline(); line != ""; line = status.readline()) { if (line.startswith("VmHWM")) print(line); }' >> "${memory}"
+
+TIMEFORMAT=%R
+echo "cold: $( { time (for i in $(seq 1 ${runs}); do ${tater} -c "${script}" > /dev/null; done) ; } 2>&1 )"
+echo "lazy: $( { time (for i in $(seq 1 ${runs}); do ${tater} -c -l "${script}" > /dev/null; done) ; } 2>&1 )"
+${tater} "${script}" > /dev/null # write the cache
+echo "cached: $( { time (for i in $(seq 1 ${runs}); do ${tater} "${script}" > /dev/null; done) ; } 2>&1 )"
+echo "cold peak memory: $(${tater} -c "${memory}" | grep VmHWM)"
+echo "lazy peak memory: $(${tater} -c -l "${memory}" | grep VmHWM)"
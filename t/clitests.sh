@@ -43,3 +43,32 @@ ${tater} -d -s "${TEST_TMPDIR}/garbage.tot" || true
 ${tater} -v
 ${tater} -h
 ${tater} -d -s -invalid-option-will-fail || true
+
+# the first run compiles and writes the bytecode cache, later runs load it until the source changes
+echo -e 'print("cached");' > "${TEST_TMPDIR}/cached.tot"
+test "$(${tater} "${TEST_TMPDIR}/cached.tot")" == "cached"
+test -f "${TEST_TMPDIR}/cached.totc"
+test "$(${tater} "${TEST_TMPDIR}/cached.tot")" == "cached"
+echo -e 'print("changed");' > "${TEST_TMPDIR}/cached.tot"
+test "$(${tater} "${TEST_TMPDIR}/cached.tot")" == "changed"
+echo -e 'print("uncached");' > "${TEST_TMPDIR}/uncached.tot"
+test "$(${tater} -c "${TEST_TMPDIR}/uncached.tot")" == "uncached"
+test ! -e "${TEST_TMPDIR}/uncached.totc"
+
+# a type rebound after a switch over its fields picks the same case with and without optimization
+echo -e 'type T { let A = 1; let B = 2; } type U { let A = 5; let B = 1; }\nfn f(x) { switch (x) { case T.A: print("T.A"); case T.B: print("T.B"); } }\nf(1); T = U; f(1);' > "${TEST_TMPDIR}/rebound.tot"
+test "$(${tater} -c -O1 "${TEST_TMPDIR}/rebound.tot")" == "$(${tater} -c -O0 "${TEST_TMPDIR}/rebound.tot")"
+test "$(${tater} -c -O1 "${TEST_TMPDIR}/rebound.tot")" == "$(printf 'T.A\nT.B')"
+
+# function bodies compiled on their first call, a broken one only fails once it is called
+echo -e 'fn broken() { this is not valid; }\nfn works() { return "lazy"; }\nprint(works());' > "${TEST_TMPDIR}/lazy.tot"
+test "$(${tater} -c -l "${TEST_TMPDIR}/lazy.tot")" == "lazy"
+! ${tater} -c "${TEST_TMPDIR}/lazy.tot" > /dev/null 2>&1
+echo -e 'fn broken() { this is not valid; }\nbroken();' > "${TEST_TMPDIR}/lazy_broken.tot"
+! ${tater} -c -l "${TEST_TMPDIR}/lazy_broken.tot" > /dev/null 2>&1
+
+# register code prints the same and fails on the same line as stack code, across calls between the two
+echo -e 'fn sum(n) { let t = 0; for (let i = 0; i < n; i++) { t += i * 2; } return t; }\nfn wide() { switch (1) { case 1: return sum(10); } }\ntype P { fn init(x) { self.x = x; } fn get() { return [self.x, wide()]; } }\nprint(P(sum(4)).get());\nfn broken(a) { return a + nil; }\nbroken(1);' > "${TEST_TMPDIR}/registers.tot"
+test "$(${tater} -c -r "${TEST_TMPDIR}/registers.tot" 2>&1)" == "$(${tater} -c "${TEST_TMPDIR}/registers.tot" 2>&1)"
+test "$(${tater} -c -r "${TEST_TMPDIR}/registers.tot" 2> /dev/null)" == "[12,90]"
+test "$(${tater} -c -r "${TEST_TMPDIR}/registers.tot" 2>&1 > /dev/null)" == "$(printf 'Operands must be two numbers or two strings.\n[line 5] in broken\n[line 6] in script')"
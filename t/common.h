@@ -24,10 +24,12 @@
 #include <strings.h>
 #include <check.h>
 
+#include "../src/cache.h"
 #include "../src/common.h"
 #include "../src/compiler.h"
 #include "../src/debug.h"
 #include "../src/memory.h"
+#include "../src/number.h"
 #include "../src/type.h"
 #include "../src/scanner.h"
 #include "../src/vm.h"
@@ -17,6 +17,7 @@
  */
 
 #include <unistd.h>
+#include <sys/stat.h>
 # pragma GCC diagnostic push
 #ifdef __clang__
 # pragma GCC diagnostic ignored "-Wgnu-zero-variadic-macro-arguments"
@@ -147,17 +148,18 @@ START_TEST(test_compiler)
     vm_t_init();
     const char *source1 = "let v = 27; { let v = 1; let y = 2; let z = v + y; }";
     obj_function_t *func1 = compiler_t_compile(source1, false);
-    ck_assert(func1->chunk.count == 17);
+    ck_assert(func1->chunk.count == 16);
     ck_assert(func1->chunk.code[0] == OP_CONSTANT);
     ck_assert(func1->chunk.code[2] == OP_DEFINE_GLOBAL);
     ck_assert(func1->chunk.code[4] == OP_CONSTANT);
     ck_assert(func1->chunk.code[6] == OP_CONSTANT);
-    ck_assert(func1->chunk.code[8] == OP_GET_LOCAL);
-    ck_assert(func1->chunk.code[10] == OP_GET_LOCAL);
-    ck_assert(func1->chunk.code[12] == OP_ADD);
-    ck_assert(func1->chunk.code[13] == OP_POPN);
-    ck_assert(func1->chunk.code[15] == OP_NIL);
-    ck_assert(func1->chunk.code[16] == OP_RETURN);
+    ck_assert(func1->chunk.code[8] == OP_GET_LOCALS);
+    ck_assert(func1->chunk.code[9] == 1);
+    ck_assert(func1->chunk.code[10] == 2);
+    ck_assert(func1->chunk.code[11] == OP_ADD);
+    ck_assert(func1->chunk.code[12] == OP_POPN);
+    ck_assert(func1->chunk.code[14] == OP_NIL);
+    ck_assert(func1->chunk.code[15] == OP_RETURN);
     ck_assert(func1->chunk.constants.count == 4); // v, 27, 1, 2
     ck_assert(memcmp(AS_CSTRING(func1->chunk.constants.values[0]), "v", 1) == 0);
     ck_assert(func1->chunk.constants.values[1].type == VAL_NUMBER);
@@ -179,14 +181,105 @@ START_TEST(test_compiler)
 
     ck_assert(memcmp(AS_CSTRING(func2->chunk.constants.values[0]), "a", 1) == 0);
     obj_function_t *inner = AS_FUNCTION(func2->chunk.constants.values[1]);
-    ck_assert(inner->chunk.count == 10);
-    ck_assert(inner->chunk.code[0] == OP_GET_LOCAL);
-    ck_assert(inner->chunk.code[2] == OP_GET_LOCAL);
-    ck_assert(inner->chunk.code[4] == OP_ADD);
-    ck_assert(inner->chunk.code[5] == OP_GET_LOCAL);
-    ck_assert(inner->chunk.code[7] == OP_PRINT);
-    ck_assert(inner->chunk.code[8] == OP_NIL);
-    ck_assert(inner->chunk.code[9] == OP_RETURN);
+    ck_assert(inner->chunk.count == 9);
+    ck_assert(inner->chunk.code[0] == OP_GET_LOCALS);
+    ck_assert(inner->chunk.code[3] == OP_ADD);
+    ck_assert(inner->chunk.code[4] == OP_GET_LOCAL);
+    ck_assert(inner->chunk.code[6] == OP_PRINT);
+    ck_assert(inner->chunk.code[7] == OP_NIL);
+    ck_assert(inner->chunk.code[8] == OP_RETURN);
+    vm_t_free();
+
+    vm_t_init();
+    const char *folded_source = "let a = 1024 * 1024 + -5 * 2; fn f() { return !true; print 2; }";
+    obj_function_t *folded = compiler_t_compile(folded_source, false);
+    ck_assert(folded->chunk.code[0] == OP_CONSTANT);
+    ck_assert(folded->chunk.code[2] == OP_DEFINE_GLOBAL);
+    ck_assert(AS_NUMBER(folded->chunk.constants.values[1]) == 1048566);
+    ck_assert(folded->chunk.constants.count == 4); // a, 1048566, f, <fn f>
+    obj_function_t *folded_f = AS_FUNCTION(folded->chunk.constants.values[3]);
+    ck_assert(folded_f->chunk.count == 4);
+    ck_assert(folded_f->chunk.code[0] == OP_FALSE);
+    ck_assert(folded_f->chunk.code[1] == OP_RETURN);
+    vm_toggle_optimize();
+    folded = compiler_t_compile(folded_source, false);
+    ck_assert(folded->chunk.code[4] == OP_MULTIPLY);
+    ck_assert(folded->chunk.constants.count == 7);
+    vm_t_free();
+
+    // loop conditions on locals branch in a single instruction
+    vm_t_init();
+    obj_function_t *fused = compiler_t_compile("fn f() { let i = 0; while (i < 10) { i = i + 1; } }", false);
+    obj_function_t *fused_f = AS_FUNCTION(fused->chunk.constants.values[1]);
+    ck_assert(fused_f->chunk.code[2] == OP_JUMP_IF_LOCAL_CONST);
+    ck_assert(fused_f->chunk.code[5] == OP_JUMP_IF_NOT_LESS);
+    vm_t_free();
+
+    // counters are updated in place
+    vm_t_init();
+    obj_function_t *inc = compiler_t_compile("fn f() { let i = 0; i++; i -= 2; i += 0.5; }", false);
+    obj_function_t *inc_f = AS_FUNCTION(inc->chunk.constants.values[1]);
+    ck_assert(inc_f->chunk.code[2] == OP_INC_LOCAL);
+    ck_assert((int8_t)inc_f->chunk.code[4] == 1);
+    ck_assert(inc_f->chunk.code[6] == OP_INC_LOCAL);
+    ck_assert((int8_t)inc_f->chunk.code[8] == -2);
+    ck_assert(inc_f->chunk.code[10] == OP_ADD_LOCAL_CONST);
+    vm_t_free();
+
+    // constant case labels dispatch through a table
+    vm_t_init();
+    obj_function_t *table = compiler_t_compile("fn f(x) { switch (x) { case 1: return 1; case \"a\": return 2; default: return 3; } }", false);
+    obj_function_t *table_f = AS_FUNCTION(table->chunk.constants.values[1]);
+    ck_assert(table_f->chunk.code[2] == OP_SWITCH_TABLE);
+    ck_assert(obj_map_t_count(AS_MAP(table_f->chunk.constants.values[table_f->chunk.code[3]])) == 2);
+    vm_t_free();
+
+    // type field labels compare in order, a later script on the same vm may rebind the type
+    vm_t_init();
+    obj_function_t *fields = compiler_t_compile("type T { let A = 1; } fn f(x) { switch (x) { case T.A: return 1; } }", false);
+    ck_assert(AS_FUNCTION(fields->chunk.constants.values[4])->chunk.code[2] != OP_SWITCH_TABLE);
+    vm_t_free();
+    vm_t_init();
+    ck_assert(vm_t_interpret("type T { let A = 1; let B = 2; } type U { let A = 5; let B = 1; }"
+        "fn f(x) { switch (x) { case T.A: return \"A\"; case T.B: return \"B\"; } }") == INTERPRET_OK);
+    ck_assert(vm_t_interpret("assert(f(1) == \"A\"); T = U; assert(f(1) == \"B\");") == INTERPRET_OK);
+    vm_t_free();
+
+    // only a call that is returned directly is a tail call
+    vm_t_init();
+    obj_function_t *tail = compiler_t_compile("fn f(n) { return f(n); } fn g(n) { return 1 + g(n); }", false);
+    obj_function_t *tail_f = AS_FUNCTION(tail->chunk.constants.values[1]);
+    ck_assert(tail_f->chunk.code[4] == OP_TAIL_CALL);
+    obj_function_t *tail_g = AS_FUNCTION(tail->chunk.constants.values[3]);
+    ck_assert(tail_g->chunk.code[6] == OP_CALL);
+    vm_t_free();
+
+    // locals read in pairs and stored without leaving the value behind
+    vm_t_init();
+    obj_function_t *pairs = compiler_t_compile("fn f(a, b) { a = b; return a - b; }", false);
+    obj_function_t *pairs_f = AS_FUNCTION(pairs->chunk.constants.values[1]);
+    ck_assert(pairs_f->chunk.code[0] == OP_GET_LOCAL);
+    ck_assert(pairs_f->chunk.code[2] == OP_SET_LOCAL_POP && pairs_f->chunk.code[3] == 1);
+    ck_assert(pairs_f->chunk.code[4] == OP_GET_LOCALS && pairs_f->chunk.code[5] == 1 && pairs_f->chunk.code[6] == 2);
+    ck_assert(pairs_f->chunk.code[7] == OP_SUBTRACT);
+    vm_t_free();
+
+    // indexes past a byte take the wide forms, the ones before them stay short
+    vm_t_init();
+    {
+        char source[8192];
+        int length = 0;
+        for (int i = 0; i < 300; i++)
+            length += snprintf(source + length, sizeof source - length, "let g%d = %d.5;", i, i);
+        obj_function_t *wide = compiler_t_compile(source, false);
+        ck_assert(wide->chunk.code[0] == OP_CONSTANT && wide->chunk.code[2] == OP_DEFINE_GLOBAL);
+        int wide_defines = 0, long_constants = 0;
+        for (int offset = 0; offset < wide->chunk.count; offset += chunk_t_instruction_length(&wide->chunk, offset)) {
+            wide_defines += wide->chunk.code[offset] == OP_WIDE && wide->chunk.code[offset + 1] == OP_DEFINE_GLOBAL;
+            long_constants += wide->chunk.code[offset] == OP_CONSTANT_LONG;
+        }
+        ck_assert(wide_defines == 172 && long_constants == 172);
+    }
     vm_t_free();
 
     const char *programs[] = {
@@ -270,6 +363,7 @@ START_TEST(test_vm)
         "assert(number(9) == 9);",
         "assert(number(\"1.1\") == 1.1);",
         "assert(number(\"-5\") == -5);",
+        "assert(number(\"1.5e3\") == 1500); assert(number(\"0x10\") == 16); assert(number(\" 12abc\") == 12); assert(number(\"1e400\") == number(\"inf\"));",
         "assert(1_000_000 == 1000000);",
         "assert(1 000 000 == 1000000);",
         "assert(0xdeadbeef == 3735928559);",
@@ -316,6 +410,10 @@ START_TEST(test_vm)
         "let a = str() + str() + str();"
         "assert(a.len() == 0);",
         "assert(str(1) == \"1\");",
+        "assert(format(\"{} is {}\", \"x\", 1.5) == \"x is 1.5\"); assert(format(\"plain\") == \"plain\"); assert(format(\"{{{}}}\", nil) == \"{nil}\"); assert(format(\"{}{}\", true, [1]) == \"true<list 1>\");",
+        "let long = format(\"{}{}\", \"0123456789012345678901234567890123456789012345678901234567890123456789\", \"0123456789012345678901234567890123456789012345678901234567890123456789\"); assert(long.len() == 140); assert(long == \"0123456789012345678901234567890123456789012345678901234567890123456789\" + \"0123456789012345678901234567890123456789012345678901234567890123456789\");",
+        "assert(str(0.1) == \"0.1\"); assert(str(0.1 + 0.2) == \"0.30000000000000004\"); assert(str(1234567) == \"1234567\"); assert(str(-2.5) == \"-2.5\");",
+        "assert(str(1000000000000000000000) == \"1e+21\"); assert(str(0.00001) == \"1e-05\"); assert(str(0.0001) == \"0.0001\"); assert(str(-0) == \"-0\"); assert(number(str(1/3)) == 1/3);",
         "assert(str(true) == \"true\");",
         "assert(str(nil) == \"nil\");",
         "assert(str(list) == \"<native fn list>\");",
@@ -326,20 +424,133 @@ START_TEST(test_vm)
         "let f = file(\"f_as_str\", \"r\"); assert(str(f) == \"<file f_as_str(r)>\"); f.close(); assert(str(f) == \"<file closed>\");",
         "assert(\"foo\".substr(0,2) == \"fo\");",
         "assert(\"foo\".substr(-2,2) == \"oo\");",
+        "let a = \"the quick brown fox jumps over the lazy dog, again and again\"; let b = a.substr(4, 40); assert(b == \"quick brown fox jumps over the lazy dog,\"); assert(b.substr(0, 34) == \"quick brown fox jumps over the laz\"); let m = {}; m[b] = 1; assert(m[\"quick brown fox jumps over the lazy dog,\"] == 1); assert(str(b) == b); assert(b.len() == 40);",
+        "let a = \"12345678901234567890123456789012345678\"; assert(number(a.substr(2, 34)) == 3456789012345678901234567890123456); assert(in(\"890\", a.substr(0, 32)));",
+        "let a = \"one two one three one\"; assert(a.find(\"one\") == 0); assert(a.find(\"one\", 1) == 8); assert(a.find(\"one\", -3) == 18); assert(a.find(\"four\") == -1); assert(a.find(\"\") == 0); assert(a.find(\"one\", 100) == -1);",
+        "let a = \"one two one three one\"; assert(a.rfind(\"one\") == 18); assert(a.rfind(\"two\") == 4); assert(a.rfind(\"x\") == -1); assert(a.rfind(\"\") == 21); assert(\"ab\".rfind(\"abc\") == -1);",
+        "let a = \"aaaa\"; assert(a.count(\"aa\") == 2); assert(a.count(\"b\") == 0); assert(a.count(\"\") == 5);",
+        "let a = \"a,b,,c\".split(\",\"); assert(a.len() == 4); assert(a[0] == \"a\"); assert(a[2] == \"\"); assert(a[3] == \"c\"); assert(\"abc\".split(\",\")[0] == \"abc\"); assert(\"a::b\".split(\"::\")[1] == \"b\");",
+        "let a = \"  lots   of\tspace  \".split(); assert(a.len() == 3); assert(a[1] == \"of\"); assert(a[2] == \"space\"); assert(\"   \".split().len() == 0);",
+        "assert(\"  x y \".strip() == \"x y\"); assert(\"   \".strip() == \"\"); assert(\"xy\".strip() == \"xy\");",
+        "assert(\"a-b-c\".replace(\"-\", \"+=\") == \"a+=b+=c\"); assert(\"abc\".replace(\"x\", \"y\") == \"abc\"); assert(\"aaa\".replace(\"a\", \"\") == \"\");",
+        "assert(\"foobar\".startswith(\"foo\")); assert(!\"foobar\".startswith(\"bar\")); assert(\"foobar\".endswith(\"bar\")); assert(!\"ar\".endswith(\"bar\")); assert(\"x\".startswith(\"\"));",
+        "assert(\", \".join([\"a\", \"b\", \"c\"]) == \"a, b, c\"); assert(\",\".join([]) == \"\"); assert(\"\".join([\"x\"]) == \"x\"); assert(\"-\".join(\"a b c\".split()) == \"a-b-c\");",
+        "let a = \"a,b\"; assert(a[1] == \",\"); assert(a.substr(2,1) == \"b\"); assert(a[-1] == a.substr(-1,1));",
         "let a = \"foobar\"; assert(a[0] == \"f\"); assert(a[-1] == \"r\"); assert(in(\"f\", a)); assert(in(\"oob\", a)); assert(!in(\"z\", a));",
 
+        "let a = array(); assert(a.len() == 0); assert(a.sum() == 0); assert(a.min() == nil); assert(a.mean() == nil); assert(!bool(a)); a.append(2); assert(a[0] == 2); assert(bool(a)); assert(is(a, array));",
+        "assert(is(map(), map)); assert(!is(map(), array)); assert(is(str(1), str)); assert(!is([], array));",
+        "let a = array([1,2,3,4,5,6,7]); assert(a.len() == 7); assert(a[-1] == 7); a[0] = 10; assert(a[0] == 10); a[1] += 5; assert(a[1] == 7); assert(a.sum() == 42); assert(a.min() == 3); assert(a.max() == 10); assert(in(7, a)); assert(!in(\"7\", a));",
+        "let a = array(9, 2); assert(a.sum() == 18); assert(a.mean() == 2); assert(a.dot(array(9, 3)) == 54); a.scale(0.5).add(1); assert(a[8] == 2); a.add(array(9, 1)); assert(a.sum() == 27); a.fill(-1); assert(a.max() == -1);",
+        "let a = array([5,6,7,8,9]); let b = a.slice(1, -1); assert(b.len() == 3); assert(b[0] == 6); b[0] = 0; assert(a[1] == 6); assert(a.slice(3).len() == 2); assert(a.slice(4, 1).len() == 0); assert(a.slice(-100, 100).len() == 5);",
+        "let a = array([1,2,3]); let l = a.tolist(); assert(l.len() == 3); assert(l[2] == 3); let c = array(a); c[0] = 9; assert(a[0] == 1); assert(array(l).sum() == 6); assert(str(a) == \"<array 3>\");",
+        "let a = [3, -1.5, 2, -7, 0, 10]; a.sort(); assert(a[0] == -7); assert(a[1] == -1.5); assert(a[2] == 0); assert(a[5] == 10); let e = []; e.sort(); assert(e.len() == 0);",
+        "let a = [\"pear\", \"apple\", \"fig\", \"app\"]; a.sort(); assert(a[0] == \"app\"); assert(a[1] == \"apple\"); assert(a[3] == \"pear\");",
+        "fn desc(x, y) { return y - x; } let a = []; for (let i = 0; i < 100; i++) { a.append((i * 37) % 100); } a.sort(desc); assert(a[0] == 99); assert(a[99] == 0); a.sort(); assert(a[0] == 0); assert(a[50] == 50);",
+        "fn first(p) { return p[0]; } let a = [[2, \"b\"], [1, \"x\"], [2, \"a\"], [1, \"y\"]]; a.sort(first); assert(a[0][1] == \"x\"); assert(a[1][1] == \"y\"); assert(a[2][1] == \"b\"); assert(a[3][1] == \"a\");",
+        "fn cmp(x, y) { return x[0] - y[0]; } let a = []; for (let i = 0; i < 50; i++) { a.append([i % 3, i]); } a.sort(cmp, true); assert(a[0][1] == 0); assert(a[1][1] == 3); assert(a[49][1] == 47);",
+        // comparators that contradict themselves still leave every element in the list
+        "fn lt(x, y) { return -1; } fn gt(x, y) { return 1; } for (c in [lt, gt]) { let a = []; let sum = 0;"
+        "for (let i = 0; i < 100; i++) { a.append((i * 37) % 100); sum += i; } a.sort(c); assert(a.len() == 100);"
+        "let total = 0; for (v in a) { total += v; } assert(total == sum); }",
+        "type K { fn key(x) { return -x; } } let a = [1, 3, 2]; a.sort(K().key); assert(a[0] == 3); assert(a[2] == 1);"
+        "let b = [10, 9, 100]; b.sort(str); assert(b[0] == 10); assert(b[1] == 100); assert(b[2] == 9);"
+        "let m = {\"a\": 3, \"b\": 1}; let c = [\"a\", \"b\"]; c.sort(m.get); assert(c[0] == \"b\");",
+        // callables hash by identity
+        "type K { fn f() { return 1; } } let f = K().f; let m = {}; m[clock] = 1; m[f] = 2; m.set(str, 3); assert(m[clock] == 1); assert(m[f] == 2); assert(m[str] == 3);"
+        "assert(m.len() == 3); m.remove(f); assert(m.len() == 2); let s = set(clock, f); assert(s.has(f)); assert(!s.has(K().f));",
+        "let a = [1, 2, 3]; a.reserve(100).extend([4, 5]); assert(a.len() == 5); assert(a[4] == 5); a.extend(a); assert(a.len() == 10); assert(a[5] == 1); a.extend([]); assert(a.len() == 10);",
+        "let a = [1, 2, 3, 4, 5]; let b = a.slice(1, -1); assert(b.len() == 3); assert(b[0] == 2); b[0] = 0; assert(a[1] == 2); assert(a.slice(3).len() == 2); assert(a.slice(4, 1).len() == 0); assert(a.slice(-100, 100).len() == 5);",
+        "let a = [1, 3]; a.insert(1, 2); a.insert(0, 0); a.insert(4, 4); a.insert(-1, 3.5); assert(a.len() == 6); assert(a[0] == 0); assert(a[2] == 2); assert(a[4] == 3.5); assert(a[5] == 4);",
+        "let a = [1, 2, 3, 4]; assert(a.pop() == 4); assert(a.pop(0) == 1); assert(a.len() == 2); assert(a[0] == 2); assert(a.pop(-2) == 2); assert(a.len() == 1);",
+        "let a = [1, 2, 3, 4]; a.reverse(); assert(a[0] == 4); assert(a[3] == 1); let e = []; e.reverse(); assert(e.len() == 0); assert(a.index(3) == 1); assert(a.index(9) == -1); assert([\"x\", \"y\"].index(\"y\") == 1);",
+        "let t = 0; for (x in [1, 2, 3]) { t += x; } assert(t == 6); for (let i, x in [\"a\", \"b\"]) { t += i; } assert(t == 7); for (x in []) { assert(false); }",
+        "let m = {\"a\": 1, \"b\": 2, 0: 3}; let keys = 0; let t = 0; for (k in m) { keys++; } for (k, v in m) { t += v; m[k] = v * 2; } assert(keys == 3); assert(t == 6); assert(m[\"b\"] == 4);",
+        "let s = \"\"; for (c in \"abc\") { s = c + s; } assert(s == \"cba\"); let t = 0; for (x in array([1.5, 2.5])) { t += x; } assert(t == 4);",
+        "let t = 0; for (i in range(5)) { t += i; } assert(t == 10); t = 0; for (i in range(10, 0, -3)) { t += i; } assert(t == 22); for (i in range(3, 3)) { assert(false); }",
+        "let t = 0; for (i in range(100)) { if (i % 2 == 0) { continue; } if (i > 10) { break; } t += i; } assert(t == 25); for (i in range(3)) { for (j in range(3)) { t += i * j; } } assert(t == 34);",
+        // a break or continue inside a switch leaves the switch value behind
+        "let out = []; for (i in [0, 1, 2]) { switch (i) { case 0: out.append(\"zero\"); continue; default: out.append(i); } } assert(out.len() == 3); assert(out[0] == \"zero\"); assert(out[1] == 1); assert(out[2] == 2);"
+        "let n = 0; for (let i = 0; i < 4; i++) { switch (i) { case 1: continue; case 3: break; default: n += 10; } } assert(n == 20);"
+        "fn f() { let a = \"a\"; for (x in range(5)) { switch (x) { case 3: break; default: { let y = x; } } } return a; } assert(f() == \"a\");",
+        "fn mk() { let out = []; for (i in range(3)) { fn g() { return i; } out.append(g); } return out; } let g = mk(); assert(g[0]() == 0); assert(g[2]() == 2);",
+        "let l = [1, 2]; for (x in l) { if (x < 4) { l.append(x + 2); } } assert(l.len() == 5); let i = 0; for (i = 0; i < 3; i++) {} assert(i == 3);",
+        "let r = range(1, 10, 2); assert(r.len() == 5); assert(r[1] == 3); assert(r[-1] == 9); assert(in(5, r)); assert(!in(4, r)); assert(!in(11, r)); assert(r.tolist().len() == 5); assert(is(r, range)); assert(!bool(range(0))); assert(range(0, 1, 0.25)[3] == 0.75);",
+        "let s = set(1, 2, 3, 2, \"a\", \"a\"); assert(s.len() == 4); assert(s.add(4)); assert(!s.add(4)); assert(s.has(4)); assert(s.remove(4)); assert(!s.remove(4)); assert(in(\"a\", s)); assert(!in(\"b\", s)); assert(is(s, set)); assert(!is([], set));",
+        "let s = set(1, 2, 3); let t = set(2, 3, 9); assert(s.union(t).len() == 4); assert(s.intersection(t).len() == 2); assert(t.intersection(s).has(3)); assert(s.difference(t).len() == 1); assert(s.difference(t).has(1)); assert(t.difference(s).has(9));",
+        "let d = set().update([1, 1, 2, 3, 3]).update(range(10)).update(array([20])); assert(d.len() == 11); assert(set(d).len() == 11); assert(d.tolist().len() == 11); assert(!bool(set())); assert(str(d) == \"<set 11>\"); d.clear(); assert(d.len() == 0);",
+        "let s = set(); for (i in range(1000)) { s.add(i); } for (i in range(900)) { s.remove(i); } assert(s.len() == 100); assert(!s.has(5)); assert(s.has(950)); for (i in range(1000)) { s.add(i % 50); } assert(s.len() == 150);",
+        "let t = 0; for (x in set(2, 3, 9)) { t += x; } assert(t == 14); let s = set(1, 2, 3); for (x in s.tolist()) { s.remove(x); } assert(s.len() == 0);",
+        "let s = set(1, 2); for (x in s) { s.add(1); s.remove(9); s.update([2]); } assert(s.len() == 2); let m = {\"a\": 1}; for (k in m) { m.remove(\"zz\"); m[k] = 2; } assert(m[\"a\"] == 2);",
         "let a = list(1,2,3); assert(a.len() == 3); a.clear(); assert(a.len() == 0); a.append(45); assert(a.len() == 1);",
         "let a = list(1,2,3,4,5); while (a.len() !=0){ a.remove(-1);} assert(a.len() == 0);",
         "let a = list(); a.remove(0); assert(a.len() == 0);",
         "let a = list(1,2,3,4,5); a.remove(2); assert(a.len() == 4); assert(a.get(2) == 4); a.remove(-1); assert(a.get(-1) == 4);",
         "let a = list(1,2,3,); assert(a[0] == 1); assert(a[2] == 3); assert(a[-1] == 3);",
         "let a = [1, \"two\", 3, \"four\",]; assert(a[0] == 1); assert(a[-1] == \"four\"); assert(in(1, a)); assert(!in(4, a));",
+        "fn mk() { return [1, \"a\", nil, true]; } let a = mk(); let b = mk(); a[0] = 9; assert(b[0] == 1); assert(b[2] == nil); assert(b[3]); assert(a.len() == 4);",
+        "fn mk() { return {\"a\": 1, 2: \"b\", false: 0}; } let a = mk(); a[\"a\"] = 5; a[3] = 1; let b = mk(); assert(b[\"a\"] == 1); assert(b[2] == \"b\"); assert(b.len() == 3); assert(a.len() == 4);",
+        "let x = 5; let a = [1, 2, x, 3, x * 2, \"s\"[0]]; assert(a.len() == 6); assert(a[2] == 5); assert(a[3] == 3); assert(a[4] == 10); assert(a[5] == \"s\");",
+        "let x = 5; let m = {\"a\": 1, \"b\": x, x: \"c\", 1: 2}; assert(m.len() == 4); assert(m[\"b\"] == 5); assert(m[5] == \"c\"); assert(m[1] == 2);",
+        "let list = 1; let map = 2; let a = [1, 2]; let m = {\"a\": list}; assert(a.len() == 2); assert(m[\"a\"] == 1); assert([].len() == 0); assert({}.len() == 0);",
+        "let a = [[1, 2], [1, 2]]; a[0][0] = 3; assert(a[1][0] == 1); let m = {\"a\": [1]}; assert(m[\"a\"][0] == 1);",
 
         "let test = false; let value = test ? 1 : 0; assert(value == 0); test = true; value = test ? 1 : 0; assert(value == 1);",
         "let counters = [0]; counters[0]++; assert(counters[0] == 1);",
         "let counters = {\"start\": 0}; counters[\"start\"]++; assert(counters[\"start\"] == 1);",
         "type Foo { let counter = 0; fn increment() { self.counter++;}}; let f = Foo(); f.increment(); assert(f.counter == 1);",
 
+        "assert(1 + 2 * 3 == 7); assert(-(2 - 5) == 3); assert(!nil); assert(!0); assert(\"a\" == \"a\"); assert(\"a\" != \"b\"); assert(7 / 2 == 3.5);"
+        "assert((6 & 3) == 2); assert((6 | 3) == 7); assert((6 ^ 3) == 5); assert(~0 == -1); assert(5 % 3 == 2); assert(1 <= 1); assert(!(2 >= 3)); assert(-0.5 * 4 == -2);",
+        "let a = 3; let b = a and 2 + 3; assert(b == 5); let c = nil; let d = c or -1; assert(d == -1); let e = !(c and true); assert(e); let f = a > 2 ? 1 + 1 : 0; assert(f == 2);",
+        "fn f(n) { if (n > 1) { return 1; print(\"dead\"); n = 5; } while (true) { n++; if (n > 3) { break; continue; } } return n; } assert(f(2) == 1); assert(f(0) == 4);",
+        "let t = 0; for (let i = 0; i < 3; i++) { if (i == 1) { continue; let x = 1; t += 100; } t += i; } assert(t == 2);",
+        "let r = []; if (true) { r.append(1); } else { r.append(2); } if (false) { r.append(3); } else { r.append(4); } if (0) { r.append(5); }"
+        "assert(r.len() == 2); assert(r[1] == 4); assert((true and 7) == 7); assert(!(false and 8)); assert((nil or 9) == 9); assert((1 or 10) == 1);",
+        "fn f(n) { let t = 0; for (let i = 0; i < n; i++) { if (i >= 2) { t += i; } if (i <= 1) { t += 100; } if (i != 3) { t += 1000; } } return t; } assert(f(5) == 4209);",
+        "fn g(a, b) { let r = 0; while (a < b) { if (a == b - 1) { r += 1; } a++; } return r > 0 ? a : -1; } assert(g(1, 4) == 4); assert(g(4, 1) == -1);"
+        "fn h(x) { switch (x) { case 1: return \"one\"; case 2: return \"two\"; default: return \"many\"; } } assert(h(2) == \"two\"); assert(h(7) == \"many\");",
+        "let lo = 1; let hi = 2; let n = 0; if (lo < hi and !(hi < lo)) { n++; } if (lo > hi or hi == 2) { n++; } if (!(lo == 1)) { n = 0; } assert(n == 2); assert((1 < 2 and 3) == 3); assert((1 > 2 or 4) == 4);",
+        "type A { let x = 1; } type B { let x = 10; fn bump(o) { o.x += 1; self.x++; self.x -= 3; return o.x; } } let a = A(); let b = B();"
+        "assert(b.bump(a) == 2); assert(a.x == 2); assert(b.x == 8); a.x += 200; a.x--; assert(a.x == 201); assert((a.x++) == 202);",
+        "fn f() { let i = 0; let s = \"a\"; i++; i += 2.5; i -= 1000; i--; s += \"b\"; fn g() { i++; i += 3; return i; } assert(g() == -993.5); assert(i == -993.5); assert(s == \"ab\"); }"
+        "f(); let g = 5; g++; g -= 2; g += 0.5; assert(g == 4.5); assert(g++ == 5.5); let h = 1; h += -128; h -= -127; h += 1000000; assert(h == 1000000);",
+        "type Sites { let RES = 0x1; let IND = 0x4; let NAME = \"sites\"; }"
+        "fn classify(x) { switch (x) { case 0: return \"zero\"; case 1: return \"one\"; case \"a\": return \"a\"; case Sites.IND: return \"ind\"; case true: return \"true\";"
+        "case nil: return \"nil\"; case -2.5: return \"neg\"; case 1: return \"dup\"; default: return \"other\"; } }"
+        "assert(classify(0) == \"zero\"); assert(classify(1) == \"one\"); assert(classify(\"a\") == \"a\"); assert(classify(4) == \"ind\"); assert(classify(true) == \"true\");"
+        "assert(classify(nil) == \"nil\"); assert(classify(-2.5) == \"neg\"); assert(classify([1]) == \"other\"); assert(classify(Sites) == \"other\"); assert(classify(false) == \"other\");"
+        "let k = 3; fn mixed(x) { switch (x) { case 1: return \"one\"; case k: return \"k\"; case 2: return \"two\"; } return \"none\"; }"
+        "assert(mixed(1) == \"one\"); assert(mixed(3) == \"k\"); assert(mixed(2) == \"two\"); assert(mixed(5) == \"none\");"
+        "fn nodefault(x) { let r = 0; switch (x) { case Sites.RES: r = 1; case Sites.NAME: r = 3; } return r; } assert(nodefault(1) == 1); assert(nodefault(\"sites\") == 3); assert(nodefault(7) == 0);",
+        "type T { let A = 1; } type T { let A = 2; } fn f(x) { switch (x) { case T.A: return 1; default: return 0; } } assert(f(2) == 1); assert(f(1) == 0);"
+        "type U { let A = 1; } U = T; fn g(x) { switch (x) { case U.A: return 1; default: return 0; } } assert(g(2) == 1); assert(g(1) == 0);",
+        // a rebinding anywhere in the script keeps the fields out of the case labels, even one after the switch
+        "type T { let A = 1; let B = 2; } type U { let A = 5; let B = 1; } fn f(x) { switch (x) { case T.A: return \"A\"; case T.B: return \"B\"; } }"
+        "assert(f(1) == \"A\"); T = U; assert(f(1) == \"B\");",
+        "type T { let A = 1; } fn f(x) { switch (x) { case T.A: return 1; default: return 0; } } assert(f(1) == 1); type V { let A = 2; } let T = V; assert(f(2) == 1);",
+        "type T { let A = 1; } type U { let A = 2; } fn f(x) { switch (x) { case T.A: return 1; default: return 0; } } fn g() { T = U; } assert(f(1) == 1); g(); assert(f(2) == 1);",
+        "fn even(n) { if (n == 0) { return true; } return odd(n - 1); } fn odd(n) { if (n == 0) { return false; } return even(n - 1); } assert(even(40)); assert(!even(41));"
+        "fn make(n) { let captured = n; fn get() { return captured; } if (n == 0) { return get; } return make(n - 1); } assert(make(30)() == 0);"
+        "fn adder(x) { fn add(y) { return x + y; } return add; } fn apply(f, v) { return f(v); } assert(apply(adder(3), 4) == 7);"
+        "fn natives(n) { return str(n); } assert(natives(5) == \"5\"); type P { fn init(v) { self.v = v; } } fn build(v) { return P(v); } assert(build(9).v == 9);",
+        "type Walker { let steps = 0; fn walk(n) { if (n == 0) { return self.steps; } self.steps++; return self.walk(n - 1); } } assert(Walker().walk(40) == 40);"
+        "type Base { fn down(n) { if (n == 0) { return \"base\"; } return self.down(n - 1); } } type Sub (Base) { fn down(n) { return super.down(n); } } assert(Sub().down(20) == \"base\");",
+        "let a = [1, 2, 3]; let i = 0; a[i + 1] += 5; assert(a[1] == 7);"
+        "let calls = 0; fn idx() { calls++; return 2; } a[idx()] *= 2; assert(a[2] == 6); assert(calls == 1);",
+        "let m = [[1, 2], [3, 4]]; m[1][0] += 10; assert(m[1][0] == 13); m[0][-1] = 9; assert(m[0][1] == 9);",
+        "let m = {}; for (let i = 0; i < 100; i++) { m[i] = i * 2; } assert(m.len() == 100); assert(m[99] == 198); assert(m[100] == nil);"
+        "m.remove(99); assert(m.len() == 99); assert(m[99] == nil); m[99] = 1; assert(m[99] == 1);"
+        "m[1.5] = \"half\"; m[-1] = \"negative\"; m[\"1\"] = \"string\"; assert(m[1] == 2); assert(m[1.5] == \"half\"); assert(m[-1] == \"negative\");"
+        "assert(m[\"1\"] == \"string\"); assert(m.len() == 103); assert(m.keys().len() == 103); assert(m.values().len() == 103);",
+        "let m = {}; for (let i = 9; i >= 0; i--) { m[i] = i; } for (let i = 0; i < 10; i++) { assert(m[i] == i); } assert(m.len() == 10);",
+        "let m = {}; for (let i = 0; i < 64; i++) { m[i] = i; } for (let i = 1; i < 64; i++) { m.remove(i); }"
+        "assert(m.len() == 1); assert(m[0] == 0); m[0] = nil; m.remove(0); assert(m.len() == 0); assert(!bool(m));"
+        "for (let i = 100; i >= 0; i--) { m[i] = i; m.remove(i + 1); } assert(m.len() == 1); assert(m[0] == 0);",
+        "let m = {}; for (let i = 0; i < 40; i++) { m[i] = i; } for (let i = 0; i < 39; i++) { m.remove(i); } m[0] = \"zero\";"
+        "assert(m[0] == \"zero\"); assert(m[39] == 39); assert(m.len() == 2); assert(in(39, m)); assert(!in(38, m));",
+        "let m = {}; assert(m[\"missing\"] == nil); m[\"k\"] = 1; m[\"k\"]++; assert(m[\"k\"] == 2);",
+        "type Doubler { fn subscript(i) { return i * 2; } } let d = Doubler(); assert(d[21] == 42);",
         "let a = [{\"name\": \"foo\", \"counter\": 11}, {\"name\": \"bar\", \"counter\": 22}];"
         "assert(a[0][\"counter\"] == 11); assert(a[1][\"counter\"] == 22); assert(a[0][\"name\"] + a[1][\"name\"] == \"foobar\");",
 
@@ -567,14 +778,176 @@ START_TEST(test_vm)
             "}"
         "}",
 
+        // quickened sites that later see other types fall back to the generic instruction
+        "fn add(a, b) { return a + b; } fn sub(a, b) { return a - b; } fn lt(a, b) { return a < b; }"
+        "for (let i = 0; i < 3; i++) { assert(add(i, 1) == i + 1); assert(sub(i, 1) == i - 1); assert(lt(i, 5)); }"
+        "assert(add(\"a\", \"b\") == \"ab\"); assert(add(1, 2) == 3); assert(add(\"c\", \"d\") == \"cd\");"
+        "assert(sub(5, 2) == 3); assert(lt(2, 1) == false);",
+
+        "type P { fn init(x) { self.x = x; } fn get() { return self.x; } }"
+        "fn prop(o) { return o.x; } fn len(o) { return o.len; }"
+        "for (let i = 0; i < 3; i++) { assert(prop(P(i)) == i); }"
+        "type Q { let x = 7; } assert(prop(Q) == 7); assert(prop(P(9)) == 9);"
+        "assert(len(\"abc\")() == 3); assert(len([1, 2])() == 2);"
+        "type R { fn len() { return 42; } } assert(len(R())() == 42); assert(len(\"ab\")() == 2);",
+
         NULL,
     };
     for (int i = 0; test_cases[i] != NULL; i++) {
+        // without the bytecode optimizer, with it, with bodies compiled on their first call and as register code
+        for (int mode = 0; mode < 4; mode++) {
+            vm_t_init();
+            if (mode == 0)
+                vm_toggle_optimize();
+            if (mode == 2)
+                vm_toggle_lazy_compile();
+            if (mode == 3)
+                vm_toggle_registers();
+            ck_assert_msg(vm_t_interpret(test_cases[i]) == INTERPRET_OK, "test case failed for \"%s\"\n", test_cases[i]);
+            vm_t_free();
+        }
+    }
+
+    // literals past a single build batch, both prebuilt and built at runtime
+    {
+        char source[16384];
+        int length = snprintf(source, sizeof source, "let x = 1; let a = [");
+        for (int i = 0; i < 600; i++)
+            length += snprintf(source + length, sizeof source - length, "%d, ", i);
+        length += snprintf(source + length, sizeof source - length, "]; let b = [");
+        for (int i = 0; i < 600; i++)
+            length += snprintf(source + length, sizeof source - length, "x, ");
+        length += snprintf(source + length, sizeof source - length, "]; let m = {");
+        for (int i = 0; i < 300; i++)
+            length += snprintf(source + length, sizeof source - length, "%d: %d, \"k%d\": %d, ", i, i, i, i);
+        length += snprintf(source + length, sizeof source - length, "\"end\": 1}; let n = {");
+        for (int i = 0; i < 300; i++)
+            length += snprintf(source + length, sizeof source - length, "x: %s, ", i % 2 ? "x" : "nil");
+        snprintf(source + length, sizeof source - length, "\"end\": x};"
+            "assert(a.len() == 600); assert(a[599] == 599); assert(b.len() == 600); assert(b[599] == 1);"
+            "assert(m.len() == 601); assert(m[299] == 299); assert(m[\"k299\"] == 299); assert(n.len() == 2); assert(n[1] == 1);");
+        vm_t_init();
+        ck_assert_msg(vm_t_interpret(source) == INTERPRET_OK, "large literal test case failed\n");
+        vm_t_free();
+    }
+
+
+    // operands past a byte: a 100k constant chunk, hundreds of locals and upvalues, jumps over more than 64KiB
+    {
+        const size_t size = 8 * 1024 * 1024;
+        char *source = malloc(size);
+        ck_assert(source != NULL);
+        int length = snprintf(source, size, "let s = 0;");
+        for (int i = 0; i < 100000; i++)
+            length += snprintf(source + length, size - length, "s = s + %d;", i);
+        length += snprintf(source + length, size - length, "assert(s == 4999950000);"
+            "let g = 1; g++; g += 2; assert(g == 4);"
+            "type T { let f = 1; fn m() { return self.f; } } let t = T(); t.f += 1; t.f++; assert(t.m() == 3);"
+            "{ let a = 5; fn c() { return a; } assert(c() == 5); }"
+            "fn big() {");
+        for (int i = 0; i < 300; i++)
+            length += snprintf(source + length, size - length, "let v%d = %d;", i, i);
+        length += snprintf(source + length, size - length, "v299++; v299 += 1; assert(v299 == 301); fn all() { let sum = 0");
+        for (int i = 0; i < 300; i++)
+            length += snprintf(source + length, size - length, " + v%d", i);
+        length += snprintf(source + length, size - length, "; v299++; return sum; } assert(all() == 44852); assert(v299 == 302);"
+            "let total = 0; for (x in [1, 2, 3]) { total += x; }"
+            "if (total == 6) {");
+        for (int i = 0; i < 20000; i++)
+            length += snprintf(source + length, size - length, "total = total + 1;");
+        length += snprintf(source + length, size - length, "} else { total = -1; }"
+            "let n = 0; while (n < 2) { n++;");
+        for (int i = 0; i < 20000; i++)
+            length += snprintf(source + length, size - length, "total = total - 1;");
+        length += snprintf(source + length, size - length, "} return total; }"
+            "assert(big() == -19994);");
+        for (int optimize = 0; optimize < 2; optimize++) {
+            vm_t_init();
+            if (!optimize)
+                vm_toggle_optimize();
+            ck_assert_msg(vm_t_interpret(source) == INTERPRET_OK, "wide operand test case failed\n");
+            vm_t_free();
+        }
+        free(source);
+    }
+
+    // calls in tail position run in constant stack depth, without them the frames run out
+    {
+        const char *source = "fn count(n, acc) { if (n == 0) { return acc; } return count(n - 1, acc + 1); } assert(count(1000000, 0) == 1000000);"
+            "type Walker { let steps = 0; fn walk(n) { if (n == 0) { return self.steps; } self.steps++; return self.walk(n - 1); } } assert(Walker().walk(1000000) == 1000000);";
+        vm_t_init();
+        ck_assert_msg(vm_t_interpret(source) == INTERPRET_OK, "deep tail recursion failed\n");
+        ck_assert(vm.frame_count == 0);
+        vm_t_free();
+        vm_t_init();
+        vm_toggle_registers();
+        ck_assert_msg(vm_t_interpret(source) == INTERPRET_OK, "deep tail recursion as register code failed\n");
+        ck_assert(vm.frame_count == 0);
+        vm_t_free();
         vm_t_init();
-        ck_assert_msg(vm_t_interpret(test_cases[i]) == INTERPRET_OK, "test case failed for \"%s\"\n", test_cases[i]);
+        vm_toggle_optimize();
+        ck_assert(vm_t_interpret(source) == INTERPRET_RUNTIME_ERROR);
         vm_t_free();
     }
 
+    // lazily compiled bodies are only scanned until their first call
+    {
+        vm_t_init();
+        vm_toggle_lazy_compile();
+        obj_function_t *script = compiler_t_compile("fn f(a, b) { return a + b; } type T { fn m() { return 1; } }", false);
+        vm_push(OBJ_VAL(script)); // compiling the body allocates
+        obj_function_t *f = AS_FUNCTION(script->chunk.constants.values[1]);
+        ck_assert(f->lazy_source != NULL);
+        ck_assert(f->arity == 2);
+        ck_assert(f->chunk.count == 0);
+        ck_assert(compiler_t_compile_lazy(f));
+        ck_assert(f->lazy_source == NULL);
+        ck_assert(f->chunk.count > 0);
+        vm_t_free();
+
+        const char *unused = "fn broken() { this is not valid { at all }; } print(1);";
+        vm_t_init();
+        ck_assert(vm_t_interpret(unused) == INTERPRET_COMPILE_ERROR);
+        vm_t_free();
+        vm_t_init();
+        vm_toggle_lazy_compile();
+        ck_assert(vm_t_interpret(unused) == INTERPRET_OK);
+        ck_assert(vm_t_interpret("broken();") == INTERPRET_RUNTIME_ERROR);
+        vm_t_free();
+
+        // a skipped body that rebinds a type still keeps its fields out of the case labels
+        vm_t_init();
+        vm_toggle_lazy_compile();
+        ck_assert(vm_t_interpret("type K { let a = 1; } type L { let a = 2; } fn swap() { K = L; } swap();"
+            "let r = 0; switch (2) { case K.a: r = 1; case 5: r = 5; default: r = 3; } assert(r == 1);") == INTERPRET_OK);
+        vm_t_free();
+    }
+
+    // register code names locals and constants directly, a switch table keeps its function on the stack loop
+    {
+        vm_t_init();
+        obj_function_t *script = compiler_t_compile("fn f(a, b) { let c = a + b; return c * 2; }"
+            "fn g(x) { switch (x) { case 1: return 1; case 2: return 2; case 3: return 3; } }", false);
+        vm_push(OBJ_VAL(script));
+        obj_function_t *f = AS_FUNCTION(script->chunk.constants.values[1]);
+        ck_assert(compiler_t_registers(f));
+        ck_assert(f->registers_tried);
+        ck_assert(f->registers->code[0] == REG_ENCODE(REG_ADD, 3, 1, 2));
+        ck_assert(f->registers->code[1] == REG_ENCODE(REG_MULTIPLY_K, 4, 3, 0));
+        ck_assert(f->registers->code[2] == REG_ENCODE(REG_RETURN, 4, 0, 0));
+        ck_assert(f->registers->register_count == 6);
+        obj_function_t *g = AS_FUNCTION(script->chunk.constants.values[3]);
+        ck_assert(!compiler_t_registers(g));
+        ck_assert(g->registers == NULL);
+        vm_t_free();
+
+        vm_t_init();
+        vm_toggle_registers();
+        ck_assert(vm_t_interpret("fn f(a, b) { let c = a + b; return c * 2; }"
+            "fn g(x) { switch (x) { case 1: return f(x, 1); case 2: return 2; case 3: return 3; } }"
+            "assert(g(1) == 4); assert(f(g(2), 3) == 10);") == INTERPRET_OK);
+        vm_t_free();
+    }
 
     const char *exit_ok_tests[] = {
         "exit;",
@@ -609,6 +982,9 @@ START_TEST(test_vm)
         "let;",
         "let foo = 1",
         "{let foo = foo;}",
+        "for (x, y z) {}",
+        "for (x in) {}",
+        "for (let x, in [1]) {}",
         // "}{",
         "if true ){}",
         " 1 = 3;",
@@ -669,6 +1045,82 @@ START_TEST(test_vm)
         "let a = \"foo\"; let f = a.nosuchmethod; f();",
         "number(list());",
         "number();",
+        "format();",
+        "array(\"a\");",
+        "array(-1);",
+        "array([1, \"a\"]);",
+        "array(1, 2, 3);",
+        "array(2)[2];",
+        "let a = array(2); a[0] = \"x\";",
+        "array(2).append(nil);",
+        "array(2).dot(array(3));",
+        "array(2).add(array(3));",
+        "array(2).scale();",
+        "array(2).fill(nil);",
+        "array(2).slice();",
+        "array(2).sum(1);",
+        "array(2).nope();",
+        "[1, \"a\"].sort();",
+        "[nil, nil].sort();",
+        "[1, 2].sort(1);",
+        "[1, 2].sort(nil, 1);",
+        "fn bad(x, y) { return nil; } [1, 2].sort(bad);",
+        "fn boom(x, y) { return x.nope(); } [1, 2].sort(boom);",
+        "let a = [1, 2, 3]; fn grow(x, y) { a.append(x); return x - y; } a.sort(grow);",
+        "[].pop();",
+        "[1].pop(1);",
+        "[1].insert(3, 1);",
+        "[1].insert(0);",
+        "[1].extend(1);",
+        "[1].reserve(-1);",
+        "[1].slice();",
+        "[1].reverse(1);",
+        "[1].index();",
+        "for (x in 5) {}",
+        "for (x in nil) {}",
+        "let m = {}; for (i in range(100)) { m[i] = i; } for (k in m) { m.remove(k); }",
+        "let m = {\"a\": 1}; for (k in m) { for (i in range(100)) { m[i + 1000] = i; } }",
+        "1 / 0;",
+        "7 % (1 - 1);",
+        "-\"a\";",
+        "!true + 1;",
+        "fn f() { let a = \"x\"; if (a < 1) {} } f();",
+        "fn f() { let a = 1; let b = nil; while (a > b) {} } f();",
+        "let a = \"x\"; while (a >= 1) {}",
+        "let s = \"a\"; s++;",
+        "nosuchvariable++;",
+        "fn f() { let s = nil; s += 1; } f();",
+        "fn f() { let s = nil; s += \"x\"; } f();",
+        "fn f() { let s = \"a\"; fn g() { s--; } g(); } f();",
+        "type A {} let a = A(); a.x++;",
+        "type A { fn m() {} } let a = A(); a.m += 1;",
+        "type A { let x = 1; } A.x++;",
+        "let l = [1]; l.x++;",
+        "range();",
+        "range(\"a\");",
+        "range(1, 2, 0);",
+        "range(3)[3];",
+        "range(3).nope();",
+        "set().add();",
+        "set().has(1, 2);",
+        "set().update(1);",
+        "set().union([1]);",
+        "set().nope();",
+        "let s = set(1); for (x in s) { for (i in range(100)) { s.add(i); } }",
+        "let s = set(1, 2); for (x in s) { s.add(3); }",
+        "let s = set(1, 2, 3); for (x in s) { s.remove(3); }",
+        "let s = set(1, 2); for (x in s) { s.clear(); }",
+        "let m = {\"a\": 1, \"b\": 2}; for (k in m) { m[\"zz\"] = 3; }",
+        "let m = {\"a\": 1, \"b\": 2, \"c\": 3, \"d\": 4, \"e\": 5}; for (k in m) { m[\"zz\"] = 3; }",
+        "let m = {\"a\": 1, \"b\": 2}; for (k, v in m) { m.set(\"zz\", v); }",
+        "let m = {0: 1, 1: 2}; for (k in m) { m[2] = 3; }",
+        "let m = {\"a\": 1, \"b\": 2}; for (k in m) { m.remove(\"b\"); }",
+        "for (k, v in set(1)) {}",
+        "format(1);",
+        "format(\"{}\");",
+        "format(\"{}\", 1, 2);",
+        "format(\"{\", 1);",
+        "format(\"}\");",
         "\"foo\".substr();",
         "\"foo\".substr(-10,1);",
         "\"foo\".substr(0);",
@@ -676,6 +1128,19 @@ START_TEST(test_vm)
         "\"foo\"[\"f\"];",
         "\"foo\"[10];",
         "\"foo\".len(1);",
+        "\"foo\".find();",
+        "\"foo\".find(\"o\", \"1\");",
+        "\"foo\".rfind(1);",
+        "\"foo\".count();",
+        "\"foo\".split(\"\");",
+        "\"foo\".split(1);",
+        "\"foo\".strip(1);",
+        "\"foo\".replace(\"\", \"x\");",
+        "\"foo\".replace(\"o\");",
+        "\"foo\".startswith(1);",
+        "\"foo\".endswith();",
+        "\",\".join(\"ab\");",
+        "\",\".join([\"a\", 1]);",
         "list().len(1);",
         "list().get();",
         "list().get(true);",
@@ -687,6 +1152,8 @@ START_TEST(test_vm)
         "list(1,2,3)[\"foo\"];",
         "list(1,2,3).nosuchmethod();",
         "list(1,2,3)[100];",
+        "let a = list(1,2,3); a[100] = 1;",
+        "let a = 1; a[0];",
         "true.nosuchpropertyonanoninstance;",
         "map(1);",
         "map(1, 100, 2, 200).get();",
@@ -706,6 +1173,9 @@ START_TEST(test_vm)
         "map(\"one\", 1).len(1);",
         "type Animals { let Cat = \"cat\"; let Dog = \"dog\"; let Bird = \"bird\";} print(Animals.NoSuch);",
         "type Animals { let Cat = \"cat\"; let Dog = \"dog\"; let Bird = \"bird\";} Animals.Cat = 1;",
+        "fn add(a, b) { return a + b; } add(1, 2); add(\"a\", \"b\"); add(1, \"b\");",
+        "fn lt(a, b) { return a < b; } lt(1, 2); lt(\"a\", 2);",
+        "type P { let x = 1; } fn prop(o) { return o.x; } prop(P()); prop(P()).nosuch; prop(P()); P().nosuch;",
         NULL,
     };
     for (int i = 0; runtime_fail_cases[i] != NULL; i++) {
@@ -750,10 +1220,28 @@ START_TEST(test_value)
     ck_assert(value_t_hash(BOOL_VAL(false)) == 5);
     ck_assert(value_t_hash(NIL_VAL) == 7);
     ck_assert(value_t_hash(EMPTY_VAL) == 0);
-    ck_assert(value_t_hash(NUMBER_VAL(9)) == 1076101120);
+    ck_assert(value_t_hash(NUMBER_VAL(9)) == 668421081);
+    ck_assert(value_t_hash(NUMBER_VAL(-0.0)) == value_t_hash(NUMBER_VAL(0)));
 
     ck_assert(value_t_equal(NUMBER_VAL(100), NUMBER_VAL(100)));
     ck_assert(!value_t_equal(NUMBER_VAL(100), NUMBER_VAL(200)));
+
+    char buffer[NUMBER_FORMAT_MAX];
+    ck_assert(number_format(123456789, buffer) == 9 && strcmp(buffer, "123456789") == 0);
+    ck_assert(number_format(5e-324, buffer) == 6 && strcmp(buffer, "5e-324") == 0);
+    ck_assert(number_format(1.7976931348623157e308, buffer) == 23);
+    ck_assert(strtod(buffer, NULL) == 1.7976931348623157e308);
+    // shortest digits, 8.6287e20 used to come out longer and 6.9881e20 is one Grisu3 leaves to the exact fallback
+    ck_assert(number_format(8.6287e20, buffer) == 10 && strcmp(buffer, "8.6287e+20") == 0);
+    ck_assert(number_format(1.0e23, buffer) == 5 && strcmp(buffer, "1e+23") == 0);
+    ck_assert(number_format(6.9881e20, buffer) == 10 && strcmp(buffer, "6.9881e+20") == 0);
+    ck_assert(number_format(0.3, buffer) == 3 && strcmp(buffer, "0.3") == 0);
+    ck_assert(number_format(0.0 / 0.0, buffer) == 3 && strcmp(buffer, "nan") == 0);
+    ck_assert(number_format(-1.0 / 0.0, buffer) == 4 && strcmp(buffer, "-inf") == 0);
+    ck_assert(number_parse("12_3", 2) == 12);
+    ck_assert(number_parse("3.14159", 7) == 3.14159);
+    ck_assert(number_parse("123456789012345678901234", 24) == 123456789012345678901234.0);
+    ck_assert(number_parse("", 0) == 0);
     ck_assert(value_t_equal(BOOL_VAL(true), BOOL_VAL(true)));
     ck_assert(!value_t_equal(BOOL_VAL(true), BOOL_VAL(false)));
     ck_assert(value_t_equal(NIL_VAL, NIL_VAL));
@@ -765,6 +1253,18 @@ START_TEST(test_value)
     ck_assert(value_t_hash(o));
     vm_pop();
 
+    // short identifiers should spread evenly over the low bits used for table slots
+    int buckets[256] = {0};
+    for (int i = 0; i < 65536; i++) {
+        char key[16];
+        const int length = snprintf(key, sizeof(key), "v%d", i);
+        buckets[hash_string(key, length) & 255]++;
+    }
+    for (int i = 0; i < 256; i++)
+        ck_assert_msg(buckets[i] > 128 && buckets[i] < 384, "bucket %d has %d entries", i, buckets[i]);
+    ck_assert(hash_string("", 0) == hash_string("", 0));
+    ck_assert(hash_string("abcdefghijklmnopqrstuvwxyz0123456789", 36) != hash_string("abcdefghijklmnopqrstuvwxyz0123456788", 36));
+
     value_list_t a;
     value_list_t_init(&a);
     value_list_t_add(&a, NUMBER_VAL(9));
@@ -811,6 +1311,17 @@ START_TEST(test_table)
     ck_assert(table_t_get(&t, OBJ_VAL(key2), &v));
     ck_assert(!table_t_get(&t, OBJ_VAL(key3), &v));
 
+    // deleting must leave a tombstone so colliding keys further along the probe stay reachable
+    table_t numbers;
+    table_t_init(&numbers);
+    for (int i = 0; i < 1000; i++)
+        table_t_set(&numbers, NUMBER_VAL(i), NUMBER_VAL(i));
+    for (int i = 0; i < 1000; i += 2)
+        ck_assert(table_t_delete(&numbers, NUMBER_VAL(i)));
+    for (int i = 0; i < 1000; i++)
+        ck_assert(table_t_get(&numbers, NUMBER_VAL(i), &v) == (i % 2 == 1));
+    table_t_free(&numbers);
+
     table_t tcopy;
     table_t_init(&tcopy);
     table_t_copy_to(&t, &tcopy);
@@ -831,37 +1342,97 @@ START_TEST(test_table)
     table_t_free(&tcopy);
 
 
-    table_t big;
-    table_t_init(&big);
+    // interned strings are weak, the map keeps our keys reachable
+    obj_map_t *big_map = obj_map_t_allocate();
+    vm_push(OBJ_VAL(big_map));
+    table_t *big = &big_map->table;
     for (int i = 0; i < 8192; i++) {
         char buffer[255];
         int wrote = snprintf(buffer, 255, "item%dforhash", i);
         value_t key = OBJ_VAL(obj_string_t_copy_from(buffer, wrote, true));
-        ck_assert(table_t_set(&big, key, NUMBER_VAL(i)));
+        vm_push(key);
+        ck_assert(table_t_set(big, key, NUMBER_VAL(i)));
+        vm_pop();
     }
     for (int i = 0; i < 8192; i++) {
         char buffer[255];
         int wrote = snprintf(buffer, 255, "item%dforhash", i);
         value_t key = OBJ_VAL(obj_string_t_copy_from(buffer, wrote, true));
         value_t rv;
-        ck_assert(table_t_get(&big, key, &rv));
+        ck_assert(table_t_get(big, key, &rv));
         ck_assert(AS_NUMBER(rv) == i);
     }
     table_t bigcopy;
     table_t_init(&bigcopy);
-    table_t_copy_to(&big, &bigcopy);
+    table_t_copy_to(big, &bigcopy);
     for (int i = 0; i < 8192; i++) {
         char buffer[255];
         int wrote = snprintf(buffer, 255, "item%dforhash", i);
         value_t key = OBJ_VAL(obj_string_t_copy_from(buffer, wrote, true));
         value_t from_big;
         value_t from_bigcopy;
-        ck_assert(table_t_get(&big, key, &from_big));
+        ck_assert(table_t_get(big, key, &from_big));
         ck_assert(table_t_get(&bigcopy, key, &from_bigcopy));
         ck_assert(value_t_equal(from_big, from_bigcopy));
     }
-    table_t_free(&big);
     table_t_free(&bigcopy);
+    vm_pop();
+
+    vm_t_free();
+}
+
+START_TEST(test_string_set)
+{
+    vm_t_init();
+
+    string_set_t set;
+    string_set_t_init(&set);
+    ck_assert(string_set_t_find(&set, "foo", 3, 0) == NULL);
+    ck_assert(set.misses == 1);
+
+    obj_list_t *roots = obj_list_t_allocate();
+    vm_push(OBJ_VAL(roots));
+    obj_string_t *strings[1024];
+    for (int i = 0; i < 1024; i++) {
+        char buffer[32];
+        const int wrote = snprintf(buffer, 32, "set%d", i);
+        strings[i] = obj_string_t_copy_from(buffer, wrote, true);
+        vm_push(OBJ_VAL(strings[i]));
+        value_list_t_add(&roots->elements, OBJ_VAL(strings[i]));
+        vm_pop();
+        string_set_t_add(&set, strings[i]);
+    }
+    ck_assert(set.count == 1024);
+    for (int i = 0; i < 1024; i++) {
+        ck_assert(string_set_t_find(&set, strings[i]->chars, strings[i]->length, strings[i]->hash) == strings[i]);
+    }
+    ck_assert(set.hits == 1024);
+
+    // everything unmarked is swept, tombstones keep later entries reachable
+    for (int i = 0; i < 1024; i += 2)
+        strings[i]->obj.is_marked = true;
+    string_set_t_remove_unmarked(&set);
+    for (int i = 0; i < 1024; i++) {
+        obj_string_t *found = string_set_t_find(&set, strings[i]->chars, strings[i]->length, strings[i]->hash);
+        ck_assert(found == (i % 2 == 0 ? strings[i] : NULL));
+        strings[i]->obj.is_marked = false;
+    }
+    string_set_t_free(&set);
+    vm_pop();
+
+    // unreachable interned strings are collected
+    obj_string_t *garbage = obj_string_t_copy_from("intern garbage", 14, true);
+    const uint32_t hash = garbage->hash;
+    ck_assert(string_set_t_find(&vm.strings, "intern garbage", 14, hash) == garbage);
+    vm_collect_garbage();
+    ck_assert(string_set_t_find(&vm.strings, "intern garbage", 14, hash) == NULL);
+
+    // single byte strings are preallocated and never collected
+    obj_string_t *a = obj_string_t_copy_from("a", 1, true);
+    ck_assert(a == vm.char_strings['a']);
+    vm_collect_garbage();
+    ck_assert(obj_string_t_copy_from("a", 1, false) == a);
+    ck_assert(vm.char_strings[0]->length == 1 && vm.char_strings[255]->chars[0] == '\xff');
 
     vm_t_free();
 }
@@ -900,6 +1471,28 @@ START_TEST(test_object)
     // FREE(obj_string_t, p1); // no free b/c of gc might be running
     // FREE(obj_string_t, p2); // no free b/c of gc might be running
 
+    // slices borrow the parent buffer, short ones are copied out
+    char big[128];
+    for (int i = 0; i < 128; i++)
+        big[i] = (char)('a' + i % 26);
+    obj_string_t *parent = obj_string_t_copy_from(big, 128, false);
+    vm_push(OBJ_VAL(parent));
+    ck_assert(obj_string_t_slice(parent, 0, 128) == parent);
+    ck_assert(obj_string_t_slice(parent, 0, 3) == obj_string_t_copy_from("abc", 3, true));
+    obj_string_t *slice = obj_string_t_slice(parent, 26, 64);
+    vm_pop();
+    vm_push(OBJ_VAL(slice));
+    ck_assert(slice->parent == parent && slice->chars == parent->chars + 26);
+    obj_string_t *inner = obj_string_t_slice(slice, 1, 40);
+    ck_assert(inner->parent == parent);
+    ck_assert(value_t_equal(OBJ_VAL(slice), OBJ_VAL(obj_string_t_copy_from(big, 64, false))));
+    ck_assert(slice->hash == obj_string_t_copy_from(big, 64, false)->hash);
+    vm_collect_garbage(); // the parent stays alive through the slice
+    ck_assert(memcmp(slice->chars, big, 64) == 0);
+    ck_assert(strlen(obj_string_t_cstring(slice)) == 64);
+    ck_assert(slice->parent == NULL);
+    vm_pop();
+
     vm_t_free();
 }
 
@@ -1001,6 +1594,152 @@ START_TEST(test_debug)
     vm_t_free();
 }
 
+static bool same_value(const value_t a, const value_t b);
+
+static bool same_function(const obj_function_t *a, const obj_function_t *b)
+{
+    if (a->arity != b->arity || a->upvalue_count != b->upvalue_count || a->slot_count != b->slot_count)
+        return false;
+    if ((a->name == NULL) != (b->name == NULL) || (a->name != NULL && a->name != b->name))
+        return false;
+    if (a->chunk.count != b->chunk.count || memcmp(a->chunk.code, b->chunk.code, a->chunk.count) != 0)
+        return false;
+    if (a->chunk.line_count != b->chunk.line_count || memcmp(a->chunk.lines, b->chunk.lines, sizeof(line_info_t) * a->chunk.line_count) != 0)
+        return false;
+    if (a->chunk.constants.count != b->chunk.constants.count)
+        return false;
+    for (int i = 0; i < a->chunk.constants.count; i++) {
+        if (!same_value(a->chunk.constants.values[i], b->chunk.constants.values[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool same_value(const value_t a, const value_t b)
+{
+    if (IS_FUNCTION(a) && IS_FUNCTION(b))
+        return same_function(AS_FUNCTION(a), AS_FUNCTION(b));
+    if (IS_LIST(a) && IS_LIST(b)) {
+        const value_list_t *x = &AS_LIST(a)->elements, *y = &AS_LIST(b)->elements;
+        if (x->count != y->count)
+            return false;
+        for (int i = 0; i < x->count; i++) {
+            if (!value_t_equal(x->values[i], y->values[i]))
+                return false;
+        }
+        return true;
+    }
+    if (IS_MAP(a) && IS_MAP(b)) {
+        if (obj_map_t_count(AS_MAP(a)) != obj_map_t_count(AS_MAP(b)))
+            return false;
+        int cursor = 0;
+        value_t key, value, other;
+        while (obj_map_t_next(AS_MAP(a), &cursor, &key, &value)) {
+            if (!obj_map_t_get(AS_MAP(b), key, &other) || !value_t_equal(value, other))
+                return false;
+        }
+        return true;
+    }
+    return value_t_equal(a, b);
+}
+
+START_TEST(test_cache)
+{
+    const char *source_path = "cachetest.tot"; // only its owner matters, the sources below are compiled from memory
+    const char *cache_path = "cachetest.totc";
+    FILE *source_file = fopen(source_path, "w");
+    ck_assert(source_file != NULL);
+    fclose(source_file);
+    const char *sources[] = {
+        "let total = 0; fn outer(n) { let x = n; fn inner() { x = x + 1; return x; } return inner; }"
+        "let f = outer(3); f(); assert(f() == 5);",
+
+        "type A { let x = 1; fn init(y) { self.y = y; } fn sum() { return self.x + self.y; } }"
+        "type B (A) { fn sum() { return super.sum() * 2; } } assert(B(2).sum() == 6);",
+
+        "let l = [1, \"two\", true, nil, 4.5]; let m = {\"a\": 1, 2: \"b\"}; assert(l.len() == 5 && m.get(\"a\") == 1);"
+        "fn s(x) { switch (x) { case 1: return \"one\"; case \"a\": return \"letter\"; default: return nil; } }"
+        "assert(s(1) == \"one\" && s(\"a\") == \"letter\" && s(3) == nil);",
+
+        NULL,
+    };
+    for (int i = 0; sources[i] != NULL; i++) {
+        for (int optimize = 0; optimize < 2; optimize++) {
+            unlink(cache_path);
+            vm_t_init();
+            if (!optimize)
+                vm_toggle_optimize();
+            obj_function_t *compiled = compiler_t_compile(sources[i], false);
+            ck_assert(compiled != NULL);
+            vm_push(OBJ_VAL(compiled));
+            ck_assert(cache_write(cache_path, source_path, compiled, sources[i]));
+            obj_function_t *loaded = cache_read(cache_path, source_path, sources[i]);
+            ck_assert_msg(loaded != NULL && same_function(compiled, loaded), "cache round trip failed for \"%s\"\n", sources[i]);
+            vm_pop();
+
+            // a cold run writes the cache, the next one runs what it loads
+            unlink(cache_path);
+            ck_assert(vm_t_interpret_cached(sources[i], source_path, cache_path) == INTERPRET_OK);
+            ck_assert(access(cache_path, R_OK) == 0);
+            ck_assert(vm_t_interpret_cached(sources[i], source_path, cache_path) == INTERPRET_OK);
+            vm_t_free();
+        }
+    }
+
+    // many constants take the wide forms
+    {
+        char source[8192];
+        int length = 0;
+        for (int i = 0; i < 300; i++)
+            length += snprintf(source + length, sizeof source - length, "let g%d = \"s%d\";", i, i);
+        snprintf(source + length, sizeof source - length, "assert(g299 == \"s299\");");
+        unlink(cache_path);
+        vm_t_init();
+        ck_assert(vm_t_interpret_cached(source, source_path, cache_path) == INTERPRET_OK);
+        vm_t_free();
+        vm_t_init();
+        ck_assert(cache_read(cache_path, source_path, source) != NULL);
+        ck_assert(vm_t_interpret_cached(source, source_path, cache_path) == INTERPRET_OK);
+        vm_t_free();
+    }
+
+    // stale, mismatched or damaged caches are ignored
+    vm_t_init();
+    ck_assert(vm_t_interpret_cached("let a = 1;", source_path, cache_path) == INTERPRET_OK);
+    ck_assert(cache_read(cache_path, source_path, "let a = 1;") != NULL);
+    ck_assert(cache_read(cache_path, source_path, "let a = 2;") == NULL);
+    vm_toggle_optimize();
+    ck_assert(cache_read(cache_path, source_path, "let a = 1;") == NULL);
+    vm_toggle_optimize();
+    FILE *f = fopen(cache_path, "r+b");
+    ck_assert(f != NULL);
+    fseek(f, -1, SEEK_END);
+    fputc(0xff, f);
+    fclose(f);
+    ck_assert(cache_read(cache_path, source_path, "let a = 1;") == NULL);
+    ck_assert(vm_t_interpret_cached("let a = 1; assert(a == 1);", source_path, cache_path) == INTERPRET_OK);
+    ck_assert(vm_t_interpret_cached("invalid syntax", source_path, cache_path) == INTERPRET_COMPILE_ERROR);
+
+    // a cache someone else could have written is never run
+    ck_assert(vm_t_interpret_cached("let a = 1;", source_path, cache_path) == INTERPRET_OK);
+    ck_assert(cache_read(cache_path, source_path, "let a = 1;") != NULL);
+    chmod(cache_path, 0666);
+    ck_assert(cache_read(cache_path, source_path, "let a = 1;") == NULL);
+    ck_assert(cache_read(cache_path, "nosuchsource.tot", "let a = 1;") == NULL);
+    ck_assert(rename(cache_path, "cachetest.real") == 0);
+    ck_assert(symlink("cachetest.real", cache_path) == 0);
+    chmod("cachetest.real", 0644);
+    ck_assert(cache_read(cache_path, source_path, "let a = 1;") == NULL);
+    // the rewrite replaces the link rather than writing through it
+    ck_assert(vm_t_interpret_cached("let a = 2;", source_path, cache_path) == INTERPRET_OK);
+    ck_assert(cache_read(cache_path, source_path, "let a = 2;") != NULL);
+    ck_assert(cache_read("cachetest.real", source_path, "let a = 1;") != NULL);
+    vm_t_free();
+    unlink("cachetest.real");
+    unlink(cache_path);
+    unlink(source_path);
+}
+
 START_TEST(test_env) {
     vm_t_init();
     vm_toggle_gc_stress();
@@ -1064,6 +1803,10 @@ int main(const int argc, const char *argv[])
     tcase_add_test(tc, test_table);
     suite_add_tcase(s, tc);
 
+    tc = tcase_create("string_set");
+    tcase_add_test(tc, test_string_set);
+    suite_add_tcase(s, tc);
+
     tc = tcase_create("object");
     tcase_add_test(tc, test_object);
     suite_add_tcase(s, tc);
@@ -1072,6 +1815,10 @@ int main(const int argc, const char *argv[])
     tcase_add_test(tc, test_debug);
     suite_add_tcase(s, tc);
 
+    tc = tcase_create("cache");
+    tcase_add_test(tc, test_cache);
+    suite_add_tcase(s, tc);
+
     tc = tcase_create("env");
     tcase_add_test(tc, test_env);
     suite_add_tcase(s, tc);